@@ -31,6 +31,7 @@
 
 #include <stdlib.h>
 #include <limits>
+#include <atomic>
 #include "lima/HwMaxImageSizeCallback.h"
 #include "lima/ThreadUtils.h"
 #include "lima/Event.h"
@@ -42,6 +43,7 @@
 namespace eigerapi
 {
   class Requests;
+  class MetricsServer;
 }
 
 namespace lima
@@ -66,7 +68,11 @@ namespace lima
 		enum Status { Ready, Initialising, Exposure, Readout, Fault };
 		enum CompressionType {LZ4,BSLZ4};
 
-			Camera(const std::string& detector_ip);
+			/// description_cache: file used to start without querying the
+			/// static detector description, empty to disable it
+			Camera(const std::string& detector_ip,
+			       const std::string& description_cache = "",
+			       bool revalidate_cache = true);
 			~Camera();
 
 			void initialize();
@@ -169,6 +175,25 @@ namespace lima
 			void disarm();
             void statusUpdate();
 
+            //- status monitor, period <= 0 disables it
+            void setStatusMonitorPeriod(double period);
+            void getStatusMonitorPeriod(double& period);
+            void getStatusAge(double& age);
+            void getFilewriterStatus(std::string&);
+            void getStreamStatus(std::string&);
+            //- always-on metrics (counters, gauges, latency histograms),
+            //- JSON snapshot; reset zeroes the counters and histograms
+            void getMetrics(std::string&);
+            void resetMetrics();
+            //- acquisition timeline, dumped as a Chrome trace (JSON)
+            void setTraceActive(bool);
+            void getTraceActive(bool&);
+            void dumpTrace(const std::string& path);
+            //- Prometheus endpoint serving the metrics, "[host:]port"
+            //- (localhost by default) or "unix:path", empty to stop it
+            void setMetricsEndpoint(const std::string& address);
+            void getMetricsEndpoint(std::string& address);
+
 			const std::string& getDetectorIp() const;
             const std::string& getTimestampType() const;
             void  setTimestampType(const std::string&);
@@ -190,13 +215,39 @@ namespace lima
 			friend class AcqCallback;
 			class InitCallback;
 			friend class InitCallback;
+			class _StatusMonitorThread;
+			friend class _StatusMonitorThread;
+			class _StartupRefresh;
+			friend class _StartupRefresh;
+
+			//- static detector description, persisted in the cache file
+			struct _Description
+			{
+				std::string api_version;
+				std::string detector_model;
+				std::string detector_type;
+				std::string software_version;
+				unsigned int max_image_width, max_image_height;
+				double x_pixelsize, y_pixelsize;
+				double readout_time;
+				double min_frame_time;
+				double min_photon_energy, max_photon_energy;
+				double min_threshold_energy, max_threshold_energy;
+			};
+			bool _loadDescriptionCache(_Description&);
+			void _saveDescriptionCache(const _Description&);
+			void _applyDescription(const _Description&);
+			void _startRefresh(bool revalidate);
 			void initialiseController(); /// Used during plug-in initialization
 			void _acquisition_finished(bool);
+			bool _isStatusCached();
+			void _waitStatusMonitorIdle();
+			void _pauseTrigger(bool);
 
             //-----------------------------------------------------------------------------
 			//- lima stuff
 			int                       m_nb_frames;
-			int                       m_image_number;
+			std::atomic<int>          m_image_number;
             int                       m_nb_triggers;
             int                       m_nb_frames_per_trigger;
 			double                    m_latency_time;
@@ -223,6 +274,7 @@ namespace lima
 			double                    m_x_pixelsize, m_y_pixelsize;
 			Cond                      m_cond;
 			std::string               m_detector_ip;
+			std::string               m_description_cache;
             std::string               m_timestamp_type;
 			double                    m_min_frame_time;
             double                    m_min_photon_energy;
@@ -231,6 +283,24 @@ namespace lima
             double                    m_max_threshold_energy;
             
 			bool 		              m_nb_frames_per_trigger_is_master;
+
+            //- status monitor (cached telemetry)
+            double                    m_status_monitor_period;
+            bool                      m_status_monitor_busy;
+            bool                      m_status_monitor_quit;
+            Timestamp                 m_status_timestamp;
+            std::string               m_detector_status;
+            std::string               m_filewriter_status;
+            std::string               m_stream_status;
+            _StatusMonitorThread*     m_status_monitor;
+
+            //- internal triggers held by the DCU buffer monitor
+            bool                      m_trigger_paused;
+
+            //- background refresh after a start from the description cache
+            _StartupRefresh*          m_startup_refresh;
+
+            eigerapi::MetricsServer*  m_metrics_server;
 			
 	};
 	} // namespace Eiger
@@ -24,6 +24,7 @@
 
 #include "EigerCompatibility.h"
 #include "lima/HwInterface.h"
+#include "processlib/Data.h"
 /*#include "EigerCamera.h"
 #include "EigerDetInfoCtrlObj.h"
 #include "EigerSyncCtrlObj.h"*/
@@ -39,6 +40,7 @@ namespace lima
       class Camera;
       class Stream;
       class Decompress;
+      class ReadBack;
 	/*******************************************************************
 	* \class Interface
 	* \brief Eiger hardware interface
@@ -63,6 +65,66 @@ namespace lima
 		//! get the camera object to access it directly from client
 		Camera& getCamera() { return m_cam;}
 		void setDownloadDataFile(bool must_download);
+		void setDownloadSegments(int nb_segments, long segment_size);
+		void getDownloadSegments(int& nb_segments, long& segment_size);
+		void setDownloadWriter(int nb_buffers, long buffer_size, bool direct_io);
+		void getDownloadWriter(int& nb_buffers, long& buffer_size, bool& direct_io);
+		void setDownloadRetries(int max_retries, double delay);
+		void getDownloadRetries(int& max_retries, double& delay);
+		void setDownloadConcurrency(int min_concurrent, int max_concurrent);
+		void getDownloadConcurrency(int& min_concurrent, int& max_concurrent);
+		void getDownloadConcurrencyLimit(int& limit);
+		void getDownloadThroughput(double& bytes_per_second);
+		void getDownloadProgress(int& nb_frames_written, int& nb_files_downloaded,
+					 long& nb_bytes_downloaded);
+		void setDownloadBandwidth(long master_file, long data_file);
+		void getDownloadBandwidth(long& master_file, long& data_file);
+		void setDeleteBatch(int nb_files, double max_delay);
+		void getDeleteBatch(int& nb_files, double& max_delay);
+		//! DCU buffer monitor
+		void setBufferWatermarks(double low, double critical);
+		void getBufferWatermarks(double& low, double& critical);
+		void setBufferThrottle(bool throttle);
+		void getBufferThrottle(bool& throttle);
+		void getBufferStatus(double& buffer_free, double& trend, double& time_to_full);
+		//! live frames in saving mode, read back from the downloaded files
+		void setSavingReadBack(bool active);
+		void getSavingReadBack(bool& active);
+		//! virtual dataset over the downloaded data files
+		void setSavingConsolidation(bool active, int files_per_container);
+		void getSavingConsolidation(bool& active, int& files_per_container);
+		//! record the stream messages for a later replay
+		void setStreamCapture(const std::string& path);
+		void getStreamCapture(std::string& path);
+		//! metrics snapshot (JSON), see Camera::getMetrics
+		void getMetrics(std::string& metrics);
+		void resetMetrics();
+		//! acquisition timeline, see Camera::dumpTrace
+		void setTraceActive(bool active);
+		void getTraceActive(bool& active);
+		void dumpTrace(const std::string& path);
+		//! Prometheus endpoint, see Camera::setMetricsEndpoint
+		void setMetricsEndpoint(const std::string& address);
+		void getMetricsEndpoint(std::string& address);
+		//! frame buffers: page size (0 default pages, 2 MiB or 1 GiB
+		//! huge pages), NUMA node (-1 first touch) or interleave on all
+		//! the nodes, pre-faulting; applied from the next allocation
+		void setFrameBufferAllocation(long page_size, int numa_node,
+					      bool numa_interleave, bool prefault);
+		void getFrameBufferAllocation(long& page_size, int& numa_node,
+					      bool& numa_interleave, bool& prefault);
+		//! in-flight compressed frames: at max_size bytes (0 no limit)
+		//! the stream is not read until the decompression catches up
+		void setStreamMemoryLimit(long max_size);
+		void getStreamMemoryLimit(long& max_size);
+		void getStreamMemoryUsage(long& size);
+		//! history of the last compressed frames, max_size bytes
+		//! (0 disables it), frames decompressed on demand
+		void setCompressedHistory(long max_size);
+		void getCompressedHistory(long& max_size);
+		void getCompressedHistoryStatus(int& first_frame, int& last_frame,
+						int& nb_frames, long& size);
+		void readCompressedFrame(int frame_nb, Data& data);
 
 	private:
 	    Camera&         m_cam;
@@ -72,6 +134,7 @@ namespace lima
 	    SavingCtrlObj*  m_saving;
 	    Stream*         m_stream;
 	    Decompress*	    m_decompress;
+	    ReadBack*	    m_readback;
 	};
 
     } // namespace Eiger
@@ -20,6 +20,8 @@
 // along with this program; if not, see <http://www.gnu.org/licenses/>.
 //###########################################################################
 #include <map>
+#include <list>
+#include <memory>
 #include "lima/Debug.h"
 #include "lima/HwSavingCtrlObj.h"
 
@@ -30,6 +32,9 @@ namespace lima
 namespace Eiger
 {
 
+class ReadBack;
+class Consolidation;
+
 class SavingCtrlObj : public HwSavingCtrlObj
 {
     DEB_CLASS_NAMESPC(DebModCamera, "SavingCtrlObj", "Eiger");
@@ -39,6 +44,18 @@ public:
     {
         IDLE, RUNNING, ERROR
     } ;
+    // accounting of a file of the current acquisition
+    struct FileStat
+    {
+        int first_frame;
+        int nb_frames;
+        long nb_bytes;          // 0 until downloaded
+        double ready_time;      // found in the filewriter listing
+        double download_time;   // -1 until downloaded
+        int nb_attempts;
+    };
+    typedef std::map<std::string, FileStat> FileStatMap;
+
     SavingCtrlObj(Camera&);
     virtual ~SavingCtrlObj();
 
@@ -51,15 +68,61 @@ public:
     Status getStatus();
     void stop();
 	void setDownloadDataFile(bool must_download);    
+	void setDownloadSegments(int nb_segments, long segment_size);
+	void getDownloadSegments(int& nb_segments, long& segment_size);
+	// nb_buffers > 0 writes the downloaded files from a thread per file,
+	// 0 writes them from the transfer thread
+	void setDownloadWriter(int nb_buffers, long buffer_size, bool direct_io);
+	void getDownloadWriter(int& nb_buffers, long& buffer_size, bool& direct_io);
+	// failed downloads are resumed up to max_retries times,
+	// after delay seconds doubled on each attempt
+	void setDownloadRetries(int max_retries, double delay);
+	void getDownloadRetries(int& max_retries, double& delay);
+	// bounds of the adaptive number of concurrent downloads,
+	// min == max for a fixed number
+	void setDownloadConcurrency(int min_concurrent, int max_concurrent);
+	void getDownloadConcurrency(int& min_concurrent, int& max_concurrent);
+	void getDownloadConcurrencyLimit(int& limit);
+	void getDownloadThroughput(double& bytes_per_second);
+	// receive bandwidth in bytes/s of the file downloads, 0 unlimited
+	void setDownloadBandwidth(long master_file, long data_file);
+	void getDownloadBandwidth(long& master_file, long& data_file);
+	// downloaded files are deleted in batches after the downloads
+	void setDeleteBatch(int nb_files, double max_delay);
+	void getDeleteBatch(int& nb_files, double& max_delay);
+	// DCU filewriter buffer monitor, sampled while saving,
+	// watermarks <= 0 are disabled
+	void setBufferWatermarks(double low, double critical);
+	void getBufferWatermarks(double& low, double& critical);
+	// hold the IntTrigMult triggers while the buffer is critical,
+	// a trigger held for more than 2 min fails
+	void setBufferThrottle(bool throttle);
+	void getBufferThrottle(bool& throttle);
+	void getBufferStatus(double& buffer_free, double& trend, double& time_to_full);
+	void getFileStats(FileStatMap&);
+	void getProgress(int& nb_frames_written, int& nb_files_downloaded, long& nb_bytes_downloaded);
+	// virtual dataset over the downloaded data files,
+	// files_per_container > 1 stitches them first
+	void setConsolidation(bool active, int files_per_container);
+	void getConsolidation(bool& active, int& files_per_container);
+	// downloaded data files are passed to the read back
+	void setReadBack(ReadBack*);
 protected:
     class _PollingThread;
     friend class _PollingThread;
+    class _BufferMonitorThread;
+    friend class _BufferMonitorThread;
     class _EndDownloadCallback;
     friend class _EndDownloadCallback;
+    class _ConcurrencyController;
+    class _ReadinessPredictor;
+    class _BufferMonitor;
 
     virtual void _prepare(int = 0);
     virtual void _start(int = 0);
     virtual void _setActive(bool, int = 0);
+    void _fileReady(const std::string& name, int first_frame, int nb_frames);
+    bool _isSaving();
 
     Camera&			m_cam;
     int             m_serie_id;
@@ -68,13 +131,30 @@ protected:
     int             m_concurrent_download;
     bool			m_poll_master_file;
     bool            m_must_download_data_file;
-    double			m_waiting_time;
+    int             m_download_segments;
+    long            m_download_segment_size;
+    int             m_download_write_buffers;
+    long            m_download_write_buffer_size;
+    bool            m_download_direct_io;
+    int             m_download_max_retries;
+    double          m_download_retry_delay;
+    std::list<std::shared_ptr<_EndDownloadCallback> > m_retries;
+    FileStatMap     m_file_stats;
+    int             m_nb_frames_written;
+    int             m_nb_files_downloaded;
+    long            m_nb_bytes_downloaded;
     std::string		m_error_msg;
     bool            m_already_done;
     //Synchro
     Cond			m_cond;
     bool			m_quit;
     _PollingThread*		m_polling_thread;
+    _BufferMonitorThread*	m_buffer_monitor_thread;
+    _ConcurrencyController*	m_concurrency;
+    _ReadinessPredictor*	m_readiness;
+    _BufferMonitor*		m_buffer_monitor;
+    ReadBack*			m_readback;
+    Consolidation*		m_consolidation;
     std::map<std::string, int>	m_availables_header_keys;
 } ;
 }
@@ -26,15 +26,20 @@
 #include <map>
 #include <list>
 #include <string>
+#include <functional>
+
+#include "eigerapi/Metrics.h"
 
 namespace eigerapi
 {
 class CurlLoop
 {
 public:
-    class FutureRequest
+    class FutureGroup;
+    class FutureRequest : public std::enable_shared_from_this<FutureRequest>
     {
         friend class CurlLoop;
+        friend class FutureGroup;
 
     public:
         static double const TIMEOUT;
@@ -46,6 +51,15 @@ public:
             OK,
             ERROR
         };
+        // scheduling classes, highest priority first
+        enum Priority
+        {
+            CONTROL,
+            MASTER_FILE,
+            DATA_FILE,
+            CLEANUP,
+            NB_PRIORITIES
+        };
         virtual ~FutureRequest();
 
         void wait(double timeout = TIMEOUT, bool lock = true) const;
@@ -61,20 +75,52 @@ public:
 
         void register_callback(std::shared_ptr<Callback> &);
 
+        typedef std::list<std::shared_ptr<FutureRequest>> List;
+        // Called from the curl thread once this request is finished.
+        // It may start and return a new request, the returned future
+        // then follows it; an empty pointer ends the chain.
+        typedef std::function<std::shared_ptr<FutureRequest>(Status)> Continuation;
+        std::shared_ptr<FutureRequest> then(Continuation);
+
+        // OK once all are OK, the first failure cancels the others
+        static std::shared_ptr<FutureRequest> when_all(const List &);
+        // OK with the first OK one and the others are cancelled,
+        // ERROR if all failed
+        static std::shared_ptr<FutureRequest> when_any(const List &);
+
         CURL *get_handle() { return m_handle; }
         FutureRequest(const std::string &url);
 
+        // must be set before the request is added,
+        // the lowest order is started first within a class
+        void set_priority(Priority, long order = 0);
+        Priority get_priority() const { return m_priority; }
+
     protected:
+        FutureRequest(); // aggregated future, no curl handle
         virtual void _request_finished(){};
+        // If _request_finished() sets m_finish_deferred, the request is
+        // not notified: CurlLoop::finish_request() later runs
+        // _deferred_finished() on the curl thread then notifies.
+        virtual void _deferred_finished(){};
+        virtual void _cancel(){};
+        void _notify() const;
+        static void _cancel_request(const std::shared_ptr<FutureRequest> &);
 
         CURL *m_handle;
+        CurlLoop *m_loop;
         Status m_status;
         std::string m_error_code;
         // Synchro
         mutable pthread_mutex_t m_lock;
         mutable pthread_cond_t m_cond;
-        std::shared_ptr<Callback> *m_cbk;
+        std::list<std::shared_ptr<Callback>> m_cbks;
         std::string m_url;
+        Priority m_priority;
+        long m_order;
+        double m_queued_time;
+        uint64_t m_queued_ns; // Tracer clock, 0 if not traced
+        bool m_finish_deferred;
     };
 
     CurlLoop();
@@ -84,13 +130,49 @@ public:
 
     void add_request(std::shared_ptr<FutureRequest>);
     void cancel_request(std::shared_ptr<FutureRequest>);
+    // may be called from any thread, never wait
+    // unpause a request paused by its write callback (CURL_WRITEFUNC_PAUSE)
+    void resume_request(const std::weak_ptr<FutureRequest> &);
+    // end a request whose finish was deferred
+    void finish_request(const std::weak_ptr<FutureRequest> &);
     void set_curl_delay_ms(double);
 
+    // requests of a class running at once (0 unlimited) and the
+    // receive bandwidth shared by them (bytes/s, 0 unlimited)
+    void set_class_limits(FutureRequest::Priority, int max_active, long max_recv_speed);
+    void get_class_limits(FutureRequest::Priority, int &max_active, long &max_recv_speed);
+    // cleanup requests wait for the file transfers to be over, or until
+    // nb_requests are queued or the oldest one waited max_delay seconds
+    void set_cleanup_batch(int nb_requests, double max_delay);
+    void get_cleanup_batch(int &nb_requests, double &max_delay);
+
 private:
     typedef std::map<CURL *, std::shared_ptr<FutureRequest>> MapRequests;
     typedef std::list<std::shared_ptr<FutureRequest>> ListRequests;
+    typedef std::list<std::weak_ptr<FutureRequest>> WeakRequests;
+    // by order then arrival
+    typedef std::map<std::pair<long, unsigned long>, std::shared_ptr<FutureRequest>> QueuedRequests;
+    struct ClassLimits
+    {
+        int max_active;
+        long max_recv_speed;
+    };
+    // metrics of a request class or endpoint, looked up once
+    struct RequestMetrics
+    {
+        RequestMetrics() : latency(NULL), errors(NULL) {}
+        std::string label;
+        Metrics::Histogram *latency;
+        Metrics::Counter *errors; // created by the first error
+    };
     static void *_runFunc(void *);
     void _run();
+    double _admit(CURLM *);
+    void _remove_canceled(CURLM *);
+    void _resume_and_finish();
+    void _finished(const std::shared_ptr<FutureRequest> &, CURLcode);
+    void _share_bandwidth(int priority);
+    void _record_metrics(FutureRequest &, CURLcode);
 
     // Synchro
     int m_pipes[2];
@@ -101,8 +183,25 @@ private:
     pthread_t m_thread_id;
     //Pending Request
     MapRequests m_pending_requests;
-    ListRequests m_new_requests;
+    QueuedRequests m_queued_requests[FutureRequest::NB_PRIORITIES];
     ListRequests m_cancel_requests;
+    WeakRequests m_resume_requests;
+    WeakRequests m_finish_requests;
+    ListRequests m_released_requests;
     double m_curl_delay_ms;
+    //Scheduling
+    unsigned long m_queue_seq;
+    int m_nb_active[FutureRequest::NB_PRIORITIES];
+    int m_nb_shared[FutureRequest::NB_PRIORITIES]; // active count of the last share
+    ClassLimits m_limits[FutureRequest::NB_PRIORITIES];
+    int m_cleanup_batch;
+    double m_cleanup_max_delay;
+    //Metrics
+    Metrics::Gauge *m_queued_gauges[FutureRequest::NB_PRIORITIES];
+    Metrics::Gauge *m_active_gauges[FutureRequest::NB_PRIORITIES];
+    // only used from the curl thread
+    RequestMetrics m_transfer_metrics[FutureRequest::NB_PRIORITIES];
+    RequestMetrics m_data_metrics;                     // control requests on /data/<file>
+    std::map<std::string, RequestMetrics> m_rest_metrics; // by url
 };
 } // namespace eigerapi
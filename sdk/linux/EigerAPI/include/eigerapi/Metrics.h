@@ -0,0 +1,156 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2015
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef _EIGERMETRICS_H
+#define _EIGERMETRICS_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace eigerapi
+{
+// Always-on metrics of the acquisition hot paths, shared by the SDK and
+// the plugin. Metrics are created on first use and never destroyed, so
+// the hot paths resolve them once and keep the reference; an update is
+// then a few relaxed atomic operations.
+//
+// Names are "name" or "name.label" (e.g. "decompress_ns.bslz4"),
+// durations are in ns.
+class Metrics
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    // sum of per-thread shards, one cache line each
+    class Counter
+    {
+    public:
+        Counter();
+        void add(uint64_t n = 1);
+        uint64_t value() const;
+        void reset();
+
+    private:
+        static const int NB_SHARDS = 16;
+        struct Shard
+        {
+            std::atomic<uint64_t> value;
+            char padding[64 - sizeof(std::atomic<uint64_t>)];
+        };
+        Shard m_shards[NB_SHARDS];
+    };
+
+    class Gauge
+    {
+    public:
+        Gauge() : m_value(0.) {}
+        void set(double value) { m_value.store(value, std::memory_order_relaxed); }
+        double value() const { return m_value.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<double> m_value;
+    };
+
+    struct HistogramSnapshot
+    {
+        HistogramSnapshot() : count(0), sum(0), max(0) {}
+        // value below which a fraction p in [0, 1] of the samples are
+        double percentile(double p) const;
+
+        uint64_t count;
+        uint64_t sum;
+        uint64_t max;
+        // non empty buckets: highest value of the bucket, sample count
+        std::vector<std::pair<uint64_t, uint64_t>> buckets;
+    };
+
+    // HDR style log-linear buckets: 8 sub-buckets per power of two,
+    // values are recorded within 12.5%
+    class Histogram
+    {
+    public:
+        Histogram();
+        void record(uint64_t value);
+        void record_since(Clock::time_point start)
+        {
+            record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+        }
+        HistogramSnapshot snapshot() const;
+        void reset();
+
+        static int bucket(uint64_t value);
+        static uint64_t bucket_max(int bucket);
+
+    private:
+        static const int SUB_BUCKET_BITS = 3;
+        static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+        static const int NB_BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+        std::atomic<uint64_t> m_buckets[NB_BUCKETS];
+        std::atomic<uint64_t> m_sum;
+        std::atomic<uint64_t> m_max;
+    };
+
+    struct Snapshot
+    {
+        double time; // s since the epoch
+        std::map<std::string, uint64_t> counters;
+        std::map<std::string, double> gauges;
+        std::map<std::string, HistogramSnapshot> histograms;
+
+        // {"time":..., "counters": {name: value}, "gauges": {name: value},
+        //  "histograms": {name: {"count","mean","p50","p90","p99","max"}}}
+        std::string to_json() const;
+        // Prometheus text format: "name.label" is exported as
+        // eiger_name{label="label"}, counters with a _total suffix,
+        // histograms as summaries (p50, p90, p99, _sum, _count)
+        std::string to_prometheus() const;
+    };
+
+    static Metrics &instance();
+
+    Counter &counter(const std::string &name);
+    Gauge &gauge(const std::string &name);
+    Histogram &histogram(const std::string &name);
+
+    Snapshot snapshot() const;
+    // counters and histograms back to zero, gauges are kept
+    void reset();
+
+private:
+    Metrics() {}
+    Metrics(const Metrics &) = delete;
+    Metrics &operator=(const Metrics &) = delete;
+
+    mutable std::mutex m_lock;
+    std::map<std::string, std::unique_ptr<Counter>> m_counters;
+    std::map<std::string, std::unique_ptr<Gauge>> m_gauges;
+    std::map<std::string, std::unique_ptr<Histogram>> m_histograms;
+};
+} // namespace eigerapi
+#endif
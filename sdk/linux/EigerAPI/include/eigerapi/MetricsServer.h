@@ -0,0 +1,60 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2015
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef _EIGERMETRICSSERVER_H
+#define _EIGERMETRICSSERVER_H
+
+#include <string>
+#include <thread>
+
+namespace eigerapi
+{
+// Prometheus endpoint: GET /metrics returns the Metrics snapshot in the
+// text format. Served by its own thread, one connection at a time, which
+// only reads the metrics registry and never blocks the acquisition.
+//
+// The address is "[host:]port" (host defaults to 127.0.0.1) or
+// "unix:path" for a Unix socket.
+class MetricsServer
+{
+public:
+    // throws EigerException if the address can't be bound
+    explicit MetricsServer(const std::string &address);
+    ~MetricsServer();
+
+    const std::string &address() const { return m_address; }
+
+private:
+    MetricsServer(const MetricsServer &) = delete;
+    MetricsServer &operator=(const MetricsServer &) = delete;
+
+    void _run();
+    void _serve(int fd);
+    void _close_socket();
+
+    std::string m_address;
+    std::string m_unix_path; // removed at exit
+    int m_socket;
+    int m_pipes[2];
+    std::thread m_thread;
+};
+} // namespace eigerapi
+#endif
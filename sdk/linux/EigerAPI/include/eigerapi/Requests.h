@@ -20,8 +20,12 @@
 // along with this program; if not, see <http://www.gnu.org/licenses/>.
 //###########################################################################
 #include <string>
+#include <cstring>
+#include <algorithm>
 #include <map>
 #include <vector>
+#include <unordered_set>
+#include <atomic>
 
 #include "eigerapi/CurlLoop.h"
 
@@ -29,6 +33,26 @@ namespace eigerapi
 {
 class Requests
 {
+    // Json token, strings are decoded in place into the reply buffer
+    struct JsonToken
+    {
+        enum Type
+        {
+            NONE,
+            NUL,
+            BOOL,
+            NUMBER,
+            STRING,
+            ARRAY,
+            OBJECT
+        };
+        JsonToken() : type(NONE), begin(NULL), size(0) {}
+
+        Type type;
+        const char *begin;
+        int size;
+    };
+
 public:
     class Command : public CurlLoop::FutureRequest
     {
@@ -51,57 +75,158 @@ public:
         friend class Requests;
 
     public:
-        enum VALUE_TYPE
+        // String view over the receive buffer,
+        // valid as long as the Param request is alive.
+        struct StringRef
         {
-            BOOL,
-            DOUBLE,
-            INT,
-            UNSIGNED,
-            STRING,
-            STRING_ARRAY
-        };
-        struct Value
-        {
-            VALUE_TYPE type;
-            union {
-                bool bool_val;
-                int int_val;
-                unsigned int unsigned_val;
-                double double_val;
-            } data;
-            std::string string_val;
-            std::vector<std::string> string_array;
+            const char *data;
+            int size;
+
+            std::string str() const { return std::string(data, size); }
+            bool operator==(const std::string &s) const
+            {
+                return int(s.size()) == size && !memcmp(data, s.data(), size);
+            }
+            bool operator==(const StringRef &other) const
+            {
+                return other.size == size && !memcmp(data, other.data, size);
+            }
+            bool operator<(const StringRef &other) const
+            {
+                int cmp = memcmp(data, other.data, std::min(size, other.size));
+                return cmp < 0 || (!cmp && size < other.size);
+            }
+            struct Hash // FNV-1a
+            {
+                size_t operator()(const StringRef &ref) const
+                {
+                    size_t hash = 2166136261u;
+                    for (int i = 0; i < ref.size; ++i)
+                        hash = (hash ^ (unsigned char)ref.data[i]) * 16777619u;
+                    return hash;
+                }
+            };
         };
+        typedef std::vector<StringRef> StringList;
+        typedef std::unordered_set<StringRef, StringRef::Hash> StringSet;
 
         Param(const std::string &url);
         virtual ~Param();
-        Value get(double timeout = CurlLoop::FutureRequest::TIMEOUT, bool lock = true);
-        Value get_min(double timeout = CurlLoop::FutureRequest::TIMEOUT, bool lock = true);
-        Value get_max(double timeout = CurlLoop::FutureRequest::TIMEOUT, bool lock = true);
+        // limits of a numerical parameter, -1 if not in the reply;
+        // the value is read with Requests::get<name>
+        double get_min(double timeout = CurlLoop::FutureRequest::TIMEOUT, bool lock = true);
+        double get_max(double timeout = CurlLoop::FutureRequest::TIMEOUT, bool lock = true);
+        const StringList &get_string_list(double timeout = CurlLoop::FutureRequest::TIMEOUT,
+                                          bool lock = true);
 
     private:
+        enum FIELD
+        {
+            VALUE_FIELD,
+            MIN_FIELD,
+            MAX_FIELD,
+            NB_FIELDS
+        };
+        typedef bool (*ReturnConverter)(Param &, void *);
+
         void _fill_get_request();
         template <class T>
         void _fill_set_request(const T &value);
 
-        void _set_return_value(bool &);
-        void _set_return_value(double &);
-        void _set_return_value(int &);
-        void _set_return_value(unsigned int &);
-        void _set_return_value(std::string &);
+        template <class T>
+        void _set_return_value(T &);
+
+        template <class T>
+        static bool _convert(Param &, void *);
 
         virtual void _request_finished();
 
         static size_t _write_callback(char *, size_t, size_t, void *);
 
-        Value _get(double timeout, bool lock, const char *);
+        void _decode();
+        double _get_limit(double timeout, bool lock, FIELD);
 
         char *m_data_buffer;
         int m_data_size;
         int m_data_memorysize;
         struct curl_slist *m_headers;
-        VALUE_TYPE m_return_type;
+        ReturnConverter m_return_converter;
         void *m_return_value;
+        // decoded reply
+        bool m_decoded;
+        bool m_is_array;
+        JsonToken m_fields[NB_FIELDS];
+        StringList m_string_list;
+    };
+
+    // Destination of a downloaded file, shared by its segments.
+    // Data is handed over in buffers of get_buffer_size() bytes.
+    // Called from the curl thread, none of the methods wait for a write;
+    // the callbacks may be called from any thread.
+    class Sink
+    {
+    public:
+        typedef std::function<void()> Ready;
+        typedef std::function<void(const std::string &error)> Done;
+
+        virtual ~Sink() {}
+
+        virtual size_t get_buffer_size() const = 0;
+        // NULL if all the buffers are being written,
+        // ready is then called once one is released
+        virtual char *get_buffer(const Ready &ready) = 0;
+        virtual void release_buffer(char *) = 0;
+        // takes back the buffer, the write may be deferred
+        virtual bool write_buffer(char *buffer, size_t size, long offset, std::string &error) = 0;
+        // set the file size, existing data is kept to resume a download
+        virtual bool allocate(long size, std::string &error) = 0;
+        // flush the handed over data to disk, returns false if
+        // done is called later else the result is in error
+        virtual bool sync(std::string &error, const Done &done) = 0;
+    };
+    typedef std::function<std::shared_ptr<Sink>(const std::string &path)> SinkFactory;
+
+    // writes from the curl thread
+    static std::shared_ptr<Sink> create_file_sink(const std::string &path,
+                                                  size_t buffer_size = 64 * 1024);
+    // writes from a thread per file with up to nb_buffers queued, beyond
+    // the download is paused; direct_io bypasses the page cache when the
+    // filesystem allows it
+    static SinkFactory async_file_sink_factory(size_t buffer_size,
+                                               int nb_buffers,
+                                               bool direct_io);
+
+    // Progress of a file download, a failed download is resumed
+    // with only the ranges not yet written
+    class TransferState
+    {
+        friend class Requests;
+        friend class Transfer;
+
+    public:
+        const std::string &get_target_path() const { return m_target_path; }
+        long get_file_size() const { return m_file_size; } // -1 if unknown
+        // scheduling class of the file requests, DATA_FILE by default
+        void set_priority(CurlLoop::FutureRequest::Priority priority, long order = 0)
+        {
+            m_priority = priority, m_order = order;
+        }
+
+    private:
+        TransferState(const std::string &url, const std::string &target_path);
+
+        struct Range
+        {
+            long begin;
+            long end; // -1 up to the end of the file
+        };
+        std::string m_url;
+        std::string m_target_path;
+        long m_file_size;
+        bool m_started; // the target file is created
+        std::vector<Range> m_missing;
+        CurlLoop::FutureRequest::Priority m_priority;
+        long m_order;
     };
 
     class Transfer : public CurlLoop::FutureRequest
@@ -116,15 +241,39 @@ public:
                  int buffer_write_size = 64 * 1024);
         virtual ~Transfer();
 
+        long get_download_size() const { return m_download_size; }
+
     private:
+        // download the range_index missing range of the file
+        Transfer(Requests &requests,
+                 const std::shared_ptr<Sink> &sink,
+                 const std::shared_ptr<TransferState> &state,
+                 int range_index);
+        void _init();
+        bool _flush();
         static size_t _write(void *ptr, size_t size, size_t nmemb, Transfer *);
         virtual void _request_finished();
+        virtual void _deferred_finished();
+        void _finish();
 
         Requests &m_requests;
         bool m_delete_after_transfer;
-        long m_download_size;
-        FILE *m_target_file;
-        void *m_buffer;
+        std::atomic<long> m_download_size;
+        std::shared_ptr<Sink> m_sink;
+        std::shared_ptr<TransferState> m_state;
+        int m_range_index;
+        bool m_ranged;       // expect a partial content
+        long m_range_begin;
+        long m_offset;       // file offset of the next write
+        long m_segment_size; // -1 up to the end of the file
+        char *m_buffer;
+        size_t m_buffer_size;
+        size_t m_buffer_used;
+        size_t m_consumed; // of the data held by a pause
+        // while the sync is pending
+        Status m_result;
+        std::shared_ptr<FutureRequest> m_self;
+        std::string m_write_error;
     };
 
     enum COMMAND_NAME
@@ -136,7 +285,8 @@ public:
         CANCEL,
         ABORT,
         STATUS_UPDATE,
-        FILEWRITER_CLEAR
+        FILEWRITER_CLEAR,
+        NB_COMMANDS
     };
     enum PARAM_NAME
     {
@@ -177,6 +327,7 @@ public:
         FILEWRITER_LS,
         STREAM_MODE,
         STREAM_HEADER_DETAIL,
+        STREAM_STATUS,
         HEADER_BEAM_CENTER_X,
         HEADER_BEAM_CENTER_Y,
         HEADER_CHI_INCREMENT,
@@ -191,44 +342,172 @@ public:
         HEADER_WAVELENGTH,
         COMPRESSION_TYPE,
         ROI_MODE,
+        NB_PARAMS
     };
 
+    // Value type of each parameter, see the specializations below
+    template <PARAM_NAME>
+    struct ParamType;
+
     Requests(const std::string &address);
+    // known api version (i.e: from a cache), no blocking request
+    Requests(const std::string &address, const std::string &api_version);
     ~Requests();
 
+    const std::string &get_api_version() const { return m_api_version; }
+    // read the version advertised by the detector
+    std::shared_ptr<Param> get_api_version(std::string &);
+
     std::shared_ptr<Command> get_command(COMMAND_NAME);
+    // Descriptor only (limits, listing), the value is not converted
     std::shared_ptr<Param> get_param(PARAM_NAME);
-    std::shared_ptr<Param> get_param(PARAM_NAME, bool &);
-    std::shared_ptr<Param> get_param(PARAM_NAME, double &);
-    std::shared_ptr<Param> get_param(PARAM_NAME, int &);
-    std::shared_ptr<Param> get_param(PARAM_NAME, unsigned int &);
-    std::shared_ptr<Param> get_param(PARAM_NAME, std::string &);
 
-    std::shared_ptr<Param> set_param(PARAM_NAME, bool);
-    std::shared_ptr<Param> set_param(PARAM_NAME, double);
-    std::shared_ptr<Param> set_param(PARAM_NAME, int);
-    std::shared_ptr<Param> set_param(PARAM_NAME, unsigned int);
-    std::shared_ptr<Param> set_param(PARAM_NAME, const std::string &);
-    std::shared_ptr<Param> set_param(PARAM_NAME, const char *);
+    // Typed accessors, the conversion is chosen at compile time
+    template <PARAM_NAME name>
+    std::shared_ptr<Param> get(typename ParamType<name>::type &ret_value)
+    {
+        std::shared_ptr<Param> param = _create_get_param(name);
+        param->_set_return_value(ret_value);
+        m_loop.add_request(param);
+        return param;
+    }
+    template <PARAM_NAME name>
+    std::shared_ptr<Param> set(const typename ParamType<name>::type &value)
+    {
+        return set_param(name, value);
+    }
+    // Header key chosen at run time, HEADER_BEAM_CENTER_X to HEADER_WAVELENGTH
+    std::shared_ptr<Param> set_header(PARAM_NAME, double);
 
     std::shared_ptr<Transfer> start_transfer(const std::string &src_filename,
                                              const std::string &target_path,
                                              bool delete_after_transfer = true);
+    // Download with up to nb_segments concurrent range requests of at
+    // least segment_size bytes, smaller files use a single request
+    std::shared_ptr<CurlLoop::FutureRequest> start_segmented_transfer(const std::string &src_filename,
+                                                                      const std::string &target_path,
+                                                                      int nb_segments,
+                                                                      long segment_size,
+                                                                      bool delete_after_transfer = true);
+    std::shared_ptr<TransferState> create_transfer_state(const std::string &src_filename,
+                                                         const std::string &target_path);
+    // Start or resume the download, the file is only deleted
+    // once all its ranges are written
+    std::shared_ptr<CurlLoop::FutureRequest> start_segmented_transfer(const std::shared_ptr<TransferState> &,
+                                                                      int nb_segments,
+                                                                      long segment_size,
+                                                                      bool delete_after_transfer = true);
     std::shared_ptr<CurlLoop::FutureRequest> delete_file(const std::string &filename,
                                                          bool full_url = false);
 
     void set_curl_delay_ms(double);
+    // request scheduling, see CurlLoop
+    void set_class_limits(CurlLoop::FutureRequest::Priority, int max_active, long max_recv_speed);
+    void get_class_limits(CurlLoop::FutureRequest::Priority, int &max_active, long &max_recv_speed);
+    void set_cleanup_batch(int nb_requests, double max_delay);
+    void get_cleanup_batch(int &nb_requests, double &max_delay);
+    // empty factory for the default file sink
+    void set_sink_factory(const SinkFactory &);
     void cancel(std::shared_ptr<CurlLoop::FutureRequest> request);
 
 private:
+    class FileSink;
+    class AsyncFileSink;
+
+    std::string _api_version_url() const;
+    std::shared_ptr<Sink> _create_sink(const std::string &path, size_t buffer_size = 64 * 1024);
+    std::string _data_url(const std::string &filename) const;
+    std::shared_ptr<CurlLoop::FutureRequest> _start_segments(const std::shared_ptr<TransferState> &,
+                                                             const std::shared_ptr<Sink> &,
+                                                             long file_size,
+                                                             int nb_segments,
+                                                             long segment_size,
+                                                             bool delete_after_transfer);
+    void _init_url_cache(const std::string &api_version);
     std::shared_ptr<Param> _create_get_param(PARAM_NAME);
+    // only reached through set<>(), which checks the type
+    std::shared_ptr<Param> set_param(PARAM_NAME, bool);
+    std::shared_ptr<Param> set_param(PARAM_NAME, double);
+    std::shared_ptr<Param> set_param(PARAM_NAME, unsigned int);
+    std::shared_ptr<Param> set_param(PARAM_NAME, const std::string &);
     template <class T>
     std::shared_ptr<Param> _set_param(PARAM_NAME, const T &);
 
-    typedef std::map<int, std::string> CACHE_TYPE;
     CurlLoop m_loop;
-    CACHE_TYPE m_cmd_cache_url;
-    CACHE_TYPE m_param_cache_url;
+    pthread_mutex_t m_sink_lock;
+    SinkFactory m_sink_factory;
+    std::string m_cmd_cache_url[NB_COMMANDS];
+    std::string m_param_cache_url[NB_PARAMS];
     std::string m_address;
+    std::string m_api_version;
 };
+
+#define EIGER_PARAM_TYPE(name, value_type) \
+    template <>                            \
+    struct Requests::ParamType<Requests::name> \
+    {                                      \
+        typedef value_type type;           \
+    }
+
+// Detector Read only values
+EIGER_PARAM_TYPE(TEMP, double);
+EIGER_PARAM_TYPE(HUMIDITY, double);
+EIGER_PARAM_TYPE(DETECTOR_STATUS, std::string);
+EIGER_PARAM_TYPE(PIXELDEPTH, unsigned int);
+EIGER_PARAM_TYPE(X_PIXEL_SIZE, double);
+EIGER_PARAM_TYPE(Y_PIXEL_SIZE, double);
+EIGER_PARAM_TYPE(DETECTOR_WITDH, unsigned int);
+EIGER_PARAM_TYPE(DETECTOR_HEIGHT, unsigned int);
+EIGER_PARAM_TYPE(DESCRIPTION, std::string);
+EIGER_PARAM_TYPE(DETECTOR_NUMBER, std::string);
+EIGER_PARAM_TYPE(DETECTOR_READOUT_TIME, double);
+EIGER_PARAM_TYPE(DATA_COLLECTION_DATE, std::string);
+EIGER_PARAM_TYPE(SOFTWARE_VERSION, std::string);
+// Detector Read/Write settings
+EIGER_PARAM_TYPE(EXPOSURE, double);
+EIGER_PARAM_TYPE(FRAME_TIME, double);
+EIGER_PARAM_TYPE(TRIGGER_MODE, std::string);
+EIGER_PARAM_TYPE(COUNTRATE_CORRECTION, bool);
+EIGER_PARAM_TYPE(FLATFIELD_CORRECTION, bool);
+EIGER_PARAM_TYPE(EFFICIENCY_CORRECTION, bool);
+EIGER_PARAM_TYPE(PIXEL_MASK, bool);
+EIGER_PARAM_TYPE(THRESHOLD_ENERGY, double);
+EIGER_PARAM_TYPE(VIRTUAL_PIXEL_CORRECTION, bool);
+EIGER_PARAM_TYPE(PHOTON_ENERGY, double);
+EIGER_PARAM_TYPE(NIMAGES, unsigned int);
+EIGER_PARAM_TYPE(NTRIGGER, unsigned int);
+EIGER_PARAM_TYPE(AUTO_SUMMATION, bool);
+// Filewriter settings
+EIGER_PARAM_TYPE(FILEWRITER_MODE, std::string);
+EIGER_PARAM_TYPE(FILEWRITER_COMPRESSION, bool);
+EIGER_PARAM_TYPE(FILEWRITER_NAME_PATTERN, std::string);
+EIGER_PARAM_TYPE(NIMAGES_PER_FILE, unsigned int);
+EIGER_PARAM_TYPE(FILEWRITER_STATUS, std::string);
+EIGER_PARAM_TYPE(FILEWRITER_ERROR, std::string);
+EIGER_PARAM_TYPE(FILEWRITER_TIME, std::string);
+EIGER_PARAM_TYPE(FILEWRITER_BUFFER_FREE, double);
+// FILEWRITER_LS has no value type: get_param() then Param::get_string_list()
+// Stream settings
+EIGER_PARAM_TYPE(STREAM_MODE, std::string);
+EIGER_PARAM_TYPE(STREAM_HEADER_DETAIL, std::string);
+EIGER_PARAM_TYPE(STREAM_STATUS, std::string);
+// Saving Header
+EIGER_PARAM_TYPE(HEADER_BEAM_CENTER_X, double);
+EIGER_PARAM_TYPE(HEADER_BEAM_CENTER_Y, double);
+EIGER_PARAM_TYPE(HEADER_CHI_INCREMENT, double);
+EIGER_PARAM_TYPE(HEADER_CHI_START, double);
+EIGER_PARAM_TYPE(HEADER_DETECTOR_DISTANCE, double);
+EIGER_PARAM_TYPE(HEADER_KAPPA_INCREMENT, double);
+EIGER_PARAM_TYPE(HEADER_KAPPA_START, double);
+EIGER_PARAM_TYPE(HEADER_OMEGA_INCREMENT, double);
+EIGER_PARAM_TYPE(HEADER_OMEGA_START, double);
+EIGER_PARAM_TYPE(HEADER_PHI_INCREMENT, double);
+EIGER_PARAM_TYPE(HEADER_PHI_START, double);
+EIGER_PARAM_TYPE(HEADER_WAVELENGTH, double);
+// Compression
+EIGER_PARAM_TYPE(COMPRESSION_TYPE, std::string);
+// roi
+EIGER_PARAM_TYPE(ROI_MODE, std::string);
+
+#undef EIGER_PARAM_TYPE
 } // namespace eigerapi
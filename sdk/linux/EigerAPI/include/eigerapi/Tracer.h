@@ -0,0 +1,101 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2015
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef _EIGERTRACER_H
+#define _EIGERTRACER_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace eigerapi
+{
+// Acquisition timeline: spans and instants with monotonic ns timestamps
+// and thread ids, kept in a ring buffer while active and exported in the
+// Chrome trace event format (chrome://tracing, ui.perfetto.dev).
+// Inactive, an event point costs one relaxed atomic load.
+//
+// Event names must be string literals, the details are copied.
+class Tracer
+{
+public:
+    static const size_t DEFAULT_CAPACITY = 65536;
+
+    // span from its construction to its destruction
+    class Span
+    {
+    public:
+        Span(const char *name, const std::string &detail = std::string());
+        ~Span();
+
+    private:
+        const char *m_name;
+        std::string m_detail;
+        uint64_t m_begin;
+    };
+
+    static Tracer &instance();
+    // CLOCK_MONOTONIC, ns
+    static uint64_t now();
+
+    // the ring keeps the last capacity events, activating clears it
+    void set_active(bool active, size_t capacity = DEFAULT_CAPACITY);
+    bool is_active() const { return m_active.load(std::memory_order_relaxed); }
+    void clear();
+
+    void complete(const char *name, uint64_t begin, uint64_t end,
+                  const std::string &detail = std::string());
+    void instant(const char *name, const std::string &detail = std::string());
+    // shown as the name of the calling thread
+    void thread_name(const std::string &name);
+
+    std::string to_json() const;
+    // throws EigerException
+    void dump(const std::string &path) const;
+
+private:
+    struct Event
+    {
+        const char *name;
+        uint64_t begin;
+        uint64_t duration; // instant if NO_DURATION
+        int tid;
+        char detail[64];
+    };
+    static const uint64_t NO_DURATION = ~uint64_t(0);
+
+    Tracer() : m_active(false), m_nb_events(0) {}
+    Tracer(const Tracer &) = delete;
+    Tracer &operator=(const Tracer &) = delete;
+    void _add(const char *name, uint64_t begin, uint64_t duration, const std::string &detail);
+
+    std::atomic<bool> m_active;
+    mutable std::mutex m_lock;
+    std::vector<Event> m_events;
+    uint64_t m_nb_events; // since the activation, the ring index is modulo the capacity
+    std::map<int, std::string> m_thread_names;
+};
+} // namespace eigerapi
+#endif
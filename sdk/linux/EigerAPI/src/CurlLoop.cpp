@@ -23,9 +23,13 @@
 #include <fcntl.h>
 #include <string.h>
 #include <sys/select.h>
+#include <sys/time.h>
+#include <algorithm>
 
 #include "eigerapi/CurlLoop.h"
 #include "eigerapi/EigerDefines.h"
+#include "eigerapi/Metrics.h"
+#include "eigerapi/Tracer.h"
 //Lock class
 class Lock
 {
@@ -62,6 +66,50 @@ using namespace eigerapi;
 
 // Constant
 double const CurlLoop::FutureRequest::TIMEOUT = 15;
+static const int DEFAULT_CLEANUP_BATCH = 16;
+static const double DEFAULT_CLEANUP_MAX_DELAY = 1.;
+
+static const char *const PRIORITY_NAMES[] = {"control", "master_file", "data_file", "cleanup"};
+
+static double _now()
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec + now.tv_usec * 1e-6;
+}
+
+// start of the path after the host, npos if none
+static size_t _path_begin(const std::string &url)
+{
+    size_t begin = url.find("://");
+    begin = url.find('/', begin == std::string::npos ? 0 : begin + 3);
+    return begin == std::string::npos ? begin : begin + 1;
+}
+
+static bool _is_data_url(const std::string &url)
+{
+    size_t begin = _path_begin(url);
+    return begin != std::string::npos && !url.compare(begin, 5, "data/");
+}
+
+// "detector/config/count_time" for http://<ip>/detector/api/<version>/config/count_time,
+// "data" for all the /data/<file> requests
+static std::string _endpoint(const std::string &url)
+{
+    size_t begin = _path_begin(url);
+    if (begin == std::string::npos)
+        return "";
+    if (_is_data_url(url))
+        return "data";
+    std::string path = url.substr(begin);
+    size_t api = path.find("/api/");
+    if (api != std::string::npos)
+    {
+        size_t version_end = path.find('/', api + 5);
+        path.erase(api, version_end == std::string::npos ? std::string::npos : version_end - api);
+    }
+    return path;
+}
 
 struct CURL_INIT
 {
@@ -78,8 +126,20 @@ struct CURL_INIT
 CurlLoop::CurlLoop() : m_running(false),
                        m_quit(false),
                        m_thread_id(0),
-                       m_curl_delay_ms(50)
+                       m_curl_delay_ms(50),
+                       m_queue_seq(0),
+                       m_cleanup_batch(DEFAULT_CLEANUP_BATCH),
+                       m_cleanup_max_delay(DEFAULT_CLEANUP_MAX_DELAY)
 {
+    for (int i = 0; i < FutureRequest::NB_PRIORITIES; ++i)
+    {
+        m_nb_active[i] = m_nb_shared[i] = 0;
+        m_limits[i].max_active = 0;
+        m_limits[i].max_recv_speed = 0;
+        m_queued_gauges[i] = &Metrics::instance().gauge(std::string("curl_queued.") + PRIORITY_NAMES[i]);
+        m_active_gauges[i] = &Metrics::instance().gauge(std::string("curl_active.") + PRIORITY_NAMES[i]);
+    }
+
     if (pthread_mutex_init(&m_lock, NULL))
         THROW_EIGER_EXCEPTION("pthread_mutex_init", "Can't initialize the lock");
     if (pthread_cond_init(&m_cond, NULL))
@@ -127,21 +187,50 @@ void CurlLoop::add_request(std::shared_ptr<CurlLoop::FutureRequest> new_request)
     if (write(m_pipes[1], "|", 1) == -1 && errno != EAGAIN)
         THROW_EIGER_EXCEPTION("write into pipe", "synchronization failed");
 
-    m_new_requests.push_back(new_request);
+    new_request->m_queued_time = _now();
+    new_request->m_queued_ns = Tracer::instance().is_active() ? Tracer::now() : 0;
+    QueuedRequests::key_type key(new_request->m_order, m_queue_seq++);
+    m_queued_requests[new_request->m_priority][key] = new_request;
     new_request->m_status = FutureRequest::RUNNING;
+    new_request->m_loop = this;
 
     pthread_cond_broadcast(&m_cond);
 }
 
 void CurlLoop::cancel_request(std::shared_ptr<CurlLoop::FutureRequest> request)
 {
+    if (!request->m_handle) // aggregated future
+    {
+        request->_cancel();
+        return;
+    }
+
     Lock alock(&m_lock);
 
     m_cancel_requests.push_back(request);
     alock.unLock();
 
     Lock req_lock(&request->m_lock);
+    if (request->m_status != FutureRequest::RUNNING)
+        return;
     request->m_status = FutureRequest::CANCEL;
+    request->_notify();
+}
+
+void CurlLoop::resume_request(const std::weak_ptr<CurlLoop::FutureRequest> &request)
+{
+    Lock alock(&m_lock);
+    m_resume_requests.push_back(request);
+    write(m_pipes[1], "|", 1);
+    pthread_cond_broadcast(&m_cond);
+}
+
+void CurlLoop::finish_request(const std::weak_ptr<CurlLoop::FutureRequest> &request)
+{
+    Lock alock(&m_lock);
+    m_finish_requests.push_back(request);
+    write(m_pipes[1], "|", 1);
+    pthread_cond_broadcast(&m_cond);
 }
 
 void CurlLoop::set_curl_delay_ms(double curl_delay_ms)
@@ -149,6 +238,211 @@ void CurlLoop::set_curl_delay_ms(double curl_delay_ms)
     m_curl_delay_ms = curl_delay_ms;
 }
 
+void CurlLoop::set_class_limits(FutureRequest::Priority priority,
+                                int max_active, long max_recv_speed)
+{
+    Lock alock(&m_lock);
+    m_limits[priority].max_active = max_active;
+    m_limits[priority].max_recv_speed = max_recv_speed;
+    m_nb_shared[priority] = -1; // share again
+    write(m_pipes[1], "|", 1);
+    pthread_cond_broadcast(&m_cond);
+}
+
+void CurlLoop::get_class_limits(FutureRequest::Priority priority,
+                                int &max_active, long &max_recv_speed)
+{
+    Lock alock(&m_lock);
+    max_active = m_limits[priority].max_active;
+    max_recv_speed = m_limits[priority].max_recv_speed;
+}
+
+void CurlLoop::set_cleanup_batch(int nb_requests, double max_delay)
+{
+    Lock alock(&m_lock);
+    m_cleanup_batch = nb_requests;
+    m_cleanup_max_delay = max_delay;
+    write(m_pipes[1], "|", 1);
+    pthread_cond_broadcast(&m_cond);
+}
+
+void CurlLoop::get_cleanup_batch(int &nb_requests, double &max_delay)
+{
+    Lock alock(&m_lock);
+    nb_requests = m_cleanup_batch;
+    max_delay = m_cleanup_max_delay;
+}
+
+// start the queued requests by priority within the class limits,
+// returns the delay until held cleanup requests are due, -1 if none.
+// must be called with the loop lock
+double CurlLoop::_admit(CURLM *multi_handle)
+{
+    double wait_delay = -1.;
+    for (int priority = 0; priority < FutureRequest::NB_PRIORITIES; ++priority)
+    {
+        QueuedRequests &queue = m_queued_requests[priority];
+        if (priority == FutureRequest::CLEANUP && !queue.empty())
+        {
+            bool transfers = m_nb_active[FutureRequest::MASTER_FILE] ||
+                             m_nb_active[FutureRequest::DATA_FILE] ||
+                             !m_queued_requests[FutureRequest::MASTER_FILE].empty() ||
+                             !m_queued_requests[FutureRequest::DATA_FILE].empty();
+            double oldest = queue.begin()->second->m_queued_time;
+            for (QueuedRequests::iterator i = queue.begin(); i != queue.end(); ++i)
+                oldest = std::min(oldest, i->second->m_queued_time);
+            double delay = oldest + m_cleanup_max_delay - _now();
+            if (transfers && int(queue.size()) < m_cleanup_batch && delay > 0.)
+            {
+                wait_delay = delay;
+                continue;
+            }
+        }
+
+        int max_active = m_limits[priority].max_active;
+        while (!queue.empty() && (max_active <= 0 || m_nb_active[priority] < max_active))
+        {
+            std::shared_ptr<FutureRequest> req = queue.begin()->second;
+            queue.erase(queue.begin());
+            std::pair<MapRequests::iterator, bool> result =
+                m_pending_requests.insert(MapRequests::value_type(req->m_handle, req));
+            if (result.second)
+            {
+                curl_multi_add_handle(multi_handle, req->m_handle);
+                ++m_nb_active[priority];
+            }
+        }
+
+        if (m_nb_shared[priority] != m_nb_active[priority] &&
+            (m_limits[priority].max_recv_speed > 0 || m_nb_shared[priority] < 0))
+            _share_bandwidth(priority);
+
+        m_queued_gauges[priority]->set(queue.size());
+        m_active_gauges[priority]->set(m_nb_active[priority]);
+    }
+    return wait_delay;
+}
+
+// split the class bandwidth between its running requests
+void CurlLoop::_share_bandwidth(int priority)
+{
+    long max_recv_speed = m_limits[priority].max_recv_speed;
+    int nb_active = m_nb_active[priority];
+    curl_off_t share = 0;
+    if (max_recv_speed > 0 && nb_active > 0)
+        share = std::max(curl_off_t(max_recv_speed / nb_active), curl_off_t(1));
+    for (MapRequests::iterator i = m_pending_requests.begin();
+         i != m_pending_requests.end(); ++i)
+        if (i->second->m_priority == priority)
+            curl_easy_setopt(i->first, CURLOPT_MAX_RECV_SPEED_LARGE, share);
+    m_nb_shared[priority] = nb_active;
+}
+
+// must be called with the loop lock
+void CurlLoop::_remove_canceled(CURLM *multi_handle)
+{
+    for (ListRequests::iterator i = m_cancel_requests.begin();
+         i != m_cancel_requests.end(); ++i)
+    {
+        MapRequests::iterator request = m_pending_requests.find((*i)->m_handle);
+        if (request != m_pending_requests.end())
+        {
+            curl_multi_remove_handle(multi_handle, (*i)->m_handle);
+            m_pending_requests.erase(request);
+            --m_nb_active[(*i)->m_priority];
+            continue;
+        }
+        // not started yet
+        QueuedRequests &queue = m_queued_requests[(*i)->m_priority];
+        for (QueuedRequests::iterator q = queue.begin(); q != queue.end(); ++q)
+            if (q->second == *i)
+            {
+                queue.erase(q);
+                break;
+            }
+    }
+    // released by _resume_and_finish without the loop lock
+    m_released_requests.splice(m_released_requests.end(), m_cancel_requests);
+}
+
+// must be called without the loop lock, the handles are only
+// touched from the curl thread
+void CurlLoop::_resume_and_finish()
+{
+    Lock alock(&m_lock);
+    WeakRequests resume_requests, finish_requests;
+    resume_requests.swap(m_resume_requests);
+    finish_requests.swap(m_finish_requests);
+    // the last reference of a transfer may wait for its file writer,
+    // which may need the loop lock
+    ListRequests released_requests;
+    released_requests.swap(m_released_requests);
+    ListRequests paused;
+    for (WeakRequests::iterator i = resume_requests.begin(); i != resume_requests.end(); ++i)
+    {
+        std::shared_ptr<FutureRequest> req = i->lock();
+        // not canceled nor finished
+        if (req && m_pending_requests.find(req->m_handle) != m_pending_requests.end())
+            paused.push_back(req);
+    }
+    alock.unLock();
+
+    // may call the write callback back with the held data
+    for (ListRequests::iterator i = paused.begin(); i != paused.end(); ++i)
+        curl_easy_pause((*i)->m_handle, CURLPAUSE_CONT);
+
+    for (WeakRequests::iterator i = finish_requests.begin(); i != finish_requests.end(); ++i)
+    {
+        std::shared_ptr<FutureRequest> req = i->lock();
+        if (!req)
+            continue;
+        Lock request_lock(&req->m_lock);
+        if (!req->m_finish_deferred)
+            continue;
+        req->m_finish_deferred = false;
+        bool canceled = req->m_status == FutureRequest::CANCEL;
+        req->_deferred_finished();
+        if (!canceled) // already notified by cancel_request
+            req->_notify();
+    }
+}
+
+// latency from the queuing of the request, REST calls by endpoint
+// and file transfers by class, also traced as a span if tracing
+void CurlLoop::_record_metrics(FutureRequest &req, CURLcode result)
+{
+    long response_code = 0;
+    if (result == CURLE_OK)
+        curl_easy_getinfo(req.m_handle, CURLINFO_RESPONSE_CODE, &response_code);
+    bool failed = result != CURLE_OK || response_code >= 400;
+    uint64_t latency = uint64_t(std::max(_now() - req.m_queued_time, 0.) * 1e9);
+
+    // the registry is only searched the first time a class or url is seen,
+    // the data files each have their url
+    bool control = req.m_priority == FutureRequest::CONTROL;
+    const char *kind = control ? "rest" : "transfer";
+    RequestMetrics &metrics = !control                ? m_transfer_metrics[req.m_priority]
+                              : _is_data_url(req.m_url) ? m_data_metrics
+                                                        : m_rest_metrics[req.m_url];
+    if (!metrics.latency)
+    {
+        metrics.label = control ? _endpoint(req.m_url) : PRIORITY_NAMES[req.m_priority];
+        metrics.latency = &Metrics::instance().histogram(std::string(kind) + "_latency_ns." + metrics.label);
+    }
+    metrics.latency->record(latency);
+    if (failed)
+    {
+        if (!metrics.errors)
+            metrics.errors = &Metrics::instance().counter(std::string(kind) + "_errors." + metrics.label);
+        metrics.errors->add();
+    }
+
+    Tracer &tracer = Tracer::instance();
+    if (req.m_queued_ns && tracer.is_active())
+        tracer.complete(kind, req.m_queued_ns, Tracer::now(),
+                        failed ? metrics.label + " failed" : metrics.label);
+}
+
 void *CurlLoop::_runFunc(void *curlloopPt)
 {
     ((CurlLoop *)curlloopPt)->_run();
@@ -158,29 +452,38 @@ void *CurlLoop::_runFunc(void *curlloopPt)
 void CurlLoop::_run()
 {
     CURLM *multi_handle = curl_multi_init();
+    Tracer::instance().thread_name("eiger curl");
     Lock lock(&m_lock);
     while (!m_quit)
     {
+        lock.unLock();
+        _resume_and_finish();
         lock.lock();
-        while (!m_quit &&
-               m_pending_requests.empty() && m_new_requests.empty())
+        _remove_canceled(multi_handle);
+        //Start the queued requests
+        double wait_delay = _admit(multi_handle);
+        if (m_pending_requests.empty())
         {
             m_running = false;
             pthread_cond_broadcast(&m_cond);
-            pthread_cond_wait(&m_cond, &m_lock);
+            if (m_quit)
+                break;
+            if (!m_resume_requests.empty() || !m_finish_requests.empty() ||
+                !m_released_requests.empty())
+                continue;
+            if (wait_delay < 0.)
+                pthread_cond_wait(&m_cond, &m_lock);
+            else
+            {
+                double until = _now() + wait_delay;
+                struct timespec wait_timeout;
+                wait_timeout.tv_sec = long(until);
+                wait_timeout.tv_nsec = long((until - long(until)) * 1e9);
+                pthread_cond_timedwait(&m_cond, &m_lock, &wait_timeout);
+            }
+            continue;
         }
-        if (m_quit)
-            break;
         m_running = true;
-        //Add all new requests
-        for (ListRequests::iterator i = m_new_requests.begin();
-             i != m_new_requests.end(); ++i)
-        {
-            std::pair<MapRequests::iterator, bool> result = m_pending_requests.insert(MapRequests::value_type((*i)->m_handle, *i));
-            if (result.second)
-                curl_multi_add_handle(multi_handle, (*i)->m_handle);
-        }
-        m_new_requests.clear();
         lock.unLock();
 
         fd_set fdread;
@@ -201,6 +504,9 @@ void CurlLoop::_run()
         struct timeval *timeoutPt;
         long curl_timeout = -1;
         curl_multi_timeout(multi_handle, &curl_timeout);
+        // wake up for the held requests
+        if (wait_delay >= 0. && (curl_timeout < 0 || wait_delay * 1000 < curl_timeout))
+            curl_timeout = long(wait_delay * 1000) + 1;
         if (curl_timeout >= 0)
         {
             timeout.tv_sec = curl_timeout / 1000;
@@ -219,18 +525,20 @@ void CurlLoop::_run()
             std::cerr << "Big problem occurred in curl loop " << __FILE__ << ":" << __LINE__ << ", exit" << std::endl;
             break;
         }
-        // fds are not ready in curl, wait 100ms
-        int nb_event = 0;
+        // fds are not ready in curl (i.e: all the transfers are paused),
+        // wait m_curl_delay_ms but still wake up on the pipe
         if (max_fd == -1)
         {
-            usleep(m_curl_delay_ms * 1000);
-            //std::cout << "==================== sleeped m_curl_delay_ms ms waiting for curl =====================" << std::endl;
-        }
-        else
-        {
-            //std::cout << "==================== Curl is finally ready ... =====================" << std::endl;
-            nb_event = select(max_fd + 1, &fdread, &fdwrite, &fdexcep, timeoutPt);
+            long delay_us = long(m_curl_delay_ms * 1000);
+            if (!timeoutPt || timeout.tv_sec * 1000000L + timeout.tv_usec > delay_us)
+            {
+                timeout.tv_sec = delay_us / 1000000;
+                timeout.tv_usec = delay_us % 1000000;
+                timeoutPt = &timeout;
+            }
         }
+        //std::cout << "==================== Curl is finally ready ... =====================" << std::endl;
+        int nb_event = select(std::max(max_fd, m_pipes[0]) + 1, &fdread, &fdwrite, &fdexcep, timeoutPt);
 
         if (nb_event == -1)
         {
@@ -267,55 +575,69 @@ void CurlLoop::_run()
                     {
                         std::shared_ptr<FutureRequest> req = request->second;
                         m_pending_requests.erase(request);
+                        --m_nb_active[req->m_priority];
                         lock.unLock();
 
-                        Lock request_lock(&req->m_lock);
-                        if (req->m_status != FutureRequest::CANCEL)
-                        {
-                            switch (msg->data.result)
-                            {
-                            case CURLE_OK:
-                                req->m_status = FutureRequest::OK;
-                                break;
-                            default: // error
-                                req->m_status = FutureRequest::ERROR;
-                                req->m_error_code = curl_easy_strerror(msg->data.result);
-                                break;
-                            }
-                        }
-                        pthread_cond_broadcast(&req->m_cond);
-                        if (req->m_cbk)
-                            (*req->m_cbk)->status_changed(req->m_status);
-                        req->_request_finished();
-
+                        _finished(req, msg->data.result);
+                        req.reset(); // without the loop lock, see _resume_and_finish
                         lock.lock();
                     }
                 }
             }
             //Remove canceled request
-            for (ListRequests::iterator i = m_cancel_requests.begin();
-                 i != m_cancel_requests.end(); ++i)
-            {
-                MapRequests::iterator request = m_pending_requests.find((*i)->m_handle);
-                if (request != m_pending_requests.end())
-                {
-                    curl_multi_remove_handle(multi_handle, (*i)->m_handle);
-                    m_pending_requests.erase(request);
-                }
-            }
-            m_cancel_requests.clear();
+            _remove_canceled(multi_handle);
         }
     }
     //cleanup
-    for (MapRequests::iterator i = m_pending_requests.begin(); i != m_pending_requests.end(); ++i)
+    lock.lock();
+    MapRequests pending_requests;
+    pending_requests.swap(m_pending_requests);
+    QueuedRequests queued_requests[FutureRequest::NB_PRIORITIES];
+    for (int i = 0; i < FutureRequest::NB_PRIORITIES; ++i)
+        queued_requests[i].swap(m_queued_requests[i]), m_nb_active[i] = 0;
+    ListRequests released_requests;
+    released_requests.swap(m_released_requests);
+    lock.unLock();
+
+    for (MapRequests::iterator i = pending_requests.begin(); i != pending_requests.end(); ++i)
         curl_multi_remove_handle(multi_handle, i->first);
-    m_pending_requests.clear();
     curl_multi_cleanup(multi_handle);
 }
 
-CurlLoop::FutureRequest::FutureRequest(const std::string &url) : m_status(IDLE),
-                                                                 m_cbk(NULL),
-                                                                 m_url(url)
+// curl is done with the request, called without the loop lock
+void CurlLoop::_finished(const std::shared_ptr<FutureRequest> &req, CURLcode result)
+{
+    Lock request_lock(&req->m_lock);
+    bool canceled = req->m_status == FutureRequest::CANCEL;
+    if (!canceled)
+    {
+        switch (result)
+        {
+        case CURLE_OK:
+            req->m_status = FutureRequest::OK;
+            break;
+        default: // error
+            req->m_status = FutureRequest::ERROR;
+            req->m_error_code = curl_easy_strerror(result);
+            break;
+        }
+    }
+    if (!canceled)
+        _record_metrics(*req, result);
+    // finish (i.e: value conversion) before notifying
+    req->_request_finished();
+    if (!canceled && !req->m_finish_deferred) // already notified by cancel_request
+        req->_notify();
+}
+
+CurlLoop::FutureRequest::FutureRequest(const std::string &url) : m_loop(NULL),
+                                                                 m_status(IDLE),
+                                                                 m_url(url),
+                                                                 m_priority(CONTROL),
+                                                                 m_order(0),
+                                                                 m_queued_time(0.),
+                                                                 m_queued_ns(0),
+                                                                 m_finish_deferred(false)
 {
     if (pthread_mutex_init(&m_lock, NULL))
         THROW_EIGER_EXCEPTION("pthread_mutex_init", "Can't initialize the lock");
@@ -329,10 +651,25 @@ CurlLoop::FutureRequest::FutureRequest(const std::string &url) : m_status(IDLE),
 #endif
 }
 
+CurlLoop::FutureRequest::FutureRequest() : m_handle(NULL),
+                                           m_loop(NULL),
+                                           m_status(RUNNING),
+                                           m_priority(CONTROL),
+                                           m_order(0),
+                                           m_queued_time(0.),
+                                           m_queued_ns(0),
+                                           m_finish_deferred(false)
+{
+    if (pthread_mutex_init(&m_lock, NULL))
+        THROW_EIGER_EXCEPTION("pthread_mutex_init", "Can't initialize the lock");
+    if (pthread_cond_init(&m_cond, NULL))
+        THROW_EIGER_EXCEPTION("pthread_cond_init", "Can't initialize the variable condition");
+}
+
 CurlLoop::FutureRequest::~FutureRequest()
 {
-    curl_easy_cleanup(m_handle);
-    delete m_cbk;
+    if (m_handle)
+        curl_easy_cleanup(m_handle);
 }
 
 void CurlLoop::FutureRequest::wait(double timeout, bool lock_flag) const
@@ -368,6 +705,12 @@ void CurlLoop::FutureRequest::wait(double timeout, bool lock_flag) const
         THROW_EIGER_EXCEPTION("wait_status", m_error_code.c_str());
 }
 
+void CurlLoop::FutureRequest::set_priority(Priority priority, long order)
+{
+    m_priority = priority;
+    m_order = order;
+}
+
 CurlLoop::FutureRequest::Status
 CurlLoop::FutureRequest::get_status() const
 {
@@ -378,10 +721,219 @@ CurlLoop::FutureRequest::get_status() const
 void CurlLoop::FutureRequest::register_callback(std::shared_ptr<Callback> &cbk)
 {
     Lock lock(&m_lock);
-    m_cbk = new std::shared_ptr<Callback>(cbk);
+    m_cbks.push_back(cbk);
     Status status = m_status;
     lock.unLock();
 
     if (status != RUNNING)
         cbk->status_changed(status);
 }
+
+// must be called with the request lock
+void CurlLoop::FutureRequest::_notify() const
+{
+    pthread_cond_broadcast(&m_cond);
+    for (std::list<std::shared_ptr<Callback>>::const_iterator i = m_cbks.begin();
+         i != m_cbks.end(); ++i)
+        (*i)->status_changed(m_status);
+}
+
+void CurlLoop::FutureRequest::_cancel_request(const std::shared_ptr<FutureRequest> &request)
+{
+    if (!request->m_handle)
+        request->_cancel();
+    else if (request->m_loop)
+        request->m_loop->cancel_request(request);
+}
+
+/*----------------------------------------------------------------------------
+			    Aggregated futures
+----------------------------------------------------------------------------*/
+class CurlLoop::FutureGroup : public CurlLoop::FutureRequest
+{
+public:
+    enum Mode
+    {
+        ALL,
+        ANY,
+        THEN
+    };
+    FutureGroup(Mode mode) : m_mode(mode), m_pending(0) {}
+
+    void follow(const List &);
+    Continuation m_continuation;
+
+protected:
+    virtual void _cancel();
+
+private:
+    class _ChildCallback;
+    void _child_finished(FutureRequest *, Status);
+    void _finish(Status, const std::string &error_code, FutureRequest *source);
+
+    Mode m_mode;
+    int m_pending;
+    List m_children;
+};
+
+class CurlLoop::FutureGroup::_ChildCallback : public CurlLoop::FutureRequest::Callback
+{
+public:
+    _ChildCallback(const std::shared_ptr<FutureGroup> &group,
+                   FutureRequest *child) : m_group(group), m_child(child) {}
+
+    virtual void status_changed(FutureRequest::Status status)
+    {
+        m_group->_child_finished(m_child, status);
+    }
+
+private:
+    // the group is kept alive until all its children are finished
+    std::shared_ptr<FutureGroup> m_group;
+    FutureRequest *m_child;
+};
+
+void CurlLoop::FutureGroup::follow(const List &children)
+{
+    std::shared_ptr<FutureGroup> self = std::static_pointer_cast<FutureGroup>(shared_from_this());
+    Lock lock(&m_lock);
+    // cancelled while a continuation was running, nothing may follow
+    if (m_status != RUNNING)
+    {
+        lock.unLock();
+        for (List::const_iterator i = children.begin(); i != children.end(); ++i)
+            _cancel_request(*i);
+        return;
+    }
+    m_children.insert(m_children.end(), children.begin(), children.end());
+    m_pending += children.size();
+    lock.unLock();
+
+    // may be called back immediately if already finished
+    for (List::const_iterator i = children.begin(); i != children.end(); ++i)
+    {
+        std::shared_ptr<Callback> cbk(new _ChildCallback(self, i->get()));
+        (*i)->register_callback(cbk);
+    }
+}
+
+// called from the curl thread with the child lock
+void CurlLoop::FutureGroup::_child_finished(FutureRequest *child, Status status)
+{
+    Lock lock(&m_lock);
+    if (m_status != RUNNING)
+        return;
+
+    if (m_mode == THEN)
+    {
+        Continuation continuation;
+        continuation.swap(m_continuation);
+        m_children.clear();
+        m_pending = 0;
+        m_mode = ALL;
+        lock.unLock();
+
+        std::shared_ptr<FutureRequest> next;
+        try
+        {
+            next = continuation(status);
+        }
+        catch (const std::exception &e)
+        {
+            _finish(ERROR, e.what(), NULL);
+            return;
+        }
+        if (next)
+            follow(List(1, next));
+        else
+            _finish(status, child->m_error_code, NULL);
+        return;
+    }
+
+    --m_pending;
+    if (status == OK)
+    {
+        if (m_mode == ANY || !m_pending)
+        {
+            lock.unLock();
+            _finish(OK, "", child);
+        }
+    }
+    else if (m_mode == ALL)
+    {
+        lock.unLock();
+        _finish(status, child->m_error_code, child);
+    }
+    else // ANY
+    {
+        if (!m_error_code.empty())
+            m_error_code += "\n";
+        m_error_code += child->m_error_code;
+        if (!m_pending)
+        {
+            std::string error_code = m_error_code;
+            lock.unLock();
+            _finish(ERROR, error_code, child);
+        }
+    }
+}
+
+// set the final status, the unfinished children are cancelled
+void CurlLoop::FutureGroup::_finish(Status status, const std::string &error_code,
+                                    FutureRequest *source)
+{
+    Lock lock(&m_lock);
+    if (m_status != RUNNING)
+        return;
+    m_status = status;
+    m_error_code = error_code;
+    List children;
+    children.swap(m_children);
+    m_continuation = Continuation();
+    _notify();
+    lock.unLock();
+
+    for (List::iterator i = children.begin(); i != children.end(); ++i)
+        if (i->get() != source) // its lock is held by the caller
+            _cancel_request(*i);
+}
+
+void CurlLoop::FutureGroup::_cancel()
+{
+    _finish(CANCEL, "", NULL);
+}
+
+std::shared_ptr<CurlLoop::FutureRequest> CurlLoop::FutureRequest::then(Continuation continuation)
+{
+    std::shared_ptr<FutureGroup> group(new FutureGroup(FutureGroup::THEN));
+    group->m_continuation = continuation;
+    group->follow(List(1, shared_from_this()));
+    return group;
+}
+
+std::shared_ptr<CurlLoop::FutureRequest> CurlLoop::FutureRequest::when_all(const List &requests)
+{
+    std::shared_ptr<FutureGroup> group(new FutureGroup(FutureGroup::ALL));
+    if (requests.empty())
+    {
+        Lock lock(&group->m_lock);
+        group->m_status = OK;
+    }
+    else
+        group->follow(requests);
+    return group;
+}
+
+std::shared_ptr<CurlLoop::FutureRequest> CurlLoop::FutureRequest::when_any(const List &requests)
+{
+    std::shared_ptr<FutureGroup> group(new FutureGroup(FutureGroup::ANY));
+    if (requests.empty())
+    {
+        Lock lock(&group->m_lock);
+        group->m_status = ERROR;
+        group->m_error_code = "when_any: no request";
+    }
+    else
+        group->follow(requests);
+    return group;
+}
@@ -0,0 +1,367 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2015
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <ctype.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+#include "eigerapi/Metrics.h"
+
+using namespace eigerapi;
+
+// shard of the calling thread, threads are spread round robin
+static int _shard_index(int nb_shards)
+{
+    static std::atomic<unsigned> next_index(0);
+    static thread_local unsigned index = next_index.fetch_add(1, std::memory_order_relaxed);
+    return index % nb_shards;
+}
+
+Metrics::Counter::Counter()
+{
+    reset();
+}
+
+void Metrics::Counter::add(uint64_t n)
+{
+    m_shards[_shard_index(NB_SHARDS)].value.fetch_add(n, std::memory_order_relaxed);
+}
+
+uint64_t Metrics::Counter::value() const
+{
+    uint64_t value = 0;
+    for (int i = 0; i < NB_SHARDS; ++i)
+        value += m_shards[i].value.load(std::memory_order_relaxed);
+    return value;
+}
+
+void Metrics::Counter::reset()
+{
+    for (int i = 0; i < NB_SHARDS; ++i)
+        m_shards[i].value.store(0, std::memory_order_relaxed);
+}
+
+Metrics::Histogram::Histogram()
+{
+    reset();
+}
+
+// values below SUB_BUCKETS have their own bucket, then each power
+// of two is split in SUB_BUCKETS
+int Metrics::Histogram::bucket(uint64_t value)
+{
+    if (value < uint64_t(SUB_BUCKETS))
+        return int(value);
+    int shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+    return (shift + 1) * SUB_BUCKETS + int((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+uint64_t Metrics::Histogram::bucket_max(int bucket)
+{
+    if (bucket < SUB_BUCKETS)
+        return bucket;
+    int shift = bucket / SUB_BUCKETS - 1;
+    uint64_t low = uint64_t(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+    return low + ((uint64_t(1) << shift) - 1);
+}
+
+void Metrics::Histogram::record(uint64_t value)
+{
+    m_buckets[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+    uint64_t max = m_max.load(std::memory_order_relaxed);
+    while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+        ;
+}
+
+// not atomic as a whole, the count is the sum of the buckets read
+Metrics::HistogramSnapshot Metrics::Histogram::snapshot() const
+{
+    HistogramSnapshot snapshot;
+    for (int i = 0; i < NB_BUCKETS; ++i)
+    {
+        uint64_t count = m_buckets[i].load(std::memory_order_relaxed);
+        if (!count)
+            continue;
+        snapshot.buckets.push_back(std::make_pair(bucket_max(i), count));
+        snapshot.count += count;
+    }
+    snapshot.sum = m_sum.load(std::memory_order_relaxed);
+    snapshot.max = m_max.load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+void Metrics::Histogram::reset()
+{
+    for (int i = 0; i < NB_BUCKETS; ++i)
+        m_buckets[i].store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+double Metrics::HistogramSnapshot::percentile(double p) const
+{
+    if (!count)
+        return 0.;
+    uint64_t rank = uint64_t(p * count + .5);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i)
+    {
+        seen += buckets[i].second;
+        if (seen >= rank)
+            return double(std::min(buckets[i].first, max));
+    }
+    return double(max);
+}
+
+Metrics &Metrics::instance()
+{
+    static Metrics metrics;
+    return metrics;
+}
+
+Metrics::Counter &Metrics::counter(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    std::unique_ptr<Counter> &counter = m_counters[name];
+    if (!counter)
+        counter.reset(new Counter());
+    return *counter;
+}
+
+Metrics::Gauge &Metrics::gauge(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    std::unique_ptr<Gauge> &gauge = m_gauges[name];
+    if (!gauge)
+        gauge.reset(new Gauge());
+    return *gauge;
+}
+
+Metrics::Histogram &Metrics::histogram(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    std::unique_ptr<Histogram> &histogram = m_histograms[name];
+    if (!histogram)
+        histogram.reset(new Histogram());
+    return *histogram;
+}
+
+Metrics::Snapshot Metrics::snapshot() const
+{
+    Snapshot snapshot;
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    snapshot.time = now.tv_sec + now.tv_usec * 1e-6;
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (auto i = m_counters.begin(); i != m_counters.end(); ++i)
+        snapshot.counters[i->first] = i->second->value();
+    for (auto i = m_gauges.begin(); i != m_gauges.end(); ++i)
+        snapshot.gauges[i->first] = i->second->value();
+    for (auto i = m_histograms.begin(); i != m_histograms.end(); ++i)
+        snapshot.histograms[i->first] = i->second->snapshot();
+    return snapshot;
+}
+
+void Metrics::reset()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (auto i = m_counters.begin(); i != m_counters.end(); ++i)
+        i->second->reset();
+    for (auto i = m_histograms.begin(); i != m_histograms.end(); ++i)
+        i->second->reset();
+}
+
+static void _json_string(std::ostream &os, const std::string &value)
+{
+    os << '"';
+    for (size_t i = 0; i < value.size(); ++i)
+    {
+        char c = value[i];
+        if (c == '"' || c == '\\')
+            os << '\\' << c;
+        else if ((unsigned char)c < 0x20)
+            os << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec;
+        else
+            os << c;
+    }
+    os << '"';
+}
+
+std::string Metrics::Snapshot::to_json() const
+{
+    std::ostringstream os;
+    os << std::setprecision(15) << "{\"time\": " << time << ", \"counters\": {";
+    for (auto i = counters.begin(); i != counters.end(); ++i)
+    {
+        if (i != counters.begin())
+            os << ", ";
+        _json_string(os, i->first);
+        os << ": " << i->second;
+    }
+    os << "}, \"gauges\": {";
+    for (auto i = gauges.begin(); i != gauges.end(); ++i)
+    {
+        if (i != gauges.begin())
+            os << ", ";
+        _json_string(os, i->first);
+        os << ": " << i->second;
+    }
+    os << "}, \"histograms\": {";
+    for (auto i = histograms.begin(); i != histograms.end(); ++i)
+    {
+        const HistogramSnapshot &histogram = i->second;
+        if (i != histograms.begin())
+            os << ", ";
+        _json_string(os, i->first);
+        os << ": {\"count\": " << histogram.count
+           << ", \"mean\": " << (histogram.count ? double(histogram.sum) / histogram.count : 0.)
+           << ", \"p50\": " << histogram.percentile(.5)
+           << ", \"p90\": " << histogram.percentile(.9)
+           << ", \"p99\": " << histogram.percentile(.99)
+           << ", \"max\": " << histogram.max << "}";
+    }
+    os << "}}";
+    return os.str();
+}
+
+// metric families of a snapshot map, by Prometheus name
+template <class T>
+static std::map<std::string, std::vector<std::pair<std::string, T>>>
+_families(const std::map<std::string, T> &metrics)
+{
+    std::map<std::string, std::vector<std::pair<std::string, T>>> families;
+    for (auto i = metrics.begin(); i != metrics.end(); ++i)
+    {
+        size_t dot = i->first.find('.');
+        std::string family = "eiger_" + i->first.substr(0, dot);
+        for (size_t j = 0; j < family.size(); ++j)
+            if (!isalnum((unsigned char)family[j]) && family[j] != '_')
+                family[j] = '_';
+        std::string label = dot == std::string::npos ? std::string() : i->first.substr(dot + 1);
+        families[family].push_back(std::make_pair(label, i->second));
+    }
+    return families;
+}
+
+static void _prometheus_labels(std::ostream &os, const std::string &label, const char *quantile = NULL)
+{
+    if (label.empty() && !quantile)
+        return;
+    os << '{';
+    if (!label.empty())
+    {
+        os << "label=\"";
+        for (size_t i = 0; i < label.size(); ++i)
+        {
+            char c = label[i];
+            if (c == '"' || c == '\\')
+                os << '\\' << c;
+            else if (c == '\n')
+                os << "\\n";
+            else
+                os << c;
+        }
+        os << '"';
+        if (quantile)
+            os << ',';
+    }
+    if (quantile)
+        os << "quantile=\"" << quantile << '"';
+    os << '}';
+}
+
+static void _prometheus_value(std::ostream &os, double value)
+{
+    if (std::isnan(value))
+        os << "NaN";
+    else if (std::isinf(value))
+        os << (value > 0 ? "+Inf" : "-Inf");
+    else
+        os << value;
+}
+
+std::string Metrics::Snapshot::to_prometheus() const
+{
+    std::ostringstream os;
+    os << std::setprecision(15);
+
+    auto counter_families = _families(counters);
+    for (auto i = counter_families.begin(); i != counter_families.end(); ++i)
+    {
+        os << "# TYPE " << i->first << "_total counter\n";
+        for (auto j = i->second.begin(); j != i->second.end(); ++j)
+        {
+            os << i->first << "_total";
+            _prometheus_labels(os, j->first);
+            os << ' ' << j->second << '\n';
+        }
+    }
+
+    auto gauge_families = _families(gauges);
+    for (auto i = gauge_families.begin(); i != gauge_families.end(); ++i)
+    {
+        os << "# TYPE " << i->first << " gauge\n";
+        for (auto j = i->second.begin(); j != i->second.end(); ++j)
+        {
+            os << i->first;
+            _prometheus_labels(os, j->first);
+            os << ' ';
+            _prometheus_value(os, j->second);
+            os << '\n';
+        }
+    }
+
+    static const struct
+    {
+        const char *name;
+        double value;
+    } quantiles[] = {{"0.5", .5}, {"0.9", .9}, {"0.99", .99}};
+    auto histogram_families = _families(histograms);
+    for (auto i = histogram_families.begin(); i != histogram_families.end(); ++i)
+    {
+        os << "# TYPE " << i->first << " summary\n";
+        for (auto j = i->second.begin(); j != i->second.end(); ++j)
+        {
+            const HistogramSnapshot &histogram = j->second;
+            for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); ++q)
+            {
+                os << i->first;
+                _prometheus_labels(os, j->first, quantiles[q].name);
+                os << ' ' << histogram.percentile(quantiles[q].value) << '\n';
+            }
+            os << i->first << "_sum";
+            _prometheus_labels(os, j->first);
+            os << ' ' << histogram.sum << '\n';
+            os << i->first << "_count";
+            _prometheus_labels(os, j->first);
+            os << ' ' << histogram.count << '\n';
+        }
+    }
+    return os.str();
+}
@@ -0,0 +1,229 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2015
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#include <sstream>
+
+#include "eigerapi/MetricsServer.h"
+#include "eigerapi/Metrics.h"
+#include "eigerapi/Tracer.h"
+#include "eigerapi/EigerDefines.h"
+
+using namespace eigerapi;
+
+static const int REQUEST_TIMEOUT = 2; // s, for a slow or stalled client
+static const size_t MAX_REQUEST_SIZE = 8192;
+
+static int _bind_tcp(const std::string &address)
+{
+    std::string host = "127.0.0.1", port = address;
+    size_t colon = address.rfind(':');
+    if (colon != std::string::npos)
+        host = address.substr(0, colon), port = address.substr(colon + 1);
+    char *end;
+    long port_nb = strtol(port.c_str(), &end, 10);
+    if (port.empty() || *end || port_nb <= 0 || port_nb > 65535)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+    struct addrinfo *result;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result))
+        return -1;
+
+    int fd = -1;
+    for (struct addrinfo *addr = result; addr && fd < 0; addr = addr->ai_next)
+    {
+        fd = socket(addr->ai_family, addr->ai_socktype | SOCK_CLOEXEC, addr->ai_protocol);
+        if (fd < 0)
+            continue;
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(fd, addr->ai_addr, addr->ai_addrlen))
+            close(fd), fd = -1;
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+static int _bind_unix(const std::string &path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+    {
+        errno = path.empty() ? EINVAL : ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    unlink(path.c_str()); // left by a previous process
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)))
+        close(fd), fd = -1;
+    return fd;
+}
+
+static void _write_all(int fd, const std::string &data)
+{
+    for (size_t done = 0; done < data.size();)
+    {
+        ssize_t n = send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        done += n;
+    }
+}
+
+MetricsServer::MetricsServer(const std::string &address) : m_address(address),
+                                                           m_socket(-1)
+{
+    if (address.compare(0, 5, "unix:") == 0)
+    {
+        m_unix_path = address.substr(5);
+        m_socket = _bind_unix(m_unix_path);
+    }
+    else
+        m_socket = _bind_tcp(address);
+    if (m_socket < 0 || listen(m_socket, 8))
+    {
+        std::string error = strerror(errno);
+        if (m_socket >= 0)
+            _close_socket();
+        THROW_EIGER_EXCEPTION(("Can't listen on " + address).c_str(), error.c_str());
+    }
+
+    if (pipe(m_pipes))
+    {
+        _close_socket();
+        THROW_EIGER_EXCEPTION("pipe", "Can't create pipe");
+    }
+    m_thread = std::thread(&MetricsServer::_run, this);
+}
+
+MetricsServer::~MetricsServer()
+{
+    // the pipe is empty, only a signal can interrupt the write
+    while (write(m_pipes[1], "|", 1) < 0 && errno == EINTR)
+        ;
+    m_thread.join();
+    close(m_pipes[0]), close(m_pipes[1]);
+    _close_socket();
+}
+
+// the socket file of a unix address is removed with it
+void MetricsServer::_close_socket()
+{
+    close(m_socket);
+    if (!m_unix_path.empty())
+        unlink(m_unix_path.c_str());
+}
+
+void MetricsServer::_run()
+{
+    Tracer::instance().thread_name("eiger metrics");
+    struct pollfd fds[2] = {{m_pipes[0], POLLIN, 0}, {m_socket, POLLIN, 0}};
+    while (1)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (fds[0].revents)
+            break;
+        if (fds[1].revents & POLLIN)
+        {
+            int fd = accept4(m_socket, NULL, NULL, SOCK_CLOEXEC);
+            if (fd < 0)
+                continue;
+            struct timeval timeout = {REQUEST_TIMEOUT, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            _serve(fd);
+            close(fd);
+        }
+    }
+}
+
+// minimal HTTP/1.0: the request line is enough, the connection is
+// closed after the reply
+void MetricsServer::_serve(int fd)
+{
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos &&
+           request.find("\n\n") == std::string::npos && request.size() < MAX_REQUEST_SIZE)
+    {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        request.append(buffer, n);
+    }
+
+    std::istringstream request_line(request.substr(0, request.find_first_of("\r\n")));
+    std::string method, path;
+    request_line >> method >> path;
+    path = path.substr(0, path.find('?'));
+
+    std::string status = "200 OK", content_type = "text/plain; version=0.0.4", body;
+    if (method.empty())
+        return;
+    else if (method != "GET" && method != "HEAD")
+        status = "405 Method Not Allowed", content_type = "text/plain", body = "GET /metrics\n";
+    else if (path != "/metrics" && path != "/")
+        status = "404 Not Found", content_type = "text/plain", body = "GET /metrics\n";
+    else
+        body = Metrics::instance().snapshot().to_prometheus();
+
+    std::ostringstream reply;
+    reply << "HTTP/1.0 " << status << "\r\n"
+          << "Content-Type: " << content_type << "\r\n"
+          << "Content-Length: " << body.size() << "\r\n"
+          << "Connection: close\r\n\r\n";
+    if (method != "HEAD")
+        reply << body;
+    _write_all(fd, reply.str());
+}
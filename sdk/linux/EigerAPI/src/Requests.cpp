@@ -22,8 +22,13 @@
 #include <cstdlib>
 #include <cstring>
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <sstream>
+#include <list>
+#include <limits>
 
 #include <json/json.h>
 
@@ -64,41 +69,49 @@ private:
 
 using namespace eigerapi;
 
-static const char *CSTR_EIGERCONFIG = "config";
-static const char *CSTR_EIGERSTATUS = "status";
-static const char *CSTR_EIGERSTATUS_BOARD = "status/board_000";
-static const char *CSTR_EIGERCOMMAND = "command";
-static const char *CSTR_SUBSYSTEMFILEWRITER = "filewriter";
-static const char *CSTR_SUBSYSTEMSTREAM = "stream";
-static const char *CSTR_SUBSYSTEMDETECTOR = "detector";
-static const char *CSTR_DATA = "data";
-static const char *CSTR_EIGERVERSION = "version";
-static const char *CSTR_EIGERAPI = "api";
+static const char CSTR_EIGERCONFIG[] = "config";
+static const char CSTR_EIGERSTATUS[] = "status";
+static const char CSTR_EIGERSTATUS_BOARD[] = "status/board_000";
+static const char CSTR_EIGERCOMMAND[] = "command";
+static const char CSTR_SUBSYSTEMFILEWRITER[] = "filewriter";
+static const char CSTR_SUBSYSTEMSTREAM[] = "stream";
+static const char CSTR_SUBSYSTEMDETECTOR[] = "detector";
+static const char CSTR_DATA[] = "data";
+static const char CSTR_EIGERVERSION[] = "version";
+static const char CSTR_EIGERAPI[] = "api";
 
 struct ResourceDescription
 {
-    ResourceDescription(const char *name,
-                        const char *subsystem = CSTR_SUBSYSTEMDETECTOR,
-                        const char *location = CSTR_EIGERCONFIG) : m_name(name),
-                                                                   m_subsystem(subsystem),
-                                                                   m_location(location){};
+    constexpr ResourceDescription(const char *name,
+                                  const char *subsystem = CSTR_SUBSYSTEMDETECTOR,
+                                  const char *location = CSTR_EIGERCONFIG) : m_name(name),
+                                                                             m_subsystem(subsystem),
+                                                                             m_location(location){};
 
     std::string build_url(const std::ostringstream &base_url,
-                          const std::ostringstream &api);
+                          const std::ostringstream &api) const;
 
     const char *m_name;
     const char *m_subsystem;
     const char *m_location;
-    std::string m_url;
 };
 
+// Descriptions tables are indexed by the enum value,
+// check at compile time that they follow the enum order.
+template <class Index>
+constexpr bool _follow_enum_order(const Index *table, int table_size, int i = 0)
+{
+    return i == table_size ||
+           (int(table[i].name) == i && _follow_enum_order(table, table_size, i + 1));
+}
+
 struct CommandIndex
 {
     Requests::COMMAND_NAME name;
     ResourceDescription desc;
 };
 
-static CommandIndex CommandsDescription[] = {
+static constexpr CommandIndex CommandsDescription[] = {
     {Requests::INITIALIZE, {"initialize", CSTR_SUBSYSTEMDETECTOR, CSTR_EIGERCOMMAND}},
     {Requests::ARM, {"arm", CSTR_SUBSYSTEMDETECTOR, CSTR_EIGERCOMMAND}},
     {Requests::DISARM, {"disarm", CSTR_SUBSYSTEMDETECTOR, CSTR_EIGERCOMMAND}},
@@ -109,15 +122,16 @@ static CommandIndex CommandsDescription[] = {
     {Requests::FILEWRITER_CLEAR, {"clear", CSTR_SUBSYSTEMFILEWRITER, CSTR_EIGERCOMMAND}},
 };
 
+static_assert(sizeof(CommandsDescription) / sizeof(CommandIndex) == Requests::NB_COMMANDS,
+              "CommandsDescription must describe all Requests::COMMAND_NAME");
+static_assert(_follow_enum_order(CommandsDescription, Requests::NB_COMMANDS),
+              "CommandsDescription must follow Requests::COMMAND_NAME order");
+
 const char *get_cmd_name(Requests::COMMAND_NAME cmd_name)
 {
-    int nb_cmd = sizeof(CommandsDescription) / sizeof(CommandIndex);
-    for (int i = 0; i < nb_cmd; ++i)
-    {
-        if (CommandsDescription[i].name == cmd_name)
-            return CommandsDescription[i].desc.m_name;
-    }
-    return "not found"; // weired
+    if (cmd_name < 0 || cmd_name >= Requests::NB_COMMANDS)
+        return "not found"; // weired
+    return CommandsDescription[cmd_name].desc.m_name;
 }
 struct ParamIndex
 {
@@ -125,7 +139,7 @@ struct ParamIndex
     ResourceDescription desc;
 };
 
-ParamIndex ParamDescription[] = {
+static constexpr ParamIndex ParamDescription[] = {
     // Detector Read only values
     {Requests::TEMP, {"th0_temp", CSTR_SUBSYSTEMDETECTOR, CSTR_EIGERSTATUS_BOARD}},
     {Requests::HUMIDITY, {"th0_humidity", CSTR_SUBSYSTEMDETECTOR, CSTR_EIGERSTATUS_BOARD}},
@@ -168,6 +182,7 @@ ParamIndex ParamDescription[] = {
     // Stream settings
     {Requests::STREAM_MODE, {"mode", CSTR_SUBSYSTEMSTREAM}},
     {Requests::STREAM_HEADER_DETAIL, {"header_detail", CSTR_SUBSYSTEMSTREAM}},
+    {Requests::STREAM_STATUS, {"state", CSTR_SUBSYSTEMSTREAM, CSTR_EIGERSTATUS}},
     // Saving Header
     {Requests::HEADER_BEAM_CENTER_X, {"beam_center_x"}},
     {Requests::HEADER_BEAM_CENTER_Y, {"beam_center_y"}},
@@ -187,18 +202,19 @@ ParamIndex ParamDescription[] = {
     {Requests::ROI_MODE, {"roi_mode"}},
 };
 
+static_assert(sizeof(ParamDescription) / sizeof(ParamIndex) == Requests::NB_PARAMS,
+              "ParamDescription must describe all Requests::PARAM_NAME");
+static_assert(_follow_enum_order(ParamDescription, Requests::NB_PARAMS),
+              "ParamDescription must follow Requests::PARAM_NAME order");
+
 const char *get_param_name(Requests::PARAM_NAME param_name)
 {
-    int nb_param = sizeof(ParamDescription) / sizeof(ParamIndex);
-    for (int i = 0; i < nb_param; ++i)
-    {
-        if (ParamDescription[i].name == param_name)
-            return ParamDescription[i].desc.m_name;
-    }
-    return "not found"; // weired
+    if (param_name < 0 || param_name >= Requests::NB_PARAMS)
+        return "not found"; // weired
+    return ParamDescription[param_name].desc.m_name;
 }
 
-std::string ResourceDescription::build_url(const std::ostringstream &base_url, const std::ostringstream &api)
+std::string ResourceDescription::build_url(const std::ostringstream &base_url, const std::ostringstream &api) const
 {
     std::ostringstream url;
     if (!m_location)
@@ -211,40 +227,61 @@ std::string ResourceDescription::build_url(const std::ostringstream &base_url, c
 // Requests class
 Requests::Requests(const std::string &address) : m_address(address)
 {
-    std::ostringstream base_url;
-    base_url << "http://" << address << '/';
+    pthread_mutex_init(&m_sink_lock, NULL);
+
+    std::string api_version;
+    std::shared_ptr<Param> version_request = get_api_version(api_version);
+    version_request->wait();
 
+    _init_url_cache(api_version);
+}
+
+Requests::Requests(const std::string &address,
+                   const std::string &api_version) : m_address(address)
+{
+    pthread_mutex_init(&m_sink_lock, NULL);
+    _init_url_cache(api_version);
+}
+
+std::string Requests::_api_version_url() const
+{
     std::ostringstream url;
-    url << base_url.str() << CSTR_SUBSYSTEMDETECTOR << '/' << CSTR_EIGERAPI << '/' << CSTR_EIGERVERSION << '/';
+    url << "http://" << m_address << '/'
+        << CSTR_SUBSYSTEMDETECTOR << '/' << CSTR_EIGERAPI << '/' << CSTR_EIGERVERSION << '/';
+    return url.str();
+}
 
-    std::shared_ptr<Param> version_request(new Param(url.str()));
-    version_request->_fill_get_request();
-    m_loop.add_request(version_request);
+void Requests::_init_url_cache(const std::string &api_version)
+{
+    m_api_version = api_version;
 
-    Requests::Param::Value value = version_request->get();
-    std::string &api_version = value.string_val;
+    std::ostringstream base_url;
+    base_url << "http://" << m_address << '/';
 
     std::ostringstream api;
     api << '/' << CSTR_EIGERAPI << '/' << api_version << '/';
 
     // COMMANDS URL CACHE
-    int nb_cmd = sizeof(CommandsDescription) / sizeof(CommandIndex);
-    for (int i = 0; i < nb_cmd; ++i)
-    {
-        CommandIndex &index = CommandsDescription[i];
-        m_cmd_cache_url[index.name] = index.desc.build_url(base_url, api);
-    }
+    for (int i = 0; i < NB_COMMANDS; ++i)
+        m_cmd_cache_url[i] = CommandsDescription[i].desc.build_url(base_url, api);
     // PARAMS URL CACHE
-    int nb_params = sizeof(ParamDescription) / sizeof(ParamIndex);
-    for (int i = 0; i < nb_params; ++i)
-    {
-        ParamIndex &index = ParamDescription[i];
-        m_param_cache_url[index.name] = index.desc.build_url(base_url, api);
-    }
+    for (int i = 0; i < NB_PARAMS; ++i)
+        m_param_cache_url[i] = ParamDescription[i].desc.build_url(base_url, api);
+}
+
+std::shared_ptr<Requests::Param> Requests::get_api_version(std::string &api_version)
+{
+    std::shared_ptr<Param> version_request(new Param(_api_version_url()));
+    version_request->_fill_get_request();
+    version_request->_set_return_value(api_version);
+    m_loop.add_request(version_request);
+    return version_request;
 }
 
 Requests::~Requests()
 {
+    m_loop.quit();
+    pthread_mutex_destroy(&m_sink_lock);
 }
 
 void Requests::set_curl_delay_ms(double curl_delay_ms)
@@ -252,73 +289,71 @@ void Requests::set_curl_delay_ms(double curl_delay_ms)
     m_loop.set_curl_delay_ms(curl_delay_ms);
 }
 
-std::shared_ptr<Requests::Command>
-Requests::get_command(Requests::COMMAND_NAME cmd_name)
+void Requests::set_class_limits(CurlLoop::FutureRequest::Priority priority,
+                                int max_active, long max_recv_speed)
 {
-    CACHE_TYPE::iterator cmd_url = m_cmd_cache_url.find(cmd_name);
-    if (cmd_url == m_cmd_cache_url.end())
-        THROW_EIGER_EXCEPTION(RESOURCE_NOT_FOUND, get_cmd_name(cmd_name));
-
-    std::shared_ptr<Requests::Command> cmd(new Command(cmd_url->second));
-    cmd->_fill_request();
-    m_loop.add_request(cmd);
-    return move(cmd);
+    m_loop.set_class_limits(priority, max_active, max_recv_speed);
 }
 
-std::shared_ptr<Requests::Param>
-Requests::get_param(Requests::PARAM_NAME param_name)
+void Requests::get_class_limits(CurlLoop::FutureRequest::Priority priority,
+                                int &max_active, long &max_recv_speed)
 {
-    std::shared_ptr<Requests::Param> param = _create_get_param(param_name);
-
-    m_loop.add_request(param);
-    return move(param);
+    m_loop.get_class_limits(priority, max_active, max_recv_speed);
 }
 
-#define GENERATE_GET_PARAM()                                                \
-    std::shared_ptr<Requests::Param> param = _create_get_param(param_name); \
-    param->_set_return_value(ret_value);                                    \
-                                                                            \
-    m_loop.add_request(param);                                              \
-    return move(param);
+void Requests::set_cleanup_batch(int nb_requests, double max_delay)
+{
+    m_loop.set_cleanup_batch(nb_requests, max_delay);
+}
 
-std::shared_ptr<Requests::Param>
-Requests::get_param(Requests::PARAM_NAME param_name, bool &ret_value)
+void Requests::get_cleanup_batch(int &nb_requests, double &max_delay)
 {
-    GENERATE_GET_PARAM();
+    m_loop.get_cleanup_batch(nb_requests, max_delay);
 }
 
-std::shared_ptr<Requests::Param>
-Requests::get_param(Requests::PARAM_NAME param_name, double &ret_value)
+void Requests::set_sink_factory(const SinkFactory &factory)
 {
-    GENERATE_GET_PARAM();
+    Lock alock(&m_sink_lock);
+    m_sink_factory = factory;
 }
 
-std::shared_ptr<Requests::Param>
-Requests::get_param(Requests::PARAM_NAME param_name, int &ret_value)
+std::shared_ptr<Requests::Sink>
+Requests::_create_sink(const std::string &path, size_t buffer_size)
 {
-    GENERATE_GET_PARAM();
+    Lock alock(&m_sink_lock);
+    SinkFactory factory = m_sink_factory;
+    alock.unLock();
+    return factory ? factory(path) : create_file_sink(path, buffer_size);
 }
 
-std::shared_ptr<Requests::Param>
-Requests::get_param(Requests::PARAM_NAME param_name, unsigned int &ret_value)
+std::shared_ptr<Requests::Command>
+Requests::get_command(Requests::COMMAND_NAME cmd_name)
 {
-    GENERATE_GET_PARAM();
+    if (cmd_name < 0 || cmd_name >= NB_COMMANDS)
+        THROW_EIGER_EXCEPTION(RESOURCE_NOT_FOUND, get_cmd_name(cmd_name));
+
+    std::shared_ptr<Requests::Command> cmd(new Command(m_cmd_cache_url[cmd_name]));
+    cmd->_fill_request();
+    m_loop.add_request(cmd);
+    return move(cmd);
 }
 
 std::shared_ptr<Requests::Param>
-Requests::get_param(Requests::PARAM_NAME param_name, std::string &ret_value)
+Requests::get_param(Requests::PARAM_NAME param_name)
 {
-    GENERATE_GET_PARAM();
+    std::shared_ptr<Requests::Param> param = _create_get_param(param_name);
+
+    m_loop.add_request(param);
+    return move(param);
 }
 
 std::shared_ptr<Requests::Param>
 Requests::_create_get_param(Requests::PARAM_NAME param_name)
 {
-    CACHE_TYPE::iterator param_url = m_param_cache_url.find(param_name);
-    if (param_url == m_param_cache_url.end())
+    if (param_name < 0 || param_name >= NB_PARAMS)
         THROW_EIGER_EXCEPTION(RESOURCE_NOT_FOUND, get_param_name(param_name));
 
-    std::shared_ptr<Requests::Param> param(new Param(param_url->second));
+    std::shared_ptr<Requests::Param> param(new Param(m_param_cache_url[param_name]));
     param->_fill_get_request();
     return move(param);
 }
@@ -327,11 +362,10 @@ template <class T>
 std::shared_ptr<Requests::Param>
 Requests::_set_param(Requests::PARAM_NAME param_name, const T &value)
 {
-    CACHE_TYPE::iterator param_url = m_param_cache_url.find(param_name);
-    if (param_url == m_param_cache_url.end())
+    if (param_name < 0 || param_name >= NB_PARAMS)
         THROW_EIGER_EXCEPTION(RESOURCE_NOT_FOUND, get_param_name(param_name));
 
-    std::shared_ptr<Requests::Param> param(new Param(param_url->second));
+    std::shared_ptr<Requests::Param> param(new Param(m_param_cache_url[param_name]));
     param->_fill_set_request(value);
     m_loop.add_request(param);
     return move(param);
@@ -350,27 +384,30 @@ Requests::set_param(PARAM_NAME name, double value)
 }
 
 std::shared_ptr<Requests::Param>
-Requests::set_param(PARAM_NAME name, int value)
+Requests::set_param(PARAM_NAME name, unsigned int value)
 {
     return _set_param(name, value);
 }
 
 std::shared_ptr<Requests::Param>
-Requests::set_param(PARAM_NAME name, unsigned int value)
+Requests::set_param(PARAM_NAME name, const std::string &value)
 {
     return _set_param(name, value);
 }
 
 std::shared_ptr<Requests::Param>
-Requests::set_param(PARAM_NAME name, const std::string &value)
+Requests::set_header(PARAM_NAME name, double value)
 {
+    if (name < HEADER_BEAM_CENTER_X || name > HEADER_WAVELENGTH)
+        THROW_EIGER_EXCEPTION(RESOURCE_NOT_FOUND, get_param_name(name));
     return _set_param(name, value);
 }
 
-std::shared_ptr<Requests::Param>
-Requests::set_param(PARAM_NAME name, const char *value)
+std::string Requests::_data_url(const std::string &filename) const
 {
-    return _set_param(name, value);
+    std::ostringstream url;
+    url << "http://" << m_address << '/' << CSTR_DATA << '/' << filename;
+    return url.str();
 }
 
 std::shared_ptr<Requests::Transfer>
@@ -378,29 +415,518 @@ Requests::start_transfer(const std::string &src_filename,
                          const std::string &dest_path,
                          bool delete_after_transfer)
 {
-    std::ostringstream url;
-    url << "http://" << m_address << '/' << CSTR_DATA << '/' << src_filename;
-
     std::shared_ptr<Transfer> transfer(new Transfer(*this,
-                                                    url.str(),
+                                                    _data_url(src_filename),
                                                     dest_path,
                                                     delete_after_transfer));
     m_loop.add_request(transfer);
     return move(transfer);
 }
 
+std::shared_ptr<CurlLoop::FutureRequest>
+Requests::start_segmented_transfer(const std::string &src_filename,
+                                   const std::string &target_path,
+                                   int nb_segments,
+                                   long segment_size,
+                                   bool delete_after_transfer)
+{
+    if (nb_segments <= 1)
+        return start_transfer(src_filename, target_path, delete_after_transfer);
+
+    return start_segmented_transfer(create_transfer_state(src_filename, target_path),
+                                    nb_segments, segment_size, delete_after_transfer);
+}
+
+std::shared_ptr<Requests::TransferState>
+Requests::create_transfer_state(const std::string &src_filename,
+                                const std::string &target_path)
+{
+    return std::shared_ptr<TransferState>(new TransferState(_data_url(src_filename), target_path));
+}
+
+std::shared_ptr<CurlLoop::FutureRequest>
+Requests::start_segmented_transfer(const std::shared_ptr<TransferState> &state,
+                                   int nb_segments,
+                                   long segment_size,
+                                   bool delete_after_transfer)
+{
+    // the file is opened and truncated here, the curl thread only
+    // lays out the segments once the size is known
+    std::shared_ptr<Sink> sink = _create_sink(state->m_target_path);
+    if (!state->m_started)
+    {
+        std::string error;
+        if (!sink->allocate(0, error))
+            THROW_EIGER_EXCEPTION(error.c_str(), state->m_target_path.c_str());
+    }
+
+    // resume, the file layout is already known
+    if (state->m_started || nb_segments <= 1)
+        return _start_segments(state, sink, state->m_file_size, nb_segments,
+                               segment_size, delete_after_transfer);
+
+    // get the file size first
+    std::shared_ptr<CurlLoop::FutureRequest> head(new CurlLoop::FutureRequest(state->m_url));
+    CURL *handle = head->get_handle();
+    curl_easy_setopt(handle, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1L);
+    head->set_priority(state->m_priority, state->m_order);
+    m_loop.add_request(head);
+
+    return head->then([=](CurlLoop::FutureRequest::Status status) {
+        if (status != CurlLoop::FutureRequest::OK)
+            return std::shared_ptr<CurlLoop::FutureRequest>();
+
+#if LIBCURL_VERSION_NUM >= 0x073700
+        curl_off_t content_length = -1;
+        curl_easy_getinfo(handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &content_length);
+#else
+        double content_length = -1;
+        curl_easy_getinfo(handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &content_length);
+#endif
+        return _start_segments(state, sink, long(content_length),
+                               nb_segments, segment_size, delete_after_transfer);
+    });
+}
+
+/*----------------------------------------------------------------------------
+			   Class FileSink
+----------------------------------------------------------------------------*/
+// alignment of the buffers, offsets and sizes for O_DIRECT
+static const size_t DIRECT_IO_ALIGN = 4 * 1024;
+
+class Requests::FileSink : public Requests::Sink
+{
+public:
+    FileSink(const std::string &path, size_t buffer_size, bool direct_io = false);
+    virtual ~FileSink();
+
+    virtual size_t get_buffer_size() const { return m_buffer_size; }
+    virtual char *get_buffer(const Ready &);
+    virtual void release_buffer(char *);
+    virtual bool write_buffer(char *buffer, size_t size, long offset, std::string &error);
+    virtual bool allocate(long size, std::string &error);
+    virtual bool sync(std::string &error, const Done &);
+
+protected:
+    char *_alloc_buffer();
+    bool _pwrite(const char *data, size_t size, long offset, std::string &error);
+    bool _fsync(std::string &error);
+    static std::string _error(const char *msg);
+
+    std::string m_path;
+    int m_fd;
+    int m_direct_fd; // -1 if O_DIRECT is not used
+    size_t m_buffer_size;
+    int m_nb_buffers;
+    std::vector<char *> m_free_buffers;
+    pthread_mutex_t m_lock;
+};
+
+Requests::FileSink::FileSink(const std::string &path,
+                             size_t buffer_size,
+                             bool direct_io) : m_path(path),
+                                               m_fd(-1),
+                                               m_direct_fd(-1),
+                                               m_buffer_size(buffer_size),
+                                               m_nb_buffers(0)
+{
+    m_fd = open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+    if (m_fd < 0)
+        THROW_EIGER_EXCEPTION(_error("Can't open destination file : ").c_str(), path.c_str());
+    // not all filesystems support it, then fallback to m_fd
+    if (direct_io)
+        m_direct_fd = open(path.c_str(), O_WRONLY | O_DIRECT);
+    pthread_mutex_init(&m_lock, NULL);
+}
+
+Requests::FileSink::~FileSink()
+{
+    for (std::vector<char *>::iterator i = m_free_buffers.begin(); i != m_free_buffers.end(); ++i)
+        free(*i);
+    if (m_direct_fd >= 0)
+        close(m_direct_fd);
+    close(m_fd);
+    pthread_mutex_destroy(&m_lock);
+}
+
+std::string Requests::FileSink::_error(const char *msg)
+{
+    char str_errno[1024];
+    std::string error = msg;
+    error += strerror_r(errno, str_errno, sizeof(str_errno));
+    return error;
+}
+
+char *Requests::FileSink::_alloc_buffer()
+{
+    void *buffer;
+    if (posix_memalign(&buffer, DIRECT_IO_ALIGN, m_buffer_size))
+        THROW_EIGER_EXCEPTION("Can't allocate write buffer memory", "");
+    ++m_nb_buffers;
+    return (char *)buffer;
+}
+
+char *Requests::FileSink::get_buffer(const Ready &)
+{
+    Lock alock(&m_lock);
+    if (m_free_buffers.empty())
+        return _alloc_buffer();
+    char *buffer = m_free_buffers.back();
+    m_free_buffers.pop_back();
+    return buffer;
+}
+
+void Requests::FileSink::release_buffer(char *buffer)
+{
+    Lock alock(&m_lock);
+    m_free_buffers.push_back(buffer);
+}
+
+bool Requests::FileSink::write_buffer(char *buffer, size_t size, long offset, std::string &error)
+{
+    bool ok = _pwrite(buffer, size, offset, error);
+    release_buffer(buffer);
+    return ok;
+}
+
+bool Requests::FileSink::sync(std::string &error, const Done &)
+{
+    return _fsync(error);
+}
+
+bool Requests::FileSink::allocate(long size, std::string &error)
+{
+    if (!ftruncate(m_fd, size))
+        return true;
+    error = _error("Can't allocate destination file: ");
+    return false;
+}
+
+bool Requests::FileSink::_pwrite(const char *data, size_t size, long offset, std::string &error)
+{
+    // only whole aligned blocks can be written directly, i.e: not the file tail
+    int fd = m_fd;
+    if (m_direct_fd >= 0 && !(size % DIRECT_IO_ALIGN) && !(offset % DIRECT_IO_ALIGN))
+        fd = m_direct_fd;
+
+    while (size > 0)
+    {
+        ssize_t written = pwrite(fd, data, size, offset);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            else if (errno == EINVAL && fd == m_direct_fd)
+            {
+                fd = m_fd;
+                continue;
+            }
+            error = _error("Can't write destination file: ");
+            return false;
+        }
+        data += written;
+        offset += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool Requests::FileSink::_fsync(std::string &error)
+{
+    // the direct writes share the inode, one flush covers both
+    while (fdatasync(m_fd))
+    {
+        if (errno == EINTR)
+            continue;
+        error = _error("Can't flush destination file: ");
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<Requests::Sink>
+Requests::create_file_sink(const std::string &path, size_t buffer_size)
+{
+    return std::shared_ptr<Sink>(new FileSink(path, buffer_size));
+}
+
+/*----------------------------------------------------------------------------
+			   Class AsyncFileSink
+----------------------------------------------------------------------------*/
+// The curl thread only fills the buffers, a writer thread does the
+// (possibly slow) filesystem writes and flushes. At most nb_buffers
+// are queued, beyond the transfers are paused until a buffer is written
+// i.e: the download is throttled without blocking the curl thread.
+class Requests::AsyncFileSink : public Requests::FileSink
+{
+public:
+    AsyncFileSink(const std::string &path, size_t buffer_size,
+                  int nb_buffers, bool direct_io);
+    virtual ~AsyncFileSink();
+
+    virtual char *get_buffer(const Ready &);
+    virtual void release_buffer(char *);
+    virtual bool write_buffer(char *buffer, size_t size, long offset, std::string &error);
+    virtual bool sync(std::string &error, const Done &);
+
+private:
+    struct _Write
+    {
+        char *buffer; // NULL for a sync
+        size_t size;
+        long offset;
+        Done done;
+    };
+    static void *_runFunc(void *);
+    void _run();
+    void _buffer_released(Lock &);
+
+    int m_max_buffers;
+    std::list<_Write> m_queue;
+    int m_nb_pending; // queued or being written
+    std::list<Ready> m_waiting;
+    std::string m_error;
+    bool m_quit;
+    pthread_cond_t m_cond;
+    pthread_t m_thread_id;
+};
+
+Requests::AsyncFileSink::AsyncFileSink(const std::string &path,
+                                       size_t buffer_size,
+                                       int nb_buffers,
+                                       bool direct_io) : FileSink(path, buffer_size, direct_io),
+                                                         m_max_buffers(nb_buffers),
+                                                         m_nb_pending(0),
+                                                         m_quit(false)
+{
+    pthread_cond_init(&m_cond, NULL);
+    if (pthread_create(&m_thread_id, NULL, _runFunc, this))
+    {
+        pthread_cond_destroy(&m_cond);
+        THROW_EIGER_EXCEPTION("Can't start writer thread", path.c_str());
+    }
+}
+
+Requests::AsyncFileSink::~AsyncFileSink()
+{
+    Lock alock(&m_lock);
+    // only the writes of canceled transfers may be left,
+    // they are not waited for
+    for (std::list<_Write>::iterator i = m_queue.begin(); i != m_queue.end(); ++i)
+        if (i->buffer)
+            m_free_buffers.push_back(i->buffer);
+    m_queue.clear();
+    m_quit = true;
+    pthread_cond_broadcast(&m_cond);
+    alock.unLock();
+
+    pthread_join(m_thread_id, NULL);
+    pthread_cond_destroy(&m_cond);
+}
+
+char *Requests::AsyncFileSink::get_buffer(const Ready &ready)
+{
+    Lock alock(&m_lock);
+    if (!m_free_buffers.empty())
+    {
+        char *buffer = m_free_buffers.back();
+        m_free_buffers.pop_back();
+        return buffer;
+    }
+    // a buffer held by the caller (segment) can't be waited for
+    if (m_nb_buffers < m_max_buffers || !m_nb_pending)
+        return _alloc_buffer();
+    m_waiting.push_back(ready);
+    return NULL;
+}
+
+void Requests::AsyncFileSink::release_buffer(char *buffer)
+{
+    Lock alock(&m_lock);
+    m_free_buffers.push_back(buffer);
+    _buffer_released(alock);
+}
+
+// the waiting callers try again, called locked
+void Requests::AsyncFileSink::_buffer_released(Lock &alock)
+{
+    if (m_waiting.empty())
+        return;
+    std::list<Ready> waiting;
+    waiting.swap(m_waiting);
+    alock.unLock();
+    for (std::list<Ready>::iterator i = waiting.begin(); i != waiting.end(); ++i)
+        (*i)();
+    alock.lock();
+}
+
+bool Requests::AsyncFileSink::write_buffer(char *buffer, size_t size, long offset, std::string &error)
+{
+    Lock alock(&m_lock);
+    if (!m_error.empty())
+    {
+        error = m_error;
+        m_free_buffers.push_back(buffer);
+        _buffer_released(alock);
+        return false;
+    }
+    _Write write = {buffer, size, offset, Done()};
+    m_queue.push_back(write);
+    ++m_nb_pending;
+    pthread_cond_broadcast(&m_cond);
+    return true;
+}
+
+bool Requests::AsyncFileSink::sync(std::string &error, const Done &done)
+{
+    Lock alock(&m_lock);
+    if (!m_error.empty())
+    {
+        error = m_error;
+        return true;
+    }
+    // done once the writes queued before are flushed
+    _Write sync = {NULL, 0, 0, done};
+    m_queue.push_back(sync);
+    ++m_nb_pending;
+    pthread_cond_broadcast(&m_cond);
+    return false;
+}
+
+void *Requests::AsyncFileSink::_runFunc(void *sinkPt)
+{
+    ((AsyncFileSink *)sinkPt)->_run();
+    return NULL;
+}
+
+void Requests::AsyncFileSink::_run()
+{
+    Lock alock(&m_lock);
+    while (1)
+    {
+        while (m_queue.empty() && !m_quit)
+            pthread_cond_wait(&m_cond, &m_lock);
+        if (m_queue.empty())
+            break;
+
+        _Write write = m_queue.front();
+        m_queue.pop_front();
+        // after an error, the remaining writes are dropped
+        bool failed = !m_error.empty();
+        std::string error = m_error;
+        alock.unLock();
+
+        if (!failed)
+            failed = write.buffer ? !_pwrite(write.buffer, write.size, write.offset, error) : !_fsync(error);
+
+        alock.lock();
+        if (failed && m_error.empty())
+            m_error = error;
+        --m_nb_pending;
+        if (write.buffer)
+        {
+            m_free_buffers.push_back(write.buffer);
+            _buffer_released(alock);
+        }
+        else
+        {
+            alock.unLock();
+            write.done(error);
+            alock.lock();
+        }
+    }
+}
+
+Requests::SinkFactory
+Requests::async_file_sink_factory(size_t buffer_size, int nb_buffers, bool direct_io)
+{
+    // direct writes need block aligned offsets and sizes
+    buffer_size = (buffer_size + DIRECT_IO_ALIGN - 1) & ~(DIRECT_IO_ALIGN - 1);
+    nb_buffers = std::max(nb_buffers, 1);
+    return [=](const std::string &path) {
+        return std::shared_ptr<Sink>(new AsyncFileSink(path, buffer_size, nb_buffers, direct_io));
+    };
+}
+
+std::shared_ptr<CurlLoop::FutureRequest>
+Requests::_start_segments(const std::shared_ptr<TransferState> &state,
+                          const std::shared_ptr<Sink> &sink,
+                          long file_size,
+                          int nb_segments,
+                          long segment_size,
+                          bool delete_after_transfer)
+{
+    if (!state->m_started)
+    {
+        // the file is empty, segments extend it at their offset
+        state->m_file_size = file_size;
+        state->m_missing.clear();
+        // unknown or small size, download in one go
+        if (nb_segments <= 1 || file_size < 2 * segment_size)
+        {
+            TransferState::Range whole = {0, -1};
+            state->m_missing.push_back(whole);
+        }
+        else
+        {
+            // segments start on a buffer boundary so that only the file tail
+            // may be an unaligned write
+            long buffer_size = sink->get_buffer_size();
+            long nb = std::min(long(nb_segments), (file_size + segment_size - 1) / segment_size);
+            long size = (file_size + nb - 1) / nb;
+            size = (size + buffer_size - 1) / buffer_size * buffer_size;
+            for (long offset = 0; offset < file_size; offset += size)
+            {
+                TransferState::Range segment = {offset, std::min(offset + size, file_size)};
+                state->m_missing.push_back(segment);
+            }
+        }
+        state->m_started = true;
+    }
+
+    CurlLoop::FutureRequest::List segments;
+    for (size_t i = 0; i < state->m_missing.size(); ++i)
+    {
+        const TransferState::Range &range = state->m_missing[i];
+        if (range.end >= 0 && range.begin >= range.end) // already written
+            continue;
+        std::shared_ptr<Transfer> segment(new Transfer(*this, sink, state, i));
+        m_loop.add_request(segment);
+        segments.push_back(segment);
+    }
+
+    return CurlLoop::FutureRequest::when_all(segments)->then([=](CurlLoop::FutureRequest::Status status) {
+        if (status != CurlLoop::FutureRequest::OK)
+            return std::shared_ptr<CurlLoop::FutureRequest>();
+
+        // all ranges are complete, they must end at the advertised size;
+        // checked on the state, no filesystem access from the curl thread
+        long end = 0;
+        for (size_t i = 0; i < state->m_missing.size(); ++i)
+            end = std::max(end, state->m_missing[i].end);
+        if (state->m_file_size >= 0 && end != state->m_file_size)
+        {
+            state->m_started = false; // download it again
+            THROW_EIGER_EXCEPTION("Downloaded file has not the expected size",
+                                  state->m_target_path.c_str());
+        }
+        if (delete_after_transfer)
+            delete_file(state->m_url, true);
+        return std::shared_ptr<CurlLoop::FutureRequest>();
+    });
+}
+
 std::shared_ptr<CurlLoop::FutureRequest>
 Requests::delete_file(const std::string &filename, bool full_url)
 {
-    std::ostringstream url;
-    if (!full_url)
-        url << "http://" << m_address << '/' << CSTR_DATA << '/' << filename;
-    else
-        url << filename;
+    std::string url = full_url ? filename : _data_url(filename);
 
-    std::shared_ptr<CurlLoop::FutureRequest> delete_req(new CurlLoop::FutureRequest(url.str()));
+    std::shared_ptr<CurlLoop::FutureRequest> delete_req(new CurlLoop::FutureRequest(url));
     CURL *handle = delete_req->get_handle();
     curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, "DELETE");
+    // batched after the transfers
+    delete_req->set_priority(CurlLoop::FutureRequest::CLEANUP);
     m_loop.add_request(delete_req);
     return move(delete_req);
 }
@@ -429,21 +955,254 @@ void Requests::Command::_fill_request()
 size_t Requests::Command::_write_callback(char *ptr, size_t size,
                                           size_t nmemb, Requests::Command *cmd)
 {
-    int size_to_copy = std::min(size * nmemb, sizeof(m_data));
+    int size_to_copy = std::min(size * nmemb, sizeof(m_data) - 1);
     memcpy(cmd->m_data, ptr, size_to_copy);
     cmd->m_data[size_to_copy] = '\0';
     return size_to_copy;
 }
 
+/*----------------------------------------------------------------------------
+			   Json decoding
+----------------------------------------------------------------------------*/
+// Minimal single-pass json decoder for the detector replies.
+// Only the wanted fields of the top-level object are extracted,
+// strings are unescaped in place so tokens point into the reply buffer.
+struct JsonCursor
+{
+    JsonCursor(char *begin, char *end) : pos(begin), end(end) {}
+
+    void skip_spaces()
+    {
+        while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\n' || *pos == '\r'))
+            ++pos;
+    }
+    bool next_is(char c)
+    {
+        skip_spaces();
+        if (pos < end && *pos == c)
+        {
+            ++pos;
+            return true;
+        }
+        return false;
+    }
+
+    char *pos;
+    char *end;
+};
+
+static void _write_utf8(char *&dst, unsigned code)
+{
+    if (code < 0x80)
+        *dst++ = char(code);
+    else if (code < 0x800)
+    {
+        *dst++ = char(0xc0 | (code >> 6));
+        *dst++ = char(0x80 | (code & 0x3f));
+    }
+    else
+    {
+        *dst++ = char(0xe0 | (code >> 12));
+        *dst++ = char(0x80 | ((code >> 6) & 0x3f));
+        *dst++ = char(0x80 | (code & 0x3f));
+    }
+}
+
+// cursor on the opening quote
+template <class Token>
+static bool _decode_string(JsonCursor &cursor, Token &token)
+{
+    char *src = ++cursor.pos;
+    char *dst = src;
+    token.begin = dst;
+    while (src < cursor.end && *src != '"')
+    {
+        if (*src != '\\')
+        {
+            *dst++ = *src++;
+            continue;
+        }
+        if (++src == cursor.end)
+            return false;
+        switch (*src++)
+        {
+        case '"':
+            *dst++ = '"';
+            break;
+        case '\\':
+            *dst++ = '\\';
+            break;
+        case '/':
+            *dst++ = '/';
+            break;
+        case 'b':
+            *dst++ = '\b';
+            break;
+        case 'f':
+            *dst++ = '\f';
+            break;
+        case 'n':
+            *dst++ = '\n';
+            break;
+        case 'r':
+            *dst++ = '\r';
+            break;
+        case 't':
+            *dst++ = '\t';
+            break;
+        case 'u':
+        {
+            if (cursor.end - src < 4)
+                return false;
+            char hex[5] = {src[0], src[1], src[2], src[3], '\0'};
+            char *hex_end;
+            unsigned code = strtoul(hex, &hex_end, 16);
+            if (hex_end != hex + 4)
+                return false;
+            _write_utf8(dst, code);
+            src += 4;
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    if (src == cursor.end)
+        return false;
+    token.type = Token::STRING;
+    token.size = dst - token.begin;
+    cursor.pos = src + 1;
+    return true;
+}
+
+// skip a nested array or object, cursor on the opening bracket
+static bool _skip_container(JsonCursor &cursor)
+{
+    int depth = 0;
+    bool in_string = false;
+    for (; cursor.pos < cursor.end; ++cursor.pos)
+    {
+        char c = *cursor.pos;
+        if (in_string)
+        {
+            if (c == '\\')
+                ++cursor.pos;
+            else if (c == '"')
+                in_string = false;
+        }
+        else if (c == '"')
+            in_string = true;
+        else if (c == '[' || c == '{')
+            ++depth;
+        else if ((c == ']' || c == '}') && !--depth)
+        {
+            ++cursor.pos;
+            return true;
+        }
+    }
+    return false;
+}
+
+template <class Token>
+static bool _decode_value(JsonCursor &cursor, Token &token)
+{
+    cursor.skip_spaces();
+    if (cursor.pos == cursor.end)
+        return false;
+
+    char *begin = cursor.pos;
+    switch (*begin)
+    {
+    case '"':
+        return _decode_string(cursor, token);
+    case '[':
+    case '{':
+        token.type = *begin == '[' ? Token::ARRAY : Token::OBJECT;
+        if (!_skip_container(cursor))
+            return false;
+        break;
+    default:
+        while (cursor.pos < cursor.end && *cursor.pos != ',' &&
+               *cursor.pos != '}' && *cursor.pos != ']' &&
+               *cursor.pos != ' ' && *cursor.pos != '\n' &&
+               *cursor.pos != '\r' && *cursor.pos != '\t')
+            ++cursor.pos;
+        if (cursor.pos == begin)
+            return false;
+        if (*begin == 't' || *begin == 'f')
+            token.type = Token::BOOL;
+        else if (*begin == 'n')
+            token.type = Token::NUL;
+        else
+            token.type = Token::NUMBER;
+        break;
+    }
+    token.begin = begin;
+    token.size = cursor.pos - begin;
+    return true;
+}
+
+// extract the wanted keys of the top-level object
+template <class Token>
+static bool _decode_object(char *begin, char *end,
+                           const char *const keys[], Token tokens[], int nb_keys)
+{
+    JsonCursor cursor(begin, end);
+    if (!cursor.next_is('{'))
+        return false;
+    if (cursor.next_is('}'))
+        return true;
+    do
+    {
+        cursor.skip_spaces();
+        Token key;
+        if (cursor.pos == cursor.end || *cursor.pos != '"' ||
+            !_decode_string(cursor, key) || !cursor.next_is(':'))
+            return false;
+
+        Token value;
+        if (!_decode_value(cursor, value))
+            return false;
+        for (int i = 0; i < nb_keys; ++i)
+        {
+            if (int(strlen(keys[i])) == key.size &&
+                !memcmp(keys[i], key.begin, key.size))
+            {
+                tokens[i] = value;
+                break;
+            }
+        }
+    } while (cursor.next_is(','));
+    return cursor.next_is('}');
+}
+
+// parse a number token, it's not null-terminated into the reply buffer
+template <class Token>
+static bool _number(const Token &token, double &value, bool &integral)
+{
+    char buffer[64];
+    if (token.type != Token::NUMBER || token.size >= int(sizeof(buffer)))
+        return false;
+    memcpy(buffer, token.begin, token.size);
+    buffer[token.size] = '\0';
+    char *end;
+    value = strtod(buffer, &end);
+    integral = !strpbrk(buffer, ".eE");
+    return end == buffer + token.size;
+}
+
 int Requests::Command::get_serie_id()
 {
-    Json::Value root;
-    Json::Reader reader;
-    if (!reader.parse(m_data, root))
+    static const char *const keys[] = {"sequence id"};
+    JsonToken sequence_id;
+    double value;
+    bool integral;
+    if (!_decode_object(m_data, m_data + strlen(m_data), keys, &sequence_id, 1))
         THROW_EIGER_EXCEPTION(eigerapi::JSON_PARSE_FAILED, "");
 
-    int seq_id = root.get("sequence id", -1).asInt();
-    return seq_id;
+    if (!_number(sequence_id, value, integral) || !integral)
+        return -1;
+    return int(value);
 }
 //Class Param
 
@@ -452,7 +1211,10 @@ Requests::Param::Param(const std::string &url) : CurlLoop::FutureRequest(url),
                                                  m_data_size(0),
                                                  m_data_memorysize(0),
                                                  m_headers(NULL),
-                                                 m_return_value(NULL)
+                                                 m_return_converter(NULL),
+                                                 m_return_value(NULL),
+                                                 m_decoded(false),
+                                                 m_is_array(false)
 {
 }
 
@@ -465,89 +1227,79 @@ Requests::Param::~Param()
         curl_slist_free_all(m_headers);
 }
 
-Requests::Param::Value Requests::Param::_get(double timeout, bool lock,
-                                             const char *param_name)
+// Decode the reply once, the result is cached for all the getters
+void Requests::Param::_decode()
 {
-    wait(timeout, lock);
+    if (m_decoded)
+        return;
+
     //check rx data
     if (!m_data_buffer)
         THROW_EIGER_EXCEPTION("No data received", "");
 
-    if (m_data_size == m_data_memorysize) // need to add an extra char
-    {
-        int alloc_size = (m_data_memorysize + 1024) & ~1023;
-        m_data_buffer = (char *)realloc(m_data_buffer, alloc_size);
-        m_data_memorysize = alloc_size;
-    }
-
-    m_data_buffer[m_data_size] = '\0'; // string ending
-
-    //- Json decoding to return the wanted data
-    Json::Value root;
-    Json::Reader reader;
-
-    if (!reader.parse(m_data_buffer, root))
-        THROW_EIGER_EXCEPTION(eigerapi::JSON_PARSE_FAILED, "");
-    Value value;
-    if (root.isArray())
+    char *begin = m_data_buffer;
+    char *end = m_data_buffer + m_data_size;
+    JsonCursor cursor(begin, end);
+    if (cursor.next_is('[')) // string list (i.e: filewriter files)
     {
-        value.type = Requests::Param::STRING_ARRAY;
-        int array_size = root.size();
-        for (int i = 0; i < array_size; ++i)
-            value.string_array.push_back(root[i].asString());
+        m_is_array = true;
+        if (!cursor.next_is(']'))
+        {
+            do
+            {
+                cursor.skip_spaces();
+                JsonToken token;
+                if (cursor.pos == end || *cursor.pos != '"' ||
+                    !_decode_string(cursor, token))
+                    THROW_EIGER_EXCEPTION(eigerapi::JSON_PARSE_FAILED, "");
+                StringRef ref = {token.begin, token.size};
+                m_string_list.push_back(ref);
+            } while (cursor.next_is(','));
+
+            if (!cursor.next_is(']'))
+                THROW_EIGER_EXCEPTION(eigerapi::JSON_PARSE_FAILED, "");
+        }
     }
     else
     {
-        //- supported types by dectris are:
-        //- bool, float, int, string or a list of float or int
-        std::string json_type = root.get("value_type", "dummy").asString();
-        if (json_type == "bool")
-        {
-            value.type = Requests::Param::BOOL;
-            value.data.bool_val = root.get(param_name, "no_value").asBool();
-        }
-        else if (json_type == "float")
-        {
-            //- asFloat is not supported by jsoncpp
-            value.type = Requests::Param::DOUBLE;
-            value.data.double_val = root.get(param_name, -1.0).asDouble();
-        }
-        else if (json_type == "int")
-        {
-            value.type = Requests::Param::INT;
-            value.data.int_val = root.get(param_name, -1).asInt();
-        }
-        else if (json_type == "uint")
-        {
-            value.type = Requests::Param::UNSIGNED;
-            value.data.unsigned_val = (int)root.get(param_name, -1).asInt();
-        }
-        else if (json_type == "string")
-        {
-            value.type = Requests::Param::STRING;
-            value.string_val = root.get(param_name, "no_value").asString();
-        }
-        else
-        {
-            THROW_EIGER_EXCEPTION(eigerapi::DATA_TYPE_NOT_HANDLED, json_type.c_str());
-        }
+        static const char *const keys[NB_FIELDS] = {"value", "min", "max"};
+        if (!_decode_object(begin, end, keys, m_fields, NB_FIELDS))
+            THROW_EIGER_EXCEPTION(eigerapi::JSON_PARSE_FAILED, "");
     }
-    return value;
+    m_decoded = true;
 }
 
-Requests::Param::Value Requests::Param::get(double timeout, bool lock)
+double Requests::Param::_get_limit(double timeout, bool lock, FIELD field)
 {
-    return _get(timeout, lock, "value");
+    wait(timeout, lock);
+
+    Lock alock(&m_lock, lock);
+    _decode();
+    double number;
+    bool integral;
+    return !m_is_array && _number(m_fields[field], number, integral) ? number : -1.;
 }
 
-Requests::Param::Value Requests::Param::get_min(double timeout, bool lock)
+double Requests::Param::get_min(double timeout, bool lock)
 {
-    return _get(timeout, lock, "min");
+    return _get_limit(timeout, lock, MIN_FIELD);
 }
 
-Requests::Param::Value Requests::Param::get_max(double timeout, bool lock)
+double Requests::Param::get_max(double timeout, bool lock)
 {
-    return _get(timeout, lock, "max");
+    return _get_limit(timeout, lock, MAX_FIELD);
+}
+
+const Requests::Param::StringList &
+Requests::Param::get_string_list(double timeout, bool lock)
+{
+    wait(timeout, lock);
+
+    Lock alock(&m_lock, lock);
+    _decode();
+    if (!m_is_array)
+        THROW_EIGER_EXCEPTION(eigerapi::DATA_TYPE_NOT_HANDLED, "not a list");
+    return m_string_list;
 }
 
 void Requests::Param::_fill_get_request()
@@ -579,146 +1331,111 @@ void Requests::Param::_fill_set_request(const T &value)
     curl_easy_setopt(m_handle, CURLOPT_WRITEDATA, this);
 }
 
-void Requests::Param::_set_return_value(bool &ret_value)
+// Conversion of the received value into the requested type
+template <>
+bool Requests::Param::_convert<bool>(Param &param, void *ret_value)
 {
-    m_return_value = &ret_value;
-    m_return_type = BOOL;
+    const JsonToken &token = param.m_fields[VALUE_FIELD];
+    double number;
+    bool integral;
+    if (token.type == JsonToken::BOOL)
+        *(bool *)ret_value = *token.begin == 't';
+    else if (_number(token, number, integral) && integral)
+        *(bool *)ret_value = number != 0.;
+    else
+        return false;
+    return true;
 }
-void Requests::Param::_set_return_value(double &ret_value)
+
+template <>
+bool Requests::Param::_convert<double>(Param &param, void *ret_value)
 {
-    m_return_value = &ret_value;
-    m_return_type = DOUBLE;
+    bool integral;
+    return _number(param.m_fields[VALUE_FIELD], *(double *)ret_value, integral);
 }
-void Requests::Param::_set_return_value(int &ret_value)
+
+template <>
+bool Requests::Param::_convert<int>(Param &param, void *ret_value)
 {
-    m_return_value = &ret_value;
-    m_return_type = INT;
+    double number;
+    bool integral;
+    if (!_number(param.m_fields[VALUE_FIELD], number, integral) || !integral ||
+        number < std::numeric_limits<int>::min() || number > std::numeric_limits<int>::max())
+        return false;
+    *(int *)ret_value = int(number);
+    return true;
 }
-void Requests::Param::_set_return_value(unsigned int &ret_value)
+
+template <>
+bool Requests::Param::_convert<unsigned int>(Param &param, void *ret_value)
 {
-    m_return_value = &ret_value;
-    m_return_type = UNSIGNED;
+    double number;
+    bool integral;
+    if (!_number(param.m_fields[VALUE_FIELD], number, integral) || !integral ||
+        number < 0. || number > std::numeric_limits<unsigned int>::max())
+        return false;
+    *(unsigned int *)ret_value = (unsigned int)number;
+    return true;
 }
-void Requests::Param::_set_return_value(std::string &ret_value)
+
+template <>
+bool Requests::Param::_convert<std::string>(Param &param, void *ret_value)
+{
+    const JsonToken &token = param.m_fields[VALUE_FIELD];
+    if (token.type != JsonToken::STRING)
+        return false;
+    ((std::string *)ret_value)->assign(token.begin, token.size);
+    return true;
+}
+
+template <>
+bool Requests::Param::_convert<std::vector<std::string>>(Param &param, void *ret_value)
+{
+    if (!param.m_is_array)
+        return false;
+    std::vector<std::string> &string_array = *(std::vector<std::string> *)ret_value;
+    string_array.resize(param.m_string_list.size());
+    for (size_t i = 0; i < string_array.size(); ++i)
+        string_array[i] = param.m_string_list[i].str();
+    return true;
+}
+
+template <class T>
+void Requests::Param::_set_return_value(T &ret_value)
 {
     m_return_value = &ret_value;
-    m_return_type = STRING;
+    m_return_converter = _convert<T>;
 }
 
+template void Requests::Param::_set_return_value(bool &);
+template void Requests::Param::_set_return_value(double &);
+template void Requests::Param::_set_return_value(int &);
+template void Requests::Param::_set_return_value(unsigned int &);
+template void Requests::Param::_set_return_value(std::string &);
+template void Requests::Param::_set_return_value(std::vector<std::string> &);
+
 void Requests::Param::_request_finished()
 {
-    if (m_status == CANCEL)
+    if (m_status == CANCEL || m_status == ERROR)
         return;
 
     std::string error_string;
     if (m_return_value)
     {
-        Value value;
         try
         {
-            value = get(0, false);
+            _decode();
+            if (!m_return_converter(*this, m_return_value))
+                error_string = "Rx value has not the expected type";
         }
         catch (EigerException &e)
         {
             error_string = e.what();
-            goto error;
-        }
-
-        switch (m_return_type)
-        {
-        case BOOL:
-        {
-            bool *retrun_val = (bool *)m_return_value;
-            switch (value.type)
-            {
-            case BOOL:
-                *retrun_val = value.data.bool_val;
-                break;
-            case INT:
-                *retrun_val = value.data.int_val;
-                break;
-            case UNSIGNED:
-                *retrun_val = value.data.unsigned_val;
-                break;
-            default:
-                error_string = "Rx value is not a bool";
-                goto error;
-            }
-            break;
-        }
-        case DOUBLE:
-        {
-            double *retrun_val = (double *)m_return_value;
-            switch (value.type)
-            {
-            case INT:
-                *retrun_val = value.data.int_val;
-                break;
-            case UNSIGNED:
-                *retrun_val = value.data.unsigned_val;
-                break;
-            case DOUBLE:
-                *retrun_val = value.data.double_val;
-                break;
-            default:
-                error_string = "Rx value is not a double";
-                goto error;
-            }
-            break;
-        }
-        case INT:
-        {
-            int *retrun_val = (int *)m_return_value;
-            switch (value.type)
-            {
-            case INT:
-                *retrun_val = value.data.int_val;
-                break;
-            default:
-                error_string = "Rx value is not a integer";
-                goto error;
-            }
-            break;
-        }
-        case UNSIGNED:
-        {
-            unsigned int *retrun_val = (unsigned int *)m_return_value;
-            switch (value.type)
-            {
-            case INT:
-                *retrun_val = value.data.int_val;
-                break;
-            case UNSIGNED:
-                *retrun_val = value.data.unsigned_val;
-                break;
-            default:
-                error_string = "Rx value is not a unsigned integer";
-                goto error;
-            }
-            break;
-        }
-        case STRING:
-        {
-            std::string *retrun_val = (std::string *)m_return_value;
-            switch (value.type)
-            {
-            case STRING:
-                *retrun_val = value.string_val;
-                break;
-            default:
-                error_string = "Rx value is not a string";
-                goto error;
-            }
-            break;
-        }
-        default:
-            error_string = "Value type not yet managed";
-            goto error;
         }
     }
-    return;
+    if (error_string.empty())
+        return;
 
-error:
     if (m_error_code.empty())
         m_error_code = error_string + "(" + m_url + ")";
     else
@@ -752,6 +1469,16 @@ size_t Requests::Param::_write_callback(char *ptr, size_t size,
 /*----------------------------------------------------------------------------
 			   Class Transfer
 ----------------------------------------------------------------------------*/
+Requests::TransferState::TransferState(const std::string &url,
+                                       const std::string &target_path) : m_url(url),
+                                                                         m_target_path(target_path),
+                                                                         m_file_size(-1),
+                                                                         m_started(false),
+                                                                         m_priority(CurlLoop::FutureRequest::DATA_FILE),
+                                                                         m_order(0)
+{
+}
+
 Requests::Transfer::Transfer(Requests &requests,
                              const std::string &url,
                              const std::string &target_path,
@@ -759,52 +1486,222 @@ Requests::Transfer::Transfer(Requests &requests,
                              int buffer_write_size) : CurlLoop::FutureRequest(url),
                                                       m_requests(requests),
                                                       m_delete_after_transfer(delete_after_transfer),
-                                                      m_download_size(0)
+                                                      m_download_size(0),
+                                                      m_sink(requests._create_sink(target_path, buffer_write_size)),
+                                                      m_range_index(-1),
+                                                      m_ranged(false),
+                                                      m_range_begin(0),
+                                                      m_offset(0),
+                                                      m_segment_size(-1)
 {
-    if (posix_memalign(&m_buffer, 4 * 1024, buffer_write_size))
-        THROW_EIGER_EXCEPTION("Can't allocate write buffer memory", "");
-    m_target_file = fopen(target_path.c_str(), "w+");
-    if (!m_target_file)
+    std::string error;
+    if (!m_sink->allocate(0, error))
+        THROW_EIGER_EXCEPTION(error.c_str(), target_path.c_str());
+    _init();
+    set_priority(DATA_FILE);
+}
+
+Requests::Transfer::Transfer(Requests &requests,
+                             const std::shared_ptr<Sink> &sink,
+                             const std::shared_ptr<TransferState> &state,
+                             int range_index) : CurlLoop::FutureRequest(state->m_url),
+                                                m_requests(requests),
+                                                m_delete_after_transfer(false),
+                                                m_download_size(0),
+                                                m_sink(sink),
+                                                m_state(state),
+                                                m_range_index(range_index)
+{
+    const TransferState::Range &range = state->m_missing[range_index];
+    m_range_begin = m_offset = range.begin;
+    m_segment_size = range.end >= 0 ? range.end - range.begin : -1;
+    m_ranged = range.begin > 0 || range.end >= 0;
+
+    _init();
+    set_priority(state->m_priority, state->m_order);
+    if (m_ranged)
     {
-        char str_errno[1024];
-        strerror_r(errno, str_errno, sizeof(str_errno));
-        char error_buffer[1024];
-        snprintf(error_buffer, sizeof(error_buffer), "Can't open destination file : %s", str_errno);
-        THROW_EIGER_EXCEPTION(error_buffer, "");
+        char range_str[64];
+        if (range.end >= 0)
+            snprintf(range_str, sizeof(range_str), "%ld-%ld", range.begin, range.end - 1);
+        else
+            snprintf(range_str, sizeof(range_str), "%ld-", range.begin);
+        curl_easy_setopt(m_handle, CURLOPT_RANGE, range_str);
     }
-    setbuffer(m_target_file, (char *)m_buffer, buffer_write_size);
-    if (!m_target_file)
-        THROW_EIGER_EXCEPTION("Can't open target file", target_path.c_str());
+}
 
+void Requests::Transfer::_init()
+{
+    // the buffer is taken from the sink on the first received data
+    m_buffer = NULL;
+    m_buffer_size = m_sink->get_buffer_size();
+    m_buffer_used = 0;
+    m_consumed = 0;
+    m_result = FutureRequest::RUNNING;
+
+    curl_easy_setopt(m_handle, CURLOPT_FAILONERROR, 1L);
     curl_easy_setopt(m_handle, CURLOPT_WRITEFUNCTION, _write);
     curl_easy_setopt(m_handle, CURLOPT_WRITEDATA, this);
 }
 
 Requests::Transfer::~Transfer()
 {
-    if (m_target_file)
-        fclose(m_target_file);
-    free(m_buffer);
+    if (m_buffer)
+        m_sink->release_buffer(m_buffer);
 }
 
-size_t
-Requests::Transfer::_write(void *ptr, size_t size,  size_t nmemb, Requests::Transfer *transfer)
+// hand the buffered data over to the sink
+bool Requests::Transfer::_flush()
 {
+    if (!m_buffer)
+        return true;
+
+    char *buffer = m_buffer;
+    size_t size = m_buffer_used;
+    m_buffer = NULL;
+    m_buffer_used = 0;
+    if (!size)
+    {
+        m_sink->release_buffer(buffer);
+        return true;
+    }
+    long offset = m_offset;
+    m_offset += size;
+    return m_sink->write_buffer(buffer, size, offset, m_write_error);
+}
 
-    FILE *stream = transfer->m_target_file;
-    size_t write_size = fwrite(ptr, size, nmemb, stream);
+size_t
+Requests::Transfer::_write(void *ptr, size_t size, size_t nmemb, Requests::Transfer *transfer)
+{
+    size_t total_size = size * nmemb;
+    // after a pause, curl delivers again the data taken before it
+    size_t skip = std::min(transfer->m_consumed, total_size);
+    transfer->m_consumed -= skip;
+    size_t new_size = total_size - skip;
+    if (transfer->m_ranged)
+    {
+        // the server must honor the range, not send the whole file
+        long response_code = 0;
+        curl_easy_getinfo(transfer->m_handle, CURLINFO_RESPONSE_CODE, &response_code);
+        if (response_code != 206 ||
+            (transfer->m_segment_size >= 0 &&
+             transfer->m_download_size + long(new_size) > transfer->m_segment_size))
+        {
+            transfer->m_write_error = "Range request not honored by the server";
+            return 0;
+        }
+    }
 
-    Lock lock(&transfer->m_lock);
-    if (write_size > 0)
-        transfer->m_download_size += size * nmemb;
+    char *data = (char *)ptr + skip;
+    size_t remaining = new_size;
+    while (remaining)
+    {
+        if (!transfer->m_buffer)
+        {
+            std::weak_ptr<FutureRequest> weak = transfer->shared_from_this();
+            CurlLoop *loop = transfer->m_loop;
+            transfer->m_buffer = transfer->m_sink->get_buffer([weak, loop]() { loop->resume_request(weak); });
+            if (!transfer->m_buffer)
+            {
+                // all the sink buffers are being written, resumed once one is free
+                transfer->m_consumed = total_size - remaining;
+                transfer->m_download_size += new_size - remaining;
+                return CURL_WRITEFUNC_PAUSE;
+            }
+        }
+        size_t copy_size = std::min(remaining, transfer->m_buffer_size - transfer->m_buffer_used);
+        memcpy(transfer->m_buffer + transfer->m_buffer_used, data, copy_size);
+        transfer->m_buffer_used += copy_size;
+        data += copy_size;
+        remaining -= copy_size;
+        if (transfer->m_buffer_used == transfer->m_buffer_size && !transfer->_flush())
+            return 0;
+    }
 
-    return write_size;
+    transfer->m_download_size += new_size;
+    return total_size;
 }
 
 void Requests::Transfer::_request_finished()
 {
-    fclose(m_target_file);
-    m_target_file = NULL;
+    if (_flush() && m_write_error.empty() && m_status != FutureRequest::CANCEL)
+    {
+        // the data must be on disk before reporting OK, the flush
+        // is done by the sink without blocking the curl thread
+        Transfer *transfer = this;
+        std::weak_ptr<FutureRequest> weak = shared_from_this();
+        CurlLoop *loop = m_loop;
+        bool synced = m_sink->sync(m_write_error, [transfer, weak, loop](const std::string &error) {
+            // kept alive by m_self until finished
+            transfer->m_write_error = error;
+            loop->finish_request(weak);
+        });
+        if (!synced)
+        {
+            m_result = m_status;
+            m_status = FutureRequest::RUNNING;
+            m_self = shared_from_this();
+            m_finish_deferred = true;
+            return;
+        }
+    }
+    _finish();
+}
+
+void Requests::Transfer::_deferred_finished()
+{
+    std::shared_ptr<FutureRequest> self;
+    self.swap(m_self); // released by the caller
+    if (m_status != FutureRequest::CANCEL)
+        m_status = m_result;
+    _finish();
+}
+
+void Requests::Transfer::_finish()
+{
+    m_sink.reset();
+    if (m_status == FutureRequest::CANCEL)
+        return;
+
+    // a connection closed early must not look like a complete file
+#if LIBCURL_VERSION_NUM >= 0x073700
+    curl_off_t content_length = -1;
+    curl_easy_getinfo(m_handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &content_length);
+#else
+    double content_length = -1;
+    curl_easy_getinfo(m_handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &content_length);
+#endif
+    if (!m_write_error.empty())
+    {
+        m_status = FutureRequest::ERROR;
+        m_error_code = m_write_error + " (" + m_url + ")";
+    }
+    else if (m_status == FutureRequest::OK &&
+             ((m_segment_size >= 0 && m_download_size != m_segment_size) ||
+              (content_length >= 0 && m_download_size != long(content_length))))
+    {
+        m_status = FutureRequest::ERROR;
+        m_error_code = "Incomplete transfer (" + m_url + ")";
+    }
+
+    if (m_state)
+    {
+        TransferState::Range &range = m_state->m_missing[m_range_index];
+        // the whole file or its tail was requested, i.e: without a HEAD
+        if (range.end < 0 && m_state->m_file_size < 0 && content_length >= 0)
+            m_state->m_file_size = m_range_begin + long(content_length);
+        if (m_status == FutureRequest::OK)
+        {
+            if (range.end < 0 && m_state->m_file_size < 0)
+                m_state->m_file_size = m_offset;
+            range.begin = range.end = m_offset;
+        }
+        else if (!m_write_error.empty()) // what reached the disk is unknown
+            range.begin = m_range_begin;
+        else // the sync succeeded, a resumed download starts after the written data
+            range.begin = m_offset;
+    }
+
     // start new request to delete the file
     if (m_status == FutureRequest::OK &&
         m_delete_after_transfer)
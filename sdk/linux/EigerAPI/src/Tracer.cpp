@@ -0,0 +1,194 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2015
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include "eigerapi/Tracer.h"
+#include "eigerapi/EigerDefines.h"
+
+using namespace eigerapi;
+
+static int _thread_id()
+{
+    static thread_local int tid = int(syscall(SYS_gettid));
+    return tid;
+}
+
+static void _json_string(std::ostream &os, const char *value)
+{
+    os << '"';
+    for (; *value; ++value)
+    {
+        char c = *value;
+        if (c == '"' || c == '\\')
+            os << '\\' << c;
+        else if ((unsigned char)c < 0x20)
+            os << ' ';
+        else
+            os << c;
+    }
+    os << '"';
+}
+
+// Chrome traces are in us
+static void _json_time(std::ostream &os, uint64_t ns)
+{
+    os << ns / 1000 << '.' << std::setw(3) << std::setfill('0') << ns % 1000;
+}
+
+Tracer::Span::Span(const char *name, const std::string &detail) : m_name(name),
+                                                                  m_begin(0)
+{
+    if (Tracer::instance().is_active())
+    {
+        m_detail = detail;
+        m_begin = now();
+    }
+}
+
+Tracer::Span::~Span()
+{
+    if (m_begin)
+        Tracer::instance().complete(m_name, m_begin, now(), m_detail);
+}
+
+Tracer &Tracer::instance()
+{
+    static Tracer tracer;
+    return tracer;
+}
+
+uint64_t Tracer::now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+void Tracer::set_active(bool active, size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (active)
+    {
+        m_events.assign(capacity > 0 ? capacity : DEFAULT_CAPACITY, Event());
+        m_nb_events = 0;
+    }
+    m_active.store(active, std::memory_order_relaxed);
+}
+
+void Tracer::clear()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_nb_events = 0;
+}
+
+void Tracer::complete(const char *name, uint64_t begin, uint64_t end, const std::string &detail)
+{
+    if (is_active())
+        _add(name, begin, end > begin ? end - begin : 0, detail);
+}
+
+void Tracer::instant(const char *name, const std::string &detail)
+{
+    if (is_active())
+        _add(name, now(), NO_DURATION, detail);
+}
+
+void Tracer::thread_name(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_thread_names[_thread_id()] = name;
+}
+
+void Tracer::_add(const char *name, uint64_t begin, uint64_t duration, const std::string &detail)
+{
+    int tid = _thread_id();
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_events.empty())
+        return;
+    Event &event = m_events[m_nb_events++ % m_events.size()];
+    event.name = name;
+    event.begin = begin;
+    event.duration = duration;
+    event.tid = tid;
+    strncpy(event.detail, detail.c_str(), sizeof(event.detail) - 1);
+    event.detail[sizeof(event.detail) - 1] = '\0';
+}
+
+std::string Tracer::to_json() const
+{
+    std::ostringstream os;
+    int pid = getpid();
+    std::lock_guard<std::mutex> lock(m_lock);
+    os << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+    bool first = true;
+    for (std::map<int, std::string>::const_iterator i = m_thread_names.begin(); i != m_thread_names.end(); ++i)
+    {
+        os << (first ? "\n" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid
+           << ", \"tid\": " << i->first << ", \"args\": {\"name\": ";
+        _json_string(os, i->second.c_str());
+        os << "}}";
+        first = false;
+    }
+
+    // oldest first
+    uint64_t nb_events = std::min<uint64_t>(m_nb_events, m_events.size());
+    for (uint64_t n = m_nb_events - nb_events; n < m_nb_events; ++n)
+    {
+        const Event &event = m_events[n % m_events.size()];
+        os << (first ? "\n" : ",\n") << "{\"name\": ";
+        _json_string(os, event.name);
+        os << ", \"cat\": \"eiger\", \"pid\": " << pid << ", \"tid\": " << event.tid << ", \"ts\": ";
+        _json_time(os, event.begin);
+        if (event.duration == NO_DURATION)
+            os << ", \"ph\": \"i\", \"s\": \"t\"";
+        else
+        {
+            os << ", \"ph\": \"X\", \"dur\": ";
+            _json_time(os, event.duration);
+        }
+        if (event.detail[0])
+        {
+            os << ", \"args\": {\"detail\": ";
+            _json_string(os, event.detail);
+            os << "}";
+        }
+        os << "}";
+        first = false;
+    }
+    os << "\n]}\n";
+    return os.str();
+}
+
+void Tracer::dump(const std::string &path) const
+{
+    std::string trace = to_json();
+    std::ofstream file(path.c_str());
+    if (!(file << trace) || !file.flush())
+        THROW_EIGER_EXCEPTION("Can't write the trace file", path.c_str());
+}
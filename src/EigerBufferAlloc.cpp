@@ -0,0 +1,333 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "EigerBufferAlloc.h"
+
+using namespace lima;
+using namespace lima::Eiger;
+
+// linux/mempolicy.h, without the libnuma dependency
+static const int MEMPOLICY_BIND = 2;
+static const int MEMPOLICY_INTERLEAVE = 3;
+static const int MAX_NUMA_NODES = 1024;
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+static const long HUGE_PAGE_2M = 2L << 20;
+static const long HUGE_PAGE_1G = 1L << 30;
+// frames start on a page (direct io, SIMD decompression)
+static const size_t FRAME_ALIGNMENT = 4096;
+static const int MAX_PREFAULT_THREADS = 8;
+
+static inline size_t _round_up(size_t size,size_t alignment)
+{
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+// "0-1,3" in /sys/devices/system/node/online
+static std::vector<int> _online_nodes()
+{
+  std::vector<int> nodes;
+  std::ifstream file("/sys/devices/system/node/online");
+  std::string range;
+  while(std::getline(file,range,','))
+    {
+      int first,last;
+      int n = sscanf(range.c_str(),"%d-%d",&first,&last);
+      if(n < 1)
+	continue;
+      if(n == 1)
+	last = first;
+      for(int node = first;node <= last;++node)
+	nodes.push_back(node);
+    }
+  if(nodes.empty())
+    nodes.push_back(0);
+  return nodes;
+}
+
+// memory of a node, of the system if node < 0
+static long long _memory_size(int node)
+{
+  if(node >= 0)
+    {
+      std::ostringstream path;
+      path << "/sys/devices/system/node/node" << node << "/meminfo";
+      std::ifstream file(path.str().c_str());
+      std::string line;
+      while(std::getline(file,line))
+	{
+	  // Node 0 MemTotal:       65856964 kB
+	  size_t pos = line.find("MemTotal:");
+	  if(pos != std::string::npos)
+	    return atoll(line.c_str() + pos + 9) * 1024;
+	}
+    }
+  return (long long)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+}
+
+// free pages of the huge page pool, of a node if node >= 0
+static long long _free_huge_pages(long page_size,int node)
+{
+  std::ostringstream path;
+  if(node >= 0)
+    path << "/sys/devices/system/node/node" << node;
+  else
+    path << "/sys/kernel/mm";
+  path << "/hugepages/hugepages-" << (page_size >> 10) << "kB/free_hugepages";
+  std::ifstream file(path.str().c_str());
+  long long nb_pages = 0;
+  file >> nb_pages;
+  return nb_pages;
+}
+
+// touch every page, in parallel: zeroing the pages is the cost
+static void _prefault(char* base,size_t size,size_t page_size)
+{
+  size_t nb_pages = size / page_size;
+  int nb_threads = std::min<long>(std::max(1u,std::thread::hardware_concurrency()),
+				  MAX_PREFAULT_THREADS);
+  nb_threads = std::max<long>(1,std::min<long>(nb_threads,nb_pages / 1024));
+  size_t pages_per_thread = (nb_pages + nb_threads - 1) / nb_threads;
+  std::vector<std::thread> threads;
+  for(int i = 0;i < nb_threads;++i)
+    {
+      size_t first = i * pages_per_thread;
+      size_t last = std::min(nb_pages,first + pages_per_thread);
+      threads.push_back(std::thread([=]() {
+	    for(size_t page = first;page < last;++page)
+	      ((volatile char*)base)[page * page_size] = 0;
+	  }));
+    }
+  for(size_t i = 0;i < threads.size();++i)
+    threads[i].join();
+}
+
+bool FrameBufferAllocMgr::Policy::operator==(const Policy& other) const
+{
+  return (page_size == other.page_size && numa_node == other.numa_node &&
+	  numa_interleave == other.numa_interleave && prefault == other.prefault);
+}
+
+FrameBufferAllocMgr::FrameBufferAllocMgr() :
+  m_nb_buffers(0),
+  m_frame_stride(0),
+  m_base(NULL),
+  m_mapped_size(0),
+  m_requested_size(0)
+{
+  DEB_CONSTRUCTOR();
+}
+
+FrameBufferAllocMgr::~FrameBufferAllocMgr()
+{
+  DEB_DESTRUCTOR();
+  _unmap();
+}
+
+void FrameBufferAllocMgr::setPolicy(const Policy& policy)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR4(policy.page_size,policy.numa_node,
+			  policy.numa_interleave,policy.prefault);
+
+  if(policy.page_size && policy.page_size != HUGE_PAGE_2M &&
+     policy.page_size != HUGE_PAGE_1G)
+    THROW_HW_ERROR(InvalidValue) << "Page size must be 0 (default), 2 MiB or 1 GiB: "
+				 << DEB_VAR1(policy.page_size);
+  if(policy.numa_node < -1 || policy.numa_node >= MAX_NUMA_NODES)
+    THROW_HW_ERROR(InvalidValue) << "Invalid NUMA node: " << DEB_VAR1(policy.numa_node);
+
+  AutoMutex lock(m_mutex);
+  m_policy = policy;
+}
+
+void FrameBufferAllocMgr::getPolicy(Policy& policy) const
+{
+  AutoMutex lock(m_mutex);
+  policy = m_policy;
+}
+
+int FrameBufferAllocMgr::getMaxNbBuffers(const FrameDim& frame_dim)
+{
+  DEB_MEMBER_FUNCT();
+
+  AutoMutex lock(m_mutex);
+  size_t frame_stride = _round_up(frame_dim.getMemSize(),FRAME_ALIGNMENT);
+  if(!frame_stride)
+    return 0;
+  int node = m_policy.numa_interleave ? -1 : m_policy.numa_node;
+  long long memory = 0;
+  if(m_policy.page_size)
+    {
+      memory = _free_huge_pages(m_policy.page_size,node) * m_policy.page_size;
+      // the pages already mapped are not free
+      if(memory && m_base && m_mapped_policy == m_policy)
+	memory += m_mapped_size;
+    }
+  // no huge page pool: transparent huge pages
+  if(!memory)
+    memory = _memory_size(node);
+  int max_nb_buffers = int(std::min<long long>(memory / frame_stride,INT_MAX));
+  DEB_RETURN() << DEB_VAR1(max_nb_buffers);
+  return max_nb_buffers;
+}
+
+void FrameBufferAllocMgr::allocBuffers(int nb_buffers,const FrameDim& frame_dim)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR2(nb_buffers,frame_dim);
+
+  AutoMutex lock(m_mutex);
+  size_t frame_stride = _round_up(frame_dim.getMemSize(),FRAME_ALIGNMENT);
+  size_t size = frame_stride * std::max(nb_buffers,0);
+  if(!size)
+    {
+      _unmap();
+      m_nb_buffers = 0;
+      return;
+    }
+
+  // the mapping is kept from one acquisition to the next
+  if(!m_base || !(m_mapped_policy == m_policy) || size != m_requested_size)
+    {
+      _unmap();
+      m_nb_buffers = 0;
+      _map(size,m_policy);
+    }
+  m_frame_dim = frame_dim;
+  m_frame_stride = frame_stride;
+  m_nb_buffers = nb_buffers;
+}
+
+const FrameDim& FrameBufferAllocMgr::getFrameDim()
+{
+  return m_frame_dim;
+}
+
+void FrameBufferAllocMgr::getNbBuffers(int& nb_buffers)
+{
+  AutoMutex lock(m_mutex);
+  nb_buffers = m_nb_buffers;
+}
+
+void FrameBufferAllocMgr::releaseBuffers()
+{
+  DEB_MEMBER_FUNCT();
+
+  AutoMutex lock(m_mutex);
+  _unmap();
+  m_nb_buffers = 0;
+}
+
+void* FrameBufferAllocMgr::getBufferPtr(int buffer_nb)
+{
+  if(buffer_nb < 0 || buffer_nb >= m_nb_buffers)
+    return NULL;
+  return m_base + buffer_nb * m_frame_stride;
+}
+
+void FrameBufferAllocMgr::_map(size_t size,const Policy& policy)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(size);
+
+  size_t requested_size = size;
+  const int prot = PROT_READ | PROT_WRITE;
+  const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  void* base = MAP_FAILED;
+  if(policy.page_size)
+    {
+      // hugetlbfs pool, reserved at mapping time
+      int page_shift = policy.page_size == HUGE_PAGE_1G ? 30 : 21;
+      size_t huge_size = _round_up(size,policy.page_size);
+      base = mmap(NULL,huge_size,prot,flags | MAP_HUGETLB | (page_shift << MAP_HUGE_SHIFT),-1,0);
+      if(base != MAP_FAILED)
+	size = huge_size,page_size = policy.page_size;
+      else
+	DEB_WARNING() << "Not enough " << (policy.page_size >> 20) << " MiB huge pages for "
+		      << huge_size << " bytes (" << strerror(errno)
+		      << "), using transparent huge pages";
+    }
+  if(base == MAP_FAILED)
+    {
+      size = _round_up(size,page_size);
+      base = mmap(NULL,size,prot,flags,-1,0);
+      if(base == MAP_FAILED)
+	THROW_HW_ERROR(Error) << "Can't allocate the frame buffers (" << size << " bytes): "
+			      << strerror(errno);
+      if(policy.page_size && madvise(base,size,MADV_HUGEPAGE))
+	DEB_WARNING() << "No transparent huge pages: " << strerror(errno);
+    }
+
+  // the policy applies to the pages faulted from now on
+  if(policy.numa_interleave || policy.numa_node >= 0)
+    {
+      std::vector<int> nodes;
+      if(policy.numa_interleave)
+	nodes = _online_nodes();
+      else
+	nodes.push_back(policy.numa_node);
+      const int bits = sizeof(unsigned long) * 8;
+      unsigned long node_mask[MAX_NUMA_NODES / bits] = {0};
+      for(size_t i = 0;i < nodes.size();++i)
+	if(nodes[i] < MAX_NUMA_NODES)
+	  node_mask[nodes[i] / bits] |= 1UL << (nodes[i] % bits);
+      int mode = policy.numa_interleave ? MEMPOLICY_INTERLEAVE : MEMPOLICY_BIND;
+      if(syscall(SYS_mbind,base,size,mode,node_mask,MAX_NUMA_NODES,0))
+	DEB_WARNING() << "NUMA policy not applied to the frame buffers: " << strerror(errno);
+    }
+
+  if(policy.prefault)
+    _prefault((char*)base,size,page_size);
+
+  m_base = (char*)base;
+  m_mapped_size = size;
+  m_requested_size = requested_size;
+  m_mapped_policy = policy;
+  DEB_TRACE() << "Frame buffers mapped: " << DEB_VAR3(m_mapped_size,page_size,policy.prefault);
+}
+
+void FrameBufferAllocMgr::_unmap()
+{
+  if(m_base)
+    munmap(m_base,m_mapped_size);
+  m_base = NULL;
+  m_mapped_size = m_requested_size = 0;
+}
@@ -0,0 +1,82 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef EIGERBUFFERALLOC_H
+#define EIGERBUFFERALLOC_H
+
+#include <stddef.h>
+
+#include "lima/Debug.h"
+#include "lima/ThreadUtils.h"
+#include "lima/HwBufferMgr.h"
+
+namespace lima
+{
+  namespace Eiger
+  {
+    /// Frame ring of the stream: one mapping for all the buffers, on
+    /// huge pages and bound to NUMA nodes if asked, optionally pre-faulted
+    /// so the first acquisition does not pay the page faults.
+    class FrameBufferAllocMgr : public BufferAllocMgr
+    {
+      DEB_CLASS_NAMESPC(DebModCamera,"FrameBufferAllocMgr","Eiger");
+    public:
+      struct Policy
+      {
+	Policy() : page_size(0),numa_node(-1),numa_interleave(false),prefault(false) {}
+	bool operator==(const Policy&) const;
+
+	long page_size;		// 0 default pages, else 2 MiB or 1 GiB huge pages
+	int numa_node;		// -1 first touch
+	bool numa_interleave;	// on all the nodes, numa_node ignored
+	bool prefault;
+      };
+
+      FrameBufferAllocMgr();
+      virtual ~FrameBufferAllocMgr();
+
+      /// applied from the next allocation
+      void setPolicy(const Policy&);
+      void getPolicy(Policy&) const;
+
+      virtual int getMaxNbBuffers(const FrameDim&);
+      virtual void allocBuffers(int nb_buffers,const FrameDim&);
+      virtual const FrameDim& getFrameDim();
+      virtual void getNbBuffers(int& nb_buffers);
+      virtual void releaseBuffers();
+      virtual void *getBufferPtr(int buffer_nb);
+    private:
+      void _map(size_t size,const Policy&);
+      void _unmap();
+
+      mutable Mutex	m_mutex;
+      Policy		m_policy;
+      Policy		m_mapped_policy;
+      FrameDim		m_frame_dim;
+      int		m_nb_buffers;
+      size_t		m_frame_stride;
+      char*		m_base;
+      size_t		m_mapped_size;	// rounded to the page size
+      size_t		m_requested_size;
+    };
+  }
+}
+#endif	// EIGERBUFFERALLOC_H
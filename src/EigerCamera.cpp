@@ -25,8 +25,14 @@
 #include <string>
 #include <math.h>
 #include <algorithm>
+#include <fstream>
+#include <map>
+#include <stdio.h>
 #include "EigerCamera.h"
 #include <eigerapi/Requests.h>
+#include <eigerapi/Metrics.h>
+#include <eigerapi/MetricsServer.h>
+#include <eigerapi/Tracer.h>
 #include "lima/Timestamp.h"
 
 using namespace lima;
@@ -34,6 +40,9 @@ using namespace lima::Eiger;
 using namespace std;
 using namespace eigerapi;
 
+// longest hold of an internal trigger by the DCU buffer throttle
+static const double TRIGGER_HOLD_TIMEOUT = 120.;
+
 #define HANDLE_EIGERERROR(__errMsg__)        \
     {                                        \
         THROW_HW_ERROR(Error) << __errMsg__; \
@@ -60,7 +69,7 @@ using namespace eigerapi;
 #define EIGER_SYNC_SET_PARAM(ParamType, value)       \
     {                                                \
         std::shared_ptr<Requests::Param> req =       \
-            m_requests->set_param(ParamType, value); \
+            m_requests->set<ParamType>(value);      \
         try                                          \
         {                                            \
             req->wait();                             \
@@ -74,7 +83,7 @@ using namespace eigerapi;
 #define EIGER_SYNC_GET_PARAM(ParamType, value)       \
     {                                                \
         std::shared_ptr<Requests::Param> req =       \
-            m_requests->get_param(ParamType, value); \
+            m_requests->get<ParamType>(value);      \
         try                                          \
         {                                            \
             req->wait();                             \
@@ -128,46 +137,262 @@ private:
     Camera &m_cam;
 };
 
+/*----------------------------------------------------------------------------
+			    Status monitor thread
+ ----------------------------------------------------------------------------*/
+// Refresh periodically the detector telemetry so the getters
+// can return the cached values without any http round-trip.
+class Camera::_StatusMonitorThread : public Thread
+{
+    DEB_CLASS_NAMESPC(DebModCamera, "Camera", "_StatusMonitorThread");
+
+public:
+    _StatusMonitorThread(Camera &cam) : m_cam(cam)
+    {
+        pthread_attr_setscope(&m_thread_attr, PTHREAD_SCOPE_PROCESS);
+    }
+    virtual ~_StatusMonitorThread()
+    {
+        AutoMutex lock(m_cam.m_cond.mutex());
+        m_cam.m_status_monitor_quit = true;
+        m_cam.m_cond.broadcast();
+        lock.unlock();
+
+        join();
+    }
+
+protected:
+    virtual void threadFunction();
+
+private:
+    bool _refresh(double &temperature, double &humidity,
+                  std::string &detector_status,
+                  std::string &filewriter_status,
+                  std::string &stream_status);
+
+    Camera &m_cam;
+};
+
+void Camera::_StatusMonitorThread::threadFunction()
+{
+    DEB_MEMBER_FUNCT();
+    double last_refresh = 0.;
+    AutoMutex lock(m_cam.m_cond.mutex());
+    while (!m_cam.m_status_monitor_quit)
+    {
+        double period = m_cam.m_status_monitor_period;
+        if (period <= 0.)
+        {
+            m_cam.m_cond.wait();
+            continue;
+        }
+
+        double remaining = last_refresh + period - double(Timestamp::now());
+        if (remaining > 0.)
+        {
+            m_cam.m_cond.wait(remaining);
+            continue;
+        }
+
+        // keep clear of the arm/trigger sequence,
+        // prepareAcq holds the lock while arming
+        if (m_cam.m_trigger_state == RUNNING)
+        {
+            m_cam.m_cond.wait(period);
+            continue;
+        }
+
+        m_cam.m_status_monitor_busy = true;
+        lock.unlock();
+
+        double temperature, humidity;
+        std::string detector_status, filewriter_status, stream_status;
+        bool ok = _refresh(temperature, humidity, detector_status,
+                           filewriter_status, stream_status);
+
+        lock.lock();
+        last_refresh = Timestamp::now();
+        m_cam.m_status_monitor_busy = false;
+        if (ok)
+        {
+            m_cam.m_temperature = temperature;
+            m_cam.m_humidity = humidity;
+            eigerapi::Metrics::instance().gauge("detector_temperature").set(temperature);
+            eigerapi::Metrics::instance().gauge("detector_humidity").set(humidity);
+            m_cam.m_detector_status = detector_status;
+            m_cam.m_filewriter_status = filewriter_status;
+            m_cam.m_stream_status = stream_status;
+            m_cam.m_status_timestamp = Timestamp::now();
+        }
+        m_cam.m_cond.broadcast();
+    }
+}
+
+bool Camera::_StatusMonitorThread::_refresh(double &temperature, double &humidity,
+                                            std::string &detector_status,
+                                            std::string &filewriter_status,
+                                            std::string &stream_status)
+{
+    DEB_MEMBER_FUNCT();
+    Requests *requests = m_cam.m_requests;
+    // the status are read concurrently from the curl thread once updated,
+    // into the values of a refresh that outlives a cancelled one
+    struct Values
+    {
+        double temperature, humidity;
+        std::string detector_status, filewriter_status, stream_status;
+    };
+    std::shared_ptr<Values> values(new Values());
+    std::shared_ptr<CurlLoop::FutureRequest> refresh =
+        requests->get_command(Requests::STATUS_UPDATE)->then([=](CurlLoop::FutureRequest::Status status) {
+            if (status != CurlLoop::FutureRequest::OK)
+                return std::shared_ptr<CurlLoop::FutureRequest>();
+            CurlLoop::FutureRequest::List reqs;
+            reqs.push_back(requests->get<Requests::TEMP>(values->temperature));
+            reqs.push_back(requests->get<Requests::HUMIDITY>(values->humidity));
+            reqs.push_back(requests->get<Requests::DETECTOR_STATUS>(values->detector_status));
+            reqs.push_back(requests->get<Requests::FILEWRITER_STATUS>(values->filewriter_status));
+            reqs.push_back(requests->get<Requests::STREAM_STATUS>(values->stream_status));
+            return CurlLoop::FutureRequest::when_all(reqs);
+        });
+    try
+    {
+        refresh->wait();
+    }
+    catch (const eigerapi::EigerException &e)
+    {
+        requests->cancel(refresh);
+        DEB_WARNING() << "status refresh failed: " << e.what();
+        return false;
+    }
+    temperature = values->temperature, humidity = values->humidity;
+    detector_status = values->detector_status;
+    filewriter_status = values->filewriter_status;
+    stream_status = values->stream_status;
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// Background refresh after a start from the cache, as the uncached start:
+// the detector is initialized if it can't be read. It runs in its own
+// thread, the description cache is written without the camera lock.
+//----------------------------------------------------------------------------
+class Camera::_StartupRefresh : public Thread
+{
+    DEB_CLASS_NAMESPC(DebModCamera, "Camera", "_StartupRefresh");
+
+public:
+    _StartupRefresh(Camera &cam, bool revalidate) : m_cam(cam),
+                                                     m_revalidate(revalidate),
+                                                     m_abort(false)
+    {
+        pthread_attr_setscope(&m_thread_attr, PTHREAD_SCOPE_PROCESS);
+    }
+    virtual ~_StartupRefresh()
+    {
+        AutoMutex lock(m_cam.m_cond.mutex());
+        m_abort = true;
+        std::shared_ptr<CurlLoop::FutureRequest> pending = m_pending;
+        lock.unlock();
+        if (pending)
+            m_cam.m_requests->cancel(pending);
+
+        join();
+    }
+
+protected:
+    virtual void threadFunction();
+
+private:
+    struct _Values
+    {
+        _Description desc;
+        double exp_time;
+        bool auto_summation;
+    };
+    bool _read(_Values &);
+    bool _wait(const std::shared_ptr<CurlLoop::FutureRequest> &, double timeout);
+    void _failed(const std::string &reason);
+
+    Camera &m_cam;
+    bool m_revalidate;
+    // under the camera lock
+    bool m_abort;
+    std::shared_ptr<CurlLoop::FutureRequest> m_pending;
+};
+
 //-----------------------------------------------------------------------------
 ///  Ctor
 //-----------------------------------------------------------------------------
-Camera::Camera(const std::string &detector_ip) ///< [in] Ip address of the detector server
+Camera::Camera(const std::string &detector_ip,       ///< [in] Ip address of the detector server
+               const std::string &description_cache, ///< [in] description cache file
+               bool revalidate_cache)                ///< [in] re-read the description in background
     : m_image_number(0),
       m_latency_time(0.),
       m_detectorImageType(Bpp16),
       m_initilize_state(IDLE),
       m_trigger_state(IDLE),
       m_serie_id(0),
-      m_requests(new Requests(detector_ip)),
+      m_requests(NULL),
       m_exp_time(1.),
       m_detector_ip(detector_ip),
+      m_description_cache(description_cache),
       m_nb_frames_per_trigger_is_master(false),
-      m_timestamp_type("RELATIVE")
+      m_timestamp_type("RELATIVE"),
+      m_status_monitor_period(0.),
+      m_status_monitor_busy(false),
+      m_status_monitor_quit(false),
+      m_status_monitor(NULL),
+      m_trigger_paused(false),
+      m_startup_refresh(NULL),
+      m_metrics_server(NULL)
 {
     DEB_CONSTRUCTOR();
-    DEB_PARAM() << DEB_VAR1(detector_ip);
-    // Init EigerAPI
-    try
+    DEB_PARAM() << DEB_VAR3(detector_ip, description_cache, revalidate_cache);
+
+    // unknown until read
+    eigerapi::Metrics::instance().gauge("detector_temperature").set(NAN);
+    eigerapi::Metrics::instance().gauge("detector_humidity").set(NAN);
+
+    _Description cached;
+    if (_loadDescriptionCache(cached))
     {
-        initialiseController();
+        // Start from the cache, live values are read in background
+        DEB_TRACE() << "Start from description cache: " << m_description_cache;
+        m_requests = new Requests(detector_ip, cached.api_version);
+        _applyDescription(cached);
+        m_trig_mode = IntTrig;
+        m_initilize_state = RUNNING;
+        _startRefresh(revalidate_cache);
     }
-    catch (Exception &e)
+    else
     {
-        DEB_ALWAYS() << "Could not get configuration parameters, try to initialize";
-        EIGER_SYNC_CMD_TIMEOUT(Requests::INITIALIZE, 5 * 60);
-        initialiseController();
+        m_requests = new Requests(detector_ip);
+        // Init EigerAPI
+        try
+        {
+            initialiseController();
+        }
+        catch (Exception &e)
+        {
+            DEB_ALWAYS() << "Could not get configuration parameters, try to initialize";
+            EIGER_SYNC_CMD_TIMEOUT(Requests::INITIALIZE, 5 * 60);
+            initialiseController();
+        }
+        // --- Set detector for software single image mode
+        setTrigMode(IntTrig);
     }
 
     // Display max image size
     DEB_TRACE() << "Detector max width: " << m_maxImageWidth;
     DEB_TRACE() << "Detector max height:" << m_maxImageHeight;
 
-    // --- Set detector for software single image mode
-    setTrigMode(IntTrig);
-
     m_nb_frames = 1;
     m_nb_triggers = 1;
     m_nb_frames_per_trigger = 1;
+
+    m_status_monitor = new _StatusMonitorThread(*this);
+    m_status_monitor->start();
 }
 
 //-----------------------------------------------------------------------------
@@ -176,6 +401,9 @@ Camera::Camera(const std::string &detector_ip) ///< [in] Ip address of the detec
 Camera::~Camera()
 {
     DEB_DESTRUCTOR();
+    delete m_metrics_server;
+    delete m_startup_refresh;
+    delete m_status_monitor;
     delete m_requests;
 }
 
@@ -202,8 +430,15 @@ void Camera::prepareAcq()
 {
     DEB_MEMBER_FUNCT();
     AutoMutex aLock(m_cond.mutex());
+    _waitStatusMonitorIdle();
+    m_trigger_paused = false;
     if (m_trigger_state != IDLE)
+    {
+        eigerapi::Tracer::Span span("disarm");
         EIGER_SYNC_CMD(Requests::DISARM);
+    }
+
+    uint64_t parameters_begin = eigerapi::Tracer::now();
 
     std::shared_ptr<Requests::Param> frame_time_req;
     std::shared_ptr<Requests::Param> nimages_req;
@@ -246,9 +481,9 @@ void Camera::prepareAcq()
         DEB_TRACE() << "nb_trigger 	= " << nb_trigger;
         DEB_TRACE() << "nb_frames_per_trigger = " << nb_frames_per_trigger;
 
-        frame_time_req = m_requests->set_param(Requests::FRAME_TIME, frame_time);
-        nimages_req = m_requests->set_param(Requests::NIMAGES, nb_frames_per_trigger);
-        ntrigger_req = m_requests->set_param(Requests::NTRIGGER, nb_trigger);
+        frame_time_req = m_requests->set<Requests::FRAME_TIME>(frame_time);
+        nimages_req = m_requests->set<Requests::NIMAGES>(nb_frames_per_trigger);
+        ntrigger_req = m_requests->set<Requests::NTRIGGER>(nb_trigger);
     }
     else // ie Swing/sixs case
     {
@@ -283,37 +518,52 @@ void Camera::prepareAcq()
         DEB_TRACE() << "nb_trigger 	= " << nb_trigger;
         DEB_TRACE() << "nb_frames 	= " << nb_frames;
 
-        frame_time_req = m_requests->set_param(Requests::FRAME_TIME, frame_time);
-        nimages_req = m_requests->set_param(Requests::NIMAGES, nb_frames);
-        ntrigger_req = m_requests->set_param(Requests::NTRIGGER, nb_trigger);
+        frame_time_req = m_requests->set<Requests::FRAME_TIME>(frame_time);
+        nimages_req = m_requests->set<Requests::NIMAGES>(nb_frames);
+        ntrigger_req = m_requests->set<Requests::NTRIGGER>(nb_trigger);
     }
 
-    try
-    {
-        frame_time_req->wait();
-        nimages_req->wait();
-        ntrigger_req->wait();
-    }
-    catch (const eigerapi::EigerException &e)
+    CurlLoop::FutureRequest::List reqs;
+    reqs.push_back(frame_time_req);
+    reqs.push_back(nimages_req);
+    reqs.push_back(ntrigger_req);
+
+    // the arm is sent from the curl thread as soon as the parameters are set,
+    // it outlives this call if the chain is cancelled
+    struct ArmState
     {
-        HANDLE_EIGERERROR(e.what());
-    }
+        std::shared_ptr<Requests::Command> cmd;
+        uint64_t begin;
+    };
+    std::shared_ptr<ArmState> arm(new ArmState());
+    Requests *requests = m_requests;
+    std::shared_ptr<CurlLoop::FutureRequest> armed =
+        CurlLoop::FutureRequest::when_all(reqs)->then([=](CurlLoop::FutureRequest::Status status) {
+            if (status != CurlLoop::FutureRequest::OK)
+                return std::shared_ptr<CurlLoop::FutureRequest>();
+            arm->begin = eigerapi::Tracer::now();
+            eigerapi::Tracer::instance().complete("set parameters", parameters_begin, arm->begin);
+            arm->cmd = requests->get_command(Requests::ARM);
+            return std::shared_ptr<CurlLoop::FutureRequest>(arm->cmd);
+        });
 
     DEB_TRACE() << "Arm start";
     double timeout = 5 * 60.; // 5 min timeout
-    std::shared_ptr<Requests::Command> arm_cmd =
-        m_requests->get_command(Requests::ARM);
     try
     {
-        arm_cmd->wait(timeout);
+        armed->wait(timeout);
         DEB_TRACE() << "Arm end";
-        m_serie_id = arm_cmd->get_serie_id();
     }
     catch (const eigerapi::EigerException &e)
     {
-        m_requests->cancel(arm_cmd);
+        m_requests->cancel(armed);
         HANDLE_EIGERERROR(e.what());
     }
+    // a cancelled chain finishes without error, and maybe without arm
+    if (armed->get_status() != CurlLoop::FutureRequest::OK || !arm->cmd)
+        THROW_HW_ERROR(Error) << "Arm cancelled";
+    m_serie_id = arm->cmd->get_serie_id();
+    eigerapi::Tracer::instance().complete("arm", arm->begin, eigerapi::Tracer::now());
     m_image_number = 0;
 }
 
@@ -327,8 +577,23 @@ void Camera::startAcq()
 
     if (m_trig_mode == IntTrig || m_trig_mode == IntTrigMult)
     {
+        // the DCU buffer must drain before the next trigger
+        if (m_trig_mode == IntTrigMult && m_trigger_paused)
+        {
+            DEB_WARNING() << "Trigger held until the DCU buffer drains";
+            double deadline = double(Timestamp::now()) + TRIGGER_HOLD_TIMEOUT;
+            double remaining;
+            while (m_trigger_paused &&
+                   (remaining = deadline - double(Timestamp::now())) > 0.)
+                m_cond.wait(remaining);
+            if (m_trigger_paused)
+                HANDLE_EIGERERROR("DCU buffer still critical after " <<
+                                  TRIGGER_HOLD_TIMEOUT << " s, trigger not sent");
+        }
+        _waitStatusMonitorIdle();
         std::shared_ptr<Requests::Command> trigger =
             m_requests->get_command(Requests::TRIGGER);
+        eigerapi::Tracer::instance().instant("trigger");
         m_trigger_state = RUNNING;
         lock.unlock();
 
@@ -343,6 +608,7 @@ void Camera::startAcq()
 void Camera::stopAcq()
 {
     DEB_MEMBER_FUNCT();
+    _pauseTrigger(false);
     EIGER_SYNC_CMD(Requests::ABORT);
 }
 
@@ -355,6 +621,61 @@ void Camera::statusUpdate()
     EIGER_SYNC_CMD(Requests::STATUS_UPDATE);
 }
 
+//-----------------------------------------------------------------------------
+/// set the status monitor refresh period in second, <= 0 disables it
+//-----------------------------------------------------------------------------
+void Camera::setStatusMonitorPeriod(double period)
+{
+    DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR1(period);
+    AutoMutex lock(m_cond.mutex());
+    m_status_monitor_period = period;
+    if (period <= 0.)
+        m_status_timestamp = Timestamp();
+    m_cond.broadcast();
+}
+
+void Camera::getStatusMonitorPeriod(double &period)
+{
+    DEB_MEMBER_FUNCT();
+    AutoMutex lock(m_cond.mutex());
+    period = m_status_monitor_period;
+    DEB_RETURN() << DEB_VAR1(period);
+}
+
+//-----------------------------------------------------------------------------
+/// age in second of the cached status, -1 if nothing cached
+//-----------------------------------------------------------------------------
+void Camera::getStatusAge(double &age)
+{
+    DEB_MEMBER_FUNCT();
+    AutoMutex lock(m_cond.mutex());
+    age = _isStatusCached() ? double(Timestamp::now()) - double(m_status_timestamp) : -1.;
+    DEB_RETURN() << DEB_VAR1(age);
+}
+
+bool Camera::_isStatusCached()
+{
+    return m_status_monitor_period > 0. && m_status_timestamp.isSet();
+}
+
+// hold or release the internal triggers
+void Camera::_pauseTrigger(bool pause)
+{
+    DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR1(pause);
+    AutoMutex lock(m_cond.mutex());
+    m_trigger_paused = pause;
+    m_cond.broadcast();
+}
+
+// must be called with the lock held
+void Camera::_waitStatusMonitorIdle()
+{
+    while (m_status_monitor_busy)
+        m_cond.wait();
+}
+
 //-----------------------------------------------------------------------------
 /// return the detector Max image size
 //-----------------------------------------------------------------------------
@@ -371,14 +692,23 @@ void Camera::getDetectorImageSize(Size &size) ///< [out] image dimensions
 {
     DEB_MEMBER_FUNCT();
 
+    unsigned int width, height;
     std::shared_ptr<Requests::Param> width_request =
-        m_requests->get_param(Requests::DETECTOR_WITDH);
+        m_requests->get<Requests::DETECTOR_WITDH>(width);
     std::shared_ptr<Requests::Param> height_request =
-        m_requests->get_param(Requests::DETECTOR_HEIGHT);
-
-    Requests::Param::Value width = width_request->get();
-    Requests::Param::Value height = height_request->get();
-    size = Size(width.data.int_val, height.data.int_val);
+        m_requests->get<Requests::DETECTOR_HEIGHT>(height);
+    try
+    {
+        width_request->wait();
+        height_request->wait();
+    }
+    catch (const eigerapi::EigerException &e)
+    {
+        m_requests->cancel(width_request);
+        m_requests->cancel(height_request);
+        HANDLE_EIGERERROR(e.what());
+    }
+    size = Size(width, height);
 }
 
 //-----------------------------------------------------------------------------
@@ -407,6 +737,7 @@ void Camera::getDetectorType(string &type) ///< [out] detector type
 {
     DEB_MEMBER_FUNCT();
 
+    AutoMutex lock(m_cond.mutex());
     type = m_detector_type;
 }
 
@@ -417,6 +748,7 @@ void Camera::getDetectorModel(string &model) ///< [out] detector model
 {
     DEB_MEMBER_FUNCT();
 
+    AutoMutex lock(m_cond.mutex());
     model = m_detector_model;
 }
 
@@ -552,11 +884,8 @@ void Camera::getExposureTimeRange(double &min_expo, ///< [out] minimum exposure
         HANDLE_EIGERERROR(e.what());
     }
 
-    Requests::Param::Value min_val = exp_time->get_min();
-    Requests::Param::Value max_val = exp_time->get_max();
-
-    min_expo = min_val.data.double_val;
-    max_expo = max_val.data.double_val;
+    min_expo = exp_time->get_min();
+    max_expo = exp_time->get_max();
     DEB_RETURN() << DEB_VAR2(min_expo, max_expo);
 }
 
@@ -652,7 +981,7 @@ void Camera::getNbFramesPerTrigger(int &nb_frames_per_trigger) ///< [out] curren
 void Camera::getNbHwAcquiredFrames(int &nb_acq_frames) ///< [out] number of acquired files
 {
     DEB_MEMBER_FUNCT();
-    nb_acq_frames = m_image_number;
+    nb_acq_frames = m_image_number.load();
 }
 
 //-----------------------------------------------------------------------------
@@ -684,9 +1013,126 @@ std::string Camera::getCamStatus()
 {
     DEB_MEMBER_FUNCT();
     std::string status;
+    AutoMutex lock(m_cond.mutex());
+    if (_isStatusCached())
+        return m_detector_status;
+    lock.unlock();
+
     EIGER_SYNC_GET_PARAM(Requests::DETECTOR_STATUS, status);
     return status;
 }
+
+//----------------------------------------------------------------------------
+// Get filewriter status
+//----------------------------------------------------------------------------
+void Camera::getFilewriterStatus(std::string &status)
+{
+    DEB_MEMBER_FUNCT();
+    AutoMutex lock(m_cond.mutex());
+    if (_isStatusCached())
+    {
+        status = m_filewriter_status;
+        return;
+    }
+    lock.unlock();
+
+    EIGER_SYNC_GET_PARAM(Requests::FILEWRITER_STATUS, status);
+}
+
+//----------------------------------------------------------------------------
+// Get stream status
+//----------------------------------------------------------------------------
+void Camera::getStreamStatus(std::string &status)
+{
+    DEB_MEMBER_FUNCT();
+    AutoMutex lock(m_cond.mutex());
+    if (_isStatusCached())
+    {
+        status = m_stream_status;
+        return;
+    }
+    lock.unlock();
+
+    EIGER_SYNC_GET_PARAM(Requests::STREAM_STATUS, status);
+}
+
+//----------------------------------------------------------------------------
+// Hot path metrics of the stream, the decompression, the REST
+// calls and the downloads, as a JSON snapshot
+//----------------------------------------------------------------------------
+void Camera::getMetrics(std::string &metrics)
+{
+    DEB_MEMBER_FUNCT();
+    metrics = eigerapi::Metrics::instance().snapshot().to_json();
+}
+
+void Camera::resetMetrics()
+{
+    DEB_MEMBER_FUNCT();
+    eigerapi::Metrics::instance().reset();
+}
+
+//----------------------------------------------------------------------------
+// Acquisition timeline (prepare, arm, stream connection, first frame,
+// trigger, REST calls and transfers) in the Chrome trace format,
+// recorded while active, activating clears the previous one
+//----------------------------------------------------------------------------
+void Camera::setTraceActive(bool active)
+{
+    DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR1(active);
+    eigerapi::Tracer::instance().set_active(active);
+}
+
+void Camera::getTraceActive(bool &active)
+{
+    DEB_MEMBER_FUNCT();
+    active = eigerapi::Tracer::instance().is_active();
+}
+
+void Camera::dumpTrace(const std::string &path)
+{
+    DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR1(path);
+    try
+    {
+        eigerapi::Tracer::instance().dump(path);
+    }
+    catch (const eigerapi::EigerException &e)
+    {
+        THROW_HW_ERROR(Error) << e.what();
+    }
+}
+
+//----------------------------------------------------------------------------
+// Prometheus endpoint, served by its own thread from the metrics
+// registry only (no stream, curl or camera lock)
+//----------------------------------------------------------------------------
+void Camera::setMetricsEndpoint(const std::string &address)
+{
+    DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR1(address);
+    AutoMutex lock(m_cond.mutex());
+    delete m_metrics_server;
+    m_metrics_server = NULL;
+    if (address.empty())
+        return;
+    try
+    {
+        m_metrics_server = new eigerapi::MetricsServer(address);
+    }
+    catch (const eigerapi::EigerException &e)
+    {
+        THROW_HW_ERROR(Error) << e.what();
+    }
+}
+
+void Camera::getMetricsEndpoint(std::string &address)
+{
+    DEB_MEMBER_FUNCT();
+    AutoMutex lock(m_cond.mutex());
+    address = m_metrics_server ? m_metrics_server->address() : "";
+}
 //-----------------------------------------------------------------------------
 /// Tells if binning is available
 /*!
@@ -731,24 +1177,27 @@ void Camera::initialiseController()
     DEB_MEMBER_FUNCT();
     DEB_TRACE() << "initialiseController()";
 
-    std::list<std::shared_ptr<Requests::Param>> synchro_list;
+    _Description desc;
+    desc.api_version = m_requests->get_api_version();
+
+    CurlLoop::FutureRequest::List synchro_list;
     std::string trig_name;
-    synchro_list.push_back(m_requests->get_param(Requests::TRIGGER_MODE, trig_name));
+    synchro_list.push_back(m_requests->get<Requests::TRIGGER_MODE>(trig_name));
 
-    synchro_list.push_back(m_requests->get_param(Requests::X_PIXEL_SIZE, m_x_pixelsize));
-    synchro_list.push_back(m_requests->get_param(Requests::Y_PIXEL_SIZE, m_y_pixelsize));
+    synchro_list.push_back(m_requests->get<Requests::X_PIXEL_SIZE>(desc.x_pixelsize));
+    synchro_list.push_back(m_requests->get<Requests::Y_PIXEL_SIZE>(desc.y_pixelsize));
 
-    synchro_list.push_back(m_requests->get_param(Requests::DETECTOR_WITDH, m_maxImageWidth));
-    synchro_list.push_back(m_requests->get_param(Requests::DETECTOR_HEIGHT, m_maxImageHeight));
+    synchro_list.push_back(m_requests->get<Requests::DETECTOR_WITDH>(desc.max_image_width));
+    synchro_list.push_back(m_requests->get<Requests::DETECTOR_HEIGHT>(desc.max_image_height));
 
-    synchro_list.push_back(m_requests->get_param(Requests::DETECTOR_READOUT_TIME, m_readout_time));
+    synchro_list.push_back(m_requests->get<Requests::DETECTOR_READOUT_TIME>(desc.readout_time));
 
-    synchro_list.push_back(m_requests->get_param(Requests::DESCRIPTION, m_detector_model));
-    synchro_list.push_back(m_requests->get_param(Requests::DETECTOR_NUMBER, m_detector_type));
-    synchro_list.push_back(m_requests->get_param(Requests::EXPOSURE, m_exp_time));
+    synchro_list.push_back(m_requests->get<Requests::DESCRIPTION>(desc.detector_model));
+    synchro_list.push_back(m_requests->get<Requests::DETECTOR_NUMBER>(desc.detector_type));
+    synchro_list.push_back(m_requests->get<Requests::EXPOSURE>(m_exp_time));
 
     unsigned nb_trigger;
-    synchro_list.push_back(m_requests->get_param(Requests::NTRIGGER, nb_trigger));
+    synchro_list.push_back(m_requests->get<Requests::NTRIGGER>(nb_trigger));
 
     std::shared_ptr<Requests::Param> frame_time_req = m_requests->get_param(Requests::FRAME_TIME);
     synchro_list.push_back(frame_time_req);
@@ -758,23 +1207,19 @@ void Camera::initialiseController()
     synchro_list.push_back(threshold_energy_req);
 
     bool auto_summation;
-    synchro_list.push_back(m_requests->get_param(Requests::AUTO_SUMMATION, auto_summation));
+    synchro_list.push_back(m_requests->get<Requests::AUTO_SUMMATION>(auto_summation));
 
-    synchro_list.push_back(m_requests->get_param(Requests::SOFTWARE_VERSION, m_software_version));
+    synchro_list.push_back(m_requests->get<Requests::SOFTWARE_VERSION>(desc.software_version));
 
     //Synchro
+    std::shared_ptr<CurlLoop::FutureRequest> synchro = CurlLoop::FutureRequest::when_all(synchro_list);
     try
     {
-        for (std::list<shared_ptr<Requests::Param>>::iterator i = synchro_list.begin();
-             i != synchro_list.end(); ++i)
-            (*i)->wait();
+        synchro->wait();
     }
     catch (const eigerapi::EigerException &e)
     {
-        for (std::list<shared_ptr<Requests::Param>>::iterator i = synchro_list.begin();
-             i != synchro_list.end(); ++i)
-            m_requests->cancel(*i);
-
+        m_requests->cancel(synchro);
         HANDLE_EIGERERROR(e.what());
     }
 
@@ -815,20 +1260,292 @@ void Camera::initialiseController()
     }
 
     //- get min of frame time (ie exposure time)
-    Requests::Param::Value min_frame_time = frame_time_req->get_min();
-    m_min_frame_time = min_frame_time.data.double_val;
+    desc.min_frame_time = frame_time_req->get_min();
 
     //- get min/max of photon energy
-    Requests::Param::Value min_photon_energy = photon_energy_req->get_min();
-    m_min_photon_energy = min_photon_energy.data.double_val;
-    Requests::Param::Value max_photon_energy = photon_energy_req->get_max();
-    m_max_photon_energy = max_photon_energy.data.double_val;
+    desc.min_photon_energy = photon_energy_req->get_min();
+    desc.max_photon_energy = photon_energy_req->get_max();
 
     //- get min/max of threshold energy
-    Requests::Param::Value min_threshold_energy = threshold_energy_req->get_min();
-    m_min_threshold_energy = min_threshold_energy.data.double_val;
-    Requests::Param::Value max_threshold_energy = threshold_energy_req->get_max();
-    m_max_threshold_energy = max_threshold_energy.data.double_val;
+    desc.min_threshold_energy = threshold_energy_req->get_min();
+    desc.max_threshold_energy = threshold_energy_req->get_max();
+
+    _applyDescription(desc);
+    _saveDescriptionCache(desc);
+}
+
+/*----------------------------------------------------------------------------
+			    Description cache
+ ----------------------------------------------------------------------------*/
+template <class T>
+static bool _get_cache_value(std::map<std::string, std::string> &values,
+                             const char *key, T &value)
+{
+    std::map<std::string, std::string>::iterator i = values.find(key);
+    if (i == values.end())
+        return false;
+    std::istringstream is(i->second);
+    return bool(is >> value);
+}
+
+static bool _get_cache_value(std::map<std::string, std::string> &values,
+                             const char *key, std::string &value)
+{
+    std::map<std::string, std::string>::iterator i = values.find(key);
+    if (i == values.end())
+        return false;
+    value = i->second;
+    return true;
+}
+
+bool Camera::_loadDescriptionCache(_Description &desc)
+{
+    DEB_MEMBER_FUNCT();
+    if (m_description_cache.empty())
+        return false;
+
+    std::ifstream cache_file(m_description_cache.c_str());
+    if (!cache_file)
+    {
+        DEB_TRACE() << "No description cache: " << m_description_cache;
+        return false;
+    }
+
+    // key=value, one per line
+    std::map<std::string, std::string> values;
+    std::string line;
+    while (std::getline(cache_file, line))
+    {
+        std::string::size_type pos = line.find('=');
+        if (line.empty() || line[0] == '#' || pos == std::string::npos)
+            continue;
+        values[line.substr(0, pos)] = line.substr(pos + 1);
+    }
+
+    std::string detector_ip;
+    bool ok = _get_cache_value(values, "detector_ip", detector_ip) &&
+              detector_ip == m_detector_ip &&
+              _get_cache_value(values, "api_version", desc.api_version) &&
+              _get_cache_value(values, "detector_model", desc.detector_model) &&
+              _get_cache_value(values, "detector_type", desc.detector_type) &&
+              _get_cache_value(values, "software_version", desc.software_version) &&
+              _get_cache_value(values, "max_image_width", desc.max_image_width) &&
+              _get_cache_value(values, "max_image_height", desc.max_image_height) &&
+              _get_cache_value(values, "x_pixelsize", desc.x_pixelsize) &&
+              _get_cache_value(values, "y_pixelsize", desc.y_pixelsize) &&
+              _get_cache_value(values, "readout_time", desc.readout_time) &&
+              _get_cache_value(values, "min_frame_time", desc.min_frame_time) &&
+              _get_cache_value(values, "min_photon_energy", desc.min_photon_energy) &&
+              _get_cache_value(values, "max_photon_energy", desc.max_photon_energy) &&
+              _get_cache_value(values, "min_threshold_energy", desc.min_threshold_energy) &&
+              _get_cache_value(values, "max_threshold_energy", desc.max_threshold_energy);
+    if (!ok)
+        DEB_WARNING() << "Description cache ignored (incomplete or other detector): "
+                      << m_description_cache;
+    return ok;
+}
+
+void Camera::_saveDescriptionCache(const _Description &desc)
+{
+    DEB_MEMBER_FUNCT();
+    if (m_description_cache.empty())
+        return;
+
+    // write aside then rename, a reader never sees a partial file
+    std::string tmp_path = m_description_cache + ".tmp";
+    std::ofstream cache_file(tmp_path.c_str());
+    cache_file.precision(17);
+    cache_file << "# Lima Eiger detector description cache" << std::endl
+               << "detector_ip=" << m_detector_ip << std::endl
+               << "api_version=" << desc.api_version << std::endl
+               << "detector_model=" << desc.detector_model << std::endl
+               << "detector_type=" << desc.detector_type << std::endl
+               << "software_version=" << desc.software_version << std::endl
+               << "max_image_width=" << desc.max_image_width << std::endl
+               << "max_image_height=" << desc.max_image_height << std::endl
+               << "x_pixelsize=" << desc.x_pixelsize << std::endl
+               << "y_pixelsize=" << desc.y_pixelsize << std::endl
+               << "readout_time=" << desc.readout_time << std::endl
+               << "min_frame_time=" << desc.min_frame_time << std::endl
+               << "min_photon_energy=" << desc.min_photon_energy << std::endl
+               << "max_photon_energy=" << desc.max_photon_energy << std::endl
+               << "min_threshold_energy=" << desc.min_threshold_energy << std::endl
+               << "max_threshold_energy=" << desc.max_threshold_energy << std::endl;
+    cache_file.close();
+
+    if (!cache_file || rename(tmp_path.c_str(), m_description_cache.c_str()))
+    {
+        DEB_WARNING() << "Can't write description cache: " << m_description_cache;
+        remove(tmp_path.c_str());
+    }
+}
+
+void Camera::_applyDescription(const _Description &desc)
+{
+    m_detector_model = desc.detector_model;
+    m_detector_type = desc.detector_type;
+    m_software_version = desc.software_version;
+    m_maxImageWidth = desc.max_image_width;
+    m_maxImageHeight = desc.max_image_height;
+    m_x_pixelsize = desc.x_pixelsize;
+    m_y_pixelsize = desc.y_pixelsize;
+    m_readout_time = desc.readout_time;
+    m_min_frame_time = desc.min_frame_time;
+    m_min_photon_energy = desc.min_photon_energy;
+    m_max_photon_energy = desc.max_photon_energy;
+    m_min_threshold_energy = desc.min_threshold_energy;
+    m_max_threshold_energy = desc.max_threshold_energy;
+}
+
+//----------------------------------------------------------------------------
+// Background refresh after a start from the cache
+//----------------------------------------------------------------------------
+void Camera::_StartupRefresh::threadFunction()
+{
+    DEB_MEMBER_FUNCT();
+    _Values values;
+    bool ok = _read(values);
+    if (!ok)
+    {
+        DEB_ALWAYS() << "Could not refresh the cached description, try to initialize";
+        ok = _wait(m_cam.m_requests->get_command(Requests::INITIALIZE), 5 * 60) &&
+             _read(values);
+    }
+    if (!ok)
+    {
+        _failed("Refresh after a start from the description cache failed");
+        return;
+    }
+
+    _Description &desc = values.desc;
+    if (m_revalidate && desc.api_version != m_cam.m_requests->get_api_version())
+    {
+        _failed("Detector api version changed");
+        return;
+    }
+
+    AutoMutex lock(m_cam.m_cond.mutex());
+    ImageType image_type = values.auto_summation ? Bpp32 : Bpp16;
+    bool size_changed = image_type != m_cam.m_detectorImageType;
+    m_cam.m_exp_time = values.exp_time;
+    m_cam.m_detectorImageType = image_type;
+    if (m_revalidate)
+    {
+        if (desc.max_image_width != m_cam.m_maxImageWidth ||
+            desc.max_image_height != m_cam.m_maxImageHeight)
+        {
+            DEB_WARNING() << "Detector size differs from the description cache";
+            size_changed = true;
+        }
+        m_cam._applyDescription(desc);
+    }
+    Size max_image_size(m_cam.m_maxImageWidth, m_cam.m_maxImageHeight);
+    m_cam.m_initilize_state = Camera::IDLE;
+    lock.unlock();
+
+    if (m_revalidate)
+        m_cam._saveDescriptionCache(desc);
+    if (size_changed)
+        m_cam.maxImageSizeChanged(max_image_size, image_type);
+    DEB_TRACE() << "Refresh from detector finished";
+}
+
+bool Camera::_StartupRefresh::_read(_Values &values)
+{
+    DEB_MEMBER_FUNCT();
+    Requests *requests = m_cam.m_requests;
+    _Description &desc = values.desc;
+    CurlLoop::FutureRequest::List reqs;
+    // --- Set detector for software single image mode
+    reqs.push_back(requests->set<Requests::TRIGGER_MODE>("ints"));
+    reqs.push_back(requests->get<Requests::EXPOSURE>(values.exp_time));
+    reqs.push_back(requests->get<Requests::AUTO_SUMMATION>(values.auto_summation));
+    std::shared_ptr<Requests::Param> frame_time_req;
+    std::shared_ptr<Requests::Param> photon_energy_req;
+    std::shared_ptr<Requests::Param> threshold_energy_req;
+    if (m_revalidate)
+    {
+        reqs.push_back(requests->get_api_version(desc.api_version));
+        reqs.push_back(requests->get<Requests::X_PIXEL_SIZE>(desc.x_pixelsize));
+        reqs.push_back(requests->get<Requests::Y_PIXEL_SIZE>(desc.y_pixelsize));
+        reqs.push_back(requests->get<Requests::DETECTOR_WITDH>(desc.max_image_width));
+        reqs.push_back(requests->get<Requests::DETECTOR_HEIGHT>(desc.max_image_height));
+        reqs.push_back(requests->get<Requests::DETECTOR_READOUT_TIME>(desc.readout_time));
+        reqs.push_back(requests->get<Requests::DESCRIPTION>(desc.detector_model));
+        reqs.push_back(requests->get<Requests::DETECTOR_NUMBER>(desc.detector_type));
+        reqs.push_back(requests->get<Requests::SOFTWARE_VERSION>(desc.software_version));
+        frame_time_req = requests->get_param(Requests::FRAME_TIME);
+        reqs.push_back(frame_time_req);
+        photon_energy_req = requests->get_param(Requests::PHOTON_ENERGY);
+        reqs.push_back(photon_energy_req);
+        threshold_energy_req = requests->get_param(Requests::THRESHOLD_ENERGY);
+        reqs.push_back(threshold_energy_req);
+    }
+
+    if (!_wait(CurlLoop::FutureRequest::when_all(reqs), CurlLoop::FutureRequest::TIMEOUT))
+        return false;
+
+    if (m_revalidate)
+    {
+        desc.min_frame_time = frame_time_req->get_min();
+        desc.min_photon_energy = photon_energy_req->get_min();
+        desc.max_photon_energy = photon_energy_req->get_max();
+        desc.min_threshold_energy = threshold_energy_req->get_min();
+        desc.max_threshold_energy = threshold_energy_req->get_max();
+    }
+    return true;
+}
+
+// false if the request failed or the refresh is aborted
+bool Camera::_StartupRefresh::_wait(const std::shared_ptr<CurlLoop::FutureRequest> &req,
+                                    double timeout)
+{
+    DEB_MEMBER_FUNCT();
+    AutoMutex lock(m_cam.m_cond.mutex());
+    if (m_abort)
+    {
+        lock.unlock();
+        m_cam.m_requests->cancel(req);
+        return false;
+    }
+    m_pending = req;
+    lock.unlock();
+
+    bool ok = true;
+    try
+    {
+        req->wait(timeout);
+    }
+    catch (const eigerapi::EigerException &e)
+    {
+        m_cam.m_requests->cancel(req);
+        DEB_WARNING() << "Refresh request failed: " << e.what();
+        ok = false;
+    }
+
+    lock.lock();
+    m_pending.reset();
+    return ok && !m_abort;
+}
+
+void Camera::_StartupRefresh::_failed(const std::string &reason)
+{
+    DEB_MEMBER_FUNCT();
+    AutoMutex lock(m_cam.m_cond.mutex());
+    if (m_abort)
+        return;
+    m_cam.m_initilize_state = Camera::ERROR;
+    lock.unlock();
+
+    DEB_ERROR() << reason << ", cache removed: " << m_cam.m_description_cache;
+    remove(m_cam.m_description_cache.c_str());
+}
+
+void Camera::_startRefresh(bool revalidate)
+{
+    DEB_MEMBER_FUNCT();
+    m_startup_refresh = new _StartupRefresh(*this, revalidate);
+    m_startup_refresh->start();
 }
 
 /*----------------------------------------------------------------------------
@@ -838,6 +1555,7 @@ void Camera::_acquisition_finished(bool ok)
 {
     DEB_MEMBER_FUNCT();
     DEB_PARAM() << DEB_VAR1(ok);
+    eigerapi::Tracer::instance().instant("acquisition finished", ok ? "" : "error");
 
     std::string error_msg;
 
@@ -863,7 +1581,16 @@ void Camera::_acquisition_finished(bool ok)
 void Camera::getTemperature(double &temp)
 {
     DEB_MEMBER_FUNCT();
+    AutoMutex lock(m_cond.mutex());
+    if (_isStatusCached())
+    {
+        temp = m_temperature;
+        return;
+    }
+    lock.unlock();
+
     EIGER_SYNC_GET_PARAM(Requests::TEMP, temp);
+    eigerapi::Metrics::instance().gauge("detector_temperature").set(temp);
 }
 
 //-----------------------------------------------------------------------------
@@ -875,7 +1602,16 @@ void Camera::getTemperature(double &temp)
 void Camera::getHumidity(double &humidity)
 {
     DEB_MEMBER_FUNCT();
+    AutoMutex lock(m_cond.mutex());
+    if (_isStatusCached())
+    {
+        humidity = m_humidity;
+        return;
+    }
+    lock.unlock();
+
     EIGER_SYNC_GET_PARAM(Requests::HUMIDITY, humidity);
+    eigerapi::Metrics::instance().gauge("detector_humidity").set(humidity);
 }
 
 //-----------------------------------------------------------------------------
@@ -1273,6 +2009,7 @@ void Camera::getDataCollectionDate(std::string &value) ///< [out]
 void Camera::getSoftwareVersion(std::string &value) ///< [out]
 {
     DEB_MEMBER_FUNCT();
+    AutoMutex lock(m_cond.mutex());
     value = m_software_version;
 }
 
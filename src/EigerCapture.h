@@ -0,0 +1,54 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef EIGERCAPTURE_H
+#define EIGERCAPTURE_H
+
+#include <stdint.h>
+
+// Stream capture file, shared with the replay tool (no lima dependency).
+// Append-only, little endian:
+//   file header			CaptureFileHeader
+//   for each multipart message	CaptureRecordHeader
+//     for each part		uint32_t size, then the part bytes
+namespace lima
+{
+  namespace Eiger
+  {
+    static const char CAPTURE_MAGIC[8] = {'E','I','G','E','R','C','A','P'};
+    static const uint32_t CAPTURE_VERSION = 1;
+
+    struct CaptureFileHeader
+    {
+      char	magic[8];
+      uint32_t	version;
+      uint32_t	reserved;
+    };
+
+    struct CaptureRecordHeader
+    {
+      uint64_t	timestamp;	// arrival time, ns since the epoch
+      uint32_t	nb_parts;
+      uint32_t	reserved;
+    };
+  }
+}
+#endif	// EIGERCAPTURE_H
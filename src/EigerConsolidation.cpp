@@ -0,0 +1,530 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "EigerHdf5.h"
+#include "EigerConsolidation.h"
+#include "EigerCamera.h"
+
+// virtual datasets need HDF5 1.10, the direct chunk copy 1.10.2
+#ifdef EIGER_H5_WRITE_CHUNK
+#define WITH_VIRTUAL_DATASET
+#endif
+
+using namespace lima;
+using namespace lima::Eiger;
+
+#ifdef WITH_VIRTUAL_DATASET
+// the containers are created with the filter pipeline of the data files,
+// which needs the filters (i.e: the LZ4 and bitshuffle plugins found
+// through HDF5_PLUGIN_PATH) to be available, even if the chunks are
+// copied without being decoded
+static bool _filterAvailable(H5Z_filter_t filter)
+{
+  return filter >= 0 && H5Zfilter_avail(filter) > 0;
+}
+
+static std::string _basename(const std::string& path)
+{
+  size_t pos = path.rfind('/');
+  return pos == std::string::npos ? path : path.substr(pos + 1);
+}
+
+// frames of a data file, the other dimensions are returned in dims
+static bool _getDims(hid_t dataset,hsize_t dims[3])
+{
+  _Hid space(H5Dget_space(dataset),H5Sclose);
+  return space.valid() && H5Sget_simple_extent_ndims(space) == 3 &&
+    H5Sget_simple_extent_dims(space,dims,NULL) == 3;
+}
+#endif
+
+/*----------------------------------------------------------------------------
+			  Consolidation thread
+----------------------------------------------------------------------------*/
+class Consolidation::_ConsolidationThread : public Thread
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"Consolidation","_ConsolidationThread");
+public:
+  _ConsolidationThread(Consolidation&);
+  virtual ~_ConsolidationThread();
+protected:
+  virtual void threadFunction();
+private:
+  Consolidation& m_consolidation;
+};
+
+Consolidation::_ConsolidationThread::_ConsolidationThread(Consolidation& consolidation) :
+  m_consolidation(consolidation)
+{
+  pthread_attr_setscope(&m_thread_attr,PTHREAD_SCOPE_PROCESS);
+}
+
+Consolidation::_ConsolidationThread::~_ConsolidationThread()
+{
+  AutoMutex lock(m_consolidation.m_cond.mutex());
+  m_consolidation.m_quit = true;
+  m_consolidation.m_cond.broadcast();
+  lock.unlock();
+
+  join();
+}
+
+void Consolidation::_ConsolidationThread::threadFunction()
+{
+  DEB_MEMBER_FUNCT();
+  Consolidation& c = m_consolidation;
+  AutoMutex lock(c.m_cond.mutex());
+
+  while(!c.m_quit)
+    {
+      while(!c.m_quit && !c._isReady())
+	c.m_cond.wait();
+      if(c.m_quit) break;
+
+      int acq_id = c.m_acq_id;
+      std::string error,path;
+      bool ok;
+      c.m_working = true;
+      if(c.m_next_file < c.m_nb_files)
+	{
+	  // next group of consecutive data files
+	  int group_end = std::min(c.m_next_file + c.m_files_per_container,c.m_nb_files);
+	  PathList files;
+	  for(int i = c.m_next_file;i < group_end;++i)
+	    {
+	      FileMap::iterator f = c.m_files.find(i);
+	      files.push_back(f->second);
+	      c.m_files.erase(f);
+	    }
+	  if(c.m_files_per_container <= 1)
+	    {
+	      c.m_sources.push_back(files.front());
+	      c.m_next_file = group_end;
+	      c.m_working = false;
+	      continue;
+	    }
+
+	  char container_nb[32];
+	  snprintf(container_nb,sizeof(container_nb),"%.6d",
+		   c.m_next_file / c.m_files_per_container + 1);
+	  path = c.m_directory + "/" + c.m_prefix + "_container_" + container_nb + ".h5";
+	  lock.unlock();
+
+	  ok = c._stitch(files,path,acq_id,error);
+
+	  lock.lock();
+	  if(ok && acq_id == c.m_acq_id)
+	    {
+	      c.m_sources.push_back(path);
+	      c.m_next_file = group_end;
+	    }
+	}
+      else
+	{
+	  PathList sources = c.m_sources;
+	  path = c.m_directory + "/" + c.m_prefix + "_vds.h5";
+	  lock.unlock();
+
+	  ok = c._writeVirtual(sources,path,error);
+
+	  lock.lock();
+	  if(acq_id == c.m_acq_id)
+	    c.m_pending = false;
+	}
+      c.m_working = false;
+      c.m_cond.broadcast();
+
+      if(!ok && acq_id == c.m_acq_id)
+	{
+	  // the downloaded data files are still valid
+	  c.m_pending = false;
+	  lock.unlock();
+	  DEB_WARNING() << "Consolidation into " << path << " failed: " << error;
+	  Event *event = new Event(Hardware,Event::Warning,Event::Saving,
+				   Event::Default,
+				   "Consolidation into " + path + " failed: " + error);
+	  c.m_cam.reportEvent(event);
+	  lock.lock();
+	}
+      else if(ok)
+	DEB_TRACE() << "Consolidated: " << DEB_VAR1(path);
+    }
+}
+
+/*----------------------------------------------------------------------------
+			      Consolidation
+----------------------------------------------------------------------------*/
+Consolidation::Consolidation(Camera& cam) :
+  m_cam(cam),
+  m_active(false),
+  m_files_per_container(1),
+  m_quit(false),
+  m_acq_id(0),
+  m_pending(false),
+  m_working(false),
+  m_nb_files(0),
+  m_frames_per_file(1),
+  m_next_file(0)
+{
+  DEB_CONSTRUCTOR();
+  m_thread = new _ConsolidationThread(*this);
+  m_thread->start();
+}
+
+Consolidation::~Consolidation()
+{
+  DEB_DESTRUCTOR();
+  delete m_thread;
+}
+
+void Consolidation::setActive(bool active,int files_per_container)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR2(active,files_per_container);
+#ifndef WITH_VIRTUAL_DATASET
+  if(active)
+    THROW_HW_ERROR(NotSupported) << "Plugin compiled without HDF5 >= 1.10.2 support";
+#endif
+  if(files_per_container < 1)
+    THROW_HW_ERROR(InvalidValue) << DEB_VAR1(files_per_container);
+  AutoMutex lock(m_cond.mutex());
+  m_active = active;
+  m_files_per_container = files_per_container;
+}
+
+void Consolidation::getActive(bool& active,int& files_per_container) const
+{
+  DEB_MEMBER_FUNCT();
+  AutoMutex lock(m_cond.mutex());
+  active = m_active;
+  files_per_container = m_files_per_container;
+  DEB_RETURN() << DEB_VAR2(active,files_per_container);
+}
+
+bool Consolidation::isActive() const
+{
+  AutoMutex lock(m_cond.mutex());
+  return m_active;
+}
+
+bool Consolidation::isBusy() const
+{
+  AutoMutex lock(m_cond.mutex());
+  return m_working || _isReady();
+}
+
+void Consolidation::start(const std::string& directory,const std::string& prefix,
+			  int nb_files,int frames_per_file)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR4(directory,prefix,nb_files,frames_per_file);
+
+  AutoMutex lock(m_cond.mutex());
+  ++m_acq_id;
+  m_pending = m_active && nb_files > 0;
+  m_directory = directory;
+  m_prefix = prefix;
+  m_nb_files = nb_files;
+  m_frames_per_file = std::max(frames_per_file,1);
+  m_next_file = 0;
+  m_files.clear();
+  m_sources.clear();
+}
+
+void Consolidation::stop()
+{
+  DEB_MEMBER_FUNCT();
+  AutoMutex lock(m_cond.mutex());
+  // abort the container being written
+  ++m_acq_id;
+  m_pending = false;
+  m_files.clear();
+  m_sources.clear();
+}
+
+void Consolidation::fileDownloaded(const std::string& path,int first_frame,int nb_frames)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR3(path,first_frame,nb_frames);
+
+  AutoMutex lock(m_cond.mutex());
+  int file_nb = first_frame / m_frames_per_file;
+  if(!m_pending || file_nb < m_next_file || file_nb >= m_nb_files) return;
+  m_files[file_nb] = path;
+  m_cond.broadcast();
+}
+
+// next group of files downloaded or all of them consolidated,
+// called locked
+bool Consolidation::_isReady() const
+{
+  if(!m_pending || m_working)
+    return false;
+  if(m_next_file >= m_nb_files)
+    return true;
+  int group_end = std::min(m_next_file + m_files_per_container,m_nb_files);
+  for(int i = m_next_file;i < group_end;++i)
+    if(!m_files.count(i))
+      return false;
+  return true;
+}
+
+bool Consolidation::_isCurrent(int acq_id) const
+{
+  AutoMutex lock(m_cond.mutex());
+  return !m_quit && acq_id == m_acq_id;
+}
+
+// concatenate the frames of the files, the chunks are copied
+// without being decompressed
+bool Consolidation::_stitch(const PathList& files,const std::string& container,
+			    int acq_id,std::string& error)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR2(container,files.size());
+#ifdef WITH_VIRTUAL_DATASET
+  // released between the chunks for the read back
+  AutoMutex h5_lock(_hdf5Mutex());
+  // the container has the type, chunks and filters of the first file
+  hsize_t dims[3] = {0,0,0};
+  hsize_t chunk_dims[3];
+  _Hid first_file(H5Fopen(files.front().c_str(),H5F_ACC_RDONLY,H5P_DEFAULT),H5Fclose);
+  _Hid first_dataset(first_file.valid() ?
+		     H5Dopen2(first_file,DATASET_PATH,H5P_DEFAULT) : -1,H5Dclose);
+  if(!first_dataset.valid() || !_getDims(first_dataset,dims))
+    {
+      error = "can't open " + files.front();
+      return false;
+    }
+  _Hid type(H5Dget_type(first_dataset),H5Tclose);
+  _Hid dcpl(H5Dget_create_plist(first_dataset),H5Pclose);
+  if(!dcpl.valid() || H5Pget_layout(dcpl) != H5D_CHUNKED ||
+     H5Pget_chunk(dcpl,3,chunk_dims) != 3)
+    {
+      error = "chunked dataset expected in " + files.front();
+      return false;
+    }
+  int nb_filters = H5Pget_nfilters(dcpl);
+  for(int i = 0;i < nb_filters;++i)
+    {
+      unsigned int flags;
+      size_t nb_values = 0;
+      H5Z_filter_t filter = H5Pget_filter2(dcpl,i,&flags,&nb_values,NULL,0,NULL,NULL);
+      if(!_filterAvailable(filter))
+	{
+	  char filter_str[64];
+	  snprintf(filter_str,sizeof(filter_str),"filter %d not available",int(filter));
+	  error = std::string(filter_str) + " (HDF5_PLUGIN_PATH)";
+	  return false;
+	}
+    }
+
+  std::vector<hsize_t> nb_frames;
+  hsize_t total_frames = 0;
+  for(PathList::const_iterator f = files.begin();f != files.end();++f)
+    {
+      _Hid file(H5Fopen(f->c_str(),H5F_ACC_RDONLY,H5P_DEFAULT),H5Fclose);
+      _Hid dataset(file.valid() ?
+		   H5Dopen2(file,DATASET_PATH,H5P_DEFAULT) : -1,H5Dclose);
+      hsize_t file_dims[3];
+      if(!dataset.valid() || !_getDims(dataset,file_dims))
+	{
+	  error = "can't open " + *f;
+	  return false;
+	}
+      if(file_dims[1] != dims[1] || file_dims[2] != dims[2])
+	{
+	  error = "frame size differs in " + *f;
+	  return false;
+	}
+      if(total_frames % chunk_dims[0])
+	{
+	  error = "frames not aligned on the chunks in " + *f;
+	  return false;
+	}
+      nb_frames.push_back(file_dims[0]);
+      total_frames += file_dims[0];
+    }
+
+  bool ok = true;
+  {
+    _Hid dst_file(H5Fcreate(container.c_str(),H5F_ACC_TRUNC,H5P_DEFAULT,H5P_DEFAULT),
+		  H5Fclose);
+    if(!dst_file.valid())
+      {
+	error = "can't create file";
+	return false;
+      }
+    hsize_t dst_dims[3] = {total_frames,dims[1],dims[2]};
+    _Hid space(H5Screate_simple(3,dst_dims,NULL),H5Sclose);
+    _Hid lcpl(H5Pcreate(H5P_LINK_CREATE),H5Pclose);
+    H5Pset_create_intermediate_group(lcpl,1);
+    _Hid dst_dataset(H5Dcreate2(dst_file,DATASET_PATH,type,space,lcpl,dcpl,H5P_DEFAULT),
+		     H5Dclose);
+    if(!dst_dataset.valid())
+      {
+	error = "can't create dataset";
+	ok = false;
+      }
+
+    std::vector<char> chunk;
+    hsize_t base = 0;
+    for(size_t i = 0;ok && i < files.size();base += nb_frames[i++])
+      {
+	// stopped or restarted meanwhile
+	if(!_isCurrent(acq_id))
+	  {
+	    error = "aborted";
+	    ok = false;
+	    break;
+	  }
+
+	_Hid src_file(H5Fopen(files[i].c_str(),H5F_ACC_RDONLY,H5P_DEFAULT),H5Fclose);
+	_Hid src_dataset(src_file.valid() ?
+			 H5Dopen2(src_file,DATASET_PATH,H5P_DEFAULT) : -1,H5Dclose);
+	// chunks not written by the detector are left to the fill value
+	hsize_t offset[3];
+	for(offset[0] = 0;ok && offset[0] < nb_frames[i];offset[0] += chunk_dims[0])
+	  for(offset[1] = 0;ok && offset[1] < dims[1];offset[1] += chunk_dims[1])
+	    for(offset[2] = 0;ok && offset[2] < dims[2];offset[2] += chunk_dims[2])
+	      {
+		hsize_t storage_size = 0;
+		if(H5Dget_chunk_storage_size(src_dataset,offset,&storage_size) < 0 ||
+		   !storage_size)
+		  continue;
+		if(storage_size > chunk.size())
+		  chunk.resize(storage_size);
+		uint32_t filter_mask = 0;
+		hsize_t dst_offset[3] = {base + offset[0],offset[1],offset[2]};
+		ok = EIGER_H5_READ_CHUNK(src_dataset,H5P_DEFAULT,offset,
+					 &filter_mask,chunk.data()) >= 0 &&
+		  EIGER_H5_WRITE_CHUNK(dst_dataset,H5P_DEFAULT,filter_mask,dst_offset,
+				       storage_size,chunk.data()) >= 0;
+		h5_lock.unlock();
+		h5_lock.lock();
+	      }
+	if(!ok)
+	  error = "can't copy the chunks of " + files[i];
+      }
+  }
+  if(!ok)
+    unlink(container.c_str());
+  return ok;
+#else
+  error = "not supported";
+  return false;
+#endif
+}
+
+// one virtual dataset mapping the sources in frame order,
+// referenced relatively to the virtual file directory
+bool Consolidation::_writeVirtual(const PathList& sources,const std::string& path,
+				  std::string& error)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR2(path,sources.size());
+#ifdef WITH_VIRTUAL_DATASET
+  if(sources.empty())
+    {
+      error = "no data file";
+      return false;
+    }
+  AutoMutex h5_lock(_hdf5Mutex());
+
+  std::vector<hsize_t> nb_frames;
+  hsize_t dims[3] = {0,0,0};
+  hid_t type_id = -1;
+  for(PathList::const_iterator s = sources.begin();s != sources.end();++s)
+    {
+      _Hid file(H5Fopen(s->c_str(),H5F_ACC_RDONLY,H5P_DEFAULT),H5Fclose);
+      _Hid dataset(file.valid() ?
+		   H5Dopen2(file,DATASET_PATH,H5P_DEFAULT) : -1,H5Dclose);
+      hsize_t src_dims[3];
+      if(!dataset.valid() || !_getDims(dataset,src_dims))
+	{
+	  error = "can't open " + *s;
+	  if(type_id >= 0) H5Tclose(type_id);
+	  return false;
+	}
+      if(type_id < 0)
+	{
+	  type_id = H5Dget_type(dataset);
+	  dims[1] = src_dims[1],dims[2] = src_dims[2];
+	}
+      else if(src_dims[1] != dims[1] || src_dims[2] != dims[2])
+	{
+	  error = "frame size differs in " + *s;
+	  H5Tclose(type_id);
+	  return false;
+	}
+      nb_frames.push_back(src_dims[0]);
+      dims[0] += src_dims[0];
+    }
+  _Hid type(type_id,H5Tclose);
+
+  _Hid dcpl(H5Pcreate(H5P_DATASET_CREATE),H5Pclose);
+  _Hid space(H5Screate_simple(3,dims,NULL),H5Sclose);
+  hsize_t start[3] = {0,0,0};
+  for(size_t i = 0;i < sources.size();++i)
+    {
+      hsize_t src_dims[3] = {nb_frames[i],dims[1],dims[2]};
+      _Hid src_space(H5Screate_simple(3,src_dims,NULL),H5Sclose);
+      if(H5Sselect_hyperslab(space,H5S_SELECT_SET,start,NULL,src_dims,NULL) < 0 ||
+	 H5Pset_virtual(dcpl,space,_basename(sources[i]).c_str(),
+			DATASET_PATH,src_space) < 0)
+	{
+	  error = "can't map " + sources[i];
+	  return false;
+	}
+      start[0] += nb_frames[i];
+    }
+  H5Sselect_all(space);
+
+  bool ok;
+  {
+    _Hid file(H5Fcreate(path.c_str(),H5F_ACC_TRUNC,H5P_DEFAULT,H5P_DEFAULT),H5Fclose);
+    if(!file.valid())
+      {
+	error = "can't create file";
+	return false;
+      }
+    _Hid lcpl(H5Pcreate(H5P_LINK_CREATE),H5Pclose);
+    H5Pset_create_intermediate_group(lcpl,1);
+    _Hid dataset(H5Dcreate2(file,DATASET_PATH,type,space,lcpl,dcpl,H5P_DEFAULT),
+		 H5Dclose);
+    ok = dataset.valid();
+  }
+  if(!ok)
+    {
+      error = "can't create virtual dataset";
+      unlink(path.c_str());
+    }
+  return ok;
+#else
+  error = "not supported";
+  return false;
+#endif
+}
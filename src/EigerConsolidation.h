@@ -0,0 +1,94 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef EIGERCONSOLIDATION_H
+#define EIGERCONSOLIDATION_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "lima/Debug.h"
+#include "lima/ThreadUtils.h"
+
+namespace lima
+{
+  namespace Eiger
+  {
+    class Camera;
+    /// Post-download step of the saving: a virtual dataset
+    /// <prefix>_vds.h5 over all the data files of the acquisition.
+    /// With files_per_container > 1, consecutive data files are first
+    /// stitched into <prefix>_container_%06d.h5 by direct chunk copy,
+    /// while the next ones are still downloaded.
+    class Consolidation
+    {
+      DEB_CLASS_NAMESPC(DebModCamera,"Consolidation","Eiger");
+    public:
+      Consolidation(Camera&);
+      ~Consolidation();
+
+      void setActive(bool active,int files_per_container = 1);
+      void getActive(bool& active,int& files_per_container) const;
+      bool isActive() const;
+      /// files are being consolidated or can be
+      bool isBusy() const;
+
+      void start(const std::string& directory,const std::string& prefix,
+		 int nb_files,int frames_per_file);
+      void stop();
+
+      /// called once a data file is completely downloaded
+      void fileDownloaded(const std::string& path,int first_frame,int nb_frames);
+    private:
+      class _ConsolidationThread;
+      friend class _ConsolidationThread;
+
+      typedef std::map<int,std::string> FileMap; // by file index
+      typedef std::vector<std::string> PathList;
+
+      bool _isReady() const;
+      bool _isCurrent(int acq_id) const;
+      bool _stitch(const PathList& files,const std::string& container,
+		   int acq_id,std::string& error);
+      bool _writeVirtual(const PathList& sources,const std::string& path,
+			 std::string& error);
+
+      Camera&		m_cam;
+      mutable Cond	m_cond;
+      bool		m_active;
+      int		m_files_per_container;
+      bool		m_quit;
+      int		m_acq_id;
+      bool		m_pending;
+      bool		m_working;
+      std::string	m_directory;
+      std::string	m_prefix;
+      int		m_nb_files;
+      int		m_frames_per_file;
+      int		m_next_file;
+      FileMap		m_files;
+      PathList		m_sources;
+      _ConsolidationThread* m_thread;
+    };
+  }
+}
+#endif	// EIGERCONSOLIDATION_H
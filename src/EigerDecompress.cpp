@@ -24,12 +24,14 @@
 
 #include "EigerDecompress.h"
 #include "EigerStream.h"
+#include "eigerapi/Metrics.h"
 
 #include "processlib/LinkTask.h"
 #include "processlib/ProcessExceptions.h"
 
 using namespace lima;
 using namespace lima::Eiger;
+using eigerapi::Metrics;
 
 class _DecompressTask : public LinkTask
 {
@@ -42,6 +44,11 @@ private:
     Stream& m_stream;
 };
 
+static double _elapsed_ms(Metrics::Clock::time_point begin)
+{
+    return std::chrono::duration<double, std::milli>(Metrics::Clock::now() - begin).count();
+}
+
 void _expend(void *src,Data& dst)
 {
     int nbItems = dst.size() / dst.depth();
@@ -58,13 +65,46 @@ void _expend(void *src,Data& dst)
 Data _DecompressTask::process(Data& src)
 {
     DEB_MEMBER_FUNCT();
-	clock_t begin_global = clock();
+    // wall time, the tasks run in parallel
+    static Metrics::Histogram& process_duration = Metrics::instance().histogram("decompress_process_ns");
+    static Metrics::Counter& nb_errors = Metrics::instance().counter("decompress_errors");
+    Metrics::Clock::time_point begin_global = Metrics::Clock::now();
+    std::shared_ptr<Stream::Message> msg;
     void *msg_data;
     size_t msg_size;
     int depth;
 
-    if(!m_stream.get_msg(src.data(),msg_data,msg_size,depth))
+    if(!m_stream.get_msg(src.data(),src.frameNumber,msg,msg_data,msg_size,depth))
+    {
+        nb_errors.add();
         throw ProcessException("_DecompressTask: can't find compressed message");
+    }
+
+    Decompress::decompressFrame(m_stream.getCompressionType(),msg_data,msg_size,depth,src);
+
+	process_duration.record_since(begin_global);
+	DEB_TRACE()<<"Process duration = "<<_elapsed_ms(begin_global)<<" (ms)";
+    return src;
+}
+
+Decompress::Decompress(Stream& stream) :
+  m_decompress_task(new _DecompressTask(stream))
+{
+}
+
+Decompress::~Decompress()
+{
+    m_decompress_task->unref();
+}
+
+void Decompress::decompressFrame(Camera::CompressionType compression_type,
+                                 void* msg_data,size_t msg_size,int depth,Data& src)
+{
+    DEB_STATIC_FUNCT();
+    // wall time, the tasks run in parallel
+    static Metrics::Histogram& lz4_duration = Metrics::instance().histogram("decompress_ns.lz4");
+    static Metrics::Histogram& bslz4_duration = Metrics::instance().histogram("decompress_ns.bslz4");
+    static Metrics::Counter& nb_errors = Metrics::instance().counter("decompress_errors");
 
     void* dst;
     int size;
@@ -85,19 +125,16 @@ Data _DecompressTask::process(Data& src)
 //	DEB_TRACE() << "msg size\t: " << msg_size  ;
 //	DEB_TRACE() << "depth\t: " << depth ;	
 	
-    // Checking the compression type
-    enum Camera::CompressionType compression_type = m_stream.getCompressionType();
-
     if(compression_type == Camera::CompressionType::LZ4)
     {        
-		clock_t begin = clock();
+		Metrics::Clock::time_point begin = Metrics::Clock::now();
 		int return_code = LZ4_decompress_fast((const char*)msg_data,(char*)dst,size);
-		clock_t end = clock();			
-		double elapsed_secs = double(end - begin) / CLOCKS_PER_SEC;
-		DEB_TRACE()<<"Decompression duration = "<<elapsed_secs*1000<<" (ms)";			
+		lz4_duration.record_since(begin);
+		DEB_TRACE()<<"Decompression duration = "<<_elapsed_ms(begin)<<" (ms)";
 
         if(return_code < 0)
         {
+            nb_errors.add();
             if(src.depth() == 4 && depth == 2) 
 				free(dst);
 
@@ -113,7 +150,7 @@ Data _DecompressTask::process(Data& src)
     else
     if(compression_type == Camera::CompressionType::BSLZ4)
     {
-		clock_t begin = clock();		
+		Metrics::Clock::time_point begin = Metrics::Clock::now();
         const size_t elem_size  = depth;
         // the blocksize is defined big endian uint32 starting at byte 8, divided by element size.
         const size_t block_size = __builtin_bswap32(*((unsigned long *)(((char *)(msg_data)) + 8)) / elem_size); 
@@ -121,9 +158,8 @@ Data _DecompressTask::process(Data& src)
 
         // The data blob starts at bit 12
         int64_t return_code = bshuf_decompress_lz4((const char*)(((char *)msg_data) + 12),(char*)dst, elem_nb, elem_size, block_size);
-		clock_t end = clock();			
-		double elapsed_secs = double(end - begin) / CLOCKS_PER_SEC;
-		DEB_TRACE()<<"Decompression duration = "<<elapsed_secs*1000<<" (ms)";			
+		bslz4_duration.record_since(begin);
+		DEB_TRACE()<<"Decompression duration = "<<_elapsed_ms(begin)<<" (ms)";
 		
 //        DEB_TRACE() << "block_size : " << block_size;
 //        DEB_TRACE() << "elem_nb    : " << elem_nb   ;		
@@ -132,6 +168,7 @@ Data _DecompressTask::process(Data& src)
         {
             DEB_TRACE() << "return_code : " << return_code;
 
+            nb_errors.add();
             if(src.depth() == 4 && depth == 2) 
 				free(dst);
 
@@ -154,20 +191,6 @@ Data _DecompressTask::process(Data& src)
         _expend(dst,src);
         free(dst);
     }
-	clock_t end_global = clock();	
-	double elapsed_secs_global = double(end_global - begin_global) / CLOCKS_PER_SEC;
-	DEB_TRACE()<<"Process duration = "<<elapsed_secs_global*1000<<" (ms)";	
-    return src;
-}
-
-Decompress::Decompress(Stream& stream) :
-  m_decompress_task(new _DecompressTask(stream))
-{
-}
-
-Decompress::~Decompress()
-{
-    m_decompress_task->unref();
 }
 
 LinkTask* Decompress::getReconstructionTask()
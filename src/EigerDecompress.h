@@ -24,6 +24,9 @@
 
 #include "lima/Debug.h"
 #include "lima/HwReconstructionCtrlObj.h"
+#include "processlib/Data.h"
+
+#include "EigerCamera.h"
 
 namespace lima
 {
@@ -40,6 +43,11 @@ namespace lima
       virtual LinkTask* getReconstructionTask();
 
       void setActive(bool);
+
+      /// decompress a stream frame of depth bytes per pixel into data,
+      /// widened if data is 32 bit and the frame 16 bit; throws ProcessException
+      static void decompressFrame(Camera::CompressionType compression_type,
+				  void* msg_data,size_t msg_size,int depth,Data& data);
     private:
       LinkTask* m_decompress_task;
     };
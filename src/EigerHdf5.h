@@ -0,0 +1,81 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef EIGERHDF5_H
+#define EIGERHDF5_H
+
+// helpers for the files written by the detector filewriter
+#ifdef WITH_HDF5_SAVING
+#include <hdf5.h>
+// direct chunk read and write, in the high level library for 1.10.2 only
+#if H5_VERSION_GE(1,10,3)
+#define EIGER_H5_READ_CHUNK H5Dread_chunk
+#define EIGER_H5_WRITE_CHUNK H5Dwrite_chunk
+#elif H5_VERSION_GE(1,10,2)
+#include <hdf5_hl.h>
+#define EIGER_H5_READ_CHUNK H5DOread_chunk
+#define EIGER_H5_WRITE_CHUNK H5DOwrite_chunk
+#endif
+
+#include "lima/ThreadUtils.h"
+
+namespace lima
+{
+  namespace Eiger
+  {
+    // dataset written by the filewriter, one frame per chunk
+    static const char DATASET_PATH[] = "/entry/data/data";
+    static const H5Z_filter_t LZ4_FILTER = 32004;
+    static const H5Z_filter_t BSHUF_FILTER = 32008;
+
+    // The library is usually not built thread-safe: the read back and
+    // the consolidation threads hold this (recursive) lock for every call
+    inline Mutex& _hdf5Mutex()
+    {
+      static Mutex mutex;
+      return mutex;
+    }
+
+    // identifier closed when leaving the scope
+    class _Hid
+    {
+    public:
+      typedef herr_t (*CloseFunc)(hid_t);
+      _Hid(hid_t id,CloseFunc close) : m_id(id),m_close(close) {}
+      ~_Hid()
+      {
+	if(m_id < 0) return;
+	AutoMutex lock(_hdf5Mutex());
+	m_close(m_id);
+      }
+      operator hid_t() const {return m_id;}
+      bool valid() const {return m_id >= 0;}
+    private:
+      _Hid(const _Hid&);
+      _Hid& operator=(const _Hid&);
+      hid_t m_id;
+      CloseFunc m_close;
+    };
+  }
+}
+#endif
+
+#endif	// EIGERHDF5_H
@@ -26,6 +26,8 @@
 #include "EigerSavingCtrlObj.h"
 #include "EigerStream.h"
 #include "EigerDecompress.h"
+#include "EigerReadBack.h"
+#include <eigerapi/Tracer.h>
 
 using namespace lima;
 using namespace lima::Eiger;
@@ -54,6 +56,9 @@ Interface::Interface(Camera& cam) : m_cam(cam)
 
   m_decompress = new Decompress(*m_stream);
   m_cap_list.push_back(HwCap(m_decompress));
+
+  m_readback = new ReadBack(cam, *m_stream);
+  m_saving->setReadBack(m_readback);
 }
 
 //-----------------------------------------------------
@@ -65,6 +70,7 @@ Interface::~Interface()
     delete m_det_info;
     delete m_sync;
     delete m_saving;
+    delete m_readback;
     delete m_stream;
     delete m_decompress;
 }
@@ -95,6 +101,7 @@ void Interface::reset(ResetLevel reset_level)
 void Interface::prepareAcq()
 {
     DEB_MEMBER_FUNCT();
+    eigerapi::Tracer::Span span("prepareAcq");
     m_stream->setActive(!m_saving->isActive());
     m_decompress->setActive(!m_saving->isActive());
     
@@ -109,9 +116,13 @@ void Interface::prepareAcq()
 void Interface::startAcq()
 {
     DEB_MEMBER_FUNCT();
+    eigerapi::Tracer::Span span("startAcq");
     // either we use eiger saving or the raw stream
     if(m_saving->isActive())
-      m_saving->start();
+      {
+	m_readback->start();
+	m_saving->start();
+      }
     else
       m_stream->start();
     m_cam.startAcq();
@@ -125,6 +136,7 @@ void Interface::stopAcq()
   DEB_MEMBER_FUNCT();
   m_cam.stopAcq();
   m_saving->stop();
+  m_readback->stop();
   m_stream->stop();
 }
 
@@ -196,3 +208,308 @@ void Interface::setDownloadDataFile(bool must_download)
     m_saving->setDownloadDataFile(must_download);
 }
 
+//-----------------------------------------------------
+// @brief parallel range download of each data file
+//-----------------------------------------------------
+void Interface::setDownloadSegments(int nb_segments, long segment_size)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving->setDownloadSegments(nb_segments, segment_size);
+}
+
+void Interface::getDownloadSegments(int& nb_segments, long& segment_size)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving->getDownloadSegments(nb_segments, segment_size);
+}
+
+//-----------------------------------------------------
+// @brief asynchronous (and direct) writes of the downloads
+//-----------------------------------------------------
+void Interface::setDownloadWriter(int nb_buffers, long buffer_size, bool direct_io)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving->setDownloadWriter(nb_buffers, buffer_size, direct_io);
+}
+
+void Interface::getDownloadWriter(int& nb_buffers, long& buffer_size, bool& direct_io)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving->getDownloadWriter(nb_buffers, buffer_size, direct_io);
+}
+
+//-----------------------------------------------------
+// @brief resume of the failed downloads
+//-----------------------------------------------------
+void Interface::setDownloadRetries(int max_retries, double delay)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving->setDownloadRetries(max_retries, delay);
+}
+
+void Interface::getDownloadRetries(int& max_retries, double& delay)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving->getDownloadRetries(max_retries, delay);
+}
+
+//-----------------------------------------------------
+// @brief bounds of the adaptive download concurrency
+//-----------------------------------------------------
+void Interface::setDownloadConcurrency(int min_concurrent, int max_concurrent)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving->setDownloadConcurrency(min_concurrent, max_concurrent);
+}
+
+void Interface::getDownloadConcurrency(int& min_concurrent, int& max_concurrent)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving->getDownloadConcurrency(min_concurrent, max_concurrent);
+}
+
+void Interface::getDownloadConcurrencyLimit(int& limit)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving->getDownloadConcurrencyLimit(limit);
+}
+
+void Interface::getDownloadThroughput(double& bytes_per_second)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving->getDownloadThroughput(bytes_per_second);
+}
+
+void Interface::getDownloadProgress(int& nb_frames_written, int& nb_files_downloaded,
+				    long& nb_bytes_downloaded)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving->getProgress(nb_frames_written, nb_files_downloaded, nb_bytes_downloaded);
+}
+
+//-----------------------------------------------------
+// @brief bandwidth of the downloads, commands get the rest
+//-----------------------------------------------------
+void Interface::setDownloadBandwidth(long master_file, long data_file)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving->setDownloadBandwidth(master_file, data_file);
+}
+
+void Interface::getDownloadBandwidth(long& master_file, long& data_file)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving->getDownloadBandwidth(master_file, data_file);
+}
+
+//-----------------------------------------------------
+// @brief batched deletes of the downloaded files
+//-----------------------------------------------------
+void Interface::setDeleteBatch(int nb_files, double max_delay)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving->setDeleteBatch(nb_files, max_delay);
+}
+
+void Interface::getDeleteBatch(int& nb_files, double& max_delay)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving->getDeleteBatch(nb_files, max_delay);
+}
+
+//-----------------------------------------------------
+// @brief DCU buffer watermarks, events and trigger throttle
+//-----------------------------------------------------
+void Interface::setBufferWatermarks(double low, double critical)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving->setBufferWatermarks(low, critical);
+}
+
+void Interface::getBufferWatermarks(double& low, double& critical)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving->getBufferWatermarks(low, critical);
+}
+
+void Interface::setBufferThrottle(bool throttle)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving->setBufferThrottle(throttle);
+}
+
+void Interface::getBufferThrottle(bool& throttle)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving->getBufferThrottle(throttle);
+}
+
+void Interface::getBufferStatus(double& buffer_free, double& trend, double& time_to_full)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving->getBufferStatus(buffer_free, trend, time_to_full);
+}
+
+//-----------------------------------------------------
+// @brief decompress the downloaded files into the buffer
+//-----------------------------------------------------
+void Interface::setSavingReadBack(bool active)
+{
+    DEB_MEMBER_FUNCT();
+    m_readback->setActive(active);
+}
+
+void Interface::getSavingReadBack(bool& active)
+{
+    DEB_MEMBER_FUNCT();
+    active = m_readback->isActive();
+}
+
+//-----------------------------------------------------
+// @brief virtual dataset over the downloaded files
+//-----------------------------------------------------
+void Interface::setSavingConsolidation(bool active, int files_per_container)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving->setConsolidation(active, files_per_container);
+}
+
+void Interface::getSavingConsolidation(bool& active, int& files_per_container)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving->getConsolidation(active, files_per_container);
+}
+
+//-----------------------------------------------------
+// @brief capture file of the stream messages
+//-----------------------------------------------------
+void Interface::setStreamCapture(const std::string& path)
+{
+    DEB_MEMBER_FUNCT();
+    m_stream->setCapture(path);
+}
+
+void Interface::getStreamCapture(std::string& path)
+{
+    DEB_MEMBER_FUNCT();
+    m_stream->getCapture(path);
+}
+
+void Interface::getMetrics(std::string& metrics)
+{
+    DEB_MEMBER_FUNCT();
+    m_cam.getMetrics(metrics);
+}
+
+void Interface::resetMetrics()
+{
+    DEB_MEMBER_FUNCT();
+    m_cam.resetMetrics();
+}
+
+void Interface::setTraceActive(bool active)
+{
+    DEB_MEMBER_FUNCT();
+    m_cam.setTraceActive(active);
+}
+
+void Interface::getTraceActive(bool& active)
+{
+    DEB_MEMBER_FUNCT();
+    m_cam.getTraceActive(active);
+}
+
+void Interface::dumpTrace(const std::string& path)
+{
+    DEB_MEMBER_FUNCT();
+    m_cam.dumpTrace(path);
+}
+
+void Interface::setMetricsEndpoint(const std::string& address)
+{
+    DEB_MEMBER_FUNCT();
+    m_cam.setMetricsEndpoint(address);
+}
+
+void Interface::getMetricsEndpoint(std::string& address)
+{
+    DEB_MEMBER_FUNCT();
+    m_cam.getMetricsEndpoint(address);
+}
+
+//-----------------------------------------------------
+// @brief huge pages and NUMA placement of the frame buffers
+//-----------------------------------------------------
+void Interface::setFrameBufferAllocation(long page_size, int numa_node,
+					  bool numa_interleave, bool prefault)
+{
+    DEB_MEMBER_FUNCT();
+    FrameBufferAllocMgr::Policy policy;
+    policy.page_size = page_size;
+    policy.numa_node = numa_node;
+    policy.numa_interleave = numa_interleave;
+    policy.prefault = prefault;
+    m_stream->setBufferAllocPolicy(policy);
+}
+
+void Interface::getFrameBufferAllocation(long& page_size, int& numa_node,
+					  bool& numa_interleave, bool& prefault)
+{
+    DEB_MEMBER_FUNCT();
+    FrameBufferAllocMgr::Policy policy;
+    m_stream->getBufferAllocPolicy(policy);
+    page_size = policy.page_size;
+    numa_node = policy.numa_node;
+    numa_interleave = policy.numa_interleave;
+    prefault = policy.prefault;
+}
+
+//-----------------------------------------------------
+// @brief bounded memory of the in-flight stream frames
+//-----------------------------------------------------
+void Interface::setStreamMemoryLimit(long max_size)
+{
+    DEB_MEMBER_FUNCT();
+    m_stream->setMemoryLimit(max_size);
+}
+
+void Interface::getStreamMemoryLimit(long& max_size)
+{
+    DEB_MEMBER_FUNCT();
+    m_stream->getMemoryLimit(max_size);
+}
+
+void Interface::getStreamMemoryUsage(long& size)
+{
+    DEB_MEMBER_FUNCT();
+    m_stream->getMemoryUsage(size);
+}
+
+//-----------------------------------------------------
+// @brief compressed frame history
+//-----------------------------------------------------
+void Interface::setCompressedHistory(long max_size)
+{
+    DEB_MEMBER_FUNCT();
+    m_stream->setCompressedHistory(max_size);
+}
+
+void Interface::getCompressedHistory(long& max_size)
+{
+    DEB_MEMBER_FUNCT();
+    m_stream->getCompressedHistory(max_size);
+}
+
+void Interface::getCompressedHistoryStatus(int& first_frame, int& last_frame,
+					    int& nb_frames, long& size)
+{
+    DEB_MEMBER_FUNCT();
+    m_stream->getCompressedHistoryStatus(first_frame, last_frame, nb_frames, size);
+}
+
+void Interface::readCompressedFrame(int frame_nb, Data& data)
+{
+    DEB_MEMBER_FUNCT();
+    m_stream->readCompressedFrame(frame_nb, data);
+}
+
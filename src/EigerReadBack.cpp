@@ -0,0 +1,404 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "EigerHdf5.h"
+#include "EigerReadBack.h"
+#include "EigerCamera.h"
+#include "EigerStream.h"
+
+#ifdef EIGER_H5_READ_CHUNK
+#include "lz4.h"
+#include "bitshuffle-master/bitshuffle.h"
+#endif
+
+using namespace lima;
+using namespace lima::Eiger;
+
+#ifdef EIGER_H5_READ_CHUNK
+static const int BSHUF_LZ4_HEADER_SIZE = 12;
+
+static inline uint64_t _read_be64(const char* p)
+{
+  const unsigned char* u = (const unsigned char*)p;
+  uint64_t value = 0;
+  for(int i = 0;i < 8;++i)
+    value = (value << 8) | u[i];
+  return value;
+}
+
+static inline uint32_t _read_be32(const char* p)
+{
+  const unsigned char* u = (const unsigned char*)p;
+  return (uint32_t(u[0]) << 24) | (uint32_t(u[1]) << 16) |
+    (uint32_t(u[2]) << 8) | uint32_t(u[3]);
+}
+
+// chunk of the HDF5 LZ4 filter: total size, block size,
+// then each block prefixed with its compressed size
+static bool _decode_lz4(const char* src,size_t src_size,char* dst,size_t dst_size)
+{
+  if(src_size < BSHUF_LZ4_HEADER_SIZE ||
+     _read_be64(src) != dst_size)
+    return false;
+  size_t block_size = _read_be32(src + 8);
+  if(!block_size) return false;
+
+  const char* p = src + BSHUF_LZ4_HEADER_SIZE;
+  const char* end = src + src_size;
+  for(size_t done = 0;done < dst_size;)
+    {
+      size_t size = std::min(block_size,dst_size - done);
+      if(end - p < 4) return false;
+      size_t compressed_size = _read_be32(p);
+      p += 4;
+      if(size_t(end - p) < compressed_size) return false;
+      if(compressed_size == size)
+	memcpy(dst + done,p,size);
+      else if(LZ4_decompress_safe(p,dst + done,int(compressed_size),int(size)) != int(size))
+	return false;
+      p += compressed_size;
+      done += size;
+    }
+  return true;
+}
+
+// chunk of the bitshuffle filter: total size, block size in bytes
+static bool _decode_bslz4(const char* src,size_t src_size,char* dst,size_t dst_size,
+			  size_t elem_size)
+{
+  if(src_size < BSHUF_LZ4_HEADER_SIZE ||
+     _read_be64(src) != dst_size)
+    return false;
+  size_t block_size = _read_be32(src + 8) / elem_size;
+  int64_t result = bshuf_decompress_lz4(src + BSHUF_LZ4_HEADER_SIZE,dst,
+					dst_size / elem_size,elem_size,block_size);
+  return result >= 0 && size_t(result) <= src_size - BSHUF_LZ4_HEADER_SIZE;
+}
+#endif
+
+/*----------------------------------------------------------------------------
+			    Read back thread
+----------------------------------------------------------------------------*/
+class ReadBack::_ReadBackThread : public Thread
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"ReadBack","_ReadBackThread");
+public:
+  _ReadBackThread(ReadBack&);
+  virtual ~_ReadBackThread();
+protected:
+  virtual void threadFunction();
+private:
+  ReadBack& m_read_back;
+};
+
+ReadBack::_ReadBackThread::_ReadBackThread(ReadBack& read_back) :
+  m_read_back(read_back)
+{
+  pthread_attr_setscope(&m_thread_attr,PTHREAD_SCOPE_PROCESS);
+}
+
+ReadBack::_ReadBackThread::~_ReadBackThread()
+{
+  AutoMutex lock(m_read_back.m_cond.mutex());
+  m_read_back.m_quit = true;
+  m_read_back.m_cond.broadcast();
+  lock.unlock();
+
+  join();
+}
+
+void ReadBack::_ReadBackThread::threadFunction()
+{
+  DEB_MEMBER_FUNCT();
+  AutoMutex lock(m_read_back.m_cond.mutex());
+  FileMap& files = m_read_back.m_files;
+
+  while(!m_read_back.m_quit)
+    {
+      // files are read in frame order, whatever the download order
+      while(!m_read_back.m_quit &&
+	    (files.empty() || files.begin()->first != m_read_back.m_next_frame))
+	m_read_back.m_cond.wait();
+      if(m_read_back.m_quit) break;
+
+      FileMap::iterator i = files.begin();
+      int first_frame = i->first;
+      _File file = i->second;
+      files.erase(i);
+      int acq_id = m_read_back.m_acq_id;
+      lock.unlock();
+
+      std::string error;
+      bool ok = m_read_back._readFile(file,first_frame,acq_id,error);
+      if(!ok)
+	{
+	  DEB_WARNING() << "Read back of " << file.path << " failed: " << error;
+	  Event *event = new Event(Hardware,Event::Warning,Event::Saving,
+				   Event::Default,
+				   "Read back of " + file.path + " failed: " + error);
+	  m_read_back.m_cam.reportEvent(event);
+	}
+
+      lock.lock();
+      // a failed file is skipped, the next ones are still displayed
+      if(acq_id == m_read_back.m_acq_id)
+	m_read_back.m_next_frame = first_frame + file.nb_frames;
+    }
+}
+
+/*----------------------------------------------------------------------------
+				ReadBack
+----------------------------------------------------------------------------*/
+ReadBack::ReadBack(Camera& cam,Stream& stream) :
+  m_cam(cam),
+  m_buffer_mgr(stream.getBufferMgr()),
+  m_active(false),
+  m_quit(false),
+  m_acq_id(0),
+  m_next_frame(0)
+{
+  DEB_CONSTRUCTOR();
+  m_thread = new _ReadBackThread(*this);
+  m_thread->start();
+}
+
+ReadBack::~ReadBack()
+{
+  DEB_DESTRUCTOR();
+  delete m_thread;
+}
+
+void ReadBack::setActive(bool active)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(active);
+#ifndef EIGER_H5_READ_CHUNK
+  if(active)
+    THROW_HW_ERROR(NotSupported) << "Plugin compiled without HDF5 >= 1.10.2 support";
+#endif
+  AutoMutex lock(m_cond.mutex());
+  m_active = active;
+}
+
+bool ReadBack::isActive() const
+{
+  AutoMutex lock(m_cond.mutex());
+  return m_active;
+}
+
+void ReadBack::start()
+{
+  DEB_MEMBER_FUNCT();
+  AutoMutex lock(m_cond.mutex());
+  ++m_acq_id;
+  m_next_frame = 0;
+  m_files.clear();
+  if(m_active)
+    m_buffer_mgr.setStartTimestamp(Timestamp::now());
+}
+
+void ReadBack::stop()
+{
+  DEB_MEMBER_FUNCT();
+  AutoMutex lock(m_cond.mutex());
+  // abort the file being read
+  ++m_acq_id;
+  m_files.clear();
+}
+
+void ReadBack::fileDownloaded(const std::string& path,int first_frame,int nb_frames)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR3(path,first_frame,nb_frames);
+
+  AutoMutex lock(m_cond.mutex());
+  if(!m_active || first_frame < m_next_frame) return;
+  _File& file = m_files[first_frame];
+  file.path = path;
+  file.nb_frames = nb_frames;
+  m_cond.broadcast();
+}
+
+bool ReadBack::_isCurrent(int acq_id) const
+{
+  AutoMutex lock(m_cond.mutex());
+  return !m_quit && acq_id == m_acq_id;
+}
+
+bool ReadBack::_readFile(const _File& file,int first_frame,int acq_id,
+			 std::string& error)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR3(file.path,first_frame,file.nb_frames);
+#ifdef EIGER_H5_READ_CHUNK
+  // released while a chunk is decoded
+  AutoMutex h5_lock(_hdf5Mutex());
+  _Hid h5_file(H5Fopen(file.path.c_str(),H5F_ACC_RDONLY,H5P_DEFAULT),H5Fclose);
+  if(!h5_file.valid())
+    {
+      error = "can't open file";
+      return false;
+    }
+  _Hid dataset(H5Dopen2(h5_file,DATASET_PATH,H5P_DEFAULT),H5Dclose);
+  if(!dataset.valid())
+    {
+      error = std::string("can't open dataset ") + DATASET_PATH;
+      return false;
+    }
+
+  _Hid space(H5Dget_space(dataset),H5Sclose);
+  hsize_t dims[3];
+  if(!space.valid() || H5Sget_simple_extent_ndims(space) != 3 ||
+     H5Sget_simple_extent_dims(space,dims,NULL) != 3)
+    {
+      error = "dataset is not a 3D stack";
+      return false;
+    }
+
+  _Hid type(H5Dget_type(dataset),H5Tclose);
+  size_t elem_size = type.valid() ? H5Tget_size(type) : 0;
+
+  _Hid dcpl(H5Dget_create_plist(dataset),H5Pclose);
+  hsize_t chunk_dims[3];
+  if(!dcpl.valid() || H5Pget_layout(dcpl) != H5D_CHUNKED ||
+     H5Pget_chunk(dcpl,3,chunk_dims) != 3 ||
+     chunk_dims[0] != 1 || chunk_dims[1] != dims[1] || chunk_dims[2] != dims[2])
+    {
+      error = "one frame per chunk expected";
+      return false;
+    }
+
+  H5Z_filter_t filter = H5Z_FILTER_NONE;
+  int nb_filters = H5Pget_nfilters(dcpl);
+  if(nb_filters > 1)
+    {
+      error = "more than one filter";
+      return false;
+    }
+  else if(nb_filters == 1)
+    {
+      unsigned int flags;
+      size_t nb_values = 0;
+      filter = H5Pget_filter2(dcpl,0,&flags,&nb_values,NULL,0,NULL,NULL);
+      if(filter != LZ4_FILTER && filter != BSHUF_FILTER)
+	{
+	  error = "unknown filter";
+	  return false;
+	}
+    }
+
+  h5_lock.unlock();
+
+  FrameDim frame_dim;
+  m_buffer_mgr.getFrameDim(frame_dim);
+  const Size& size = frame_dim.getSize();
+  size_t depth = frame_dim.getDepth();
+  if(hsize_t(size.getWidth()) != dims[2] || hsize_t(size.getHeight()) != dims[1])
+    {
+      error = "frame size differs from the buffer one";
+      return false;
+    }
+  // the buffer may be 32 bits while the detector saves 16 bits
+  if(depth != elem_size && !(depth == 4 && elem_size == 2))
+    {
+      error = "pixel depth differs from the buffer one";
+      return false;
+    }
+
+  size_t nb_pixels = dims[1] * dims[2];
+  size_t frame_size = nb_pixels * elem_size;
+  int nb_frames = std::min(hsize_t(file.nb_frames),dims[0]);
+  // sized from each chunk storage
+  std::vector<char> chunk;
+  std::vector<char> frame(depth != elem_size ? frame_size : 0);
+
+  bool is_absolute = m_cam.getTimestampType() == "ABSOLUTE";
+  for(int i = 0;i < nb_frames;++i)
+    {
+      // stopped or restarted meanwhile
+      if(!_isCurrent(acq_id)) return true;
+
+      hsize_t offset[3] = {hsize_t(i),0,0};
+      uint32_t filter_mask = 0;
+      hsize_t storage_size;
+      h5_lock.lock();
+      if(H5Dget_chunk_storage_size(dataset,offset,&storage_size) < 0 || !storage_size)
+	{
+	  error = "can't get chunk size";
+	  return false;
+	}
+      if(storage_size > chunk.size())
+	chunk.resize(storage_size);
+      size_t chunk_size = storage_size;
+      herr_t status = EIGER_H5_READ_CHUNK(dataset,H5P_DEFAULT,offset,&filter_mask,chunk.data());
+      h5_lock.unlock();
+      if(status < 0)
+	{
+	  error = "can't read chunk";
+	  return false;
+	}
+
+      int frame_nb = first_frame + i;
+      char* buffer = (char*)m_buffer_mgr.getFrameBufferPtr(frame_nb);
+      char* dst = frame.empty() ? buffer : frame.data();
+      bool decoded;
+      // bit 0 of the mask set: the filter was skipped for this chunk
+      if(filter == H5Z_FILTER_NONE || (filter_mask & 1))
+	{
+	  decoded = chunk_size >= frame_size;
+	  if(decoded) memcpy(dst,chunk.data(),frame_size);
+	}
+      else if(filter == LZ4_FILTER)
+	decoded = _decode_lz4(chunk.data(),chunk_size,dst,frame_size);
+      else
+	decoded = _decode_bslz4(chunk.data(),chunk_size,dst,frame_size,elem_size);
+      if(!decoded)
+	{
+	  error = "can't decode chunk";
+	  return false;
+	}
+
+      if(!frame.empty())
+	{
+	  const uint16_t* src = (const uint16_t*)frame.data();
+	  uint32_t* pixels = (uint32_t*)buffer;
+	  for(size_t p = 0;p < nb_pixels;++p)
+	    pixels[p] = src[p];
+	}
+
+      HwFrameInfoType frame_info;
+      frame_info.acq_frame_nb = frame_nb;
+      if(is_absolute)
+	frame_info.frame_timestamp = Timestamp::now();
+      if(!m_buffer_mgr.newFrameReady(frame_info))
+	return true;
+    }
+  DEB_TRACE() << DEB_VAR2(file.path,nb_frames);
+  return true;
+#else
+  error = "not supported";
+  return false;
+#endif
+}
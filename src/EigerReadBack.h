@@ -0,0 +1,81 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef EIGERREADBACK_H
+#define EIGERREADBACK_H
+
+#include <map>
+#include <string>
+
+#include "lima/Debug.h"
+#include "lima/ThreadUtils.h"
+#include "lima/HwBufferMgr.h"
+
+namespace lima
+{
+  namespace Eiger
+  {
+    class Camera;
+    class Stream;
+    /// Live feed in saving mode: the chunks of each downloaded
+    /// data file are decompressed into the stream buffer, in frame order.
+    class ReadBack
+    {
+      DEB_CLASS_NAMESPC(DebModCamera,"ReadBack","Eiger");
+    public:
+      ReadBack(Camera&,Stream&);
+      ~ReadBack();
+
+      void setActive(bool);
+      bool isActive() const;
+
+      void start();
+      void stop();
+
+      /// called once a data file is completely downloaded
+      void fileDownloaded(const std::string& path,int first_frame,int nb_frames);
+    private:
+      class _ReadBackThread;
+      friend class _ReadBackThread;
+
+      struct _File
+      {
+	std::string path;
+	int nb_frames;
+      };
+      typedef std::map<int,_File> FileMap; // by first frame
+
+      bool _isCurrent(int acq_id) const;
+      bool _readFile(const _File&,int first_frame,int acq_id,std::string& error);
+
+      Camera&		m_cam;
+      StdBufferCbMgr&	m_buffer_mgr;
+      mutable Cond	m_cond;
+      bool		m_active;
+      bool		m_quit;
+      int		m_acq_id;
+      int		m_next_frame;
+      FileMap		m_files;
+      _ReadBackThread*	m_thread;
+    };
+  }
+}
+#endif	// EIGERREADBACK_H
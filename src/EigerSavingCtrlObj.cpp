@@ -20,16 +20,31 @@
 // along with this program; if not, see <http://www.gnu.org/licenses/>.
 //###########################################################################
 #include <algorithm>
+#include <cmath>
+#include <sys/stat.h>
 #include "EigerSavingCtrlObj.h"
+#include "EigerReadBack.h"
+#include "EigerConsolidation.h"
 
 #include <eigerapi/Requests.h>
 #include <eigerapi/EigerDefines.h>
+#include <eigerapi/Metrics.h>
 
 using namespace lima;
 using namespace lima::Eiger;
 using namespace eigerapi;
 
-const int MAX_SIMULTANEOUS_DOWNLOAD = 4;
+const int DEFAULT_CONCURRENT_DOWNLOAD = 4;
+const long DEFAULT_SEGMENT_SIZE = 64 * 1024 * 1024;
+const long DEFAULT_WRITE_BUFFER_SIZE = 4 * 1024 * 1024;
+const int DEFAULT_DOWNLOAD_RETRIES = 3;
+const double DEFAULT_RETRY_DELAY = 1.;
+const double BUFFER_POLL_PERIOD = 1.;
+// file readiness prediction, in second
+static const double READINESS_MIN_POLL = 0.05;
+static const double READINESS_MAX_POLL = 1.;
+static const double READINESS_MAX_WAIT = 10.;
+static const double READINESS_PERIOD_GAIN = 0.3;
 
 /*----------------------------------------------------------------------------
 				 HDF5 HEADER
@@ -55,6 +70,287 @@ static HeaderKey2Index available_header[] = {
 	{"wavelength", Requests::HEADER_WAVELENGTH},
 };
 
+/*----------------------------------------------------------------------------
+			  Concurrent download controller
+----------------------------------------------------------------------------*/
+// AIMD on the number of concurrent downloads, driven by the measured
+// aggregate throughput and the DCU buffer occupancy.
+// Every call must be done under the SavingCtrlObj lock.
+class SavingCtrlObj::_ConcurrencyController
+{
+	DEB_CLASS_NAMESPC(DebModCamera, "SavingCtrlObj", "_ConcurrencyController");
+public:
+	_ConcurrencyController() :
+		m_min(DEFAULT_CONCURRENT_DOWNLOAD),
+		m_max(DEFAULT_CONCURRENT_DOWNLOAD),
+		m_limit(DEFAULT_CONCURRENT_DOWNLOAD),
+		m_throughput(0.),
+		m_max_buffer_free(0.)
+	{
+		reset();
+	}
+
+	void setBounds(int min_concurrent, int max_concurrent)
+	{
+		m_min = min_concurrent, m_max = max_concurrent;
+		m_limit = std::max(m_min, std::min(m_max, m_limit));
+	}
+	void getBounds(int& min_concurrent, int& max_concurrent) const
+	{
+		min_concurrent = m_min, max_concurrent = m_max;
+	}
+	bool isAdaptive() const { return m_min < m_max; }
+	int limit() const { return m_limit; }
+	double throughput() const { return m_throughput; }
+
+	// new acquisition, keep the learned limit
+	void reset()
+	{
+		m_window_start = 0.;
+		m_window_bytes = 0;
+		m_window_nb_transfers = 0;
+		m_window_failed = false;
+		m_saturated = false;
+		m_last_increase = false;
+		m_max_buffer_free = 0.;
+	}
+
+	void transferFinished(long nb_bytes, bool ok)
+	{
+		m_window_bytes += nb_bytes;
+		++m_window_nb_transfers;
+		if(!ok) m_window_failed = true;
+	}
+
+	// the polling thread had to wait for a download slot
+	void saturated() { m_saturated = true; }
+
+	// buffer_free < 0 if unknown
+	void update(double buffer_free)
+	{
+		DEB_MEMBER_FUNCT();
+		double now = Timestamp::now();
+		if(m_window_start <= 0.)
+		{
+			m_window_start = now;
+			return;
+		}
+		double elapsed = now - m_window_start;
+		if(elapsed < MIN_WINDOW || !m_window_nb_transfers)
+			return;
+
+		double throughput = m_window_bytes / elapsed;
+		double previous = m_throughput;
+		m_throughput = throughput;
+
+		if(buffer_free > m_max_buffer_free)
+			m_max_buffer_free = buffer_free;
+		// the DCU buffer fills up, downloads don't keep up
+		bool buffer_low = buffer_free >= 0. &&
+			buffer_free < m_max_buffer_free * LOW_BUFFER_RATIO;
+
+		int limit = m_limit;
+		if(m_window_failed)					// multiplicative decrease
+			limit = std::max(m_min, m_limit / 2), m_last_increase = false;
+		else if(m_saturated &&
+				(throughput > previous * (1. + GAIN_THRESHOLD) || buffer_low))
+			limit = std::min(m_max, m_limit + 1), m_last_increase = true;
+		else if(m_last_increase && throughput < previous * (1. - GAIN_THRESHOLD))
+			limit = std::max(m_min, m_limit - 1), m_last_increase = false;
+
+		if(limit != m_limit)
+			DEB_TRACE() << "Concurrent download limit: " << m_limit << " -> " << limit
+						<< DEB_VAR3(throughput, previous, buffer_free);
+		m_limit = limit;
+
+		m_window_start = now;
+		m_window_bytes = 0;
+		m_window_nb_transfers = 0;
+		m_window_failed = false;
+		m_saturated = false;
+	}
+
+private:
+	static constexpr double MIN_WINDOW = 1.;		// second
+	static constexpr double GAIN_THRESHOLD = 0.05;
+	static constexpr double LOW_BUFFER_RATIO = 0.5;
+
+	int		m_min;
+	int		m_max;
+	int		m_limit;
+	double	m_throughput;
+	double	m_max_buffer_free;
+	double	m_window_start;
+	long	m_window_bytes;
+	int		m_window_nb_transfers;
+	bool	m_window_failed;
+	bool	m_saturated;
+	bool	m_last_increase;
+};
+
+/*----------------------------------------------------------------------------
+			  File readiness predictor
+----------------------------------------------------------------------------*/
+// Predicts when the filewriter publishes the next data file, from the
+// expected then the observed file period. The listing is requested at
+// that time, then with an exponential backoff while the file is late.
+// Every call must be done under the SavingCtrlObj lock.
+class SavingCtrlObj::_ReadinessPredictor
+{
+public:
+	_ReadinessPredictor() :
+		m_period(0.),
+		m_last_time(0.),
+		m_nb_files(0),
+		m_backoff(READINESS_MIN_POLL)
+	{}
+
+	// new acquisition, file_period <= 0 if unknown
+	void start(double file_period)
+	{
+		m_period = file_period;
+		m_last_time = Timestamp::now();
+		m_nb_files = 0;
+		m_backoff = _firstBackoff();
+	}
+
+	void filesReady(int nb_files)
+	{
+		double now = Timestamp::now();
+		double period = (now - m_last_time) / nb_files;
+		if(m_period > 0.)
+			m_period += READINESS_PERIOD_GAIN * (period - m_period);
+		else
+			m_period = period;
+		m_nb_files += nb_files;
+		m_last_time = now;
+		m_backoff = _firstBackoff();
+	}
+
+	// delay before the next listing, files_due if they should be
+	// already written (i.e: the acquisition is finished)
+	double nextPoll(bool files_due)
+	{
+		double delay = -1.;
+		if(m_period > 0.)
+			delay = m_last_time + m_period - double(Timestamp::now());
+		if(delay <= 0. || files_due)
+		{
+			delay = delay > 0. ? std::min(delay, m_backoff) : m_backoff;
+			m_backoff = std::min(m_backoff * 2., READINESS_MAX_POLL);
+		}
+		return std::max(READINESS_MIN_POLL, std::min(delay, READINESS_MAX_WAIT));
+	}
+
+private:
+	double _firstBackoff() const
+	{
+		return std::max(READINESS_MIN_POLL, std::min(READINESS_MAX_POLL, m_period / 10.));
+	}
+
+	double	m_period;
+	double	m_last_time;
+	int		m_nb_files;
+	double	m_backoff;
+};
+
+/*----------------------------------------------------------------------------
+			  DCU buffer monitor
+----------------------------------------------------------------------------*/
+// Tracks the filewriter free buffer and its trend during the acquisition,
+// and classifies it against the watermarks, with an hysteresis to leave
+// a level. A watermark <= 0 is disabled.
+// Every call must be done under the SavingCtrlObj lock.
+class SavingCtrlObj::_BufferMonitor
+{
+public:
+	enum Level {NORMAL, LOW, CRITICAL};
+
+	_BufferMonitor() :
+		m_warning(0.),
+		m_critical(0.),
+		m_throttle(false)
+	{
+		reset();
+	}
+
+	void setWatermarks(double warning, double critical)
+	{
+		m_warning = warning, m_critical = critical;
+	}
+	void getWatermarks(double& warning, double& critical) const
+	{
+		warning = m_warning, critical = m_critical;
+	}
+	void setThrottle(bool throttle) { m_throttle = throttle; }
+	bool throttle() const { return m_throttle; }
+	bool isEnabled() const { return m_warning > 0. || m_critical > 0.; }
+
+	Level level() const { return m_level; }
+	double bufferFree() const { return m_free; }
+	// free buffer variation per second, < 0 while filling up
+	double trend() const { return m_trend; }
+	// seconds until the buffer is full at the current trend, -1 if not filling
+	double timeToFull() const
+	{
+		return m_free >= 0. && m_trend < 0. ? m_free / -m_trend : -1.;
+	}
+
+	void reset()
+	{
+		m_free = -1.;
+		m_trend = 0.;
+		m_last_time = 0.;
+		m_level = NORMAL;
+	}
+
+	// returns true if the level changed
+	bool sample(double buffer_free)
+	{
+		double now = Timestamp::now();
+		if(m_free >= 0. && now > m_last_time)
+		{
+			double trend = (buffer_free - m_free) / (now - m_last_time);
+			m_trend += TREND_GAIN * (trend - m_trend);
+		}
+		m_free = buffer_free;
+		m_last_time = now;
+
+		Level level = NORMAL;
+		if(_below(m_critical, m_level == CRITICAL))
+			level = CRITICAL;
+		else if(_below(m_warning, m_level != NORMAL))
+			level = LOW;
+		bool changed = level != m_level;
+		m_level = level;
+		return changed;
+	}
+
+private:
+	static constexpr double TREND_GAIN = 0.3;
+	static constexpr double HYSTERESIS = 0.1;
+
+	bool _below(double watermark, bool in_level) const
+	{
+		if(watermark <= 0.) return false;
+		return m_free < (in_level ? watermark * (1. + HYSTERESIS) : watermark);
+	}
+
+	double	m_warning;
+	double	m_critical;
+	bool	m_throttle;
+	double	m_free;
+	double	m_trend;
+	double	m_last_time;
+	Level	m_level;
+};
+
+static inline Requests::Param::StringRef string_ref(const std::string& s)
+{
+	Requests::Param::StringRef ref = {s.data(), int(s.size())};
+	return ref;
+}
+
 /*----------------------------------------------------------------------------
 				Polling thread
 ----------------------------------------------------------------------------*/
@@ -67,6 +363,26 @@ public:
 protected:
 	virtual void threadFunction();
 private:
+	double _retryDelay();
+	void _restartDownloads(AutoMutex&);
+
+	SavingCtrlObj& m_saving;
+	eigerapi::Requests* m_requests;
+};
+
+// samples the DCU buffer during the saving, independently of the
+// download loop which can wait for a free download slot
+class SavingCtrlObj::_BufferMonitorThread:public Thread
+{
+	DEB_CLASS_NAMESPC(DebModCamera, "SavingCtrlObj", "_BufferMonitorThread");
+public:
+	_BufferMonitorThread(SavingCtrlObj&, eigerapi::Requests*);
+	virtual ~_BufferMonitorThread();
+protected:
+	virtual void threadFunction();
+private:
+	void _levelChanged(AutoMutex&);
+
 	SavingCtrlObj& m_saving;
 	eigerapi::Requests* m_requests;
 };
@@ -79,11 +395,28 @@ m_nb_file_transfer_started(0),
 m_concurrent_download(0),
 m_poll_master_file(false),
 m_must_download_data_file(false),
+m_download_segments(1),
+m_download_segment_size(DEFAULT_SEGMENT_SIZE),
+m_download_write_buffers(0),
+m_download_write_buffer_size(DEFAULT_WRITE_BUFFER_SIZE),
+m_download_direct_io(false),
+m_download_max_retries(DEFAULT_DOWNLOAD_RETRIES),
+m_download_retry_delay(DEFAULT_RETRY_DELAY),
+m_nb_frames_written(0),
+m_nb_files_downloaded(0),
+m_nb_bytes_downloaded(0),
 m_quit(false),
-m_already_done(false)
+m_already_done(false),
+m_readback(NULL)
 {
+	m_concurrency = new _ConcurrencyController();
+	m_readiness = new _ReadinessPredictor();
+	m_buffer_monitor = new _BufferMonitor();
+	m_consolidation = new Consolidation(cam);
 	m_polling_thread = new _PollingThread(*this, this->m_cam.m_requests);
 	m_polling_thread->start();
+	m_buffer_monitor_thread = new _BufferMonitorThread(*this, this->m_cam.m_requests);
+	m_buffer_monitor_thread->start();
 	// Known keys for common header
 	int nb_header_key = sizeof(available_header) / sizeof(HeaderKey2Index);
 	for(int i = 0;i < nb_header_key;++i)
@@ -100,12 +433,22 @@ class SavingCtrlObj::_EndDownloadCallback:public CurlLoop::FutureRequest::Callba
 {
 	DEB_CLASS_NAMESPC(DebModCamera, "SavingCtrlObj", "_EndDownloadCallback");
 public:
-	_EndDownloadCallback(SavingCtrlObj&, const std::string &filename);
+	_EndDownloadCallback(SavingCtrlObj&, const std::string &filename,
+						 const std::shared_ptr<Requests::TransferState>&,
+						 int first_frame = 0, int nb_frames = 0,
+						 int attempt = 0);
 
 	virtual void status_changed(CurlLoop::FutureRequest::Status);
 private:
+	friend class _PollingThread;
+
 	SavingCtrlObj& m_saving;
 	std::string m_filename;
+	std::shared_ptr<Requests::TransferState> m_state;
+	int m_first_frame;
+	int m_nb_frames;
+	int m_attempt;
+	double m_retry_time;
 };
 /*----------------------------------------------------------------------------
 				SavingCtrlObj
@@ -113,6 +456,11 @@ private:
 SavingCtrlObj::~SavingCtrlObj()
 {
 	delete m_polling_thread;
+	delete m_buffer_monitor_thread;
+	delete m_concurrency;
+	delete m_readiness;
+	delete m_buffer_monitor;
+	delete m_consolidation;
 }
 
 /*----------------------------------------------------------------------------
@@ -130,24 +478,28 @@ void SavingCtrlObj::setCommonHeader(const HwSavingCtrlObj::HeaderMap& header)
 {
 	DEB_MEMBER_FUNCT();
 
-	std::list<std::shared_ptr < Requests::Param>> pending_request;
+	CurlLoop::FutureRequest::List pending_request;
 	for(HwSavingCtrlObj::HeaderMap::const_iterator i = header.begin();	i != header.end();++i)
 	{
 		std::map<std::string, int>::iterator header_index = m_availables_header_keys.find(i->first);
 		if(header_index == m_availables_header_keys.end())
 			THROW_HW_ERROR(Error) << "Header key: " << i->first << " not yet managed ";
-		pending_request.push_back(m_cam.m_requests->set_param(Requests::PARAM_NAME(header_index->second), i->second));
+		// the header keys are all numbers
+		char* end;
+		double value = strtod(i->second.c_str(), &end);
+		if(end == i->second.c_str() || *end)
+			THROW_HW_ERROR(Error) << "Header key: " << i->first << " invalid value: " << i->second;
+		pending_request.push_back(m_cam.m_requests->set_header(Requests::PARAM_NAME(header_index->second), value));
 	}
 
+	std::shared_ptr<CurlLoop::FutureRequest> all = CurlLoop::FutureRequest::when_all(pending_request);
 	try
 	{
-		for(std::list<std::shared_ptr < Requests::Param>>::iterator i = pending_request.begin(); i != pending_request.end();++i)
-			(*i)->wait();
+		all->wait();
 	}
 	catch(const eigerapi::EigerException &e)
 	{
-		for(std::list<std::shared_ptr < Requests::Param>>::iterator i = pending_request.begin();i != pending_request.end();++i)
-			m_cam.m_requests->cancel(*i);
+		m_cam.m_requests->cancel(all);
 		THROW_HW_ERROR(Error) << e.what();
 	}
 }
@@ -171,7 +523,8 @@ SavingCtrlObj::Status SavingCtrlObj::getStatus()
 	DEB_MEMBER_FUNCT();
 	AutoMutex lock(m_cond.mutex());
 	bool status = m_poll_master_file ||
-	 (m_nb_file_to_watch != m_nb_file_transfer_started);
+	 (m_nb_file_to_watch != m_nb_file_transfer_started) ||
+	 !m_retries.empty() || m_consolidation->isBusy();
 	DEB_RETURN() << DEB_VAR2(status, m_error_msg);
 	if(m_error_msg.empty())
 		return status ? RUNNING : IDLE;
@@ -185,6 +538,8 @@ void SavingCtrlObj::stop()
 	AutoMutex lock(m_cond.mutex());
 	m_nb_file_transfer_started = m_nb_file_to_watch = 0;
 	m_poll_master_file = false;
+	m_retries.clear();
+	m_consolidation->stop();
 }
 
 void SavingCtrlObj::_setActive(bool active, int stream_idx)
@@ -195,7 +550,7 @@ void SavingCtrlObj::_setActive(bool active, int stream_idx)
   	if(!m_already_done)
   	{
 		const char *active_str = active ? "enabled" : "disabled";
-		std::shared_ptr<Requests::Param> active_req = m_cam.m_requests->set_param(Requests::FILEWRITER_MODE, active_str);
+		std::shared_ptr<Requests::Param> active_req = m_cam.m_requests->set<Requests::FILEWRITER_MODE>(active_str);
 		DEB_TRACE() << "FILEWRITER_MODE: " << DEB_VAR1(active_str);
 		active_req->wait();
 		m_already_done = true;
@@ -208,12 +563,11 @@ void SavingCtrlObj::_prepare(int stream_idx)
 
 	int frames_per_file = int(m_frames_per_file);
 	std::shared_ptr<Requests::Param> nb_image_per_file_req =
-	 m_cam.m_requests->set_param(Requests::NIMAGES_PER_FILE,
-								 frames_per_file);
+	 m_cam.m_requests->set<Requests::NIMAGES_PER_FILE>(frames_per_file);
 	DEB_TRACE() << "NIMAGES_PER_FILE: " << DEB_VAR1(frames_per_file);
 
 	std::shared_ptr<Requests::Param> name_pattern_req =
-	 m_cam.m_requests->set_param(Requests::FILEWRITER_NAME_PATTERN, m_prefix);
+	 m_cam.m_requests->set<Requests::FILEWRITER_NAME_PATTERN>(m_prefix);
 	DEB_TRACE() << "FILEWRITER_NAME_PATTERN: " << DEB_VAR1(m_prefix);
 
 	nb_image_per_file_req->wait(), name_pattern_req->wait();
@@ -221,6 +575,9 @@ void SavingCtrlObj::_prepare(int stream_idx)
 	AutoMutex lock(m_cond.mutex());
 	m_nb_file_transfer_started = m_nb_file_to_watch = 0;
 	m_poll_master_file = true;
+	m_retries.clear();
+	m_concurrency->reset();
+	m_buffer_monitor->reset();
 }
 
 void SavingCtrlObj::_start(int stream_idx)
@@ -232,17 +589,45 @@ void SavingCtrlObj::_start(int stream_idx)
 	m_cam.getNbFrames(nb_frames);
 	double expo_time;
 	m_cam.getExpTime(expo_time);
+	double lat_time;
+	m_cam.getLatTime(lat_time);
 
 	AutoMutex lock(m_cond.mutex());
 	m_nb_file_transfer_started = 0;
+	m_file_stats.clear();
+	m_nb_frames_written = m_nb_files_downloaded = 0;
+	m_nb_bytes_downloaded = 0;
 	m_nb_file_to_watch = nb_frames / m_frames_per_file;
 	if(nb_frames % m_frames_per_file) ++m_nb_file_to_watch;
+	m_consolidation->start(m_directory, m_prefix,
+						   m_must_download_data_file ? m_nb_file_to_watch : 0,
+						   int(m_frames_per_file));
 
-	m_waiting_time = (expo_time * std::min(nb_frames, int(m_frames_per_file))) / 2.;
+	m_readiness->start((expo_time + lat_time) * std::min(nb_frames, int(m_frames_per_file)));
 
 	m_cond.broadcast();
 
-	DEB_TRACE() << DEB_VAR2(m_nb_file_to_watch, m_waiting_time);
+	DEB_TRACE() << DEB_VAR1(m_nb_file_to_watch);
+}
+
+// files of the series still to be listed or downloaded, called locked
+bool SavingCtrlObj::_isSaving()
+{
+	return m_poll_master_file ||
+		m_nb_file_transfer_started < m_nb_file_to_watch ||
+		m_concurrent_download > 0 || !m_retries.empty();
+}
+
+// start the accounting of a file found in the listing, called locked
+void SavingCtrlObj::_fileReady(const std::string& name, int first_frame, int nb_frames)
+{
+	FileStat& stat = m_file_stats[name];
+	stat.first_frame = first_frame;
+	stat.nb_frames = nb_frames;
+	stat.nb_bytes = 0;
+	stat.ready_time = Timestamp::now();
+	stat.download_time = -1.;
+	stat.nb_attempts = m_must_download_data_file ? 1 : 0;
 }
 
 //----------------------------------------------------------------------------
@@ -255,6 +640,282 @@ void SavingCtrlObj::setDownloadDataFile(bool must_download)
 	m_must_download_data_file = must_download;
 }
 
+//----------------------------------------------------------------------------
+// Data files are downloaded with up to nb_segments range requests
+// of at least segment_size bytes, 1 to disable
+//----------------------------------------------------------------------------
+void SavingCtrlObj::setDownloadSegments(int nb_segments, long segment_size)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(nb_segments, segment_size);
+	if(nb_segments < 1 || segment_size <= 0)
+		THROW_HW_ERROR(InvalidValue) << DEB_VAR2(nb_segments, segment_size);
+
+	AutoMutex lock(m_cond.mutex());
+	m_download_segments = nb_segments;
+	m_download_segment_size = segment_size;
+}
+
+void SavingCtrlObj::getDownloadSegments(int& nb_segments, long& segment_size)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex lock(m_cond.mutex());
+	nb_segments = m_download_segments;
+	segment_size = m_download_segment_size;
+	DEB_RETURN() << DEB_VAR2(nb_segments, segment_size);
+}
+
+//----------------------------------------------------------------------------
+// Downloaded data is written by a thread per file in buffers of
+// buffer_size bytes, at most nb_buffers waiting for the filesystem
+//----------------------------------------------------------------------------
+void SavingCtrlObj::setDownloadWriter(int nb_buffers, long buffer_size, bool direct_io)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR3(nb_buffers, buffer_size, direct_io);
+	if(nb_buffers < 0 || buffer_size <= 0)
+		THROW_HW_ERROR(InvalidValue) << DEB_VAR2(nb_buffers, buffer_size);
+
+	AutoMutex lock(m_cond.mutex());
+	m_download_write_buffers = nb_buffers;
+	m_download_write_buffer_size = buffer_size;
+	m_download_direct_io = direct_io;
+	// only apply to the next started transfers
+	if(nb_buffers)
+		m_cam.m_requests->set_sink_factory(Requests::async_file_sink_factory(buffer_size,
+																		   nb_buffers,
+																		   direct_io));
+	else
+		m_cam.m_requests->set_sink_factory(Requests::SinkFactory());
+}
+
+void SavingCtrlObj::getDownloadWriter(int& nb_buffers, long& buffer_size, bool& direct_io)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex lock(m_cond.mutex());
+	nb_buffers = m_download_write_buffers;
+	buffer_size = m_download_write_buffer_size;
+	direct_io = m_download_direct_io;
+	DEB_RETURN() << DEB_VAR3(nb_buffers, buffer_size, direct_io);
+}
+
+//----------------------------------------------------------------------------
+// A failed download is resumed from the data already written
+//----------------------------------------------------------------------------
+void SavingCtrlObj::setDownloadRetries(int max_retries, double delay)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(max_retries, delay);
+	if(max_retries < 0 || delay < 0.)
+		THROW_HW_ERROR(InvalidValue) << DEB_VAR2(max_retries, delay);
+
+	AutoMutex lock(m_cond.mutex());
+	m_download_max_retries = max_retries;
+	m_download_retry_delay = delay;
+}
+
+void SavingCtrlObj::getDownloadRetries(int& max_retries, double& delay)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex lock(m_cond.mutex());
+	max_retries = m_download_max_retries;
+	delay = m_download_retry_delay;
+	DEB_RETURN() << DEB_VAR2(max_retries, delay);
+}
+
+//----------------------------------------------------------------------------
+// The number of concurrent downloads adapts between these bounds
+//----------------------------------------------------------------------------
+void SavingCtrlObj::setDownloadConcurrency(int min_concurrent, int max_concurrent)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(min_concurrent, max_concurrent);
+	if(min_concurrent < 1 || max_concurrent < min_concurrent)
+		THROW_HW_ERROR(InvalidValue) << DEB_VAR2(min_concurrent, max_concurrent);
+
+	AutoMutex lock(m_cond.mutex());
+	m_concurrency->setBounds(min_concurrent, max_concurrent);
+	m_cond.broadcast();
+}
+
+void SavingCtrlObj::getDownloadConcurrency(int& min_concurrent, int& max_concurrent)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex lock(m_cond.mutex());
+	m_concurrency->getBounds(min_concurrent, max_concurrent);
+	DEB_RETURN() << DEB_VAR2(min_concurrent, max_concurrent);
+}
+
+void SavingCtrlObj::getDownloadConcurrencyLimit(int& limit)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex lock(m_cond.mutex());
+	limit = m_concurrency->limit();
+	DEB_RETURN() << DEB_VAR1(limit);
+}
+
+void SavingCtrlObj::getDownloadThroughput(double& bytes_per_second)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex lock(m_cond.mutex());
+	bytes_per_second = m_concurrency->throughput();
+	DEB_RETURN() << DEB_VAR1(bytes_per_second);
+}
+
+//----------------------------------------------------------------------------
+// Receive bandwidth of the master and data file downloads in bytes/s,
+// 0 for unlimited, what is left goes to the detector commands
+//----------------------------------------------------------------------------
+void SavingCtrlObj::setDownloadBandwidth(long master_file, long data_file)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(master_file, data_file);
+	if(master_file < 0 || data_file < 0)
+		THROW_HW_ERROR(InvalidValue) << DEB_VAR2(master_file, data_file);
+
+	Requests* requests = m_cam.m_requests;
+	int max_active;
+	long max_recv_speed;
+	requests->get_class_limits(CurlLoop::FutureRequest::MASTER_FILE, max_active, max_recv_speed);
+	requests->set_class_limits(CurlLoop::FutureRequest::MASTER_FILE, max_active, master_file);
+	requests->get_class_limits(CurlLoop::FutureRequest::DATA_FILE, max_active, max_recv_speed);
+	requests->set_class_limits(CurlLoop::FutureRequest::DATA_FILE, max_active, data_file);
+}
+
+void SavingCtrlObj::getDownloadBandwidth(long& master_file, long& data_file)
+{
+	DEB_MEMBER_FUNCT();
+	int max_active;
+	m_cam.m_requests->get_class_limits(CurlLoop::FutureRequest::MASTER_FILE, max_active, master_file);
+	m_cam.m_requests->get_class_limits(CurlLoop::FutureRequest::DATA_FILE, max_active, data_file);
+	DEB_RETURN() << DEB_VAR2(master_file, data_file);
+}
+
+//----------------------------------------------------------------------------
+// Downloaded files are deleted once no download is running, or by
+// nb_files or after max_delay seconds
+//----------------------------------------------------------------------------
+void SavingCtrlObj::setDeleteBatch(int nb_files, double max_delay)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(nb_files, max_delay);
+	if(nb_files < 1 || max_delay < 0.)
+		THROW_HW_ERROR(InvalidValue) << DEB_VAR2(nb_files, max_delay);
+	m_cam.m_requests->set_cleanup_batch(nb_files, max_delay);
+}
+
+void SavingCtrlObj::getDeleteBatch(int& nb_files, double& max_delay)
+{
+	DEB_MEMBER_FUNCT();
+	m_cam.m_requests->get_cleanup_batch(nb_files, max_delay);
+	DEB_RETURN() << DEB_VAR2(nb_files, max_delay);
+}
+
+//----------------------------------------------------------------------------
+// Events are reported when the DCU free buffer goes below the watermarks
+// (in the unit of the filewriter buffer_free, kB), <= 0 to disable.
+// With throttle, the internal multiple triggers are held while critical.
+//----------------------------------------------------------------------------
+void SavingCtrlObj::setBufferWatermarks(double low, double critical)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(low, critical);
+	if(low > 0. && critical > 0. && critical > low)
+		THROW_HW_ERROR(InvalidValue) << "critical watermark above the low one: "
+									 << DEB_VAR2(low, critical);
+
+	AutoMutex lock(m_cond.mutex());
+	m_buffer_monitor->setWatermarks(low, critical);
+	bool enabled = m_buffer_monitor->isEnabled();
+	if(!enabled)
+		m_buffer_monitor->reset();
+	m_cond.broadcast();
+	lock.unlock();
+	// nothing would release the held triggers
+	if(!enabled)
+		m_cam._pauseTrigger(false);
+}
+
+void SavingCtrlObj::getBufferWatermarks(double& low, double& critical)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex lock(m_cond.mutex());
+	m_buffer_monitor->getWatermarks(low, critical);
+	DEB_RETURN() << DEB_VAR2(low, critical);
+}
+
+void SavingCtrlObj::setBufferThrottle(bool throttle)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(throttle);
+	AutoMutex lock(m_cond.mutex());
+	m_buffer_monitor->setThrottle(throttle);
+	lock.unlock();
+	if(!throttle)
+		m_cam._pauseTrigger(false);
+}
+
+void SavingCtrlObj::getBufferThrottle(bool& throttle)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex lock(m_cond.mutex());
+	throttle = m_buffer_monitor->throttle();
+	DEB_RETURN() << DEB_VAR1(throttle);
+}
+
+// last sampled free buffer (-1 if unknown), its trend per second
+// and the time until full (-1 if not filling up)
+void SavingCtrlObj::getBufferStatus(double& buffer_free, double& trend, double& time_to_full)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex lock(m_cond.mutex());
+	buffer_free = m_buffer_monitor->bufferFree();
+	trend = m_buffer_monitor->trend();
+	time_to_full = m_buffer_monitor->timeToFull();
+	DEB_RETURN() << DEB_VAR3(buffer_free, trend, time_to_full);
+}
+
+void SavingCtrlObj::getFileStats(FileStatMap& file_stats)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex lock(m_cond.mutex());
+	file_stats = m_file_stats;
+}
+
+void SavingCtrlObj::getProgress(int& nb_frames_written, int& nb_files_downloaded,
+								long& nb_bytes_downloaded)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex lock(m_cond.mutex());
+	nb_frames_written = m_nb_frames_written;
+	nb_files_downloaded = m_nb_files_downloaded;
+	nb_bytes_downloaded = m_nb_bytes_downloaded;
+	DEB_RETURN() << DEB_VAR3(nb_frames_written, nb_files_downloaded, nb_bytes_downloaded);
+}
+
+//----------------------------------------------------------------------------
+// Virtual dataset over the downloaded data files, stitched by
+// files_per_container when > 1
+//----------------------------------------------------------------------------
+void SavingCtrlObj::setConsolidation(bool active, int files_per_container)
+{
+	DEB_MEMBER_FUNCT();
+	m_consolidation->setActive(active, files_per_container);
+}
+
+void SavingCtrlObj::getConsolidation(bool& active, int& files_per_container)
+{
+	DEB_MEMBER_FUNCT();
+	m_consolidation->getActive(active, files_per_container);
+}
+
+void SavingCtrlObj::setReadBack(ReadBack* readback)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex lock(m_cond.mutex());
+	m_readback = readback;
+}
+
 //----------------------------------------------------------------------------
 //
 //----------------------------------------------------------------------------
@@ -279,18 +940,26 @@ SavingCtrlObj::_PollingThread::~_PollingThread()
 void SavingCtrlObj::_PollingThread::threadFunction()
 {
 	DEB_MEMBER_FUNCT();
+	static Metrics::Gauge& download_speed = Metrics::instance().gauge("download_bytes_per_second");
+	static Metrics::Gauge& dcu_buffer_free = Metrics::instance().gauge("dcu_buffer_free_kb");
 	AutoMutex lock(m_saving.m_cond.mutex());
 
 	while(!m_saving.m_quit)
 	{
+		_restartDownloads(lock);
 		while(!m_saving.m_quit &&
-			  (m_saving.m_concurrent_download >= MAX_SIMULTANEOUS_DOWNLOAD ||
+			  (m_saving.m_concurrent_download >= m_saving.m_concurrency->limit() ||
 			   (!m_saving.m_poll_master_file &&
 				(m_saving.m_nb_file_to_watch ==
 				 m_saving.m_nb_file_transfer_started))))
 		{
 			m_saving.m_cond.broadcast();
-			m_saving.m_cond.wait();
+			double retry_delay = _retryDelay();
+			if(retry_delay < 0.)
+				m_saving.m_cond.wait();
+			else if(retry_delay > 0.)
+				m_saving.m_cond.wait(retry_delay);
+			_restartDownloads(lock);
 		}
 
 		if(m_saving.m_quit) break;
@@ -306,41 +975,86 @@ void SavingCtrlObj::_PollingThread::threadFunction()
 		int frames_per_file = m_saving.m_frames_per_file;
 		lock.unlock();
 
-		Requests::Param::Value files;
+		// the remaining files are due once the filewriter leaves "acquire",
+		// until then the predicted file period paces the listing.
+		// Not the camera status: with the external triggers it never
+		// reports the exposure.
+		bool files_due = false;
+		double status_age;
+		m_saving.m_cam.getStatusAge(status_age);
+		if(status_age >= 0.)
+		{
+			std::string filewriter_status;
+			m_saving.m_cam.getFilewriterStatus(filewriter_status);
+			files_due = filewriter_status != "acquire";
+		}
+
+		// name references stay valid while ls_req is alive
+		Requests::Param::StringList files;
 		//Ls request
 		std::shared_ptr<Requests::Param> ls_req = m_requests->get_param(Requests::FILEWRITER_LS);
+		// DCU buffer occupancy drives the download concurrency
+		double buffer_free = -1.;
+		std::shared_ptr<Requests::Param> buffer_free_req;
+		if(m_saving.m_concurrency->isAdaptive())
+			buffer_free_req = m_requests->get<Requests::FILEWRITER_BUFFER_FREE>(buffer_free);
 		try
 		{
-			files = ls_req->get();
+			files = ls_req->get_string_list();
 		}
 		catch(eigerapi::EigerException& e)
 		{
 			m_requests->cancel(ls_req);
+			if(buffer_free_req) m_requests->cancel(buffer_free_req);
 			DEB_WARNING() << "ls failed, continue: " << e.what();
+			lock.lock();
+			m_saving.m_cond.wait(m_saving.m_readiness->nextPoll(true));
 			continue;
 		}
+		if(buffer_free_req)
+		{
+			try
+			{
+				buffer_free_req->wait();
+			}
+			catch(eigerapi::EigerException& e)
+			{
+				m_requests->cancel(buffer_free_req);
+				buffer_free = -1.;
+			}
+		}
+
+		// hashed listing, constant time lookup of the expected names
+		Requests::Param::StringSet listing(files.begin(), files.end());
 
 		// try to download master file
 		lock.lock();
+		m_saving.m_concurrency->update(buffer_free);
+		download_speed.set(m_saving.m_concurrency->throughput());
+		if(buffer_free >= 0.)
+			dcu_buffer_free.set(buffer_free);
+		int nb_file_transfer_started = m_saving.m_nb_file_transfer_started;
 		if(m_saving.m_poll_master_file)
 		{
 			std::ostringstream src_file_name;
 			src_file_name << prefix << "_master.h5";
-			bool master_file_found = false;
-			for(std::vector<std::string>::iterator i = files.string_array.begin();
-				!master_file_found && i != files.string_array.end();++i)
-				master_file_found = *i == src_file_name.str();
+			bool master_file_found = listing.count(string_ref(src_file_name.str())) > 0;
 
 			if(master_file_found)
 			{
 				std::string master_file_name = prefix + "_master.h5";
 				std::string dest_path = directory + "/" + master_file_name;
+				m_saving._fileReady(master_file_name, 0, 0);
 				if(m_saving.m_must_download_data_file)
 				{
-					std::shared_ptr<Requests::Transfer> master_file_req;
+					std::shared_ptr<Requests::TransferState> state =
+						m_requests->create_transfer_state(src_file_name.str(), dest_path);
+					state->set_priority(CurlLoop::FutureRequest::MASTER_FILE);
+					std::shared_ptr<CurlLoop::FutureRequest> master_file_req;
 					try
 					{
-						master_file_req = m_requests->start_transfer(src_file_name.str(), dest_path);
+						master_file_req = m_requests->start_segmented_transfer(state, 1,
+																			   m_saving.m_download_segment_size);
 					}
 					catch(eigerapi::EigerException& e)
 					{
@@ -353,7 +1067,7 @@ void SavingCtrlObj::_PollingThread::threadFunction()
 						m_saving.m_nb_file_to_watch = m_saving.m_nb_file_transfer_started = 0;
 						continue;
 					}
-					std::shared_ptr<CurlLoop::FutureRequest::Callback> end_cbk(new _EndDownloadCallback(m_saving, src_file_name.str()));
+					std::shared_ptr<CurlLoop::FutureRequest::Callback> end_cbk(new _EndDownloadCallback(m_saving, src_file_name.str(), state));
 					lock.unlock();
 					master_file_req->register_callback(end_cbk);
 					lock.lock();
@@ -366,45 +1080,44 @@ void SavingCtrlObj::_PollingThread::threadFunction()
 		if(m_saving.m_nb_file_transfer_started < m_saving.m_nb_file_to_watch)
 		{
 			int next_file_nb = m_saving.m_nb_file_transfer_started + 1;
-
-			std::sort(files.string_array.begin(), files.string_array.end());
+			int last_written_frame = -1;
 			char file_nb[32];
-			snprintf(file_nb, sizeof(file_nb), "%.6d", next_file_nb);
-
 			std::ostringstream src_file_name;
-			src_file_name << prefix << "_data_" << file_nb << ".h5";
 
-			//init find the first file_name of the list
-			std::vector<std::string>::iterator file_name = files.string_array.begin();
-			for(;file_name != files.string_array.end();++file_name)
-				if(*file_name == src_file_name.str()) 
-					break;
-
-			for(;file_name != files.string_array.end() &&
-				m_saving.m_concurrent_download < MAX_SIMULTANEOUS_DOWNLOAD;
-				++file_name, ++next_file_nb)
+			for(;m_saving.m_nb_file_transfer_started < m_saving.m_nb_file_to_watch;
+				++next_file_nb)
 			{
+				if(m_saving.m_must_download_data_file &&
+				   m_saving.m_concurrent_download >= m_saving.m_concurrency->limit())
+				{
+					m_saving.m_concurrency->saturated();
+					break;
+				}
 
 				snprintf(file_nb, sizeof(file_nb), "%.6d", next_file_nb);
 				src_file_name.clear();
 				src_file_name.seekp(0);
 				src_file_name << prefix << "_data_" << file_nb << ".h5";
-				if(*file_name == src_file_name.str()) // will start the transfer
+				if(listing.count(string_ref(src_file_name.str()))) // will start the transfer
 				{
-					if(next_file_nb > m_saving.m_nb_file_to_watch)
-					{
-						DEB_WARNING() << "Something weird happened " << DEB_VAR2(next_file_nb, m_saving.m_nb_file_to_watch);
-						break;
-					}
-
+					//lima index start at 0
+					int first_frame = (next_file_nb - 1) * frames_per_file;
+					int nb_frames = std::min(frames_per_file, total_nb_frames - first_frame);
+					m_saving._fileReady(src_file_name.str(), first_frame, nb_frames);
 					if(m_saving.m_must_download_data_file)
 					{
-						DEB_TRACE() << "Start transfer file: " << DEB_VAR1(*file_name);
+						DEB_TRACE() << "Start transfer file: " << DEB_VAR1(src_file_name.str());
 						std::string dest_path = directory + "/" + src_file_name.str();
-						std::shared_ptr<Requests::Transfer> file_req;
+						std::shared_ptr<Requests::TransferState> state =
+							m_requests->create_transfer_state(src_file_name.str(), dest_path);
+						// oldest file first
+						state->set_priority(CurlLoop::FutureRequest::DATA_FILE, next_file_nb);
+						std::shared_ptr<CurlLoop::FutureRequest> file_req;
 						try
 						{
-							file_req = m_requests->start_transfer(src_file_name.str(), dest_path);
+							file_req = m_requests->start_segmented_transfer(state,
+																			m_saving.m_download_segments,
+																			m_saving.m_download_segment_size);
 						}
 						catch(eigerapi::EigerException& e)
 						{
@@ -420,7 +1133,8 @@ void SavingCtrlObj::_PollingThread::threadFunction()
 
 						++m_saving.m_nb_file_transfer_started;
 						++m_saving.m_concurrent_download;
-						std::shared_ptr<CurlLoop::FutureRequest::Callback> end_cbk(new _EndDownloadCallback(m_saving, src_file_name.str()));
+						std::shared_ptr<CurlLoop::FutureRequest::Callback> end_cbk(new _EndDownloadCallback(m_saving, src_file_name.str(), state,
+																											first_frame, nb_frames));
 						lock.unlock();
 						file_req->register_callback(end_cbk);
 						lock.lock();
@@ -428,53 +1142,273 @@ void SavingCtrlObj::_PollingThread::threadFunction()
                     else
 					   ++m_saving.m_nb_file_transfer_started;
 
-					if(m_saving.m_callback)
-					{
-						int written_frame = m_saving.m_nb_file_transfer_started * frames_per_file;
-						if(written_frame > total_nb_frames)
-							written_frame = total_nb_frames;
-
-						//lima index start at 0
-						--written_frame;
-						lock.unlock();
-						bool continueFlag = false;
-
-						for(int frame_index = (written_frame - frames_per_file + 1);frame_index <= written_frame;frame_index++)
-						{
-							continueFlag = m_saving.m_callback->newFrameWritten(frame_index);
-						}
-
-						m_saving.m_cam.m_image_number = written_frame + 1;
-
-						lock.lock();
-						if(!continueFlag) // stop the loop
-							m_saving.m_nb_file_to_watch = m_saving.m_nb_file_transfer_started = 0;
-					}
+					last_written_frame = first_frame + nb_frames - 1;
 				}
 				else
 					break;
 			}
+
+			// the files found in this pass are notified at once,
+			// Lima takes the frame as the last one written
+			if(last_written_frame >= 0)
+			{
+				m_saving.m_nb_frames_written = last_written_frame + 1;
+				m_saving.m_cam.m_image_number = last_written_frame + 1;
+				if(m_saving.m_callback)
+				{
+					lock.unlock();
+					bool continueFlag = m_saving.m_callback->newFrameWritten(last_written_frame);
+					lock.lock();
+					if(!continueFlag) // stop the loop
+						m_saving.m_nb_file_to_watch = m_saving.m_nb_file_transfer_started = 0;
+				}
+			}
+		}
+
+		int nb_new_files = m_saving.m_nb_file_transfer_started - nb_file_transfer_started;
+		if(nb_new_files > 0)
+			m_saving.m_readiness->filesReady(nb_new_files);
+
+		double waiting_time = m_saving.m_readiness->nextPoll(files_due);
+		double retry_delay = _retryDelay();
+		if(retry_delay >= 0. && retry_delay < waiting_time)
+			waiting_time = retry_delay;
+		if(waiting_time > 0.)
+			m_saving.m_cond.wait(waiting_time);
+	}
+}
+
+// time until the next download to resume, -1 if none can start
+double SavingCtrlObj::_PollingThread::_retryDelay()
+{
+	if(m_saving.m_retries.empty() ||
+	   m_saving.m_concurrent_download >= m_saving.m_concurrency->limit())
+		return -1.;
+
+	double retry_time = m_saving.m_retries.front()->m_retry_time;
+	for(std::list<std::shared_ptr<_EndDownloadCallback> >::iterator i = m_saving.m_retries.begin();
+		i != m_saving.m_retries.end();++i)
+		retry_time = std::min(retry_time, (*i)->m_retry_time);
+	return std::max(retry_time - double(Timestamp::now()), 0.);
+}
+
+// resume the failed downloads whose delay is elapsed, called locked
+void SavingCtrlObj::_PollingThread::_restartDownloads(AutoMutex& lock)
+{
+	DEB_MEMBER_FUNCT();
+	double now = Timestamp::now();
+	std::list<std::shared_ptr<_EndDownloadCallback> >::iterator i = m_saving.m_retries.begin();
+	while(i != m_saving.m_retries.end() &&
+		  m_saving.m_concurrent_download < m_saving.m_concurrency->limit())
+	{
+		if((*i)->m_retry_time > now)
+		{
+			++i;
+			continue;
+		}
+		std::shared_ptr<CurlLoop::FutureRequest::Callback> end_cbk = *i;
+		std::shared_ptr<Requests::TransferState> state = (*i)->m_state;
+		DEB_TRACE() << "Resume transfer file: " << DEB_VAR2((*i)->m_filename, (*i)->m_attempt);
+		FileStatMap::iterator accounting = m_saving.m_file_stats.find((*i)->m_filename);
+		if(accounting != m_saving.m_file_stats.end())
+			++accounting->second.nb_attempts;
+		m_saving.m_retries.erase(i);
+		int nb_segments = m_saving.m_download_segments;
+		long segment_size = m_saving.m_download_segment_size;
+		++m_saving.m_concurrent_download;
+		lock.unlock();
+
+		std::shared_ptr<CurlLoop::FutureRequest> file_req;
+		try
+		{
+			file_req = m_requests->start_segmented_transfer(state, nb_segments, segment_size);
+		}
+		catch(eigerapi::EigerException& e)
+		{
+			Event *event = new Event(Hardware, Event::Error, Event::Saving,
+									 Event::SaveOpenError, e.what());
+			m_saving.m_cam.reportEvent(event);
+			lock.lock();
+			--m_saving.m_concurrent_download;
+			// stop the loop
+			m_saving.m_nb_file_to_watch = m_saving.m_nb_file_transfer_started = 0;
+			m_saving.m_poll_master_file = false;
+			m_saving.m_retries.clear();
+			return;
+		}
+		file_req->register_callback(end_cbk);
+		lock.lock();
+		// may have changed while unlocked
+		i = m_saving.m_retries.begin();
+	}
+}
+
+/*----------------------------------------------------------------------------
+			  Buffer monitor thread
+----------------------------------------------------------------------------*/
+SavingCtrlObj::_BufferMonitorThread::_BufferMonitorThread(SavingCtrlObj& saving,
+														  eigerapi::Requests* requests):
+m_saving(saving),
+m_requests(requests)
+{
+	pthread_attr_setscope(&m_thread_attr, PTHREAD_SCOPE_PROCESS);
+}
+
+SavingCtrlObj::_BufferMonitorThread::~_BufferMonitorThread()
+{
+	AutoMutex lock(m_saving.m_cond.mutex());
+	m_saving.m_quit = true;
+	m_saving.m_cond.broadcast();
+	lock.unlock();
+
+	join();
+}
+
+// samples every BUFFER_POLL_PERIOD while saving, and after it
+// until the buffer recovers so that held triggers are released
+void SavingCtrlObj::_BufferMonitorThread::threadFunction()
+{
+	DEB_MEMBER_FUNCT();
+	static Metrics::Gauge& dcu_buffer_free = Metrics::instance().gauge("dcu_buffer_free_kb");
+	_BufferMonitor* monitor = m_saving.m_buffer_monitor;
+	AutoMutex lock(m_saving.m_cond.mutex());
+
+	double next_sample = 0.;
+	while(!m_saving.m_quit)
+	{
+		if(!monitor->isEnabled() ||
+		   (!m_saving._isSaving() && monitor->level() == _BufferMonitor::NORMAL))
+		{
+			m_saving.m_cond.wait();
+			continue;
+		}
+		// the condition is shared with the download loop
+		double now = Timestamp::now();
+		if(now < next_sample)
+		{
+			m_saving.m_cond.wait(next_sample - now);
+			continue;
+		}
+		next_sample = now + BUFFER_POLL_PERIOD;
+		lock.unlock();
+
+		double buffer_free = -1.;
+		std::shared_ptr<Requests::Param> buffer_free_req =
+			m_requests->get<Requests::FILEWRITER_BUFFER_FREE>(buffer_free);
+		try
+		{
+			buffer_free_req->wait();
+		}
+		catch(eigerapi::EigerException& e)
+		{
+			m_requests->cancel(buffer_free_req);
+			DEB_TRACE() << "buffer_free failed: " << e.what();
+			buffer_free = -1.;
 		}
 
-		m_saving.m_cond.wait(m_saving.m_waiting_time);
+		lock.lock();
+		if(buffer_free < 0.)
+			continue;
+		dcu_buffer_free.set(buffer_free);
+		if(monitor->isEnabled() && monitor->sample(buffer_free))
+			_levelChanged(lock);
 	}
 }
 
+// report the new buffer level and pause the triggers if throttling,
+// called locked
+void SavingCtrlObj::_BufferMonitorThread::_levelChanged(AutoMutex& lock)
+{
+	DEB_MEMBER_FUNCT();
+	_BufferMonitor* monitor = m_saving.m_buffer_monitor;
+	_BufferMonitor::Level level = monitor->level();
+	std::ostringstream msg;
+	if(level == _BufferMonitor::NORMAL)
+		msg << "DCU buffer recovered";
+	else
+		msg << "DCU buffer " << (level == _BufferMonitor::CRITICAL ? "critical" : "low");
+	msg << ": " << monitor->bufferFree() << " free";
+	double time_to_full = monitor->timeToFull();
+	if(time_to_full >= 0.)
+		msg << ", full in " << time_to_full << " s";
+	DEB_WARNING() << msg.str();
+
+	bool pause = monitor->throttle() && level == _BufferMonitor::CRITICAL;
+	bool resume = level == _BufferMonitor::NORMAL;
+	Event::Severity severity = level == _BufferMonitor::NORMAL ? Event::Info : Event::Warning;
+	Event *event = new Event(Hardware, severity, Event::Saving, Event::Default, msg.str());
+	lock.unlock();
+	m_saving.m_cam.reportEvent(event);
+	if(pause || resume)
+		m_saving.m_cam._pauseTrigger(pause);
+	lock.lock();
+}
+
 /*----------------------------------------------------------------------------
 			  class _EndDownloadCallback
 ----------------------------------------------------------------------------*/
 SavingCtrlObj::_EndDownloadCallback::_EndDownloadCallback(SavingCtrlObj& saving,
-														  const std::string& filename):
+														  const std::string& filename,
+														  const std::shared_ptr<Requests::TransferState>& state,
+														  int first_frame, int nb_frames,
+														  int attempt):
 m_saving(saving),
-m_filename(filename)
+m_filename(filename),
+m_state(state),
+m_first_frame(first_frame),
+m_nb_frames(nb_frames),
+m_attempt(attempt),
+m_retry_time(0.)
 {
 }
 void SavingCtrlObj::_EndDownloadCallback::
 status_changed(CurlLoop::FutureRequest::Status status)
 {
 	DEB_MEMBER_FUNCT();
+	static Metrics::Counter& nb_files_downloaded = Metrics::instance().counter("download_files");
+	static Metrics::Counter& nb_bytes_downloaded = Metrics::instance().counter("download_bytes");
+	bool ok = status == CurlLoop::FutureRequest::OK;
+	bool cancelled = status == CurlLoop::FutureRequest::CANCEL;
+	struct stat file_stat;
+	long nb_bytes = ok && !stat(m_state->get_target_path().c_str(), &file_stat) ? file_stat.st_size : 0;
+	if(ok && m_nb_frames > 0 && m_saving.m_readback)
+		m_saving.m_readback->fileDownloaded(m_state->get_target_path(), m_first_frame, m_nb_frames);
+	if(ok && m_nb_frames > 0)
+		m_saving.m_consolidation->fileDownloaded(m_state->get_target_path(), m_first_frame, m_nb_frames);
+
 	AutoMutex lock(m_saving.m_cond.mutex());
-	if(status != CurlLoop::FutureRequest::OK)
+	// a cancelled download says nothing about the link
+	if(!cancelled)
+		m_saving.m_concurrency->transferFinished(nb_bytes, ok);
+	FileStatMap::iterator accounting = m_saving.m_file_stats.find(m_filename);
+	if(ok && accounting != m_saving.m_file_stats.end())
+	{
+		FileStat& stat = accounting->second;
+		stat.nb_bytes = nb_bytes;
+		stat.download_time = double(Timestamp::now()) - stat.ready_time;
+		++m_saving.m_nb_files_downloaded;
+		m_saving.m_nb_bytes_downloaded += nb_bytes;
+		nb_files_downloaded.add();
+		nb_bytes_downloaded.add(nb_bytes);
+		DEB_TRACE() << "Downloaded file: " << DEB_VAR4(m_filename, stat.nb_bytes,
+													 stat.download_time, stat.nb_attempts);
+	}
+	if(status == CurlLoop::FutureRequest::ERROR && m_saving.m_error_msg.empty() &&
+	   m_attempt < m_saving.m_download_max_retries)
+	{
+		// transient failure, resume it later with an exponential backoff
+		double delay = ldexp(m_saving.m_download_retry_delay, m_attempt);
+		DEB_WARNING() << "Failed to download file: " << m_filename
+					  << ", resume in " << delay << " s";
+		std::shared_ptr<_EndDownloadCallback> retry(new _EndDownloadCallback(m_saving, m_filename,
+																			 m_state, m_first_frame, m_nb_frames,
+																			 m_attempt + 1));
+		retry->m_retry_time = double(Timestamp::now()) + delay;
+		m_saving.m_retries.push_back(retry);
+	}
+	else if(cancelled)
+		DEB_TRACE() << "Download cancelled: " << m_filename;
+	else if(!ok)
 	{
 		m_saving.m_error_msg = "Failed to download file: ";
 		m_saving.m_error_msg += m_filename;
@@ -20,8 +20,15 @@
 // along with this program; if not, see <http://www.gnu.org/licenses/>.
 //###########################################################################
 #include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
+#include <algorithm>
+#include <deque>
 #include <map>
 #include <set>
 
@@ -31,9 +38,15 @@
 
 #include <eigerapi/Requests.h>
 #include <eigerapi/EigerDefines.h>
+#include <eigerapi/Metrics.h>
+#include <eigerapi/Tracer.h>
 
 #include "lima/Exceptions.h"
 #include "EigerStream.h"
+#include "EigerCapture.h"
+#include "EigerDecompress.h"
+
+#include "processlib/ProcessExceptions.h"
 
 using namespace lima;
 using namespace lima::Eiger;
@@ -57,12 +70,38 @@ struct Stream::Message
 class Stream::_BufferCallback : public HwBufferCtrlObj::Callback
 {
   DEB_CLASS_NAMESPC(DebModCamera,"Stream","_BufferCallback");
-  typedef std::pair<std::shared_ptr<Stream::Message>,int> MessageNDepth;
+  struct MessageNDepth
+  {
+    MessageNDepth() : depth(0),frame_nb(-1) {}
+    MessageNDepth(const std::shared_ptr<Stream::Message>& m,int d,int f) :
+      msg(m),depth(d),frame_nb(f) {}
+
+    std::shared_ptr<Stream::Message> msg;
+    int depth;
+    int frame_nb;
+  };
   typedef std::map<void*,MessageNDepth> Data2Message;
   typedef std::multiset<void *> BufferList;
 public:
-  _BufferCallback() : HwBufferCtrlObj::Callback() {}
-  virtual ~_BufferCallback() {releaseAll();}
+  // reading resumes below this fraction of the limit
+  static constexpr double RESUME_FRACTION = 0.9;
+
+  _BufferCallback(Stream& stream) :
+    HwBufferCtrlObj::Callback(),
+    m_stream(stream),
+    m_size(0),
+    m_max_size(0),
+    m_hold(false),
+    m_wakeup_sent(false),
+    m_nb_held(Metrics::instance().gauge("stream_frames_held")),
+    m_size_gauge(Metrics::instance().gauge("stream_inflight_bytes")),
+    m_nb_overwritten(Metrics::instance().counter("stream_messages_overwritten"))
+  {}
+  virtual ~_BufferCallback()
+  {
+    m_hold = false;		// the stream pipe is closed
+    releaseAll();
+  }
 
   virtual void map(void* address)
   {
@@ -84,7 +123,15 @@ public:
     
     m_buffer_in_use.erase(it++);
     if(it == m_buffer_in_use.end() || *it != address)
-      m_data_2_msg.erase(address);
+      {
+	Data2Message::iterator msg_it = m_data_2_msg.find(address);
+	if(msg_it != m_data_2_msg.end())
+	  {
+	    m_size -= zmq_msg_size(msg_it->second.msg->get_msg());
+	    m_data_2_msg.erase(msg_it);
+	  }
+      }
+    _update();
   }
   virtual void releaseAll()
   {
@@ -93,54 +140,460 @@ public:
     AutoMutex lock(m_mutex);
     m_buffer_in_use.clear();
     m_data_2_msg.clear();
+    m_size = 0;
+    _update();
   }
   
-  void register_new_msg(std::shared_ptr<Stream::Message>& msg,void* aDataBuffer,int depth)
+  void register_new_msg(std::shared_ptr<Stream::Message>& msg,void* aDataBuffer,int depth,
+			int frame_nb)
   {
     DEB_MEMBER_FUNCT();
-    DEB_PARAM() << DEB_VAR1(aDataBuffer);
+    DEB_PARAM() << DEB_VAR2(aDataBuffer,frame_nb);
 
     AutoMutex lock(m_mutex);
-    m_data_2_msg[aDataBuffer] = MessageNDepth(msg,depth);
+    MessageNDepth& message_depth = m_data_2_msg[aDataBuffer];
+    // the frame buffers wrapped before the previous frame was decompressed
+    if(message_depth.msg)
+      {
+	DEB_WARNING() << "Compressed frame overwritten before its decompression: "
+		      << DEB_VAR2(aDataBuffer,message_depth.frame_nb);
+	m_nb_overwritten.add();
+	m_size -= zmq_msg_size(message_depth.msg->get_msg());
+      }
+    message_depth = MessageNDepth(msg,depth,frame_nb);
+    m_size += zmq_msg_size(msg->get_msg());
+    _update();
+  }
+
+  // bytes of compressed messages held, 0 no limit
+  void setMaxSize(long max_size)
+  {
+    AutoMutex lock(m_mutex);
+    m_max_size = std::max(max_size,0L);
+    _update();
+  }
+  long getMaxSize() const
+  {
+    AutoMutex lock(m_mutex);
+    return m_max_size;
+  }
+  long getSize() const
+  {
+    AutoMutex lock(m_mutex);
+    return m_size;
+  }
+  // receive thread: true while the socket must not be read,
+  // from the limit down to RESUME_FRACTION of it
+  bool holdReceive()
+  {
+    AutoMutex lock(m_mutex);
+    if(!m_max_size)
+      m_hold = false;
+    else if(m_size >= m_max_size)
+      m_hold = true;
+    else if(m_size < m_max_size * RESUME_FRACTION)
+      m_hold = false;
+    m_wakeup_sent = false;
+    return m_hold;
   }
-  bool get_msg(void* aDataBuffer,void*& msg_data,size_t& msg_size,int& depth)
+  // false if the buffer holds no message or the one of another frame
+  bool get_msg(void* aDataBuffer,int frame_nb,std::shared_ptr<Stream::Message>& msg,
+	       int& depth)
   {
     DEB_MEMBER_FUNCT();
-    DEB_PARAM() << DEB_VAR1(aDataBuffer);
+    DEB_PARAM() << DEB_VAR2(aDataBuffer,frame_nb);
 
     AutoMutex lock(m_mutex);
     Data2Message::iterator it = m_data_2_msg.find(aDataBuffer);
-    if(it == m_data_2_msg.end())
+    if(it == m_data_2_msg.end() || it->second.frame_nb != frame_nb)
       return false;
     
-    MessageNDepth message_depth = it->second;
-    std::shared_ptr<Stream::Message> message = message_depth.first;
-    depth = message_depth.second;
-    msg_data = zmq_msg_data(message->get_msg());
-    msg_size = zmq_msg_size(message->get_msg());
-    DEB_RETURN() << DEB_VAR2(msg_data,msg_size);
+    msg = it->second.msg;
+    depth = it->second.depth;
     return true;
   }
 private:
-  Mutex m_mutex;
+  // wakes the held receive thread up once below the resume level
+  void _update()
+  {
+    m_nb_held.set(m_data_2_msg.size());
+    m_size_gauge.set(m_size);
+    if(m_hold && !m_wakeup_sent &&
+       (!m_max_size || m_size < m_max_size * RESUME_FRACTION))
+      {
+	m_stream._send_synchro();
+	m_wakeup_sent = true;
+      }
+  }
+
+  Stream& m_stream;
+  mutable Mutex m_mutex;
   Data2Message m_data_2_msg;
   BufferList m_buffer_in_use;
+  long m_size;
+  long m_max_size;
+  bool m_hold;
+  bool m_wakeup_sent;
+  // compressed frames waiting for their decompression or release
+  Metrics::Gauge& m_nb_held;
+  Metrics::Gauge& m_size_gauge;
+  Metrics::Counter& m_nb_overwritten;
 };
 //		      --- buffer management ---
-class Stream::_BufferCtrlObj : public SoftBufferCtrlObj
+// as SoftBufferCtrlObj, on the Eiger frame buffer allocation
+class Stream::_BufferCtrlObj : public HwBufferCtrlObj
 {
   DEB_CLASS_NAMESPC(DebModCamera,"Stream","_BufferCtrlObj");
 public:
   _BufferCtrlObj(Stream& stream) : 
-    m_stream(stream)
+    m_stream(stream),
+    m_buffer_cb_mgr(m_buffer_alloc_mgr),
+    m_mgr(m_buffer_cb_mgr)
+  {
+  }
+  virtual void setFrameDim(const FrameDim& frame_dim) {m_mgr.setFrameDim(frame_dim);}
+  virtual void getFrameDim(FrameDim& frame_dim) {m_mgr.getFrameDim(frame_dim);}
+  virtual void setNbBuffers(int nb_buffers) {m_mgr.setNbBuffers(nb_buffers);}
+  virtual void getNbBuffers(int& nb_buffers) {m_mgr.getNbBuffers(nb_buffers);}
+  virtual void setNbConcatFrames(int nb_concat_frames) {m_mgr.setNbConcatFrames(nb_concat_frames);}
+  virtual void getNbConcatFrames(int& nb_concat_frames) {m_mgr.getNbConcatFrames(nb_concat_frames);}
+  virtual void getMaxNbBuffers(int& max_nb_buffers) {m_mgr.getMaxNbBuffers(max_nb_buffers);}
+  virtual void *getBufferPtr(int buffer_nb,int concat_frame_nb = 0)
   {
+    return m_mgr.getBufferPtr(buffer_nb,concat_frame_nb);
   }
+  virtual void *getFramePtr(int acq_frame_nb) {return m_mgr.getFramePtr(acq_frame_nb);}
+  virtual void getStartTimestamp(Timestamp& start_ts) {m_mgr.getStartTimestamp(start_ts);}
+  virtual void getFrameInfo(int acq_frame_nb,HwFrameInfoType& info)
+  {
+    m_mgr.getFrameInfo(acq_frame_nb,info);
+  }
+  virtual void registerFrameCallback(HwFrameCallback& frame_cb) {m_mgr.registerFrameCallback(frame_cb);}
+  virtual void unregisterFrameCallback(HwFrameCallback& frame_cb) {m_mgr.unregisterFrameCallback(frame_cb);}
   virtual HwBufferCtrlObj::Callback* getBufferCallback()
   {
     return m_stream.m_buffer_cbk;
   }
+
+  StdBufferCbMgr& getBuffer() {return m_buffer_cb_mgr;}
+  FrameBufferAllocMgr& getAllocMgr() {return m_buffer_alloc_mgr;}
 private:
-  Stream&	m_stream;
+  Stream&		m_stream;
+  FrameBufferAllocMgr	m_buffer_alloc_mgr;
+  StdBufferCbMgr	m_buffer_cb_mgr;
+  BufferCtrlMgr		m_mgr;
+};
+
+//		      --- stream capture ---
+// the received messages are queued with their arrival time and written by
+// a dedicated thread, the zmq receive loop never waits for the disk
+static const size_t CAPTURE_MAX_QUEUED_BYTES = 512UL * 1024 * 1024;
+
+class Stream::_Capture
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"Stream","_Capture");
+public:
+  typedef std::vector<std::shared_ptr<Stream::Message> > Messages;
+
+  _Capture() : m_fd(-1),m_quit(false),m_stopped(false),m_queued_bytes(0),m_writer(NULL) {}
+  ~_Capture() {close();}
+
+  bool open(const std::string& path)
+  {
+    DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR1(path);
+
+    m_fd = ::open(path.c_str(),O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC,0644);
+    struct stat file_stat;
+    if(m_fd < 0 || fstat(m_fd,&file_stat))
+      {
+	DEB_ERROR() << "Can't open capture file " << path << ": " << strerror(errno);
+	_closeFile();
+	return false;
+      }
+
+    CaptureFileHeader header;
+    if(!file_stat.st_size)
+      {
+	memcpy(header.magic,CAPTURE_MAGIC,sizeof(header.magic));
+	header.version = CAPTURE_VERSION,header.reserved = 0;
+	if(::write(m_fd,&header,sizeof(header)) != sizeof(header))
+	  {
+	    DEB_ERROR() << "Can't write capture file " << path << ": " << strerror(errno);
+	    _closeFile();
+	    return false;
+	  }
+      }
+    // appending to a previous capture
+    else if(pread(m_fd,&header,sizeof(header),0) != sizeof(header) ||
+	    memcmp(header.magic,CAPTURE_MAGIC,sizeof(header.magic)) ||
+	    header.version != CAPTURE_VERSION)
+      {
+	DEB_ERROR() << path << " is not a stream capture file";
+	_closeFile();
+	return false;
+      }
+
+    m_quit = m_stopped = false;
+    m_writer = new _Writer(*this);
+    m_writer->start();
+    return true;
+  }
+  // the queued records are still written
+  void close()
+  {
+    if(m_writer)
+      {
+	AutoMutex lock(m_cond.mutex());
+	m_quit = true;
+	m_cond.broadcast();
+	lock.unlock();
+	delete m_writer;
+	m_writer = NULL;
+      }
+    _closeFile();
+  }
+  bool isOpen() const {return m_writer != NULL;}
+
+  // keeps a reference on the zmq messages until they are written
+  void write(const Messages& messages)
+  {
+    DEB_MEMBER_FUNCT();
+
+    Record record;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME,&now);
+    record.timestamp = uint64_t(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+    record.messages = messages;
+    record.nb_bytes = 0;
+    for(Messages::const_iterator i = messages.begin();i != messages.end();++i)
+      record.nb_bytes += zmq_msg_size((*i)->get_msg());
+
+    AutoMutex lock(m_cond.mutex());
+    if(m_stopped)
+      return;
+    if(m_queued_bytes + record.nb_bytes > CAPTURE_MAX_QUEUED_BYTES)
+      {
+	// a capture with holes would not replay the acquisition
+	DEB_ERROR() << "Capture stopped, the disk doesn't keep up: "
+		    << m_queued_bytes << " bytes waiting";
+	_stop();
+	return;
+      }
+    m_queued_bytes += record.nb_bytes;
+    m_queue.push_back(record);
+    m_cond.signal();
+  }
+private:
+  struct Record
+  {
+    uint64_t timestamp;
+    Messages messages;
+    size_t nb_bytes;
+  };
+
+  class _Writer : public Thread
+  {
+    DEB_CLASS_NAMESPC(DebModCamera,"Stream::_Capture","_Writer");
+  public:
+    _Writer(_Capture& capture) : m_capture(capture)
+    {
+      pthread_attr_setscope(&m_thread_attr,PTHREAD_SCOPE_PROCESS);
+    }
+    virtual ~_Writer() {join();}
+  protected:
+    virtual void threadFunction()
+    {
+      _Capture& c = m_capture;
+      AutoMutex lock(c.m_cond.mutex());
+      while(true)
+	{
+	  while(!c.m_quit && c.m_queue.empty())
+	    c.m_cond.wait();
+	  if(c.m_queue.empty())
+	    break;
+	  Record record = c.m_queue.front();
+	  c.m_queue.pop_front();
+	  c.m_queued_bytes -= record.nb_bytes;
+	  lock.unlock();
+	  bool ok = c._writeRecord(record);
+	  lock.lock();
+	  if(!ok)
+	    c._stop();
+	}
+    }
+  private:
+    _Capture& m_capture;
+  };
+  friend class _Writer;
+
+  // one writev per multipart message, straight from the zmq buffers
+  bool _writeRecord(const Record& rec)
+  {
+    DEB_MEMBER_FUNCT();
+
+    const Messages& messages = rec.messages;
+    CaptureRecordHeader record;
+    record.timestamp = rec.timestamp;
+    record.nb_parts = messages.size(),record.reserved = 0;
+
+    std::vector<uint32_t> sizes(messages.size());
+    std::vector<struct iovec> iov;
+    iov.reserve(1 + 2 * messages.size());
+    iov.push_back({&record,sizeof(record)});
+    for(size_t i = 0;i < messages.size();++i)
+      {
+	zmq_msg_t* msg = messages[i]->get_msg();
+	sizes[i] = zmq_msg_size(msg);
+	iov.push_back({&sizes[i],sizeof(uint32_t)});
+	iov.push_back({zmq_msg_data(msg),sizes[i]});
+      }
+
+    struct iovec* pending = iov.data();
+    int nb_pending = iov.size();
+    while(nb_pending)
+      {
+	ssize_t written = writev(m_fd,pending,std::min(nb_pending,IOV_MAX));
+	if(written < 0)
+	  {
+	    if(errno == EINTR)
+	      continue;
+	    DEB_ERROR() << "Capture stopped, write failed: " << strerror(errno);
+	    return false;
+	  }
+	for(;nb_pending && size_t(written) >= pending->iov_len;++pending,--nb_pending)
+	  written -= pending->iov_len;
+	if(nb_pending)
+	  {
+	    pending->iov_base = (char*)pending->iov_base + written;
+	    pending->iov_len -= written;
+	  }
+      }
+    return true;
+  }
+  void _stop()
+  {
+    m_stopped = true;
+    m_queue.clear();
+    m_queued_bytes = 0;
+  }
+  void _closeFile()
+  {
+    if(m_fd >= 0)
+      ::close(m_fd);
+    m_fd = -1;
+  }
+
+  int			m_fd;
+  Cond			m_cond;
+  bool			m_quit;
+  bool			m_stopped;
+  std::deque<Record>	m_queue;
+  size_t		m_queued_bytes;
+  _Writer*		m_writer;
+};
+
+//		  --- compressed frame history ---
+// the last compressed frames, bounded in bytes, sharing the zmq messages
+// with the buffer callback: deeper than the frame buffers for the same
+// memory, the frames are decompressed on demand
+class Stream::_CompressedRing
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"Stream","_CompressedRing");
+public:
+  struct Frame
+  {
+    std::shared_ptr<Stream::Message> msg;
+    FrameDim dim;
+    Camera::CompressionType compression;
+  };
+
+  _CompressedRing() :
+    m_max_size(0),
+    m_size(0),
+    m_nb_frames_gauge(Metrics::instance().gauge("compressed_history_frames")),
+    m_size_gauge(Metrics::instance().gauge("compressed_history_bytes"))
+  {}
+
+  void setMaxSize(long max_size)
+  {
+    AutoMutex lock(m_mutex);
+    m_max_size = std::max(max_size,0L);
+    _evict();
+  }
+  long getMaxSize() const
+  {
+    AutoMutex lock(m_mutex);
+    return m_max_size;
+  }
+  bool isActive() const
+  {
+    AutoMutex lock(m_mutex);
+    return m_max_size > 0;
+  }
+  void add(int frameid,const Frame& frame)
+  {
+    AutoMutex lock(m_mutex);
+    if(m_max_size <= 0)
+      return;
+    Frame& old_frame = m_frames[frameid];
+    if(old_frame.msg)
+      m_size -= zmq_msg_size(old_frame.msg->get_msg());
+    old_frame = frame;
+    m_size += zmq_msg_size(frame.msg->get_msg());
+    _evict();
+  }
+  bool get(int frameid,Frame& frame) const
+  {
+    AutoMutex lock(m_mutex);
+    FrameMap::const_iterator it = m_frames.find(frameid);
+    if(it == m_frames.end())
+      return false;
+    frame = it->second;
+    return true;
+  }
+  void clear()
+  {
+    AutoMutex lock(m_mutex);
+    m_frames.clear();
+    m_size = 0;
+    _update_gauges();
+  }
+  void getStatus(int& first_frame,int& last_frame,int& nb_frames,long& size) const
+  {
+    AutoMutex lock(m_mutex);
+    first_frame = m_frames.empty() ? -1 : m_frames.begin()->first;
+    last_frame = m_frames.empty() ? -1 : m_frames.rbegin()->first;
+    nb_frames = m_frames.size();
+    size = m_size;
+  }
+private:
+  typedef std::map<int,Frame> FrameMap;
+
+  // the oldest frames first, the last one is always kept
+  void _evict()
+  {
+    while(m_frames.size() > 1 && m_size > m_max_size)
+      {
+	m_size -= zmq_msg_size(m_frames.begin()->second.msg->get_msg());
+	m_frames.erase(m_frames.begin());
+      }
+    if(m_max_size <= 0)
+      m_frames.clear(),m_size = 0;
+    _update_gauges();
+  }
+  void _update_gauges()
+  {
+    m_nb_frames_gauge.set(m_frames.size());
+    m_size_gauge.set(m_size);
+  }
+
+  mutable Mutex m_mutex;
+  long m_max_size;
+  long m_size;
+  FrameMap m_frames;
+  Metrics::Gauge& m_nb_frames_gauge;
+  Metrics::Gauge& m_size_gauge;
 };
 
 //			 --- Stream class ---
@@ -152,7 +605,8 @@ Stream::Stream(Camera& cam) :
   m_wait(true),
   m_running(false),
   m_stop(false),
-  m_buffer_cbk(new Stream::_BufferCallback()),
+  m_buffer_cbk(new Stream::_BufferCallback(*this)),
+  m_compressed_ring(new Stream::_CompressedRing()),
   m_buffer_ctrl_obj(new Stream::_BufferCtrlObj(*this))
 {
   DEB_CONSTRUCTOR();
@@ -179,6 +633,7 @@ Stream::~Stream()
   zmq_ctx_destroy(m_zmq_context);
 
   delete m_buffer_cbk;
+  delete m_compressed_ring;
   delete m_buffer_ctrl_obj;
 }
 
@@ -230,6 +685,7 @@ void Stream::setActive(bool active)
 {
   DEB_MEMBER_FUNCT();
   DEB_PARAM() << DEB_VAR1(active);
+  Tracer::Span span("Stream::setActive");
 
   AutoMutex lock(m_cond.mutex());
   //Don't resend parameters if not changed
@@ -248,13 +704,13 @@ void Stream::setActive(bool active)
 	}
 
       std::shared_ptr<Requests::Param> header_detail_req = 
-	m_cam.m_requests->set_param(Requests::STREAM_HEADER_DETAIL,header_detail_str);
+	m_cam.m_requests->set<Requests::STREAM_HEADER_DETAIL>(header_detail_str);
       DEB_TRACE() << "STREAM_HEADER_DETAIL: " << DEB_VAR1(header_detail_str);
       header_detail_req->wait();
 
       const char* active_str = active ? "enabled" : "disabled";
       std::shared_ptr<Requests::Param> active_req = 
-	m_cam.m_requests->set_param(Requests::STREAM_MODE,active_str);
+	m_cam.m_requests->set<Requests::STREAM_MODE>(active_str);
       DEB_TRACE() << "STREAM_MODE: " << DEB_VAR1(active_str);
       active_req->wait();
     }
@@ -275,6 +731,23 @@ HwBufferCtrlObj* Stream::getBufferCtrlObj()
   return m_buffer_ctrl_obj;
 }
 
+StdBufferCbMgr& Stream::getBufferMgr()
+{
+  return m_buffer_ctrl_obj->getBuffer();
+}
+
+void Stream::setBufferAllocPolicy(const FrameBufferAllocMgr::Policy& policy)
+{
+  DEB_MEMBER_FUNCT();
+  m_buffer_ctrl_obj->getAllocMgr().setPolicy(policy);
+}
+
+void Stream::getBufferAllocPolicy(FrameBufferAllocMgr::Policy& policy) const
+{
+  DEB_MEMBER_FUNCT();
+  m_buffer_ctrl_obj->getAllocMgr().getPolicy(policy);
+}
+
 enum Camera::CompressionType Stream::getCompressionType(void) const
 {
   enum Camera::CompressionType compression_type;
@@ -282,9 +755,131 @@ enum Camera::CompressionType Stream::getCompressionType(void) const
   return compression_type;
 }
 
-bool Stream::get_msg(void* aDataBuffer,void*& msg_data,size_t& msg_size,int &depth)
+// the message registered for the frame buffer, or the frame from the
+// compressed history when the buffer was given to a later frame
+bool Stream::get_msg(void* aDataBuffer,int frame_nb,std::shared_ptr<Message>& msg,
+		     void*& msg_data,size_t& msg_size,int &depth)
+{
+  DEB_MEMBER_FUNCT();
+  static Metrics::Counter& nb_from_history =
+    Metrics::instance().counter("stream_frames_from_history");
+
+  if(!m_buffer_cbk->get_msg(aDataBuffer,frame_nb,msg,depth))
+    {
+      _CompressedRing::Frame frame;
+      if(!m_compressed_ring->get(frame_nb,frame))
+	return false;
+      DEB_TRACE() << "Frame " << frame_nb << " taken from the compressed history";
+      nb_from_history.add();
+      msg = frame.msg;
+      depth = frame.dim.getDepth();
+    }
+  msg_data = zmq_msg_data(msg->get_msg());
+  msg_size = zmq_msg_size(msg->get_msg());
+  DEB_RETURN() << DEB_VAR2(msg_data,msg_size);
+  return true;
+}
+
+void Stream::setMemoryLimit(long max_size)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(max_size);
+  m_buffer_cbk->setMaxSize(max_size);
+}
+
+void Stream::getMemoryLimit(long& max_size) const
+{
+  DEB_MEMBER_FUNCT();
+  max_size = m_buffer_cbk->getMaxSize();
+  DEB_RETURN() << DEB_VAR1(max_size);
+}
+
+void Stream::getMemoryUsage(long& size) const
+{
+  DEB_MEMBER_FUNCT();
+  size = m_buffer_cbk->getSize();
+  DEB_RETURN() << DEB_VAR1(size);
+}
+
+void Stream::setCompressedHistory(long max_size)
 {
-  return m_buffer_cbk->get_msg(aDataBuffer,msg_data,msg_size,depth);
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(max_size);
+  m_compressed_ring->setMaxSize(max_size);
+}
+
+void Stream::getCompressedHistory(long& max_size) const
+{
+  DEB_MEMBER_FUNCT();
+  max_size = m_compressed_ring->getMaxSize();
+  DEB_RETURN() << DEB_VAR1(max_size);
+}
+
+void Stream::getCompressedHistoryStatus(int& first_frame,int& last_frame,
+					int& nb_frames,long& size) const
+{
+  DEB_MEMBER_FUNCT();
+  m_compressed_ring->getStatus(first_frame,last_frame,nb_frames,size);
+  DEB_RETURN() << DEB_VAR4(first_frame,last_frame,nb_frames,size);
+}
+
+void Stream::readCompressedFrame(int frame_nb,Data& data)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(frame_nb);
+
+  // the message is kept alive by the copy, evicted or not
+  _CompressedRing::Frame frame;
+  if(!m_compressed_ring->get(frame_nb,frame))
+    THROW_HW_ERROR(Error) << "Frame " << frame_nb << " is not in the compressed history";
+
+  const Size& size = frame.dim.getSize();
+  data.dimensions.clear();
+  data.dimensions.push_back(size.getWidth());
+  data.dimensions.push_back(size.getHeight());
+  switch(frame.dim.getImageType())
+    {
+    case Bpp16: data.type = Data::UINT16;break;
+    case Bpp16S: data.type = Data::INT16;break;
+    case Bpp32: data.type = Data::UINT32;break;
+    case Bpp32S: data.type = Data::INT32;break;
+    default:
+      THROW_HW_ERROR(Error) << "Unsupported image type: " << DEB_VAR1(frame.dim);
+    }
+  data.frameNumber = frame_nb;
+  Buffer* buffer = new Buffer(frame.dim.getMemSize());
+  data.setBuffer(buffer);
+  buffer->unref();
+
+  zmq_msg_t* msg = frame.msg->get_msg();
+  try
+    {
+      Decompress::decompressFrame(frame.compression,zmq_msg_data(msg),zmq_msg_size(msg),
+				  frame.dim.getDepth(),data);
+    }
+  catch(ProcessException& e)
+    {
+      THROW_HW_ERROR(Error) << "Frame " << frame_nb << ": " << e.getErrMsg();
+    }
+}
+
+void Stream::setCapture(const std::string& path)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(path);
+
+  // taken into account at the next stream connection
+  AutoMutex lock(m_cond.mutex());
+  m_capture_path = path;
+}
+
+void Stream::getCapture(std::string& path) const
+{
+  DEB_MEMBER_FUNCT();
+
+  AutoMutex lock(m_cond.mutex());
+  path = m_capture_path;
+  DEB_RETURN() << DEB_VAR1(path);
 }
 
 void* Stream::_runFunc(void *streamPt)
@@ -350,6 +945,20 @@ void Stream::_run()
 	AutoMutex aLock(m_cond.mutex());
 	StdBufferCbMgr& buffer_mgr = m_buffer_ctrl_obj->getBuffer();
 
+	Metrics& metrics = Metrics::instance();
+	Metrics::Counter& nb_messages_received = metrics.counter("stream_messages");
+	Metrics::Counter& nb_bytes_received = metrics.counter("stream_bytes");
+	Metrics::Counter& nb_frames_received = metrics.counter("stream_frames");
+	// gaps in the frame numbers: missing during the series, lost once disconnected
+	Metrics::Counter& nb_frames_lost = metrics.counter("stream_frames_lost");
+	Metrics::Gauge& nb_frames_missing = metrics.gauge("stream_frames_missing");
+	Metrics::Histogram& header_parse_duration = metrics.histogram("stream_header_parse_ns");
+	Metrics::Counter& nb_backpressure = metrics.counter("stream_backpressure");
+	Metrics::Histogram& backpressure_duration = metrics.histogram("stream_backpressure_ns");
+	Metrics::Clock::time_point last_backpressure_event;
+	Tracer& tracer = Tracer::instance();
+	tracer.thread_name("eiger stream");
+
 	while (1)
 	{
 		void* stream_socket = NULL;
@@ -373,23 +982,64 @@ void Stream::_run()
 		char stream_endpoint[256];
 		snprintf(stream_endpoint, sizeof (stream_endpoint),
 				 "tcp://%s:9999", m_cam.getDetectorIp().c_str());
+		uint64_t connect_begin = Tracer::now();
 		stream_socket = zmq_socket(m_zmq_context, ZMQ_PULL);
 
 		if (!zmq_connect(stream_socket, stream_endpoint))
 		{
+			tracer.complete("zmq connect", connect_begin, Tracer::now(), stream_endpoint);
+			bool first_frame = true;
+			// the frame numbers start again
+			m_compressed_ring->clear();
+			int nb_series_frames = 0, nb_series_received = 0;
+			nb_frames_missing.set(0);
+			std::string capture_path = m_capture_path;
 			m_cond.broadcast();
 			aLock.unlock();
 
+			_Capture capture;
+			if (!capture_path.empty())
+				capture.open(capture_path);
+
 			DEB_TRACE() << "connected to " << stream_endpoint;
 			//  Initialize poll set
 			zmq_pollitem_t items [] = {
 				{ NULL, m_pipes[0], ZMQ_POLLIN, 0 },
 				{ stream_socket, 0, ZMQ_POLLIN, 0 }
 			};
+			bool hold = false;
+			Metrics::Clock::time_point hold_begin;
 			while (continue_flag)		// reading loop
 			{
+				// at the in-flight limit the socket is not read, the zmq queue
+				// and the detector buffer absorb the burst until the
+				// decompression catches up (woken up through the pipe)
+				if (m_buffer_cbk->holdReceive() != hold)
+				{
+					hold = !hold;
+					if (hold)
+					{
+						hold_begin = Metrics::Clock::now();
+						nb_backpressure.add();
+						tracer.instant("backpressure");
+						// one event per second at most
+						if (hold_begin - last_backpressure_event > std::chrono::seconds(1))
+						{
+							std::string msg = "Stream backpressure: " +
+								std::to_string(m_buffer_cbk->getSize()) +
+								" bytes of compressed frames waiting for their decompression";
+							DEB_WARNING() << msg;
+							m_cam.reportEvent(new Event(Hardware, Event::Warning, Event::Camera,
+														Event::Default, msg));
+							last_backpressure_event = hold_begin;
+						}
+					}
+					else
+						backpressure_duration.record_since(hold_begin);
+				}
+				items[1].revents = 0;
 //				DEB_TRACE() << "Enter poll";
-				zmq_poll(items, 2, -1);
+				zmq_poll(items, hold ? 1 : 2, -1);
 //				DEB_TRACE() << "Exit poll";
 								
 				if (items[0].revents & ZMQ_POLLIN)
@@ -415,10 +1065,18 @@ void Stream::_run()
 						pending_messages.emplace_back(msg);
 					}
 					while (more);
+					if (capture.isOpen())
+						capture.write(pending_messages);
 					int nb_messages = pending_messages.size();
 					DEB_TRACE() << DEB_VAR1(nb_messages);
+					nb_messages_received.add();
+					size_t nb_bytes = 0;
+					for (int i = 0; i < nb_messages; ++i)
+						nb_bytes += zmq_msg_size(pending_messages[i]->get_msg());
+					nb_bytes_received.add(nb_bytes);
 					if (nb_messages > 0)
 					{
+						Metrics::Clock::time_point parse_start = Metrics::Clock::now();
 						Json::Value stream_header;
 						continue_flag = _get_json_header(pending_messages[0], stream_header);
 						if (continue_flag)
@@ -439,6 +1097,11 @@ void Stream::_run()
 							{
 								int frameid = stream_header.get("frame", -1).asInt();
 								DEB_TRACE() << DEB_VAR1(frameid);
+								if (first_frame)
+								{
+									tracer.instant("first frame", std::to_string(frameid));
+									first_frame = false;
+								}
 								//stream_header.get("hash","md5sum")
 								if (nb_messages < 3)
 								{
@@ -473,13 +1136,23 @@ void Stream::_run()
 								// blob size
 								int blob_size = data_header.get("size", -1).asInt();
 								DEB_TRACE() << "Stream Blob size : " << blob_size;
+								header_parse_duration.record_since(parse_start);
 
 								DEB_TRACE() << DEB_VAR1(anImageDim);
 								HwFrameInfoType frame_info;
 								frame_info.acq_frame_nb = frameid;
 								void* buffer_ptr = buffer_mgr.getFrameBufferPtr(frameid);
 								m_buffer_cbk->register_new_msg(pending_messages[2], buffer_ptr,
-															   anImageDim.getDepth());
+															   anImageDim.getDepth(), frameid);
+								if (encoding.find("lz4") != std::string::npos && m_compressed_ring->isActive())
+								{
+									_CompressedRing::Frame compressed_frame;
+									compressed_frame.msg = pending_messages[2];
+									compressed_frame.dim = anImageDim;
+									compressed_frame.compression = encoding.find("bs") != std::string::npos ?
+										Camera::BSLZ4 : Camera::LZ4;
+									m_compressed_ring->add(frameid, compressed_frame);
+								}
 #ifdef READ_HEADER
 								if (nb_messages == 5)
 								{
@@ -498,6 +1171,9 @@ void Stream::_run()
 								continue_flag = buffer_mgr.newFrameReady(frame_info);
 
 								m_cam.m_image_number++;
+								nb_frames_received.add();
+								nb_series_frames = std::max(nb_series_frames, frameid + 1);
+								nb_frames_missing.set(nb_series_frames - ++nb_series_received);
 
 								DEB_TRACE() << "Stream::_run() : nb_frames = " << nb_frames;
 								if (trigger_mode != IntTrig && trigger_mode != IntTrigMult && !--nb_frames)
@@ -518,6 +1194,10 @@ void Stream::_run()
 					}
 				}
 			}
+			if (nb_series_frames > nb_series_received)
+				nb_frames_lost.add(nb_series_frames - nb_series_received);
+			if (hold)
+				backpressure_duration.record_since(hold_begin);
 		}
 		else
 		{
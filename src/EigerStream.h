@@ -25,7 +25,9 @@
 #include "lima/Debug.h"
 
 #include "EigerCamera.h"
+#include "EigerBufferAlloc.h"
 #include "lima/HwBufferMgr.h"
+#include "processlib/Data.h"
 
 namespace lima
 {
@@ -54,11 +56,38 @@ namespace lima
       enum Camera::CompressionType getCompressionType(void) const;
 
       HwBufferCtrlObj* getBufferCtrlObj();
-      bool get_msg(void* aDataBuffer,void*& msg_data,size_t& msg_size,
-		   int& depth);
+      StdBufferCbMgr& getBufferMgr();
+      // huge pages, NUMA placement and pre-faulting of the frame buffers,
+      // applied from the next buffer allocation
+      void setBufferAllocPolicy(const FrameBufferAllocMgr::Policy&);
+      void getBufferAllocPolicy(FrameBufferAllocMgr::Policy&) const;
+      // msg keeps the compressed data alive
+      bool get_msg(void* aDataBuffer,int frame_nb,std::shared_ptr<Message>& msg,
+		   void*& msg_data,size_t& msg_size,int& depth);
+
+      // append the received messages to a capture file, empty to stop
+      void setCapture(const std::string& path);
+      void getCapture(std::string& path) const;
+
+      // bytes of compressed frames waiting for their decompression, 0 no
+      // limit; at the limit the stream is not read until they drop below 90%
+      void setMemoryLimit(long max_size);
+      void getMemoryLimit(long& max_size) const;
+      void getMemoryUsage(long& size) const;
+
+      // history of the last compressed frames, bounded in bytes (0 disables
+      // it), cleared at the next acquisition; read back decompressed, and
+      // decompressed for a frame whose buffer was taken by a later frame
+      void setCompressedHistory(long max_size);
+      void getCompressedHistory(long& max_size) const;
+      void getCompressedHistoryStatus(int& first_frame,int& last_frame,
+				      int& nb_frames,long& size) const;
+      void readCompressedFrame(int frame_nb,Data& data);
     private:
       class _BufferCallback;
       class _BufferCtrlObj;
+      class _Capture;
+      class _CompressedRing;
       friend class _BufferCtrlObj;
 
       static void* _runFunc(void*);
@@ -69,6 +98,7 @@ namespace lima
       bool		m_active;
       HeaderDetail	m_header_detail;
       bool		m_dirty_flag;
+      std::string	m_capture_path;
 
       mutable Cond	m_cond;
       bool		m_wait;
@@ -79,6 +109,7 @@ namespace lima
       void*		m_zmq_context;
       int		m_pipes[2];
       _BufferCallback*	m_buffer_cbk;
+      _CompressedRing*	m_compressed_ring;
       _BufferCtrlObj*	m_buffer_ctrl_obj;
     };
   }
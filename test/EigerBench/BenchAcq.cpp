@@ -0,0 +1,214 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <stdexcept>
+#include <thread>
+
+#include "lima/CtControl.h"
+#include "lima/CtAcquisition.h"
+#include "lima/CtImage.h"
+
+#include "EigerCamera.h"
+#include "EigerInterface.h"
+
+#include "BenchUtils.h"
+
+using namespace lima;
+using namespace lima::Eiger;
+using namespace eigerbench;
+
+// arrival time of each frame, as seen by the control layer
+class _ImageStatus : public CtControl::ImageStatusCallback
+{
+public:
+    _ImageStatus() : m_last_image(-1) {}
+
+    void reset(int nb_frames)
+    {
+        AutoMutex lock(m_cond.mutex());
+        m_last_image = -1;
+        m_ready.clear();
+        m_ready.reserve(nb_frames);
+    }
+    bool wait(int last_image, double timeout)
+    {
+        AutoMutex lock(m_cond.mutex());
+        Clock::time_point start = Clock::now();
+        while (m_last_image < last_image)
+            if (seconds_since(start) > timeout)
+                return false;
+            else
+                m_cond.wait(.1);
+        return true;
+    }
+    std::vector<Clock::time_point> ready() const
+    {
+        AutoMutex lock(m_cond.mutex());
+        return m_ready;
+    }
+
+protected:
+    virtual void imageStatusChanged(const CtControl::ImageStatus &status)
+    {
+        Clock::time_point now = Clock::now();
+        AutoMutex lock(m_cond.mutex());
+        // several frames can be reported at once
+        for (; m_last_image < status.LastImageReady; ++m_last_image)
+            m_ready.push_back(now);
+        m_cond.broadcast();
+    }
+
+private:
+    mutable Cond m_cond;
+    int m_last_image;
+    std::vector<Clock::time_point> m_ready;
+};
+
+// map/release of the stream buffer callback, one fake buffer
+// address per thread, all the threads share the callback mutex
+static void _bench_buffer_callback(Interface &hw, const Options &options)
+{
+    HwBufferCtrlObj *buffer_ctrl;
+    hw.getHwCtrlObj(buffer_ctrl);
+    HwBufferCtrlObj::Callback *callback = buffer_ctrl->getBufferCallback();
+
+    static char addresses[64];
+    for (size_t t = 0; t < options.nb_threads.size(); ++t)
+    {
+        int nb_threads = options.nb_threads[t];
+        std::vector<long long> nb_ops(nb_threads, 0);
+        std::vector<std::thread> threads;
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < nb_threads; ++i)
+            threads.push_back(std::thread([&, i]() {
+                void *address = addresses + i % sizeof(addresses);
+                long long n = 0;
+                do
+                {
+                    for (int j = 0; j < 1000; ++j)
+                    {
+                        callback->map(address);
+                        callback->release(address);
+                    }
+                    n += 1000;
+                } while (seconds_since(start) < options.min_time);
+                nb_ops[i] = n;
+            }));
+        for (size_t i = 0; i < threads.size(); ++i)
+            threads[i].join();
+        double elapsed = seconds_since(start);
+
+        long long total = 0;
+        for (size_t i = 0; i < nb_ops.size(); ++i)
+            total += nb_ops[i];
+        Result("buffer_callback")
+            ("threads", nb_threads)
+            ("map_release_per_second", total / elapsed)
+            ("ns_per_map_release", elapsed / total * 1e9 * nb_threads)
+            .print();
+    }
+}
+
+// internal trigger acquisitions, latency of a frame is its arrival
+// minus the end of its exposure (start + (i + 1) * frame_time)
+static void _bench_acquisitions(CtControl &control, const Options &options)
+{
+    _ImageStatus image_status;
+    control.registerImageStatusCallback(image_status);
+
+    CtAcquisition *acq = control.acquisition();
+    acq->setTriggerMode(IntTrig);
+    acq->setAcqNbFrames(options.nb_frames);
+    acq->setAcqExpoTime(options.frame_time);
+
+    FrameDim frame_dim;
+    control.image()->getImageDim(frame_dim);
+    double frame_size = frame_dim.getMemSize();
+
+    for (int a = 0; a < options.nb_acquisitions; ++a)
+    {
+        image_status.reset(options.nb_frames);
+        control.prepareAcq();
+
+        double cpu_start = cpu_time();
+        Clock::time_point start = Clock::now();
+        control.startAcq();
+        double timeout = options.nb_frames * options.frame_time * 2 + 30;
+        bool complete = image_status.wait(options.nb_frames - 1, timeout);
+        if (!complete)
+            control.stopAcq();
+        double elapsed = seconds_since(start);
+        double cpu = cpu_time() - cpu_start;
+
+        std::vector<Clock::time_point> ready = image_status.ready();
+        std::vector<double> latencies, intervals;
+        for (size_t i = 0; i < ready.size(); ++i)
+        {
+            double exposure_end = (i + 1) * options.frame_time;
+            latencies.push_back(std::chrono::duration<double>(ready[i] - start).count() - exposure_end);
+            if (i)
+                intervals.push_back(std::chrono::duration<double>(ready[i] - ready[i - 1]).count());
+        }
+        double nb_frames = ready.size();
+
+        Result("acquisition")
+            ("run", a)
+            ("frames", nb_frames)
+            ("complete", complete ? "yes" : "no")
+            ("elapsed", elapsed)
+            ("frames_per_second", nb_frames / elapsed)
+            ("mb_per_second", nb_frames * frame_size / elapsed / 1e6)
+            ("latency_p50_ms", percentile(latencies, .5) * 1e3)
+            ("latency_p90_ms", percentile(latencies, .9) * 1e3)
+            ("latency_p99_ms", percentile(latencies, .99) * 1e3)
+            ("latency_max_ms", percentile(latencies, 1.) * 1e3)
+            ("interval_p50_ms", percentile(intervals, .5) * 1e3)
+            ("interval_p99_ms", percentile(intervals, .99) * 1e3)
+            ("cpu_ms_per_frame", nb_frames ? cpu / nb_frames * 1e3 : 0.)
+            .print();
+
+        // wait for the end of the acquisition before the next one
+        CtControl::Status status;
+        do
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            control.getStatus(status);
+        } while (status.AcquisitionStatus == AcqRunning);
+    }
+    control.unregisterImageStatusCallback(image_status);
+}
+
+void eigerbench::bench_acquisition(const Options &options)
+{
+    try
+    {
+        Camera camera(options.detector_ip);
+        Interface hw(camera);
+        CtControl control(&hw);
+
+        _bench_buffer_callback(hw, options);
+        _bench_acquisitions(control, options);
+    }
+    catch (const Exception &e)
+    {
+        throw std::runtime_error(e.getErrMsg());
+    }
+}
@@ -0,0 +1,187 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <stdlib.h>
+#include <string.h>
+
+#include <stdexcept>
+
+#include "lz4.h"
+#include "bitshuffle.h"
+
+#include "processlib/Data.h"
+
+#include "SimFrames.h"
+#include "BenchUtils.h"
+
+using namespace eigerbench;
+
+// widening of the 16 bit frames in a 32 bit buffer, EigerDecompress.cpp
+void _expend(void *src, Data &dst);
+
+// runs the measured function by batches until the minimum time
+template <class Function>
+static double _measure(double min_time, long long &nb_iterations, Function function)
+{
+    function(); // warm up
+    nb_iterations = 0;
+    long long batch = 1;
+    Clock::time_point start = Clock::now();
+    double elapsed;
+    do
+    {
+        for (long long i = 0; i < batch; ++i)
+            function();
+        nb_iterations += batch;
+        elapsed = seconds_since(start);
+        if (elapsed < min_time / 10)
+            batch *= 2;
+    } while (elapsed < min_time);
+    return elapsed;
+}
+
+static void *_aligned_alloc(size_t size)
+{
+    void *ptr;
+    if (posix_memalign(&ptr, 16, size))
+        throw std::runtime_error("Can't allocate the frame buffer");
+    return ptr;
+}
+
+// the json headers of a dimage message, parsed as in Stream::_run
+void eigerbench::bench_header_parsing(const Options &options)
+{
+    static const char *const headers[] = {
+        "{\"htype\":\"dimage-1.0\",\"series\":12,\"frame\":1234,\"hash\":\"\"}",
+        "{\"htype\":\"dimage_d-1.0\",\"shape\":[2070,2167],\"type\":\"uint32\","
+        "\"encoding\":\"bs32-lz4<\",\"size\":1453220}",
+        "{\"htype\":\"dconfig-1.0\",\"start_time\":1234000000,\"stop_time\":1234500000,"
+        "\"real_time\":500000000}",
+    };
+    static const int NB_HEADERS = sizeof(headers) / sizeof(headers[0]);
+
+    Json::Reader reader;
+    long long nb_iterations;
+    double elapsed = _measure(options.min_time, nb_iterations, [&]() {
+        for (int i = 0; i < NB_HEADERS; ++i)
+        {
+            Json::Value header;
+            const char *begin = headers[i];
+            if (!reader.parse(begin, begin + strlen(begin), header))
+                throw std::runtime_error("Header parsing failed");
+            // the fields read by the stream
+            if (header.get("frame", -1).asInt() == -2 || header.get("size", -1).asInt() == -2)
+                throw std::runtime_error("Unexpected header");
+        }
+    });
+    Result("header_parsing")
+        ("messages_per_second", nb_iterations / elapsed)
+        ("ns_per_message", elapsed / nb_iterations * 1e9)
+        ("ns_per_header", elapsed / (nb_iterations * NB_HEADERS) * 1e9)
+        .print();
+}
+
+// same calls and header decoding as the _DecompressTask
+void eigerbench::bench_decompression(const Options &options)
+{
+    static const eigersim::FrameSet::Compression compressions[] = {eigersim::FrameSet::LZ4,
+                                                                    eigersim::FrameSet::BSLZ4};
+    for (size_t s = 0; s < options.shapes.size(); ++s)
+    {
+        Shape shape;
+        find_shape(options.shapes[s], shape);
+        for (int depth = 2; depth <= 4; depth += 2)
+            for (int c = 0; c < 2; ++c)
+            {
+                eigersim::FrameSet frames;
+                frames.generate(shape.width, shape.height, depth, compressions[c], 2);
+                size_t size = size_t(shape.width) * shape.height * depth;
+                void *dst = _aligned_alloc(size);
+
+                int frame_nb = 0;
+                auto decompress = [&]() {
+                    const eigersim::FrameSet::Frame &frame = frames[frame_nb++];
+                    const char *msg_data = frame.blob.data();
+                    if (compressions[c] == eigersim::FrameSet::LZ4)
+                    {
+                        if (LZ4_decompress_fast(msg_data, (char *)dst, int(size)) < 0)
+                            throw std::runtime_error("lz4 decompression failed");
+                    }
+                    else
+                    {
+                        size_t block_size = __builtin_bswap32(*(const uint32_t *)(msg_data + 8)) / depth;
+                        if (bshuf_decompress_lz4(msg_data + 12, dst, size / depth, depth, block_size) < 0)
+                            throw std::runtime_error("bslz4 decompression failed");
+                    }
+                };
+
+                long long nb_frames;
+                double elapsed = _measure(options.min_time, nb_frames, decompress);
+                decompress();
+                bool valid = !memcmp(dst, frames[frame_nb - 1].raw.data(), size);
+                free(dst);
+
+                double compressed_size = (frames[0].blob.size() + frames[1].blob.size()) / 2.;
+                Result("decompression")
+                    ("codec", compressions[c] == eigersim::FrameSet::LZ4 ? "lz4" : "bslz4")
+                    ("shape", shape.name)
+                    ("bits", depth * 8)
+                    ("frames_per_second", nb_frames / elapsed)
+                    ("mb_per_second", nb_frames * size / elapsed / 1e6)
+                    ("compressed_mb_per_second", nb_frames * compressed_size / elapsed / 1e6)
+                    ("compression_ratio", size / compressed_size)
+                    ("ms_per_frame", elapsed / nb_frames * 1e3)
+                    ("valid", valid ? "yes" : "no")
+                    .print();
+            }
+    }
+}
+
+// Data::UINT32 frame of the 32 bit Lima buffer filled from 16 bit pixels
+void eigerbench::bench_widening(const Options &options)
+{
+    for (size_t s = 0; s < options.shapes.size(); ++s)
+    {
+        Shape shape;
+        find_shape(options.shapes[s], shape);
+        std::string src;
+        eigersim::FrameSet::fill(0, shape.width, shape.height, 2, src);
+
+        Data dst;
+        dst.type = Data::UINT32;
+        dst.dimensions.push_back(shape.width);
+        dst.dimensions.push_back(shape.height);
+        Buffer *buffer = new Buffer(dst.size());
+        dst.setBuffer(buffer);
+        buffer->unref();
+
+        long long nb_frames;
+        double elapsed = _measure(options.min_time, nb_frames, [&]() {
+            _expend(&src[0], dst);
+        });
+        Result("widening")
+            ("shape", shape.name)
+            ("frames_per_second", nb_frames / elapsed)
+            ("mb_per_second", nb_frames * double(dst.size()) / elapsed / 1e6)
+            ("ms_per_frame", elapsed / nb_frames * 1e3)
+            .print();
+    }
+}
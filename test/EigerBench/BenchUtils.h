@@ -0,0 +1,84 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef BENCHUTILS_H
+#define BENCHUTILS_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <json/json.h>
+
+namespace eigerbench
+{
+typedef std::chrono::steady_clock Clock;
+
+struct Options
+{
+    Options();
+
+    double min_time;                 // s per measurement
+    std::vector<std::string> shapes; // "1M", "4M", "9M", "16M"
+    std::string detector_ip;         // acquisition benchmarks, skipped if empty
+    int nb_frames;
+    double frame_time;
+    int nb_acquisitions;
+    std::vector<int> nb_threads;
+};
+
+struct Shape
+{
+    const char *name;
+    int width;
+    int height;
+};
+
+/// Eiger module layouts
+bool find_shape(const std::string &name, Shape &shape);
+
+double seconds_since(Clock::time_point start);
+/// process cpu time (user + system) in s, all the threads
+double cpu_time();
+/// p in [0, 1], values are sorted
+double percentile(std::vector<double> &values, double p);
+
+/// One JSON object per line, so the results of two builds
+/// can be parsed and compared.
+class Result
+{
+public:
+    explicit Result(const std::string &bench);
+
+    Result &operator()(const char *key, double value);
+    Result &operator()(const char *key, const std::string &value);
+    void print() const;
+
+private:
+    Json::Value m_value;
+};
+
+void bench_header_parsing(const Options &);
+void bench_decompression(const Options &);
+void bench_widening(const Options &);
+void bench_acquisition(const Options &);
+} // namespace eigerbench
+#endif // BENCHUTILS_H
@@ -0,0 +1,223 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+// Benchmarks of the acquisition data path: micro benchmarks of the
+// stream header parsing, the decompression and the 16 to 32 bit widening,
+// then, with a detector (or the simulator), of the whole acquisition.
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+#include "BenchUtils.h"
+
+using namespace eigerbench;
+
+static const Shape SHAPES[] = {
+    {"1M", 1030, 1065},
+    {"4M", 2070, 2167},
+    {"9M", 3110, 3269},
+    {"16M", 4150, 4371},
+};
+
+Options::Options() : min_time(1.),
+                     nb_frames(1000),
+                     frame_time(1e-3),
+                     nb_acquisitions(3)
+{
+    for (size_t i = 0; i < sizeof(SHAPES) / sizeof(Shape); ++i)
+        shapes.push_back(SHAPES[i].name);
+    nb_threads = {1, 2, 4, 8};
+}
+
+bool eigerbench::find_shape(const std::string &name, Shape &shape)
+{
+    for (size_t i = 0; i < sizeof(SHAPES) / sizeof(Shape); ++i)
+        if (name == SHAPES[i].name)
+        {
+            shape = SHAPES[i];
+            return true;
+        }
+    return false;
+}
+
+double eigerbench::seconds_since(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+double eigerbench::cpu_time()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+}
+
+double eigerbench::percentile(std::vector<double> &values, double p)
+{
+    if (values.empty())
+        return 0.;
+    std::sort(values.begin(), values.end());
+    size_t index = size_t(p * (values.size() - 1) + .5);
+    return values[std::min(index, values.size() - 1)];
+}
+
+Result::Result(const std::string &bench)
+{
+    m_value["bench"] = bench;
+}
+
+Result &Result::operator()(const char *key, double value)
+{
+    m_value[key] = value;
+    return *this;
+}
+
+Result &Result::operator()(const char *key, const std::string &value)
+{
+    m_value[key] = value;
+    return *this;
+}
+
+void Result::print() const
+{
+    std::cout << Json::FastWriter().write(m_value) << std::flush;
+}
+
+static std::vector<std::string> _split(const char *list)
+{
+    std::vector<std::string> items;
+    std::istringstream is(list);
+    std::string item;
+    while (std::getline(is, item, ','))
+        if (!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+static void _usage(const char *name)
+{
+    Options defaults;
+    fprintf(stderr,
+            "Usage: %s [options] [micro|acquisition]...\n"
+            "  --min-time S          duration of each measurement (default %g)\n"
+            "  --shapes LIST         frame shapes among 1M,4M,9M,16M (default all)\n"
+            "  --threads LIST        buffer callback threads (default 1,2,4,8)\n"
+            "  --detector IP         detector or simulator of the acquisition benchmarks\n"
+            "  --frames N            frames per acquisition (default %d)\n"
+            "  --frame-time S        (default %g)\n"
+            "  --acquisitions N      (default %d)\n"
+            "The results are printed as one JSON object per line.\n",
+            name, defaults.min_time, defaults.nb_frames, defaults.frame_time,
+            defaults.nb_acquisitions);
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        {"min-time", required_argument, NULL, 't'},
+        {"shapes", required_argument, NULL, 's'},
+        {"threads", required_argument, NULL, 'T'},
+        {"detector", required_argument, NULL, 'd'},
+        {"frames", required_argument, NULL, 'n'},
+        {"frame-time", required_argument, NULL, 'f'},
+        {"acquisitions", required_argument, NULL, 'a'},
+        {"help", no_argument, NULL, '?'},
+        {NULL, 0, NULL, 0}};
+
+    Options options;
+    int c;
+    while ((c = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 't': options.min_time = atof(optarg); break;
+        case 's': options.shapes = _split(optarg); break;
+        case 'T':
+        {
+            options.nb_threads.clear();
+            std::vector<std::string> threads = _split(optarg);
+            for (size_t i = 0; i < threads.size(); ++i)
+                options.nb_threads.push_back(atoi(threads[i].c_str()));
+            break;
+        }
+        case 'd': options.detector_ip = optarg; break;
+        case 'n': options.nb_frames = atoi(optarg); break;
+        case 'f': options.frame_time = atof(optarg); break;
+        case 'a': options.nb_acquisitions = atoi(optarg); break;
+        default:
+            _usage(argv[0]);
+            return 1;
+        }
+    }
+    for (size_t i = 0; i < options.shapes.size(); ++i)
+    {
+        Shape shape;
+        if (!find_shape(options.shapes[i], shape))
+        {
+            _usage(argv[0]);
+            return 1;
+        }
+    }
+
+    bool micro = optind == argc, acquisition = optind == argc;
+    for (int i = optind; i < argc; ++i)
+    {
+        std::string suite = argv[i];
+        if (suite == "micro")
+            micro = true;
+        else if (suite == "acquisition")
+            acquisition = true;
+        else
+        {
+            _usage(argv[0]);
+            return 1;
+        }
+    }
+
+    try
+    {
+        if (micro)
+        {
+            bench_header_parsing(options);
+            bench_decompression(options);
+            bench_widening(options);
+        }
+        if (acquisition)
+        {
+            if (options.detector_ip.empty())
+                fprintf(stderr, "No --detector, acquisition benchmarks skipped\n");
+            else
+                bench_acquisition(options);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
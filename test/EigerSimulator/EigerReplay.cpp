@@ -0,0 +1,228 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+// Replay of a stream capture (Interface::setStreamCapture) on a local
+// ZMQ PUSH socket, at the original timing or as fast as possible.
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <thread>
+
+#include <zmq.h>
+
+#include "EigerCapture.h"
+
+using namespace lima::Eiger;
+
+typedef std::chrono::steady_clock Clock;
+
+struct Stats
+{
+    Stats() : nb_messages(0), nb_images(0), nb_bytes(0) {}
+
+    long long nb_messages;
+    long long nb_images;
+    long long nb_bytes;
+    Clock::time_point first_send; // the receiver is connected
+};
+
+static void _usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [options] capture_file...\n"
+            "  --port N   stream port (default 9999)\n"
+            "  --fast     as fast as possible, original timing otherwise\n"
+            "  --loop N   replay the captures N times (default 1)\n"
+            "  --hwm N    messages queued before blocking (default 1000)\n",
+            name);
+}
+
+// the capture is checked while replayed, a truncated last record
+// (capture interrupted) ends the replay
+static bool _replay(void *socket, const char *path, bool fast, Stats &stats)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat file_stat;
+    if (fd < 0 || fstat(fd, &file_stat))
+    {
+        fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+    size_t file_size = file_stat.st_size;
+    const char *data = NULL;
+    if (file_size)
+        data = (const char *)mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    CaptureFileHeader header;
+    if (!data || data == MAP_FAILED || file_size < sizeof(header) ||
+        (memcpy(&header, data, sizeof(header)), memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic))) ||
+        header.version != CAPTURE_VERSION)
+    {
+        fprintf(stderr, "%s is not a stream capture file\n", path);
+        if (data && data != MAP_FAILED)
+            munmap((void *)data, file_size);
+        return false;
+    }
+    madvise((void *)data, file_size, MADV_SEQUENTIAL);
+
+    const char *end = data + file_size;
+    const char *pos = data + sizeof(header);
+    uint64_t first_timestamp = 0;
+    Clock::time_point start;
+    long long nb_sent = 0;
+    bool truncated = false;
+    while (pos < end)
+    {
+        CaptureRecordHeader record;
+        if (size_t(end - pos) < sizeof(record))
+        {
+            truncated = true;
+            break;
+        }
+        memcpy(&record, pos, sizeof(record));
+        pos += sizeof(record);
+
+        // parts checked before sending, zmq sends all parts or none
+        const char *part = pos;
+        for (uint32_t i = 0; !truncated && i < record.nb_parts; ++i)
+        {
+            uint32_t size;
+            if (size_t(end - part) < sizeof(size))
+                truncated = true;
+            else
+            {
+                memcpy(&size, part, sizeof(size));
+                part += sizeof(size);
+                if (size_t(end - part) < size)
+                    truncated = true;
+                part += size;
+            }
+        }
+        if (truncated)
+            break;
+
+        if (!fast && nb_sent)
+            std::this_thread::sleep_until(start + std::chrono::nanoseconds(record.timestamp - first_timestamp));
+
+        for (uint32_t i = 0; i < record.nb_parts; ++i)
+        {
+            uint32_t size;
+            memcpy(&size, pos, sizeof(size));
+            pos += sizeof(size);
+            if (i == 0 && size > 16 && memmem(pos, size, "dimage-", 7))
+                ++stats.nb_images;
+            if (zmq_send(socket, pos, size, i + 1 < record.nb_parts ? ZMQ_SNDMORE : 0) < 0)
+            {
+                fprintf(stderr, "Send failed: %s\n", zmq_strerror(zmq_errno()));
+                munmap((void *)data, file_size);
+                return false;
+            }
+            pos += size;
+            stats.nb_bytes += size;
+        }
+
+        // the timing starts once the receiver is connected, the first send blocks until then
+        if (!nb_sent++)
+        {
+            first_timestamp = record.timestamp;
+            start = Clock::now();
+            if (!stats.nb_messages)
+                stats.first_send = start;
+        }
+        ++stats.nb_messages;
+    }
+    if (truncated)
+        fprintf(stderr, "%s: truncated record at offset %ld, ignored\n", path, long(pos - data));
+    munmap((void *)data, file_size);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        {"port", required_argument, NULL, 'p'},
+        {"fast", no_argument, NULL, 'f'},
+        {"loop", required_argument, NULL, 'l'},
+        {"hwm", required_argument, NULL, 'q'},
+        {"help", no_argument, NULL, '?'},
+        {NULL, 0, NULL, 0}};
+
+    int port = 9999, nb_loops = 1, high_water_mark = 1000;
+    bool fast = false;
+    int c;
+    while ((c = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 'p': port = atoi(optarg); break;
+        case 'f': fast = true; break;
+        case 'l': nb_loops = atoi(optarg); break;
+        case 'q': high_water_mark = atoi(optarg); break;
+        default:
+            _usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind == argc)
+    {
+        _usage(argv[0]);
+        return 1;
+    }
+
+    void *context = zmq_ctx_new();
+    void *socket = zmq_socket(context, ZMQ_PUSH);
+    int linger = -1; // the queued messages are delivered before exiting
+    zmq_setsockopt(socket, ZMQ_SNDHWM, &high_water_mark, sizeof(high_water_mark));
+    zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger));
+    char endpoint[64];
+    snprintf(endpoint, sizeof(endpoint), "tcp://*:%d", port);
+    if (zmq_bind(socket, endpoint))
+    {
+        fprintf(stderr, "Can't bind %s: %s\n", endpoint, zmq_strerror(zmq_errno()));
+        return 1;
+    }
+
+    Stats stats;
+    bool ok = true;
+    for (int loop = 0; ok && loop < nb_loops; ++loop)
+        for (int i = optind; ok && i < argc; ++i)
+            ok = _replay(socket, argv[i], fast, stats);
+    double elapsed = stats.nb_messages ? std::chrono::duration<double>(Clock::now() - stats.first_send).count() : 0.;
+
+    printf("{\"messages\": %lld, \"images\": %lld, \"bytes\": %lld, \"elapsed\": %.6f, "
+           "\"images_per_second\": %.1f, \"mb_per_second\": %.1f}\n",
+           stats.nb_messages, stats.nb_images, stats.nb_bytes, elapsed,
+           elapsed > 0 ? stats.nb_images / elapsed : 0., elapsed > 0 ? stats.nb_bytes / elapsed / 1e6 : 0.);
+
+    zmq_close(socket);
+    zmq_ctx_destroy(context);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+// Headless Eiger detector simulator: SIMPLON REST API, ZMQ stream
+// and filewriter, to run the plugin without a detector.
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <fstream>
+#include <stdexcept>
+
+#include "SimDetector.h"
+#include "SimHttpServer.h"
+
+using namespace eigersim;
+
+static HttpServer *server = NULL;
+
+static void _stop(int)
+{
+    if (server)
+        server->stop();
+}
+
+static void _usage(const char *name)
+{
+    Detector::Options defaults;
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --host ADDR            REST listening address (default all)\n"
+            "  --port N               REST port (default 80, the plugin uses the default http port)\n"
+            "  --zmq-port N           stream port (default %d)\n"
+            "  --data-dir DIR         filewriter directory (default %s)\n"
+            "  --buffer-size MB       DCU buffer size (default %lld)\n"
+            "  --width N, --height N  detector size (default %dx%d)\n"
+            "  --frame-rate HZ        0 as fast as possible (default frame_time)\n"
+            "  --distinct-frames N    generated frames cycled through (default %d)\n"
+            "  --hwm N                stream frames queued before blocking (default %d)\n"
+            "  --send-timeout S       stream frame dropped after S seconds (default %g)\n"
+            "  --description TEXT     detector description\n"
+            "  --faults FILE          fault injection configuration (JSON)\n",
+            name, defaults.zmq_port, defaults.data_dir.c_str(), defaults.buffer_size >> 20,
+            defaults.width, defaults.height, defaults.distinct_frames,
+            defaults.zmq_high_water_mark, defaults.zmq_send_timeout);
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        {"host", required_argument, NULL, 'H'},
+        {"port", required_argument, NULL, 'p'},
+        {"zmq-port", required_argument, NULL, 'z'},
+        {"data-dir", required_argument, NULL, 'd'},
+        {"buffer-size", required_argument, NULL, 'b'},
+        {"width", required_argument, NULL, 'W'},
+        {"height", required_argument, NULL, 'h'},
+        {"frame-rate", required_argument, NULL, 'r'},
+        {"distinct-frames", required_argument, NULL, 'n'},
+        {"hwm", required_argument, NULL, 'q'},
+        {"send-timeout", required_argument, NULL, 't'},
+        {"description", required_argument, NULL, 'D'},
+        {"faults", required_argument, NULL, 'F'},
+        {"help", no_argument, NULL, '?'},
+        {NULL, 0, NULL, 0}};
+
+    Detector::Options options;
+    std::string host;
+    int port = 80;
+    int c;
+    while ((c = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 'H': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'z': options.zmq_port = atoi(optarg); break;
+        case 'd': options.data_dir = optarg; break;
+        case 'b': options.buffer_size = atoll(optarg) << 20; break;
+        case 'W': options.width = atoi(optarg); break;
+        case 'h': options.height = atoi(optarg); break;
+        case 'r': options.frame_rate = atof(optarg); break;
+        case 'n': options.distinct_frames = atoi(optarg); break;
+        case 'q': options.zmq_high_water_mark = atoi(optarg); break;
+        case 't': options.zmq_send_timeout = atof(optarg); break;
+        case 'D': options.description = optarg; break;
+        case 'F':
+        {
+            std::ifstream faults(optarg);
+            if (!faults || !Json::Reader().parse(faults, options.faults))
+            {
+                fprintf(stderr, "Can't read the fault configuration %s\n", optarg);
+                return 1;
+            }
+            break;
+        }
+        default:
+            _usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.width <= 0 || options.height <= 0 || options.distinct_frames <= 0)
+    {
+        _usage(argv[0]);
+        return 1;
+    }
+    mkdir(options.data_dir.c_str(), 0755);
+
+    try
+    {
+        Detector detector(options);
+        HttpServer http(host, port, [&detector](const HttpRequest &request, HttpResponse &response) {
+            detector.handle(request, response);
+        });
+        server = &http;
+        signal(SIGINT, _stop);
+        signal(SIGTERM, _stop);
+        signal(SIGPIPE, SIG_IGN);
+
+        printf("Eiger simulator %dx%d: REST on port %d, stream on port %d, files in %s\n",
+               options.width, options.height, port, options.zmq_port, options.data_dir.c_str());
+        fflush(stdout);
+        http.run();
+        server = NULL;
+    }
+    catch (const std::exception &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,674 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <stdio.h>
+#include <time.h>
+
+#include <chrono>
+#include <sstream>
+#include <stdexcept>
+
+#include "SimDetector.h"
+
+using namespace eigersim;
+
+static const char API_VERSION[] = "1.8.0";
+
+typedef std::chrono::steady_clock Clock;
+
+static double _elapsed(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static std::vector<std::string> _split(const std::string &path)
+{
+    std::vector<std::string> parts;
+    std::istringstream is(path);
+    std::string part;
+    while (std::getline(is, part, '/'))
+        if (!part.empty())
+            parts.push_back(part);
+    return parts;
+}
+
+static void _error(HttpResponse &response, int status, const std::string &msg)
+{
+    response.status = status;
+    response.content_type = "text/plain";
+    response.body = msg;
+}
+
+Detector::Options::Options() : data_dir("."),
+                               buffer_size(4LL << 30),
+                               width(2070),
+                               height(2167),
+                               frame_rate(-1),
+                               distinct_frames(16),
+                               description("Dectris EIGER2 Si 4M (simulator)"),
+                               zmq_port(9999),
+                               zmq_high_water_mark(1000),
+                               zmq_send_timeout(1.)
+{
+}
+
+Detector::Detector(const Options &options) : m_options(options),
+                                             m_state("na"),
+                                             m_series(0),
+                                             m_nb_frames(0),
+                                             m_next_frame(0),
+                                             m_nb_triggers(0),
+                                             m_acquiring(false),
+                                             m_abort(false),
+                                             m_start_time(0),
+                                             m_stream(options.zmq_port, options.zmq_high_water_mark,
+                                                      options.zmq_send_timeout),
+                                             m_filewriter(options.data_dir, options.buffer_size)
+{
+    _init_params();
+    if (!options.faults.isNull())
+        m_faults.configure(options.faults);
+    m_stream.set_faults(&m_faults);
+    m_filewriter.set_faults(&m_faults);
+}
+
+Detector::~Detector()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_abort = true;
+    _join_acquisition(lock);
+    _end_series(lock);
+}
+
+Detector::Param &Detector::_add(const std::string &key, const Json::Value &value,
+                                const std::string &value_type, bool writable,
+                                const std::string &unit)
+{
+    Param &param = m_params[key];
+    param.value = value;
+    param.value_type = value_type;
+    param.writable = writable;
+    param.unit = unit;
+    return param;
+}
+
+void Detector::_set_range(const std::string &key, double min, double max)
+{
+    Param &param = m_params[key];
+    param.min = min;
+    param.max = max;
+}
+
+void Detector::_set_allowed(const std::string &key, const char *const *values)
+{
+    Param &param = m_params[key];
+    for (; *values; ++values)
+        param.allowed_values.push_back(*values);
+}
+
+// the parameters of the SDK ParamDescription table
+void Detector::_init_params()
+{
+    static const char *const trigger_modes[] = {"ints", "inte", "exts", "exte", NULL};
+    static const char *const compressions[] = {"lz4", "bslz4", NULL};
+    static const char *const roi_modes[] = {"disabled", "4M", NULL};
+    static const char *const enabled[] = {"enabled", "disabled", NULL};
+    static const char *const header_details[] = {"all", "basic", "none", NULL};
+
+    // detector read only values
+    _add("detector/status/board_000/th0_temp", 28.5, "float", false, "degree Celsius");
+    _add("detector/status/board_000/th0_humidity", 10.2, "float", false, "%");
+    _add("detector/status/state", m_state, "string", false);
+    _add("detector/config/bit_depth_readout", 12, "uint", false);
+    _add("detector/config/x_pixel_size", 75e-6, "float", false, "m");
+    _add("detector/config/y_pixel_size", 75e-6, "float", false, "m");
+    _add("detector/config/x_pixels_in_detector", m_options.width, "uint", false);
+    _add("detector/config/y_pixels_in_detector", m_options.height, "uint", false);
+    _add("detector/config/description", m_options.description, "string", false);
+    _add("detector/config/detector_number", "E-08-0000-SIM", "string", false);
+    _add("detector/config/detector_readout_time", 1e-7, "float", false, "s");
+    _add("detector/config/data_collection_date", "", "string", false);
+    _add("detector/config/software_version", API_VERSION, "string", false);
+
+    // detector settings
+    _add("detector/config/count_time", 0.5, "float", true, "s");
+    _set_range("detector/config/count_time", 1e-6, 3600);
+    _add("detector/config/frame_time", 0.5, "float", true, "s");
+    _set_range("detector/config/frame_time", 1e-4, 3600);
+    _add("detector/config/trigger_mode", "ints", "string");
+    _set_allowed("detector/config/trigger_mode", trigger_modes);
+    _add("detector/config/countrate_correction_applied", true, "bool");
+    _add("detector/config/flatfield_correction_applied", true, "bool");
+    _add("detector/config/efficiency_correction_applied", false, "bool");
+    _add("detector/config/pixel_mask_applied", true, "bool");
+    _add("detector/config/threshold_energy", 4020., "float", true, "eV");
+    _set_range("detector/config/threshold_energy", 2700, 18000);
+    _add("detector/config/virtual_pixel_correction_applied", true, "bool");
+    _add("detector/config/photon_energy", 8041., "float", true, "eV");
+    _set_range("detector/config/photon_energy", 5400, 36000);
+    _add("detector/config/nimages", 1, "uint");
+    _set_range("detector/config/nimages", 1, 2000000000);
+    _add("detector/config/ntrigger", 1, "uint");
+    _set_range("detector/config/ntrigger", 1, 2000000000);
+    _add("detector/config/auto_summation", true, "bool");
+
+    // header values, only stored
+    static const char *const header[] = {"beam_center_x", "beam_center_y", "chi_increment", "chi_start",
+                                         "detector_distance", "kappa_increment", "kappa_start",
+                                         "omega_increment", "omega_start", "phi_increment", "phi_start",
+                                         NULL};
+    for (const char *const *name = header; *name; ++name)
+        _add(std::string("detector/config/") + *name, 0., "float");
+    _add("detector/config/wavelength", 12398.42 / 8041., "float", true, "A");
+
+    _add("detector/config/compression", "bslz4", "string");
+    _set_allowed("detector/config/compression", compressions);
+    _add("detector/config/roi_mode", "disabled", "string");
+    _set_allowed("detector/config/roi_mode", roi_modes);
+
+    // filewriter
+    _add("filewriter/config/mode", "enabled", "string");
+    _set_allowed("filewriter/config/mode", enabled);
+    _add("filewriter/config/compression_enabled", true, "bool");
+    _add("filewriter/config/name_pattern", "series_$id", "string");
+    _add("filewriter/config/nimages_per_file", 1000, "uint");
+    _add("filewriter/status/state", "ready", "string", false);
+    _add("filewriter/status/error", "", "string", false);
+    _add("filewriter/status/time", 0., "float", false, "s");
+    _add("filewriter/status/buffer_free", 0, "uint", false, "kB");
+
+    // stream
+    _add("stream/config/mode", "enabled", "string");
+    _set_allowed("stream/config/mode", enabled);
+    _add("stream/config/header_detail", "basic", "string");
+    _set_allowed("stream/config/header_detail", header_details);
+    _add("stream/config/header_appendix", "", "string");
+    _add("stream/status/state", "ready", "string", false);
+    _add("stream/status/dropped", 0, "uint", false);
+}
+
+void Detector::_update_status()
+{
+    bool series_open = m_state == "ready" || m_state == "acquire";
+    m_params["detector/status/state"].value = m_state;
+
+    if (m_params["filewriter/config/mode"].value.asString() == "disabled")
+        m_params["filewriter/status/state"].value = "disabled";
+    else
+        m_params["filewriter/status/state"].value = m_filewriter.state();
+    m_params["filewriter/status/error"].value = m_filewriter.error();
+    m_params["filewriter/status/time"].value = m_filewriter.time();
+    m_params["filewriter/status/buffer_free"].value = Json::UInt64(m_filewriter.buffer_free());
+
+    if (m_params["stream/config/mode"].value.asString() == "disabled")
+        m_params["stream/status/state"].value = "disabled";
+    else
+        m_params["stream/status/state"].value = series_open ? "acquire" : "ready";
+    m_params["stream/status/dropped"].value = m_stream.dropped();
+}
+
+// detector configuration of the stream header and the master file
+Json::Value Detector::_config() const
+{
+    static const char PREFIX[] = "detector/config/";
+    Json::Value config(Json::objectValue);
+    for (std::map<std::string, Param>::const_iterator i = m_params.begin(); i != m_params.end(); ++i)
+        if (!i->first.compare(0, sizeof(PREFIX) - 1, PREFIX))
+            config[i->first.substr(sizeof(PREFIX) - 1)] = i->second.value;
+    return config;
+}
+
+void Detector::handle(const HttpRequest &request, HttpResponse &response)
+{
+    std::vector<std::string> parts = _split(request.path);
+    if (parts.size() == 3 && parts[0] == "simulator" && parts[1] == "api" && parts[2] == "faults")
+    {
+        _faults(request, response);
+        return;
+    }
+    if (!m_faults.http(request, response))
+        return;
+
+    if (parts.size() >= 2 && parts[0] == "data")
+    {
+        _data(request, request.path.substr(request.path.find("data/") + 5), response);
+        return;
+    }
+    if (parts.size() < 3 || parts[1] != "api")
+    {
+        _error(response, 404, "Unknown resource " + request.path);
+        return;
+    }
+
+    const std::string &subsystem = parts[0];
+    if (parts[2] == "version")
+    {
+        Json::Value version;
+        version["value"] = API_VERSION;
+        version["value_type"] = "string";
+        response.body = Json::FastWriter().write(version);
+        return;
+    }
+    if (parts.size() < 4)
+    {
+        _error(response, 404, "Unknown resource " + request.path);
+        return;
+    }
+
+    if (subsystem == "filewriter" && parts[3] == "files")
+    {
+        if (parts.size() > 4)
+            _data(request, parts[4], response);
+        else
+        {
+            Json::Value files(Json::arrayValue);
+            std::vector<std::string> names = m_filewriter.list();
+            for (size_t i = 0; i < names.size(); ++i)
+                files.append(names[i]);
+            response.body = Json::FastWriter().write(files);
+        }
+        return;
+    }
+
+    if (parts[3] == "command" && parts.size() == 5)
+    {
+        if (request.method != "PUT")
+            _error(response, 405, "Commands are PUT requests");
+        else
+            _command(subsystem, parts[4], response);
+        return;
+    }
+
+    std::string key = subsystem;
+    for (size_t i = 3; i < parts.size(); ++i)
+        key += "/" + parts[i];
+    if (request.method == "GET" || request.method == "HEAD")
+        _get_param(key, response);
+    else if (request.method == "PUT")
+        _put_param(key, request.body, response);
+    else
+        _error(response, 405, "Method not allowed");
+}
+
+void Detector::_get_param(const std::string &key, HttpResponse &response)
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    std::map<std::string, Param>::const_iterator i = m_params.find(key);
+    if (i == m_params.end())
+    {
+        _error(response, 404, "Unknown parameter " + key);
+        return;
+    }
+    if (key.find("/status/") != std::string::npos)
+        _update_status();
+
+    const Param &param = i->second;
+    Json::Value reply;
+    reply["value"] = param.value;
+    reply["value_type"] = param.value_type;
+    reply["access_mode"] = param.writable ? "rw" : "r";
+    if (!param.min.isNull())
+    {
+        reply["min"] = param.min;
+        reply["max"] = param.max;
+    }
+    if (!param.allowed_values.empty())
+        for (size_t v = 0; v < param.allowed_values.size(); ++v)
+            reply["allowed_values"].append(param.allowed_values[v]);
+    if (!param.unit.empty())
+        reply["unit"] = param.unit;
+    response.body = Json::FastWriter().write(reply);
+}
+
+void Detector::_put_param(const std::string &key, const std::string &body, HttpResponse &response)
+{
+    Json::Value request;
+    if (!Json::Reader().parse(body, request) || !request.isObject() || !request.isMember("value"))
+    {
+        _error(response, 400, "Expected {\"value\": ...}");
+        return;
+    }
+    const Json::Value &value = request["value"];
+
+    std::unique_lock<std::mutex> lock(m_lock);
+    std::map<std::string, Param>::iterator i = m_params.find(key);
+    if (i == m_params.end())
+    {
+        _error(response, 404, "Unknown parameter " + key);
+        return;
+    }
+    Param &param = i->second;
+    if (!param.writable)
+    {
+        _error(response, 400, key + " is read only");
+        return;
+    }
+    if (m_state == "acquire")
+    {
+        _error(response, 400, "Acquisition running");
+        return;
+    }
+
+    Json::Value new_value;
+    if (param.value_type == "bool" && value.isBool())
+        new_value = value.asBool();
+    else if (param.value_type == "float" && value.isNumeric())
+        new_value = value.asDouble();
+    else if (param.value_type == "int" && value.isIntegral())
+        new_value = value.asInt64();
+    else if (param.value_type == "uint" && value.isIntegral() && value.asInt64() >= 0)
+        new_value = value.asUInt64();
+    else if (param.value_type == "string" && value.isString())
+        new_value = value.asString();
+    else
+    {
+        _error(response, 400, "Bad value type for " + key + ", expected " + param.value_type);
+        return;
+    }
+    if (!param.min.isNull() &&
+        (new_value.asDouble() < param.min.asDouble() || new_value.asDouble() > param.max.asDouble()))
+    {
+        _error(response, 400, "Value out of range for " + key);
+        return;
+    }
+    if (!param.allowed_values.empty())
+    {
+        bool allowed = false;
+        for (size_t v = 0; !allowed && v < param.allowed_values.size(); ++v)
+            allowed = param.allowed_values[v] == new_value.asString();
+        if (!allowed)
+        {
+            _error(response, 400, "Value not allowed for " + key);
+            return;
+        }
+    }
+    param.value = new_value;
+
+    // the reply lists the parameters changed by the request
+    Json::Value changed(Json::arrayValue);
+    changed.append(key.substr(key.rfind('/') + 1));
+    if (key == "detector/config/photon_energy")
+    {
+        double energy = new_value.asDouble();
+        m_params["detector/config/threshold_energy"].value = energy / 2;
+        m_params["detector/config/wavelength"].value = 12398.42 / energy;
+        changed.append("threshold_energy");
+        changed.append("wavelength");
+    }
+    response.body = Json::FastWriter().write(changed);
+}
+
+void Detector::_command(const std::string &subsystem, const std::string &name, HttpResponse &response)
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    Json::Value reply(Json::objectValue);
+
+    if (subsystem == "filewriter" && name == "clear")
+        m_filewriter.clear();
+    else if (subsystem != "detector")
+    {
+        _error(response, 404, "Unknown command " + name);
+        return;
+    }
+    else if (name == "initialize")
+    {
+        m_abort = true;
+        _join_acquisition(lock);
+        _end_series(lock);
+        m_state = "idle";
+    }
+    else if (name == "arm")
+    {
+        if (m_state != "idle")
+        {
+            _error(response, 400, "Can't arm in state " + m_state);
+            return;
+        }
+        try
+        {
+            _arm();
+        }
+        catch (const std::exception &e)
+        {
+            _error(response, 400, std::string("Arm failed: ") + e.what());
+            return;
+        }
+        reply["sequence id"] = m_series;
+    }
+    else if (name == "trigger")
+    {
+        if (m_state != "ready" || m_acquiring || !_internal_trigger())
+        {
+            _error(response, 400, "Can't trigger in state " + m_state);
+            return;
+        }
+        // the command returns once the trigger frames are acquired
+        int series = m_series, first_frame = m_next_frame;
+        int nb_frames = m_params["detector/config/nimages"].value.asInt();
+        m_acquiring = true;
+        m_state = "acquire";
+        lock.unlock();
+        _acquire(series, first_frame, nb_frames);
+        lock.lock();
+        m_acquiring = false;
+        m_cond.notify_all();
+        if (!m_abort && series == m_series && m_state == "acquire")
+        {
+            m_next_frame += nb_frames;
+            if (++m_nb_triggers >= m_params["detector/config/ntrigger"].value.asInt())
+                _end_series(lock);
+            else
+                m_state = "ready";
+        }
+        reply["sequence id"] = series;
+    }
+    else if (name == "disarm" || name == "cancel" || name == "abort")
+    {
+        m_abort = true;
+        _join_acquisition(lock);
+        _end_series(lock);
+        reply["sequence id"] = m_series;
+    }
+    else if (name != "status_update")
+    {
+        _error(response, 404, "Unknown command " + name);
+        return;
+    }
+    if (!reply.empty())
+        response.body = Json::FastWriter().write(reply);
+}
+
+void Detector::_data(const HttpRequest &request, const std::string &name, HttpResponse &response)
+{
+    if (request.method == "DELETE")
+    {
+        if (!m_filewriter.remove(name))
+            _error(response, 404, "Unknown file " + name);
+        return;
+    }
+    if (request.method != "GET" && request.method != "HEAD")
+    {
+        _error(response, 405, "Method not allowed");
+        return;
+    }
+    if (!m_filewriter.path(name, response.file_path))
+        _error(response, 404, "Unknown file " + name);
+}
+
+// GET: configuration and injected fault counters, PUT: new configuration
+void Detector::_faults(const HttpRequest &request, HttpResponse &response)
+{
+    if (request.method == "PUT")
+    {
+        Json::Value config;
+        if (!Json::Reader().parse(request.body, config))
+        {
+            _error(response, 400, "Bad fault configuration");
+            return;
+        }
+        try
+        {
+            m_faults.configure(config);
+        }
+        catch (const std::invalid_argument &e)
+        {
+            _error(response, 400, e.what());
+            return;
+        }
+    }
+    else if (request.method != "GET" && request.method != "HEAD")
+    {
+        _error(response, 405, "Method not allowed");
+        return;
+    }
+    response.body = Json::FastWriter().write(m_faults.status());
+}
+
+void Detector::_arm()
+{
+    int nimages = m_params["detector/config/nimages"].value.asInt();
+    int ntrigger = m_params["detector/config/ntrigger"].value.asInt();
+    bool auto_summation = m_params["detector/config/auto_summation"].value.asBool();
+    bool lz4 = m_params["detector/config/compression"].value.asString() == "lz4";
+    m_frames.generate(m_options.width, m_options.height, auto_summation ? 4 : 2,
+                      lz4 ? FrameSet::LZ4 : FrameSet::BSLZ4, m_options.distinct_frames);
+
+    char date[64];
+    time_t now = time(NULL);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+    m_params["detector/config/data_collection_date"].value = date;
+
+    ++m_series;
+    m_nb_frames = nimages * ntrigger;
+    m_next_frame = m_nb_triggers = 0;
+    m_abort = false;
+    m_stream.reset_dropped();
+    Json::Value config = _config();
+
+    if (m_params["filewriter/config/mode"].value.asString() == "enabled")
+    {
+        std::string prefix = m_params["filewriter/config/name_pattern"].value.asString();
+        size_t id = prefix.find("$id");
+        if (id != std::string::npos)
+            prefix.replace(id, 3, std::to_string(m_series));
+        m_filewriter.start(prefix, m_nb_frames, m_params["filewriter/config/nimages_per_file"].value.asInt(),
+                           m_params["filewriter/config/compression_enabled"].value.asBool(), m_frames, config);
+    }
+    if (m_params["stream/config/mode"].value.asString() == "enabled")
+    {
+        const std::string &appendix = m_params["stream/config/header_appendix"].value.asString();
+        m_stream.header(m_series, m_params["stream/config/header_detail"].value.asString(),
+                        config, appendix);
+    }
+
+    m_start_time = std::chrono::duration<double>(Clock::now().time_since_epoch()).count();
+    m_state = "ready";
+
+    // the external triggers are simulated, all the frames are acquired at arm time
+    if (!_internal_trigger())
+    {
+        int series = m_series, nb_frames = m_nb_frames;
+        m_acquiring = true;
+        m_state = "acquire";
+        m_thread = std::thread([this, series, nb_frames]() {
+            _acquire(series, 0, nb_frames);
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_acquiring = false;
+            m_cond.notify_all();
+            if (!m_abort && series == m_series && m_state == "acquire")
+            {
+                m_next_frame = nb_frames;
+                _end_series(lock);
+            }
+        });
+    }
+}
+
+bool Detector::_internal_trigger()
+{
+    return !m_params["detector/config/trigger_mode"].value.asString().compare(0, 3, "int");
+}
+
+void Detector::_acquire(int series, int first_frame, int nb_frames)
+{
+    double period, count_time;
+    bool stream, filewriter;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        count_time = m_params["detector/config/count_time"].value.asDouble();
+        if (m_options.frame_rate > 0)
+            period = 1. / m_options.frame_rate;
+        else if (m_options.frame_rate == 0)
+            period = 0;
+        else
+            period = m_params["detector/config/frame_time"].value.asDouble();
+        stream = m_params["stream/config/mode"].value.asString() == "enabled";
+        filewriter = m_params["filewriter/config/mode"].value.asString() == "enabled";
+    }
+
+    Clock::time_point start = Clock::now();
+    double series_offset = std::chrono::duration<double>(start.time_since_epoch()).count() - m_start_time;
+    for (int i = 0; i < nb_frames && !m_abort; ++i)
+    {
+        if (period > 0)
+            std::this_thread::sleep_until(start + std::chrono::duration<double>(i * period));
+        int frame_nb = first_frame + i;
+        long long start_time = (long long)((series_offset + _elapsed(start)) * 1e9);
+        if (stream)
+            m_stream.image(series, frame_nb, m_frames, start_time, start_time + (long long)(count_time * 1e9));
+        if (filewriter)
+        {
+            try
+            {
+                m_filewriter.write(frame_nb);
+            }
+            catch (const std::exception &e)
+            {
+                fprintf(stderr, "filewriter: %s\n", e.what());
+                filewriter = false;
+            }
+        }
+    }
+}
+
+void Detector::_end_series(std::unique_lock<std::mutex> &)
+{
+    if (m_state != "ready" && m_state != "acquire")
+        return;
+    m_filewriter.finish();
+    if (m_params["stream/config/mode"].value.asString() == "enabled")
+        m_stream.end(m_series);
+    m_state = "idle";
+}
+
+// wait for the acquisition of a trigger or of the simulated external triggers
+void Detector::_join_acquisition(std::unique_lock<std::mutex> &lock)
+{
+    while (m_acquiring)
+        m_cond.wait(lock);
+    if (m_thread.joinable())
+    {
+        std::thread thread(std::move(m_thread));
+        lock.unlock();
+        thread.join();
+        lock.lock();
+    }
+}
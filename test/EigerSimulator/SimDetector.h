@@ -0,0 +1,125 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef SIMDETECTOR_H
+#define SIMDETECTOR_H
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <json/json.h>
+
+#include "SimFaults.h"
+#include "SimFileWriter.h"
+#include "SimFrames.h"
+#include "SimHttpServer.h"
+#include "SimStream.h"
+
+namespace eigersim
+{
+/// Detector state machine behind the SIMPLON REST API:
+/// detector, filewriter and stream subsystems and the /data/ files,
+/// the fault injection on /simulator/api/faults.
+class Detector
+{
+public:
+    struct Options
+    {
+        Options();
+
+        std::string data_dir;
+        long long buffer_size;   // DCU buffer in bytes
+        int width;
+        int height;
+        double frame_rate;       // <0: frame_time, 0: as fast as possible
+        int distinct_frames;     // generated frames, cycled through
+        std::string description;
+        int zmq_port;
+        int zmq_high_water_mark; // frames queued before the stream blocks
+        double zmq_send_timeout; // s, then the frame is dropped
+        Json::Value faults;      // initial fault injection, see Faults
+    };
+
+    explicit Detector(const Options &options);
+    ~Detector();
+
+    void handle(const HttpRequest &request, HttpResponse &response);
+
+private:
+    struct Param
+    {
+        Json::Value value;
+        std::string value_type; // bool, float, int, uint or string
+        Json::Value min;
+        Json::Value max;
+        std::vector<std::string> allowed_values;
+        std::string unit;
+        bool writable;
+    };
+
+    void _init_params();
+    Param &_add(const std::string &key, const Json::Value &value, const std::string &value_type,
+                bool writable = true, const std::string &unit = "");
+    void _set_range(const std::string &key, double min, double max);
+    void _set_allowed(const std::string &key, const char *const *values);
+    void _update_status();
+    Json::Value _config() const;
+
+    void _get_param(const std::string &key, HttpResponse &response);
+    void _put_param(const std::string &key, const std::string &body, HttpResponse &response);
+    void _command(const std::string &subsystem, const std::string &name, HttpResponse &response);
+    void _data(const HttpRequest &request, const std::string &name, HttpResponse &response);
+    void _faults(const HttpRequest &request, HttpResponse &response);
+
+    void _arm();
+    bool _internal_trigger();
+    void _acquire(int series, int first_frame, int nb_frames);
+    void _end_series(std::unique_lock<std::mutex> &lock);
+    void _join_acquisition(std::unique_lock<std::mutex> &lock);
+
+    Options m_options;
+    std::map<std::string, Param> m_params; // "subsystem/location/name"
+
+    std::string m_state;
+    int m_series;
+    int m_nb_frames;     // of the series
+    int m_next_frame;
+    int m_nb_triggers;
+    bool m_acquiring;
+    std::atomic<bool> m_abort;
+    double m_start_time; // of the series, for the stream timestamps
+    std::thread m_thread; // external trigger acquisition
+
+    FrameSet m_frames;
+    Faults m_faults;
+    Stream m_stream;
+    FileWriter m_filewriter;
+
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+};
+} // namespace eigersim
+#endif // SIMDETECTOR_H
@@ -0,0 +1,219 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <stdexcept>
+#include <thread>
+
+#include "SimFaults.h"
+
+using namespace eigersim;
+
+static double _number(const Json::Value &section, const char *key, double max)
+{
+    const Json::Value &value = section.get(key, 0.);
+    if (!value.isNumeric() || value.asDouble() < 0 || value.asDouble() > max)
+        throw std::invalid_argument(std::string("Bad fault value for ") + key);
+    return value.asDouble();
+}
+
+static double _probability(const Json::Value &section, const char *key)
+{
+    return _number(section, key, 1.);
+}
+
+static double _time(const Json::Value &section, const char *key)
+{
+    return _number(section, key, 3600.);
+}
+
+static const Json::Value &_section(const Json::Value &config, const char *key)
+{
+    const Json::Value &section = config[key];
+    if (!section.isNull() && !section.isObject() && !(section.isArray() && std::string(key) == "http"))
+        throw std::invalid_argument(std::string("Bad fault section ") + key);
+    return section;
+}
+
+Faults::Faults() : m_config(Json::objectValue),
+                   m_drop(0),
+                   m_reorder(0),
+                   m_truncate(0),
+                   m_stall(0),
+                   m_stall_time(0),
+                   m_publish_delay(0),
+                   m_injected(Json::objectValue)
+{
+    m_random.seed(std::random_device()());
+}
+
+void Faults::configure(const Json::Value &config)
+{
+    if (!config.isObject())
+        throw std::invalid_argument("Fault configuration is not an object");
+
+    // parsed before being applied, a bad configuration changes nothing
+    const Json::Value &stream = _section(config, "stream");
+    double drop = _probability(stream, "drop");
+    double reorder = _probability(stream, "reorder");
+    double truncate = _probability(stream, "truncate");
+    double stall = _probability(stream, "stall");
+    double stall_time = _time(stream, "stall_time");
+
+    std::vector<HttpRule> http_rules;
+    Json::Value http = _section(config, "http");
+    if (http.isObject())
+    {
+        Json::Value rules(Json::arrayValue);
+        rules.append(http);
+        http = rules;
+    }
+    for (Json::Value::ArrayIndex i = 0; i < http.size(); ++i)
+    {
+        const Json::Value &rule = http[i];
+        if (!rule.isObject())
+            throw std::invalid_argument("Bad http fault rule");
+        HttpRule http_rule;
+        http_rule.match = rule.get("match", "").asString();
+        http_rule.latency = _time(rule, "latency");
+        http_rule.jitter = _time(rule, "jitter");
+        http_rule.error = _probability(rule, "error");
+        const Json::Value &error_status = rule.get("error_status", 500);
+        if (!error_status.isIntegral() || error_status.asInt() < 400 || error_status.asInt() > 599)
+            throw std::invalid_argument("Bad fault value for error_status");
+        http_rule.error_status = error_status.asInt();
+        http_rule.disconnect = _probability(rule, "disconnect");
+        http_rules.push_back(http_rule);
+    }
+
+    double publish_delay = _time(_section(config, "filewriter"), "publish_delay");
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (config.isMember("seed"))
+        m_random.seed(config["seed"].asUInt());
+    m_config = config;
+    m_drop = drop;
+    m_reorder = reorder;
+    m_truncate = truncate;
+    m_stall = stall;
+    m_stall_time = stall_time;
+    m_http_rules = http_rules;
+    m_publish_delay = publish_delay;
+    m_injected = Json::Value(Json::objectValue);
+}
+
+Json::Value Faults::status() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    Json::Value status;
+    status["config"] = m_config;
+    status["injected"] = m_injected;
+    return status;
+}
+
+bool Faults::_draw(double probability)
+{
+    return probability > 0 && std::uniform_real_distribution<double>()(m_random) < probability;
+}
+
+void Faults::_count(const char *fault)
+{
+    m_injected[fault] = m_injected.get(fault, 0).asInt() + 1;
+}
+
+Faults::StreamFault Faults::stream_frame(double &stall_time)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    stall_time = 0;
+    if (_draw(m_stall))
+    {
+        stall_time = m_stall_time;
+        _count("stream_stall");
+    }
+    StreamFault fault = NONE;
+    const char *name = NULL;
+    if (_draw(m_drop))
+        fault = DROP, name = "stream_drop";
+    else if (_draw(m_reorder))
+        fault = REORDER, name = "stream_reorder";
+    else if (_draw(m_truncate))
+        fault = TRUNCATE, name = "stream_truncate";
+    if (name)
+        _count(name);
+    return fault;
+}
+
+size_t Faults::truncated_size(size_t size)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return size ? std::uniform_int_distribution<size_t>(0, size - 1)(m_random) : 0;
+}
+
+bool Faults::http(const HttpRequest &request, HttpResponse &response)
+{
+    double latency = 0;
+    bool error = false, disconnect = false;
+    int error_status = 500;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        for (size_t i = 0; i < m_http_rules.size(); ++i)
+        {
+            const HttpRule &rule = m_http_rules[i];
+            if (request.path.find(rule.match) == std::string::npos)
+                continue;
+            latency = rule.latency;
+            if (rule.jitter > 0)
+                latency += std::uniform_real_distribution<double>(0, rule.jitter)(m_random);
+            disconnect = _draw(rule.disconnect);
+            error = !disconnect && _draw(rule.error);
+            error_status = rule.error_status;
+            if (latency > 0)
+                _count("http_delayed");
+            if (disconnect)
+                _count("http_disconnect");
+            if (error)
+                _count("http_error");
+            break;
+        }
+    }
+
+    // slept without the lock, the server has a thread per connection
+    if (latency > 0)
+        std::this_thread::sleep_for(std::chrono::duration<double>(latency));
+    if (disconnect)
+    {
+        response.disconnect = true;
+        return false;
+    }
+    if (error)
+    {
+        response.status = error_status;
+        response.content_type = "text/plain";
+        response.body = "Injected fault";
+        return false;
+    }
+    return true;
+}
+
+double Faults::publish_delay() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_publish_delay;
+}
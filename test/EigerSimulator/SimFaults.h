@@ -0,0 +1,108 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef SIMFAULTS_H
+#define SIMFAULTS_H
+
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <json/json.h>
+
+#include "SimHttpServer.h"
+
+namespace eigersim
+{
+/// Fault injection of the simulator, configured by a JSON document
+/// (--faults file or PUT /simulator/api/faults) and counted so the
+/// degradation can be related to the injected faults:
+///
+///   {"seed": 1,
+///    "stream": {"drop": 0.01, "reorder": 0.01, "truncate": 0.001,
+///               "stall": 0.001, "stall_time": 0.5},
+///    "http": [{"match": "/data/", "latency": 0.05, "jitter": 0.05,
+///              "error": 0.01, "error_status": 503, "disconnect": 0.01}],
+///    "filewriter": {"publish_delay": 2.0}}
+///
+/// Probabilities are per frame or per request, times in s.
+class Faults
+{
+public:
+    enum StreamFault
+    {
+        NONE,
+        DROP,     // frame not sent
+        REORDER,  // frame sent after the next one
+        TRUNCATE, // frame payload cut
+    };
+
+    Faults();
+
+    /// replaces the configuration and resets the counters,
+    /// throws std::invalid_argument
+    void configure(const Json::Value &config);
+    /// configuration and injected fault counters
+    Json::Value status() const;
+
+    /// fault of the next stream frame, stall_time set when the frame is delayed
+    StreamFault stream_frame(double &stall_time);
+    /// length of a truncated payload, in [0, size)
+    size_t truncated_size(size_t size);
+
+    /// sleeps the latency of the request, false with the response
+    /// filled (error or disconnect) when the request fails
+    bool http(const HttpRequest &request, HttpResponse &response);
+
+    /// s between the completion of a filewriter file and its listing
+    double publish_delay() const;
+
+private:
+    struct HttpRule
+    {
+        std::string match; // path substring, empty for all
+        double latency;
+        double jitter;
+        double error;
+        int error_status;
+        double disconnect;
+    };
+
+    bool _draw(double probability);
+    void _count(const char *fault);
+
+    mutable std::mutex m_lock;
+    std::mt19937 m_random;
+    Json::Value m_config;
+
+    double m_drop;
+    double m_reorder;
+    double m_truncate;
+    double m_stall;
+    double m_stall_time;
+    std::vector<HttpRule> m_http_rules;
+    double m_publish_delay;
+
+    Json::Value m_injected; // counters by fault name
+};
+} // namespace eigersim
+#endif // SIMFAULTS_H
@@ -0,0 +1,376 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <stdexcept>
+
+#include <hdf5.h>
+#if !H5_VERSION_GE(1, 10, 2)
+#include <hdf5_hl.h>
+#define H5Dwrite_chunk H5DOwrite_chunk
+#endif
+
+#include "SimFileWriter.h"
+
+using namespace eigersim;
+
+static const H5Z_filter_t LZ4_FILTER = 32004;
+static const H5Z_filter_t BSHUF_FILTER = 32008;
+static const unsigned int BSHUF_LZ4_COMPRESSION = 2;
+
+static double _now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// chunks are written compressed, the filters only need to be known
+// by the library to be set in the dataset pipeline
+static size_t _no_filter(unsigned int, size_t, const unsigned int[], size_t,
+                         size_t *, void **)
+{
+    return 0;
+}
+
+static void _register_filter(H5Z_filter_t filter, const char *name)
+{
+    if (H5Zfilter_avail(filter) > 0)
+        return;
+    H5Z_class2_t filter_class = {H5Z_CLASS_T_VERS, filter, 1, 1, name, NULL, NULL, _no_filter};
+    if (H5Zregister(&filter_class) < 0)
+        throw std::runtime_error("Can't register HDF5 filter");
+}
+
+static void _write_attribute(hid_t location, const char *name, long long value)
+{
+    hid_t space = H5Screate(H5S_SCALAR);
+    hid_t attribute = H5Acreate2(location, name, H5T_STD_I64LE, space, H5P_DEFAULT, H5P_DEFAULT);
+    H5Awrite(attribute, H5T_NATIVE_LLONG, &value);
+    H5Aclose(attribute);
+    H5Sclose(space);
+}
+
+static void _write_scalar(hid_t group, const std::string &name, const Json::Value &value)
+{
+    hid_t space = H5Screate(H5S_SCALAR);
+    if (value.isString())
+    {
+        std::string str = value.asString();
+        hid_t type = H5Tcopy(H5T_C_S1);
+        H5Tset_size(type, str.size() + 1);
+        hid_t dataset = H5Dcreate2(group, name.c_str(), type, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        H5Dwrite(dataset, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, str.c_str());
+        H5Dclose(dataset);
+        H5Tclose(type);
+    }
+    else if (value.isNumeric() || value.isBool())
+    {
+        double number = value.asDouble();
+        hid_t dataset = H5Dcreate2(group, name.c_str(), H5T_IEEE_F64LE, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        H5Dwrite(dataset, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, &number);
+        H5Dclose(dataset);
+    }
+    H5Sclose(space);
+}
+
+FileWriter::FileWriter(const std::string &directory, long long buffer_size) : m_directory(directory),
+                                                                              m_buffer_size(buffer_size),
+                                                                              m_stored_size(0),
+                                                                              m_open_size(0),
+                                                                              m_faults(NULL),
+                                                                              m_nb_frames(0),
+                                                                              m_frames_per_file(1),
+                                                                              m_compression(true),
+                                                                              m_frames(NULL),
+                                                                              m_acquiring(false),
+                                                                              m_start_time(0),
+                                                                              m_end_time(0),
+                                                                              m_file_id(-1),
+                                                                              m_dataset_id(-1),
+                                                                              m_file_nb(0),
+                                                                              m_first_frame(0),
+                                                                              m_nb_written(0)
+{
+    _register_filter(LZ4_FILTER, "lz4 (simulator)");
+    _register_filter(BSHUF_FILTER, "bitshuffle (simulator)");
+}
+
+FileWriter::~FileWriter()
+{
+    finish();
+}
+
+void FileWriter::start(const std::string &prefix, int nb_frames, int frames_per_file,
+                       bool compression, const FrameSet &frames, const Json::Value &config)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    _close_data_file();
+    m_prefix = prefix;
+    m_nb_frames = nb_frames;
+    m_frames_per_file = frames_per_file > 0 ? frames_per_file : nb_frames;
+    m_compression = compression;
+    m_frames = &frames;
+    m_error.clear();
+    m_file_nb = 0;
+    m_acquiring = true;
+    m_start_time = _now();
+    _write_master(config);
+}
+
+void FileWriter::write(int frame_nb)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (!m_acquiring || !m_error.empty())
+        return;
+
+    const FrameSet::Frame &frame = (*m_frames)[frame_nb];
+    const std::string &chunk = m_compression ? frame.chunk : frame.raw;
+    if (m_stored_size + m_open_size + (long long)chunk.size() > m_buffer_size)
+    {
+        _set_error("buffer full, frame dropped");
+        return;
+    }
+
+    if (m_file_id < 0)
+        _open_data_file();
+
+    hsize_t dims[3] = {hsize_t(m_nb_written + 1), hsize_t(m_frames->height()), hsize_t(m_frames->width())};
+    hsize_t offset[3] = {hsize_t(m_nb_written), 0, 0};
+    if (H5Dset_extent(m_dataset_id, dims) < 0 ||
+        H5Dwrite_chunk(m_dataset_id, H5P_DEFAULT, 0, offset, chunk.size(), chunk.data()) < 0)
+    {
+        _set_error("chunk write failed");
+        return;
+    }
+    m_open_size += chunk.size();
+
+    if (++m_nb_written == m_frames_per_file || frame_nb + 1 == m_nb_frames)
+        _close_data_file();
+}
+
+void FileWriter::finish()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    _close_data_file();
+    if (m_acquiring)
+        m_end_time = _now();
+    m_acquiring = false;
+}
+
+void FileWriter::_open_data_file()
+{
+    char name[64];
+    snprintf(name, sizeof(name), "_data_%06d.h5", ++m_file_nb);
+    m_file_name = m_prefix + name;
+    m_first_frame = (m_file_nb - 1) * m_frames_per_file + 1;
+    m_nb_written = 0;
+
+    std::string tmp_path = m_directory + "/." + m_file_name + ".part";
+    m_file_id = H5Fcreate(tmp_path.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    if (m_file_id < 0)
+        throw std::runtime_error("Can't create " + tmp_path);
+
+    hid_t lcpl = H5Pcreate(H5P_LINK_CREATE);
+    H5Pset_create_intermediate_group(lcpl, 1);
+    hsize_t dims[3] = {0, hsize_t(m_frames->height()), hsize_t(m_frames->width())};
+    hsize_t max_dims[3] = {H5S_UNLIMITED, dims[1], dims[2]};
+    hsize_t chunk_dims[3] = {1, dims[1], dims[2]};
+    hid_t space = H5Screate_simple(3, dims, max_dims);
+    hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(dcpl, 3, chunk_dims);
+    if (m_compression)
+    {
+        if (m_frames->compression() == FrameSet::LZ4)
+        {
+            unsigned int block_size = 0;
+            H5Pset_filter(dcpl, LZ4_FILTER, H5Z_FLAG_MANDATORY, 1, &block_size);
+        }
+        else
+        {
+            unsigned int cd_values[5] = {0, 0, unsigned(m_frames->depth()), 0, BSHUF_LZ4_COMPRESSION};
+            H5Pset_filter(dcpl, BSHUF_FILTER, H5Z_FLAG_MANDATORY, 5, cd_values);
+        }
+    }
+    hid_t type = m_frames->depth() == 2 ? H5T_STD_U16LE : H5T_STD_U32LE;
+    m_dataset_id = H5Dcreate2(m_file_id, "/entry/data/data", type, space, lcpl, dcpl, H5P_DEFAULT);
+    H5Pclose(dcpl);
+    H5Sclose(space);
+    H5Pclose(lcpl);
+    if (m_dataset_id < 0)
+        throw std::runtime_error("Can't create the dataset of " + tmp_path);
+}
+
+void FileWriter::_close_data_file()
+{
+    if (m_file_id < 0)
+        return;
+    _write_attribute(m_dataset_id, "image_nr_low", m_first_frame);
+    _write_attribute(m_dataset_id, "image_nr_high", m_first_frame + m_nb_written - 1);
+    H5Dclose(m_dataset_id);
+    H5Fclose(m_file_id);
+    m_dataset_id = m_file_id = -1;
+    m_open_size = 0;
+    _publish(m_directory + "/." + m_file_name + ".part", m_file_name);
+}
+
+void FileWriter::_write_master(const Json::Value &config)
+{
+    std::string name = m_prefix + "_master.h5";
+    std::string tmp_path = m_directory + "/." + name + ".part";
+    hid_t file = H5Fcreate(tmp_path.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    if (file < 0)
+        throw std::runtime_error("Can't create " + tmp_path);
+
+    hid_t lcpl = H5Pcreate(H5P_LINK_CREATE);
+    H5Pset_create_intermediate_group(lcpl, 1);
+
+    // the data files are linked before they exist, as the DCU does
+    hid_t data = H5Gcreate2(file, "/entry/data", lcpl, H5P_DEFAULT, H5P_DEFAULT);
+    int nb_files = (m_nb_frames + m_frames_per_file - 1) / m_frames_per_file;
+    for (int i = 1; i <= nb_files; ++i)
+    {
+        char link_name[32], file_suffix[32];
+        snprintf(link_name, sizeof(link_name), "data_%06d", i);
+        snprintf(file_suffix, sizeof(file_suffix), "_data_%06d.h5", i);
+        H5Lcreate_external((m_prefix + file_suffix).c_str(), "/entry/data/data",
+                           data, link_name, H5P_DEFAULT, H5P_DEFAULT);
+    }
+    H5Gclose(data);
+
+    hid_t detector = H5Gcreate2(file, "/entry/instrument/detector", lcpl, H5P_DEFAULT, H5P_DEFAULT);
+    for (Json::Value::const_iterator i = config.begin(); i != config.end(); ++i)
+        _write_scalar(detector, i.key().asString(), *i);
+    H5Gclose(detector);
+
+    H5Pclose(lcpl);
+    H5Fclose(file);
+    _publish(tmp_path, name);
+}
+
+// renamed once complete, so a listed file is always readable
+void FileWriter::_publish(const std::string &tmp_path, const std::string &name)
+{
+    std::string path = m_directory + "/" + name;
+    struct stat file_stat;
+    if (rename(tmp_path.c_str(), path.c_str()) || stat(path.c_str(), &file_stat))
+    {
+        _set_error("can't publish " + name);
+        return;
+    }
+    std::map<std::string, PublishedFile>::iterator i = m_files.find(name);
+    if (i != m_files.end())
+        m_stored_size -= i->second.size;
+    PublishedFile &file = m_files[name];
+    file.size = file_stat.st_size;
+    file.listed_time = _now() + (m_faults ? m_faults->publish_delay() : 0);
+    m_stored_size += file.size;
+}
+
+// published and listed
+const FileWriter::PublishedFile *FileWriter::_find(const std::string &name) const
+{
+    std::map<std::string, PublishedFile>::const_iterator i = m_files.find(name);
+    if (i == m_files.end() || i->second.listed_time > _now())
+        return NULL;
+    return &i->second;
+}
+
+std::vector<std::string> FileWriter::list() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    std::vector<std::string> names;
+    double now = _now();
+    for (std::map<std::string, PublishedFile>::const_iterator i = m_files.begin(); i != m_files.end(); ++i)
+        if (i->second.listed_time <= now)
+            names.push_back(i->first);
+    return names;
+}
+
+bool FileWriter::path(const std::string &name, std::string &path) const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (!_find(name))
+        return false;
+    path = m_directory + "/" + name;
+    return true;
+}
+
+bool FileWriter::remove(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    const PublishedFile *file = _find(name);
+    if (!file)
+        return false;
+    ::remove((m_directory + "/" + name).c_str());
+    m_stored_size -= file->size;
+    m_files.erase(name);
+    return true;
+}
+
+void FileWriter::clear()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (std::map<std::string, PublishedFile>::iterator i = m_files.begin(); i != m_files.end(); ++i)
+        ::remove((m_directory + "/" + i->first).c_str());
+    m_files.clear();
+    m_stored_size = 0;
+    m_error.clear();
+}
+
+std::string FileWriter::state() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (!m_error.empty())
+        return "error";
+    return m_acquiring ? "acquire" : "ready";
+}
+
+std::string FileWriter::error() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_error;
+}
+
+double FileWriter::time() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (!m_start_time)
+        return 0;
+    return (m_acquiring ? _now() : m_end_time) - m_start_time;
+}
+
+long long FileWriter::buffer_free() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    long long free_size = m_buffer_size - m_stored_size - m_open_size;
+    return free_size > 0 ? free_size / 1024 : 0;
+}
+
+void FileWriter::_set_error(const std::string &error)
+{
+    if (m_error.empty())
+        fprintf(stderr, "filewriter: %s\n", error.c_str());
+    m_error = error;
+}
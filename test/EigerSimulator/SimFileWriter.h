@@ -0,0 +1,112 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef SIMFILEWRITER_H
+#define SIMFILEWRITER_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <json/json.h>
+
+#include "SimFaults.h"
+#include "SimFrames.h"
+
+namespace eigersim
+{
+/// HDF5 filewriter of the DCU: a master file written at arm time with
+/// external links to the data files, the data files being published
+/// (listed and downloadable) once they are complete.
+class FileWriter
+{
+public:
+    /// buffer_size: DCU buffer in bytes, the frames are dropped when full
+    FileWriter(const std::string &directory, long long buffer_size);
+    ~FileWriter();
+
+    /// prefix is the name pattern with $id already replaced
+    void start(const std::string &prefix, int nb_frames, int frames_per_file,
+               bool compression, const FrameSet &frames, const Json::Value &config);
+    void write(int frame_nb);
+    /// close the data file in progress, also after an abort
+    void finish();
+
+    std::vector<std::string> list() const;
+    /// full path of a published file, false if unknown
+    bool path(const std::string &name, std::string &path) const;
+    bool remove(const std::string &name);
+    void clear();
+
+    /// "ready" or "acquire"
+    std::string state() const;
+    std::string error() const;
+    double time() const;
+    /// in kB as the DCU reports it
+    long long buffer_free() const;
+
+    /// publish delay of the files, none when NULL
+    void set_faults(Faults *faults) { m_faults = faults; }
+
+private:
+    struct PublishedFile
+    {
+        long long size;
+        double listed_time; // the file is hidden until then
+    };
+
+    void _open_data_file();
+    void _close_data_file();
+    void _write_master(const Json::Value &config);
+    void _publish(const std::string &tmp_path, const std::string &name);
+    void _set_error(const std::string &error);
+    const PublishedFile *_find(const std::string &name) const;
+
+    std::string m_directory;
+    long long m_buffer_size;
+    long long m_stored_size; // published files
+    long long m_open_size;   // chunks of the data file in progress
+    std::map<std::string, PublishedFile> m_files; // by name
+    Faults *m_faults;
+
+    std::string m_prefix;
+    int m_nb_frames;
+    int m_frames_per_file;
+    bool m_compression;
+    const FrameSet *m_frames;
+    bool m_acquiring;
+    std::string m_error;
+    double m_start_time;
+    double m_end_time;
+
+    // data file in progress
+    long long m_file_id;
+    long long m_dataset_id;
+    int m_file_nb;
+    int m_first_frame;
+    int m_nb_written;
+    std::string m_file_name;
+
+    mutable std::mutex m_lock;
+};
+} // namespace eigersim
+#endif // SIMFILEWRITER_H
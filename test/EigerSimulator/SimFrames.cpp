@@ -0,0 +1,176 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+#include "lz4.h"
+#include "bitshuffle.h"
+
+#include "SimFrames.h"
+
+using namespace eigersim;
+
+static const int BSHUF_LZ4_HEADER_SIZE = 12;
+
+static void _write_be64(char *p, uint64_t value)
+{
+    for (int i = 7; i >= 0; --i, value >>= 8)
+        p[i] = char(value & 0xff);
+}
+
+static void _write_be32(char *p, uint32_t value)
+{
+    for (int i = 3; i >= 0; --i, value >>= 8)
+        p[i] = char(value & 0xff);
+}
+
+// plain LZ4 block of the stream
+static void _compress_lz4(const std::string &raw, std::string &blob)
+{
+    blob.resize(LZ4_compressBound(int(raw.size())));
+    int size = LZ4_compress_default(raw.data(), &blob[0], int(raw.size()), int(blob.size()));
+    if (size <= 0)
+        throw std::runtime_error("LZ4 compression failed");
+    blob.resize(size);
+}
+
+// HDF5 LZ4 filter chunk: total size, block size, then one block prefixed
+// with its compressed size, stored raw when it doesn't compress
+static void _lz4_chunk(const std::string &raw, const std::string &blob, std::string &chunk)
+{
+    bool compressed = blob.size() < raw.size();
+    const std::string &block = compressed ? blob : raw;
+    chunk.resize(BSHUF_LZ4_HEADER_SIZE + 4 + block.size());
+    _write_be64(&chunk[0], raw.size());
+    _write_be32(&chunk[8], uint32_t(raw.size()));
+    _write_be32(&chunk[12], uint32_t(block.size()));
+    memcpy(&chunk[16], block.data(), block.size());
+}
+
+// bitshuffle/LZ4: total size, block size in bytes, then the blocks,
+// the same for the stream and the HDF5 chunk
+static void _compress_bslz4(const std::string &raw, int depth, std::string &blob)
+{
+    size_t nb_elements = raw.size() / depth;
+    size_t block_size = bshuf_default_block_size(depth);
+    blob.resize(BSHUF_LZ4_HEADER_SIZE + bshuf_compress_lz4_bound(nb_elements, depth, block_size));
+    int64_t size = bshuf_compress_lz4(raw.data(), &blob[BSHUF_LZ4_HEADER_SIZE],
+                                      nb_elements, depth, block_size);
+    if (size < 0)
+        throw std::runtime_error("bitshuffle/LZ4 compression failed");
+    _write_be64(&blob[0], raw.size());
+    _write_be32(&blob[8], uint32_t(block_size * depth));
+    blob.resize(BSHUF_LZ4_HEADER_SIZE + size);
+}
+
+FrameSet::FrameSet() : m_width(0),
+                       m_height(0),
+                       m_depth(2),
+                       m_compression(BSLZ4)
+{
+}
+
+// sparse diffraction like image: low background and a few rings,
+// so the compression ratio is close to the detector one
+void FrameSet::fill(int frame_nb, int width, int height, int depth, std::string &raw)
+{
+    raw.assign(size_t(width) * height * depth, '\0');
+    uint32_t seed = 2463534242u + uint32_t(frame_nb) * 2654435761u;
+    int center_x = width / 2 + frame_nb % 7, center_y = height / 2 + frame_nb % 5;
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+        {
+            // xorshift, background of 0 to 3 counts mostly 0
+            seed ^= seed << 13, seed ^= seed >> 17, seed ^= seed << 5;
+            uint32_t value = (seed & 0xff) < 200 ? 0 : seed >> 30;
+            int dx = x - center_x, dy = y - center_y;
+            int radius2 = dx * dx + dy * dy;
+            if (radius2 % 4096 < 64)
+                value += 50 + (seed >> 24) % 50;
+            if (!x && !y)
+                value = uint32_t(frame_nb);
+            size_t offset = (size_t(y) * width + x) * depth;
+            if (depth == 2)
+            {
+                uint16_t pixel = uint16_t(value);
+                memcpy(&raw[offset], &pixel, 2);
+            }
+            else
+                memcpy(&raw[offset], &value, 4);
+        }
+}
+
+void FrameSet::generate(int width, int height, int depth, Compression compression, int nb_frames)
+{
+    if (width == m_width && height == m_height && depth == m_depth &&
+        compression == m_compression && size_t(nb_frames) == m_frames.size())
+        return;
+
+    m_width = width, m_height = height, m_depth = depth;
+    m_compression = compression;
+    m_frames.assign(nb_frames, Frame());
+
+    // compressed on all the cores, the generation of large frames is slow
+    std::vector<std::thread> workers;
+    int nb_workers = std::max(1, std::min(nb_frames, int(std::thread::hardware_concurrency())));
+    for (int w = 0; w < nb_workers; ++w)
+        workers.emplace_back([=]() {
+            for (int i = w; i < nb_frames; i += nb_workers)
+            {
+                Frame &frame = m_frames[i];
+                fill(i, width, height, depth, frame.raw);
+                if (compression == LZ4)
+                {
+                    _compress_lz4(frame.raw, frame.blob);
+                    _lz4_chunk(frame.raw, frame.blob, frame.chunk);
+                }
+                else
+                {
+                    _compress_bslz4(frame.raw, depth, frame.blob);
+                    frame.chunk = frame.blob;
+                }
+            }
+        });
+    for (size_t w = 0; w < workers.size(); ++w)
+        workers[w].join();
+}
+
+const char *FrameSet::type() const
+{
+    return m_depth == 2 ? "uint16" : "uint32";
+}
+
+std::string FrameSet::encoding() const
+{
+    if (m_compression == LZ4)
+        return "lz4<";
+    return m_depth == 2 ? "bs16-lz4<" : "bs32-lz4<";
+}
+
+const FrameSet::Frame &FrameSet::operator[](int frame_nb) const
+{
+    return m_frames[frame_nb % m_frames.size()];
+}
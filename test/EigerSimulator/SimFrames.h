@@ -0,0 +1,75 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef SIMFRAMES_H
+#define SIMFRAMES_H
+
+#include <string>
+#include <vector>
+
+namespace eigersim
+{
+/// Synthetic frames, compressed once per acquisition and cycled
+/// through so the frame rate is not bound by the compression.
+class FrameSet
+{
+public:
+    enum Compression
+    {
+        LZ4,
+        BSLZ4
+    };
+
+    struct Frame
+    {
+        std::string blob;  // stream payload, "lz4<" or "bsXX-lz4<"
+        std::string chunk; // HDF5 chunk of the filewriter filter
+        std::string raw;   // uncompressed pixels, filewriter compression off
+    };
+
+    FrameSet();
+
+    /// depth in bytes, 2 or 4
+    void generate(int width, int height, int depth, Compression, int nb_frames);
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    int depth() const { return m_depth; }
+    Compression compression() const { return m_compression; }
+    const char *type() const;
+    std::string encoding() const;
+
+    /// frame of the acquisition, frames are cycled through
+    const Frame &operator[](int frame_nb) const;
+    size_t size() const { return m_frames.size(); }
+
+    /// frame pixel generation, frame_nb is written in the first pixel
+    static void fill(int frame_nb, int width, int height, int depth, std::string &raw);
+
+private:
+    int m_width;
+    int m_height;
+    int m_depth;
+    Compression m_compression;
+    std::vector<Frame> m_frames;
+};
+} // namespace eigersim
+#endif // SIMFRAMES_H
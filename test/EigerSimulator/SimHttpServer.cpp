@@ -0,0 +1,375 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include "SimHttpServer.h"
+
+using namespace eigersim;
+
+static const size_t MAX_HEADER_SIZE = 64 * 1024;
+
+static const char *_reason(int status)
+{
+    switch (status)
+    {
+    case 100: return "Continue";
+    case 200: return "OK";
+    case 206: return "Partial Content";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 416: return "Range Not Satisfiable";
+    default: return "Internal Server Error";
+    }
+}
+
+static bool _send_all(int fd, const char *data, size_t size)
+{
+    while (size)
+    {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += sent, size -= sent;
+    }
+    return true;
+}
+
+static std::string _lower(std::string s)
+{
+    std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+    return s;
+}
+
+static std::string _url_decode(const std::string &s)
+{
+    std::string decoded;
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        if (s[i] == '%' && i + 2 < s.size())
+        {
+            decoded += char(strtol(s.substr(i + 1, 2).c_str(), NULL, 16));
+            i += 2;
+        }
+        else
+            decoded += s[i];
+    }
+    return decoded;
+}
+
+HttpServer::HttpServer(const std::string &host, int port, Handler handler) : m_listen_fd(-1),
+                                                                            m_handler(handler),
+                                                                            m_quit(false)
+{
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    char port_str[16];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    int error = getaddrinfo(host.empty() ? NULL : host.c_str(), port_str, &hints, &result);
+    if (error)
+        throw std::runtime_error(std::string("Can't resolve ") + host + ": " + gai_strerror(error));
+
+    m_listen_fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    int on = 1;
+    if (m_listen_fd < 0 ||
+        setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+        bind(m_listen_fd, result->ai_addr, result->ai_addrlen) < 0 ||
+        listen(m_listen_fd, 64) < 0)
+    {
+        std::string msg = std::string("Can't listen on port ") + port_str + ": " + strerror(errno);
+        freeaddrinfo(result);
+        if (m_listen_fd >= 0)
+            close(m_listen_fd);
+        throw std::runtime_error(msg);
+    }
+    freeaddrinfo(result);
+}
+
+HttpServer::~HttpServer()
+{
+    stop();
+}
+
+void HttpServer::run()
+{
+    while (!m_quit)
+    {
+        int fd = accept(m_listen_fd, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        _join_finished();
+        // registered before _serve can look it up
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_connections[fd] = std::thread(&HttpServer::_serve, this, fd);
+    }
+    _join_connections();
+}
+
+void HttpServer::stop()
+{
+    if (m_quit.exchange(true))
+        return;
+    if (m_listen_fd >= 0)
+    {
+        shutdown(m_listen_fd, SHUT_RDWR);
+        close(m_listen_fd);
+    }
+}
+
+void HttpServer::_serve(int fd)
+{
+    std::string buffer;
+    HttpRequest request;
+    while (!m_quit && _read_request(fd, buffer, request))
+    {
+        HttpResponse response;
+        try
+        {
+            m_handler(request, response);
+        }
+        catch (const std::exception &e)
+        {
+            response = HttpResponse();
+            response.status = 400;
+            response.content_type = "text/plain";
+            response.body = e.what();
+        }
+        if (response.disconnect || !_send_response(fd, request, response))
+            break;
+    }
+    // closed under the lock, so _join_connections never shuts down a reused fd
+    std::lock_guard<std::mutex> lock(m_lock);
+    std::map<int, std::thread>::iterator connection = m_connections.find(fd);
+    if (connection != m_connections.end())
+    {
+        m_finished.push_back(std::move(connection->second));
+        m_connections.erase(connection);
+    }
+    close(fd);
+}
+
+void HttpServer::_join_finished()
+{
+    std::vector<std::thread> finished;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        finished.swap(m_finished);
+    }
+    for (std::vector<std::thread>::iterator t = finished.begin(); t != finished.end(); ++t)
+        t->join();
+}
+
+void HttpServer::_join_connections()
+{
+    std::vector<std::thread> threads;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        // wake up the threads blocked in recv or send
+        for (std::map<int, std::thread>::iterator c = m_connections.begin(); c != m_connections.end(); ++c)
+        {
+            shutdown(c->first, SHUT_RDWR);
+            threads.push_back(std::move(c->second));
+        }
+        m_connections.clear();
+    }
+    for (std::vector<std::thread>::iterator t = threads.begin(); t != threads.end(); ++t)
+        t->join();
+    _join_finished();
+}
+
+bool HttpServer::_read_request(int fd, std::string &buffer, HttpRequest &request)
+{
+    size_t header_end;
+    while ((header_end = buffer.find("\r\n\r\n")) == std::string::npos)
+    {
+        if (buffer.size() > MAX_HEADER_SIZE)
+            return false;
+        char chunk[4096];
+        ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+        buffer.append(chunk, received);
+    }
+
+    request = HttpRequest();
+    std::istringstream header(buffer.substr(0, header_end));
+    std::string line, target, version;
+    std::getline(header, line);
+    std::istringstream request_line(line);
+    request_line >> request.method >> target >> version;
+    while (std::getline(header, line))
+    {
+        size_t colon = line.find(':');
+        if (colon == std::string::npos)
+            continue;
+        size_t value_begin = line.find_first_not_of(" \t", colon + 1);
+        size_t value_end = line.find_last_not_of(" \t\r");
+        request.headers[_lower(line.substr(0, colon))] =
+            value_begin == std::string::npos ? "" : line.substr(value_begin, value_end - value_begin + 1);
+    }
+    buffer.erase(0, header_end + 4);
+
+    size_t query = target.find('?');
+    request.path = _url_decode(target.substr(0, query));
+    if (query != std::string::npos)
+        request.query = target.substr(query + 1);
+
+    std::map<std::string, std::string>::const_iterator length = request.headers.find("content-length");
+    size_t body_size = length != request.headers.end() ? strtoul(length->second.c_str(), NULL, 10) : 0;
+    if (body_size && buffer.size() < body_size &&
+        _lower(request.headers["expect"]) == "100-continue")
+    {
+        static const char CONTINUE[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        if (!_send_all(fd, CONTINUE, sizeof(CONTINUE) - 1))
+            return false;
+    }
+    while (buffer.size() < body_size)
+    {
+        char chunk[4096];
+        ssize_t received = recv(fd, chunk, std::min(sizeof(chunk), body_size - buffer.size()), 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+        buffer.append(chunk, received);
+    }
+    request.body = buffer.substr(0, body_size);
+    buffer.erase(0, body_size);
+    return true;
+}
+
+bool HttpServer::_send_response(int fd, const HttpRequest &request, HttpResponse &response)
+{
+    std::map<std::string, std::string>::const_iterator connection = request.headers.find("connection");
+    bool keep_alive = connection == request.headers.end() || _lower(connection->second) != "close";
+
+    if (!response.file_path.empty())
+        return _send_file(fd, request, response, keep_alive);
+
+    std::ostringstream header;
+    header << "HTTP/1.1 " << response.status << ' ' << _reason(response.status) << "\r\n"
+           << "Content-Type: " << response.content_type << "\r\n"
+           << "Content-Length: " << response.body.size() << "\r\n"
+           << (keep_alive ? "" : "Connection: close\r\n") << "\r\n";
+    std::string data = header.str();
+    if (request.method != "HEAD")
+        data += response.body;
+    return _send_all(fd, data.data(), data.size()) && keep_alive;
+}
+
+bool HttpServer::_send_file(int fd, const HttpRequest &request, HttpResponse &response,
+                            bool keep_alive)
+{
+    int file_fd = open(response.file_path.c_str(), O_RDONLY);
+    struct stat file_stat;
+    if (file_fd < 0 || fstat(file_fd, &file_stat) < 0)
+    {
+        if (file_fd >= 0)
+            close(file_fd);
+        response.file_path.clear();
+        response.status = 404;
+        response.content_type = "text/plain";
+        response.body = "File not found";
+        return _send_response(fd, request, response);
+    }
+
+    // single byte range "bytes=first-last", last being optional
+    off_t file_size = file_stat.st_size;
+    off_t first = 0, last = file_size - 1;
+    std::map<std::string, std::string>::const_iterator range = request.headers.find("range");
+    bool partial = range != request.headers.end();
+    if (partial)
+    {
+        long long range_first, range_last;
+        int nb = sscanf(range->second.c_str(), "bytes=%lld-%lld", &range_first, &range_last);
+        if (nb < 1 || range_first >= file_size || (nb == 2 && range_last < range_first))
+        {
+            close(file_fd);
+            std::ostringstream header;
+            header << "HTTP/1.1 416 " << _reason(416) << "\r\n"
+                   << "Content-Range: bytes */" << file_size << "\r\n"
+                   << "Content-Length: 0\r\n\r\n";
+            std::string data = header.str();
+            return _send_all(fd, data.data(), data.size()) && keep_alive;
+        }
+        first = range_first;
+        if (nb == 2)
+            last = std::min(off_t(range_last), file_size - 1);
+    }
+
+    std::ostringstream header;
+    int status = partial ? 206 : 200;
+    header << "HTTP/1.1 " << status << ' ' << _reason(status) << "\r\n"
+           << "Content-Type: application/octet-stream\r\n"
+           << "Content-Length: " << (last - first + 1) << "\r\n"
+           << "Accept-Ranges: bytes\r\n";
+    if (partial)
+        header << "Content-Range: bytes " << first << '-' << last << '/' << file_size << "\r\n";
+    header << (keep_alive ? "" : "Connection: close\r\n") << "\r\n";
+    std::string data = header.str();
+    bool ok = _send_all(fd, data.data(), data.size());
+
+    if (request.method != "HEAD")
+    {
+        off_t offset = first;
+        while (ok && offset <= last)
+        {
+            ssize_t sent = sendfile(fd, file_fd, &offset, last - offset + 1);
+            if (sent < 0 && errno == EINTR)
+                continue;
+            ok = sent > 0;
+        }
+    }
+    close(file_fd);
+    return ok && keep_alive;
+}
@@ -0,0 +1,90 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef SIMHTTPSERVER_H
+#define SIMHTTPSERVER_H
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace eigersim
+{
+struct HttpRequest
+{
+    std::string method;
+    std::string path;
+    std::string query;
+    std::map<std::string, std::string> headers; // lower case names
+    std::string body;
+};
+
+struct HttpResponse
+{
+    HttpResponse() : status(200), content_type("application/json"), disconnect(false) {}
+
+    int status;
+    std::string content_type;
+    std::string body;
+    // when set, the file is sent instead of the body,
+    // with the HEAD and Range requests of the data downloads
+    std::string file_path;
+    // when set, the connection is closed without a response
+    bool disconnect;
+};
+
+/// Minimal HTTP/1.1 server of the SIMPLON API: one thread per
+/// connection, keep-alive, Expect: 100-continue and single byte ranges.
+class HttpServer
+{
+public:
+    typedef std::function<void(const HttpRequest &, HttpResponse &)> Handler;
+
+    HttpServer(const std::string &host, int port, Handler handler);
+    ~HttpServer();
+
+    /// accept the connections until stop(),
+    /// then close them and join their threads
+    void run();
+    void stop();
+
+private:
+    void _serve(int fd);
+    void _join_finished();
+    void _join_connections();
+    bool _read_request(int fd, std::string &buffer, HttpRequest &request);
+    bool _send_response(int fd, const HttpRequest &request, HttpResponse &response);
+    bool _send_file(int fd, const HttpRequest &request, HttpResponse &response,
+                    bool keep_alive);
+
+    int m_listen_fd;
+    Handler m_handler;
+    std::atomic<bool> m_quit;
+    std::mutex m_lock;
+    std::map<int, std::thread> m_connections; // by socket
+    std::vector<std::thread> m_finished;      // to be joined
+};
+} // namespace eigersim
+#endif // SIMHTTPSERVER_H
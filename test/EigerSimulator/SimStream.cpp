@@ -0,0 +1,198 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <stdio.h>
+
+#include <stdexcept>
+#include <thread>
+
+#include <zmq.h>
+
+#include "SimStream.h"
+
+using namespace eigersim;
+
+Stream::Stream(int port, int high_water_mark, double send_timeout) : m_dropped(0),
+                                                                     m_faults(NULL)
+{
+    m_context = zmq_ctx_new();
+    m_socket = zmq_socket(m_context, ZMQ_PUSH);
+    int timeout = int(send_timeout * 1000);
+    int linger = 0;
+    zmq_setsockopt(m_socket, ZMQ_SNDHWM, &high_water_mark, sizeof(high_water_mark));
+    zmq_setsockopt(m_socket, ZMQ_SNDTIMEO, &timeout, sizeof(timeout));
+    zmq_setsockopt(m_socket, ZMQ_LINGER, &linger, sizeof(linger));
+
+    char endpoint[64];
+    snprintf(endpoint, sizeof(endpoint), "tcp://*:%d", port);
+    if (zmq_bind(m_socket, endpoint))
+    {
+        std::string msg = std::string("Can't bind ") + endpoint + ": " + zmq_strerror(zmq_errno());
+        zmq_close(m_socket);
+        zmq_ctx_destroy(m_context);
+        throw std::runtime_error(msg);
+    }
+}
+
+Stream::~Stream()
+{
+    zmq_close(m_socket);
+    zmq_ctx_destroy(m_context);
+}
+
+// multipart message, all parts or none are queued
+bool Stream::_send(const std::vector<std::string> &parts)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (size_t i = 0; i < parts.size(); ++i)
+    {
+        int flags = i + 1 < parts.size() ? ZMQ_SNDMORE : 0;
+        // only the first part may time out, zmq queues the others atomically
+        if (zmq_send(m_socket, parts[i].data(), parts[i].size(), flags) < 0)
+        {
+            ++m_dropped;
+            return false;
+        }
+    }
+    return true;
+}
+
+void Stream::_send_held()
+{
+    std::vector<std::string> held;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        held.swap(m_held);
+    }
+    if (!held.empty())
+        _send(held);
+}
+
+void Stream::header(int series, const std::string &header_detail, const Json::Value &config,
+                    const std::string &appendix)
+{
+    std::vector<std::string> parts;
+    Json::Value header;
+    header["htype"] = "dheader-1.0";
+    header["series"] = series;
+    header["header_detail"] = header_detail;
+    parts.push_back(m_writer.write(header));
+    if (header_detail == "basic" || header_detail == "all")
+        parts.push_back(m_writer.write(config));
+    if (header_detail == "all")
+    {
+        // flatfield, pixel mask and countrate table, empty payloads
+        static const char *const htypes[] = {"dflatfield-1.0", "dpixelmask-1.0", "dcountrate_table-1.0"};
+        static const char *const types[] = {"float32", "uint32", "float32"};
+        for (int i = 0; i < 3; ++i)
+        {
+            Json::Value table;
+            table["htype"] = htypes[i];
+            table["shape"].append(0);
+            table["shape"].append(0);
+            table["type"] = types[i];
+            parts.push_back(m_writer.write(table));
+            parts.push_back(std::string());
+        }
+    }
+    if (!appendix.empty())
+        parts.push_back(appendix);
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_held.clear(); // of the previous series
+    }
+    _send(parts);
+}
+
+void Stream::image(int series, int frame_nb, const FrameSet &frames,
+                   long long start_time, long long stop_time)
+{
+    double stall_time = 0;
+    Faults::StreamFault fault = m_faults ? m_faults->stream_frame(stall_time) : Faults::NONE;
+    if (stall_time > 0)
+        std::this_thread::sleep_for(std::chrono::duration<double>(stall_time));
+    if (fault == Faults::DROP)
+        return;
+
+    const FrameSet::Frame &frame = frames[frame_nb];
+    std::vector<std::string> parts(4);
+
+    Json::Value part1;
+    part1["htype"] = "dimage-1.0";
+    part1["series"] = series;
+    part1["frame"] = frame_nb;
+    part1["hash"] = "";
+    parts[0] = m_writer.write(part1);
+
+    Json::Value part2;
+    part2["htype"] = "dimage_d-1.0";
+    part2["shape"].append(frames.width());
+    part2["shape"].append(frames.height());
+    part2["type"] = frames.type();
+    part2["encoding"] = frames.encoding();
+    part2["size"] = Json::UInt64(frame.blob.size());
+    parts[1] = m_writer.write(part2);
+
+    parts[2] = frame.blob;
+
+    Json::Value part4;
+    part4["htype"] = "dconfig-1.0";
+    part4["start_time"] = Json::Int64(start_time);
+    part4["stop_time"] = Json::Int64(stop_time);
+    part4["real_time"] = Json::Int64(stop_time - start_time);
+    parts[3] = m_writer.write(part4);
+
+    // the header keeps the original size, as a corrupted transfer would
+    if (fault == Faults::TRUNCATE)
+        parts[2].resize(m_faults->truncated_size(parts[2].size()));
+    else if (fault == Faults::REORDER)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (m_held.empty())
+        {
+            m_held.swap(parts);
+            return;
+        }
+    }
+    _send(parts);
+    _send_held();
+}
+
+void Stream::end(int series)
+{
+    Json::Value end;
+    end["htype"] = "dseries_end-1.0";
+    end["series"] = series;
+    _send_held();
+    _send(std::vector<std::string>(1, m_writer.write(end)));
+}
+
+int Stream::dropped() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_dropped;
+}
+
+void Stream::reset_dropped()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_dropped = 0;
+}
@@ -0,0 +1,72 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2014
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef SIMSTREAM_H
+#define SIMSTREAM_H
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <json/json.h>
+
+#include "SimFaults.h"
+#include "SimFrames.h"
+
+namespace eigersim
+{
+/// ZMQ PUSH socket of the stream interface, the messages follow the
+/// stream API 1.x: dheader, dimage and dseries_end.
+class Stream
+{
+public:
+    /// send_timeout: a frame not taken after that many seconds is dropped
+    Stream(int port, int high_water_mark, double send_timeout);
+    ~Stream();
+
+    /// appendix: user data sent as the last part when not empty
+    void header(int series, const std::string &header_detail, const Json::Value &config,
+                const std::string &appendix);
+    /// times in ns since the start of the series
+    void image(int series, int frame_nb, const FrameSet &frames,
+               long long start_time, long long stop_time);
+    void end(int series);
+
+    int dropped() const;
+    void reset_dropped();
+
+    /// faults applied to the images, none when NULL
+    void set_faults(Faults *faults) { m_faults = faults; }
+
+private:
+    bool _send(const std::vector<std::string> &parts);
+    void _send_held();
+
+    void *m_context;
+    void *m_socket;
+    mutable std::mutex m_lock;
+    int m_dropped;
+    Faults *m_faults;
+    std::vector<std::string> m_held; // reordered image, sent after the next one
+    Json::FastWriter m_writer;
+};
+} // namespace eigersim
+#endif // SIMSTREAM_H